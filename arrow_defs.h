@@ -15,6 +15,7 @@ typedef enum
 	ArrowMetadataVersion__V2 = 1,		/* not supported */
 	ArrowMetadataVersion__V3 = 2,		/* not supported */
 	ArrowMetadataVersion__V4 = 3,
+	ArrowMetadataVersion__V5 = 4,		/* only for BodyCompression */
 } ArrowMetadataVersion;
 
 /*
@@ -60,6 +61,10 @@ typedef enum
 	ArrowType__FixedSizeBinary	= 15,
 	ArrowType__FixedSizeList	= 16,
 	ArrowType__Map				= 17,
+	ArrowType__Duration			= 18,	/* not supported */
+	ArrowType__LargeBinary		= 19,
+	ArrowType__LargeUtf8		= 20,
+	ArrowType__LargeList		= 21,
 } ArrowTypeTag;
 
 /*
@@ -110,6 +115,23 @@ typedef enum
 	ArrowUnionMode__Dense		= 1,
 } ArrowUnionMode;
 
+/*
+ * CompressionType : byte
+ */
+typedef enum
+{
+	ArrowCompressionType__LZ4_FRAME	= 0,
+	ArrowCompressionType__ZSTD		= 1,
+} ArrowCompressionType;
+
+/*
+ * BodyCompressionMethod : byte
+ */
+typedef enum
+{
+	ArrowBodyCompressionMethod__BUFFER	= 0,
+} ArrowBodyCompressionMethod;
+
 /*
  * ArrowNodeTag
  */
@@ -133,6 +155,9 @@ typedef enum
 	ArrowNodeTag__FixedSizeBinary,
 	ArrowNodeTag__FixedSizeList,
 	ArrowNodeTag__Map,
+	ArrowNodeTag__LargeBinary,
+	ArrowNodeTag__LargeUtf8,
+	ArrowNodeTag__LargeList,
 	/* others */
 	ArrowNodeTag__KeyValue,
 	ArrowNodeTag__DictionaryEncoding,
@@ -140,6 +165,7 @@ typedef enum
 	ArrowNodeTag__FieldNode,
 	ArrowNodeTag__Buffer,
 	ArrowNodeTag__Schema,
+	ArrowNodeTag__BodyCompression,
 	ArrowNodeTag__RecordBatch,
 	ArrowNodeTag__DictionaryBatch,
 	ArrowNodeTag__Message,
@@ -188,6 +214,7 @@ typedef struct		ArrowTypeDecimal
 	ArrowNodeTag	tag;
 	int32			precision;
 	int32			scale;
+	int32			bitWidth;		/* 128 or 256 */
 } ArrowTypeDecimal;
 
 /* Date */
@@ -257,6 +284,15 @@ typedef struct		ArrowTypeMap
 	bool			keysSorted;
 } ArrowTypeMap;
 
+/* LargeBinary */
+typedef ArrowNode	ArrowTypeLargeBinary;
+
+/* LargeUtf8 */
+typedef ArrowNode	ArrowTypeLargeUtf8;
+
+/* LargeList */
+typedef ArrowNode	ArrowTypeLargeList;
+
 /*
  * ArrowType
  */
@@ -280,6 +316,9 @@ typedef union		ArrowType
 	ArrowTypeFixedSizeBinary FixedSizeBinary;
 	ArrowTypeFixedSizeList	FixedSizeList;
 	ArrowTypeMap			Map;
+	ArrowTypeLargeBinary	LargeBinary;
+	ArrowTypeLargeUtf8		LargeUtf8;
+	ArrowTypeLargeList		LargeList;
 } ArrowType;
 
 /*
@@ -359,6 +398,16 @@ typedef struct		ArrowSchema
 	int				_num_custom_metadata;
 } ArrowSchema;
 
+/*
+ * BodyCompression
+ */
+typedef struct		ArrowBodyCompression
+{
+	ArrowNodeTag	tag;
+	ArrowCompressionType codec;
+	ArrowBodyCompressionMethod method;
+} ArrowBodyCompression;
+
 /*
  * RecordBatch
  */
@@ -372,6 +421,8 @@ typedef struct		ArrowRecordBatch
 	/* vector of Buffer */
 	ArrowBuffer	    *buffers;
 	int				_num_buffers;
+	/* optional compression of the body; tag is 0 if uncompressed */
+	ArrowBodyCompression compression;
 } ArrowRecordBatch;
 
 /*
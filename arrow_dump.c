@@ -28,9 +28,10 @@ dumpArrowTypeFloatingPoint(ArrowTypeFloatingPoint *node, FILE *out)
 static void
 dumpArrowTypeDecimal(ArrowTypeDecimal *node, FILE *out)
 {
-	fprintf(out, "{Decimal: precision=%d, scale=%d}",
+	fprintf(out, "{Decimal: precision=%d, scale=%d, bitWidth=%d}",
 			node->precision,
-			node->scale);
+			node->scale,
+			node->bitWidth);
 }
 
 static void
@@ -201,6 +202,15 @@ dumpArrowSchema(ArrowSchema *node, FILE *out)
 	fprintf(out, "]}");
 }
 
+static void
+dumpArrowBodyCompression(ArrowBodyCompression *node, FILE *out)
+{
+	fprintf(out, "{BodyCompression: codec=%s, method=%s}",
+			node->codec == ArrowCompressionType__LZ4_FRAME ? "LZ4_FRAME" :
+			node->codec == ArrowCompressionType__ZSTD ? "ZSTD" : "???",
+			node->method == ArrowBodyCompressionMethod__BUFFER ? "BUFFER" : "???");
+}
+
 static void
 dumpArrowRecordBatch(ArrowRecordBatch *node, FILE *out)
 {
@@ -221,7 +231,13 @@ dumpArrowRecordBatch(ArrowRecordBatch *node, FILE *out)
 			fprintf(out, ", ");
 		dumpArrowBuffer(&node->buffers[i], out);
 	}
-	fprintf(out, "]}");
+	fprintf(out, "]");
+	if (node->compression.tag == ArrowNodeTag__BodyCompression)
+	{
+		fprintf(out, ", compression=");
+		dumpArrowBodyCompression(&node->compression, out);
+	}
+	fprintf(out, "}");
 }
 
 static void
@@ -334,6 +350,15 @@ dumpArrowNode(ArrowNode *node, FILE *out)
 		case ArrowNodeTag__Map:
 			dumpArrowTypeMap((ArrowTypeMap *) node, out);
 			break;
+		case ArrowNodeTag__LargeBinary:
+			fprintf(out, "{LargeBinary}");
+			break;
+		case ArrowNodeTag__LargeUtf8:
+			fprintf(out, "{LargeUtf8}");
+			break;
+		case ArrowNodeTag__LargeList:
+			fprintf(out, "{LargeList}");
+			break;
 		case ArrowNodeTag__Buffer:
 			dumpArrowBuffer((ArrowBuffer *) node, out);
 			break;
@@ -352,6 +377,9 @@ dumpArrowNode(ArrowNode *node, FILE *out)
 		case ArrowNodeTag__Schema:
 			dumpArrowSchema((ArrowSchema *)node, out);
 			break;
+		case ArrowNodeTag__BodyCompression:
+			dumpArrowBodyCompression((ArrowBodyCompression *) node, out);
+			break;
 		case ArrowNodeTag__RecordBatch:
 			dumpArrowRecordBatch((ArrowRecordBatch *) node, out);
 			break;
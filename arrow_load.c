@@ -0,0 +1,846 @@
+/*
+ * arrow_load.c - loads apache arrow file into PostgreSQL (--load)
+ *
+ * Copyright 2018-2019 (C) KaiGai Kohei <kaigai@heterodb.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the PostgreSQL License. See the LICENSE file.
+ */
+#include "pg2arrow.h"
+
+/*
+ * The record batches are read from the file mapping, then every row is
+ * encoded to the binary COPY format, and sent by COPY ... FROM STDIN.
+ * The encoders are the inverse of the put_value handlers in arrow_types.c;
+ * so, the target columns are described by SQLattribute as if they were
+ * dumped by pg2arrow, and a field of the file is loaded to the column of
+ * the same Arrow type. Slight differences are allowed, like narrower
+ * integers, other time units, or other precision and scale of Decimal.
+ */
+#define LOAD_COPY_CHUNK_SZ		(4UL << 20)		/* 4MB */
+
+typedef struct
+{
+	int64		id;
+	int64		nitems;
+	int64		nrooms;
+	const char **labels;		/* NULL, if null label */
+	int32	   *lengths;
+} SQLloadDict;
+
+typedef struct SQLloadColumn	SQLloadColumn;
+struct SQLloadColumn
+{
+	SQLattribute *attr;			/* target column */
+	ArrowField *field;			/* source field */
+	/* encodes a valid item of the view; NULL means always null */
+	void	  (*encode)(SQLloadColumn *lcol, ArrowColumnView *view,
+						int64 index, SQLbuffer *buf);
+	SQLloadDict *dict;			/* valid, if dictionary encoded */
+	SQLloadColumn *children;	/* fields of composite, or array element */
+	int			nchildren;
+};
+
+struct SQLloader
+{
+	ArrowFileMap *af_map;
+	char	   *copy_command;
+	SQLloadDict *dicts;
+	int			num_dicts;
+	int			nfields;
+	SQLloadColumn columns[FLEXIBLE_ARRAY_MEMBER];
+};
+
+/*
+ * Routines to build the binary COPY stream
+ */
+static inline void
+__append_be16(SQLbuffer *buf, uint16 value)
+{
+	value = htons(value);
+	sql_buffer_append(buf, &value, sizeof(uint16));
+}
+
+static inline void
+__append_be32(SQLbuffer *buf, uint32 value)
+{
+	value = htonl(value);
+	sql_buffer_append(buf, &value, sizeof(uint32));
+}
+
+static inline void
+__append_be64(SQLbuffer *buf, uint64 value)
+{
+	__append_be32(buf, (uint32)(value >> 32));
+	__append_be32(buf, (uint32)(value & 0xffffffffU));
+}
+
+static inline int64
+__fetch_int_value(ArrowColumnView *view, int64 index,
+				  int bitWidth, bool is_signed)
+{
+	switch (bitWidth)
+	{
+		case 8:
+			return (is_signed
+					? (int64)((const int8 *)view->values)[index]
+					: (int64)((const uint8 *)view->values)[index]);
+		case 16:
+			return (is_signed
+					? (int64)((const int16 *)view->values)[index]
+					: (int64)((const uint16 *)view->values)[index]);
+		case 32:
+			return (is_signed
+					? (int64)((const int32 *)view->values)[index]
+					: (int64)((const uint32 *)view->values)[index]);
+		default:
+			return ((const int64 *)view->values)[index];
+	}
+}
+
+static inline int64
+__floor_div(int64 value, int64 divisor)
+{
+	int64		q = value / divisor;
+
+	if ((value % divisor) < 0)
+		q--;
+	return q;
+}
+
+static inline int64
+__usecs_by_unit(int64 value, ArrowTimeUnit unit)
+{
+	switch (unit)
+	{
+		case ArrowTimeUnit__Second:
+			return value * 1000000L;
+		case ArrowTimeUnit__MilliSecond:
+			return value * 1000L;
+		case ArrowTimeUnit__MicroSecond:
+			return value;
+		default:
+			return __floor_div(value, 1000L);
+	}
+}
+
+static inline void
+__fetch_varlena_value(ArrowColumnView *view, int64 index, bool is_large,
+					  const char **p_addr, int64 *p_len)
+{
+	int64		head, tail;
+
+	if (is_large)
+	{
+		head = ((const int64 *)view->values)[index];
+		tail = ((const int64 *)view->values)[index + 1];
+	}
+	else
+	{
+		head = ((const int32 *)view->values)[index];
+		tail = ((const int32 *)view->values)[index + 1];
+	}
+	*p_addr = view->extra + head;
+	*p_len = tail - head;
+}
+
+/*
+ * __load_encode_item - appends the length and the value of an item;
+ * -1 for null
+ */
+static void
+__load_encode_item(SQLloadColumn *lcol, ArrowColumnView *view,
+				   int64 index, SQLbuffer *buf)
+{
+	size_t		pos = buf->usage;
+	uint32		len;
+
+	if (!lcol->encode || !arrow_view_isvalid(view, index))
+	{
+		__append_be32(buf, (uint32)-1);
+		return;
+	}
+	sql_buffer_append_zero(buf, sizeof(uint32));
+	lcol->encode(lcol, view, index, buf);
+	len = htonl(buf->usage - pos - sizeof(uint32));
+	memcpy(buf->ptr + pos, &len, sizeof(uint32));
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Encoders for each data type
+ *
+ * ----------------------------------------------------------------
+ */
+static void
+load_bool_value(SQLloadColumn *lcol, ArrowColumnView *view,
+				int64 index, SQLbuffer *buf)
+{
+	char		value = ((view->values[index >> 3] & (1 << (index & 7))) != 0);
+
+	sql_buffer_append(buf, &value, sizeof(char));
+}
+
+static void
+load_int_value(SQLloadColumn *lcol, ArrowColumnView *view,
+			   int64 index, SQLbuffer *buf)
+{
+	ArrowTypeInt *src = &lcol->field->type.Int;
+	int64		value = __fetch_int_value(view, index,
+										  src->bitWidth,
+										  src->is_signed);
+	switch (lcol->attr->attlen)
+	{
+		case sizeof(char):
+			{
+				char	c = (char)value;
+
+				sql_buffer_append(buf, &c, sizeof(char));
+			}
+			break;
+		case sizeof(int16):
+			__append_be16(buf, (uint16)value);
+			break;
+		case sizeof(int32):
+			__append_be32(buf, (uint32)value);
+			break;
+		default:
+			__append_be64(buf, (uint64)value);
+			break;
+	}
+}
+
+static void
+load_float_value(SQLloadColumn *lcol, ArrowColumnView *view,
+				 int64 index, SQLbuffer *buf)
+{
+	ArrowPrecision src = lcol->field->type.FloatingPoint.precision;
+	ArrowPrecision dst = lcol->attr->arrow_type.FloatingPoint.precision;
+
+	if (src == ArrowPrecision__Half)
+		__append_be16(buf, ((const uint16 *)view->values)[index]);
+	else if (src == ArrowPrecision__Single && dst == ArrowPrecision__Single)
+		__append_be32(buf, ((const uint32 *)view->values)[index]);
+	else
+	{
+		union {
+			double	fval;
+			uint64	ival;
+		} u;
+
+		if (src == ArrowPrecision__Single)
+			u.fval = ((const float *)view->values)[index];
+		else
+			u.fval = ((const double *)view->values)[index];
+		__append_be64(buf, u.ival);
+	}
+}
+
+/*
+ * load_numeric_value - converts Decimal128/256 into numeric; see
+ * numeric_send(). The scale is aligned to the base-10000 digits, then
+ * the digits are taken by repeated division.
+ */
+#define LOAD_NUMERIC_LIMBS		5	/* 256bit + room of the scale alignment */
+#define LOAD_NUMERIC_DIGITS		(LOAD_NUMERIC_LIMBS * 64 / 13 + 1)
+
+static inline void
+__numeric_mul_small(uint64 *limbs, uint64 mul)
+{
+	unsigned __int128 carry = 0;
+	int			i;
+
+	for (i=0; i < LOAD_NUMERIC_LIMBS; i++)
+	{
+		carry += (unsigned __int128)limbs[i] * mul;
+		limbs[i] = (uint64)carry;
+		carry >>= 64;
+	}
+}
+
+static inline uint32
+__numeric_div_small(uint64 *limbs, uint64 div)
+{
+	unsigned __int128 rem = 0;
+	int			i;
+
+	for (i=LOAD_NUMERIC_LIMBS-1; i >= 0; i--)
+	{
+		rem = (rem << 64) | limbs[i];
+		limbs[i] = (uint64)(rem / div);
+		rem %= div;
+	}
+	return (uint32)rem;
+}
+
+static void
+load_numeric_value(SQLloadColumn *lcol, ArrowColumnView *view,
+				   int64 index, SQLbuffer *buf)
+{
+	ArrowTypeDecimal *src = &lcol->field->type.Decimal;
+	int			nlimbs = (src->bitWidth == 256 ? 4 : 2);
+	uint64		limbs[LOAD_NUMERIC_LIMBS];
+	uint16		digits[LOAD_NUMERIC_DIGITS];
+	int			ndigits = 0;
+	int			scale = src->scale;
+	int			dscale = Max(scale, 0);
+	int			weight = 0;
+	int			lo = 0;
+	bool		negative;
+	int			i;
+
+	memset(limbs, 0, sizeof(limbs));
+	memcpy(limbs, view->values + index * nlimbs * sizeof(uint64),
+		   nlimbs * sizeof(uint64));
+	negative = ((int64)limbs[nlimbs-1] < 0);
+	if (negative)
+	{
+		/* two's complement to the absolute value */
+		uint64	carry = 1;
+
+		for (i=0; i < nlimbs; i++)
+		{
+			limbs[i] = ~limbs[i] + carry;
+			carry = (carry && limbs[i] == 0);
+		}
+	}
+	/* negative scale means a multiple of 10^-scale */
+	while (scale < 0)
+	{
+		__numeric_mul_small(limbs, 10);
+		scale++;
+	}
+	/* align the scale to the base-10000 digits */
+	while (scale % 4 != 0)
+	{
+		__numeric_mul_small(limbs, 10);
+		scale++;
+	}
+	for (;;)
+	{
+		for (i=0; i < LOAD_NUMERIC_LIMBS && limbs[i] == 0; i++);
+		if (i == LOAD_NUMERIC_LIMBS)
+			break;
+		digits[ndigits++] = __numeric_div_small(limbs, 10000);
+	}
+	if (ndigits > 0)
+	{
+		/* digits[] are LSB first; trailing zeros are not sent */
+		weight = ndigits - 1 - scale / 4;
+		while (digits[lo] == 0)
+			lo++;
+	}
+	else
+		negative = false;
+	__append_be16(buf, ndigits - lo);
+	__append_be16(buf, weight);
+	__append_be16(buf, negative ? 0x4000 : 0x0000);
+	__append_be16(buf, dscale);
+	for (i=ndigits-1; i >= lo; i--)
+		__append_be16(buf, digits[i]);
+}
+
+static void
+load_date_value(SQLloadColumn *lcol, ArrowColumnView *view,
+				int64 index, SQLbuffer *buf)
+{
+	int64		value;
+
+	if (lcol->field->type.Date.unit == ArrowDateUnit__Day)
+		value = ((const int32 *)view->values)[index];
+	else
+		value = __floor_div(((const int64 *)view->values)[index],
+							86400000L);
+	/* convert UNIX epoch to PostgreSQL epoch */
+	value -= (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE);
+	__append_be32(buf, (uint32)value);
+}
+
+static void
+load_time_value(SQLloadColumn *lcol, ArrowColumnView *view,
+				int64 index, SQLbuffer *buf)
+{
+	ArrowTypeTime *src = &lcol->field->type.Time;
+	int64		value;
+
+	if (src->bitWidth == 32)
+		value = ((const int32 *)view->values)[index];
+	else
+		value = ((const int64 *)view->values)[index];
+	__append_be64(buf, __usecs_by_unit(value, src->unit));
+}
+
+static void
+load_timestamp_value(SQLloadColumn *lcol, ArrowColumnView *view,
+					 int64 index, SQLbuffer *buf)
+{
+	int64		value = ((const int64 *)view->values)[index];
+
+	value = __usecs_by_unit(value, lcol->field->type.Timestamp.unit);
+	/* convert UNIX epoch to PostgreSQL epoch */
+	value -= (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY;
+	__append_be64(buf, value);
+}
+
+static void
+load_variable_value(SQLloadColumn *lcol, ArrowColumnView *view,
+					int64 index, SQLbuffer *buf)
+{
+	ArrowNodeTag tag = lcol->field->type.tag;
+	const char *addr;
+	int64		len;
+
+	__fetch_varlena_value(view, index,
+						  (tag == ArrowNodeTag__LargeUtf8 ||
+						   tag == ArrowNodeTag__LargeBinary),
+						  &addr, &len);
+	sql_buffer_append(buf, addr, len);
+}
+
+static void
+load_dictionary_value(SQLloadColumn *lcol, ArrowColumnView *view,
+					  int64 index, SQLbuffer *buf)
+{
+	ArrowTypeInt *itype = &lcol->field->dictionary.indexType;
+	SQLloadDict *dict = lcol->dict;
+	int64		label;
+
+	label = __fetch_int_value(view, index, itype->bitWidth, itype->is_signed);
+	if (label < 0 || label >= dict->nitems || !dict->labels[label])
+		Elog("dictionary index %ld of field '%s' is not valid",
+			 label, lcol->field->name);
+	sql_buffer_append(buf, dict->labels[label], dict->lengths[label]);
+}
+
+static void
+load_array_value(SQLloadColumn *lcol, ArrowColumnView *view,
+				 int64 index, SQLbuffer *buf)
+{
+	SQLloadColumn *element = &lcol->children[0];
+	ArrowColumnView *child = &view->children[0];
+	int64		head, tail, i;
+	bool		hasnull = false;
+
+	if (lcol->field->type.tag == ArrowNodeTag__LargeList)
+	{
+		head = ((const int64 *)view->values)[index];
+		tail = ((const int64 *)view->values)[index + 1];
+	}
+	else
+	{
+		head = ((const int32 *)view->values)[index];
+		tail = ((const int32 *)view->values)[index + 1];
+	}
+	for (i=head; i < tail && !hasnull; i++)
+		hasnull = !arrow_view_isvalid(child, i);
+	/* see array_send() */
+	__append_be32(buf, head < tail ? 1 : 0);	/* ndim */
+	__append_be32(buf, hasnull);
+	__append_be32(buf, element->attr->atttypid);
+	if (head < tail)
+	{
+		__append_be32(buf, tail - head);		/* dim[0] */
+		__append_be32(buf, 1);					/* lbound[0] */
+	}
+	for (i=head; i < tail; i++)
+		__load_encode_item(element, child, i, buf);
+}
+
+static void
+load_composite_value(SQLloadColumn *lcol, ArrowColumnView *view,
+					 int64 index, SQLbuffer *buf)
+{
+	int			j;
+
+	/* see record_send() */
+	__append_be32(buf, lcol->nchildren);
+	for (j=0; j < lcol->nchildren; j++)
+	{
+		SQLloadColumn *sub = &lcol->children[j];
+
+		__append_be32(buf, sub->attr->atttypid);
+		__load_encode_item(sub, &view->children[j], index, buf);
+	}
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Setup of the loader
+ *
+ * ----------------------------------------------------------------
+ */
+static inline bool
+__is_varlena_arrow_type(ArrowNodeTag tag)
+{
+	return (tag == ArrowNodeTag__Utf8 ||
+			tag == ArrowNodeTag__LargeUtf8 ||
+			tag == ArrowNodeTag__Binary ||
+			tag == ArrowNodeTag__LargeBinary);
+}
+
+static SQLloadDict *
+__lookup_load_dictionary(SQLloader *loader, int64 dict_id)
+{
+	int			i;
+
+	for (i=0; i < loader->num_dicts; i++)
+	{
+		if (loader->dicts[i].id == dict_id)
+			return &loader->dicts[i];
+	}
+	return NULL;
+}
+
+static void
+__setup_load_dictionaries(SQLloader *loader)
+{
+	ArrowFileMap *af_map = loader->af_map;
+	ArrowFooter *footer = &af_map->footer;
+	int			i;
+
+	loader->dicts = palloc0(sizeof(SQLloadDict) *
+							Max(footer->_num_dictionaries, 1));
+	for (i=0; i < footer->_num_dictionaries; i++)
+	{
+		ArrowBlock *b = &footer->dictionaries[i];
+		ArrowMessage message;
+		ArrowDictionaryBatch *dbatch;
+		ArrowField *field;
+		ArrowField	vfield;
+		ArrowColumnView view;
+		SQLloadDict *dict;
+		const char *body;
+		const char *errmsg;
+		bool		is_large;
+		int64		k;
+
+		errmsg = readArrowBlockView(af_map, b, &message, &body);
+		if (errmsg)
+			Elog("dictionary batch %d: %s", i, errmsg);
+		if (message.body.tag != ArrowNodeTag__DictionaryBatch)
+			Elog("dictionary batch %d: block is not DictionaryBatch", i);
+		dbatch = &message.body.dictionaryBatch;
+		field = lookupArrowDictionaryField(&footer->schema, dbatch->id);
+		if (!field)
+			continue;	/* nobody refers the dictionary */
+		if (!__is_varlena_arrow_type(field->type.tag))
+			Elog("dictionary of field '%s' is not variable length values",
+				 field->name);
+		memcpy(&vfield, field, sizeof(ArrowField));
+		memset(&vfield.dictionary, 0, sizeof(ArrowDictionaryEncoding));
+		/* the views are kept, because the labels refer them */
+		errmsg = setupArrowColumnViews(&dbatch->data, body, b->bodyLength,
+									   &vfield, 1, &view);
+		if (errmsg)
+			Elog("dictionary batch %d: %s", i, errmsg);
+
+		dict = __lookup_load_dictionary(loader, dbatch->id);
+		if (!dict)
+		{
+			if (dbatch->isDelta)
+				Elog("delta dictionary (id=%ld) has no base", dbatch->id);
+			dict = &loader->dicts[loader->num_dicts++];
+			dict->id = dbatch->id;
+		}
+		else if (!dbatch->isDelta)
+			dict->nitems = 0;
+		if (dict->nitems + view.length > dict->nrooms)
+		{
+			dict->nrooms = Max(2 * dict->nrooms, dict->nitems + view.length);
+			dict->nrooms = Max(dict->nrooms, 1);
+			if (!dict->labels)
+			{
+				dict->labels = palloc(sizeof(char *) * dict->nrooms);
+				dict->lengths = palloc(sizeof(int32) * dict->nrooms);
+			}
+			else
+			{
+				dict->labels = repalloc(dict->labels,
+										sizeof(char *) * dict->nrooms);
+				dict->lengths = repalloc(dict->lengths,
+										 sizeof(int32) * dict->nrooms);
+			}
+		}
+		is_large = (field->type.tag == ArrowNodeTag__LargeUtf8 ||
+					field->type.tag == ArrowNodeTag__LargeBinary);
+		for (k=0; k < view.length; k++)
+		{
+			const char *addr = NULL;
+			int64		len = 0;
+
+			if (arrow_view_isvalid(&view, k))
+				__fetch_varlena_value(&view, k, is_large, &addr, &len);
+			dict->labels[dict->nitems] = addr;
+			dict->lengths[dict->nitems] = len;
+			dict->nitems++;
+		}
+	}
+}
+
+static void
+__setup_load_column(SQLloader *loader, SQLloadColumn *lcol,
+					SQLattribute *attr, ArrowField *field)
+{
+	ArrowType  *src = &field->type;
+	ArrowType  *dst = &attr->arrow_type;
+	int			j;
+
+	lcol->attr = attr;
+	lcol->field = field;
+	if (src->tag == ArrowNodeTag__Null)
+		return;		/* always null */
+	if (field->dictionary.tag == ArrowNodeTag__DictionaryEncoding)
+	{
+		if (dst->tag != ArrowNodeTag__Utf8 &&
+			dst->tag != ArrowNodeTag__LargeUtf8)
+			goto not_compatible;
+		lcol->dict = __lookup_load_dictionary(loader, field->dictionary.id);
+		if (!lcol->dict)
+			Elog("dictionary (id=%ld) of field '%s' is missing",
+				 field->dictionary.id, field->name);
+		lcol->encode = load_dictionary_value;
+		return;
+	}
+
+	switch (src->tag)
+	{
+		case ArrowNodeTag__Bool:
+			if (dst->tag != ArrowNodeTag__Bool)
+				goto not_compatible;
+			lcol->encode = load_bool_value;
+			break;
+		case ArrowNodeTag__Int:
+			if (dst->tag != ArrowNodeTag__Int ||
+				src->Int.bitWidth > dst->Int.bitWidth)
+				goto not_compatible;
+			lcol->encode = load_int_value;
+			break;
+		case ArrowNodeTag__FloatingPoint:
+			if (dst->tag != ArrowNodeTag__FloatingPoint ||
+				(src->FloatingPoint.precision == ArrowPrecision__Half)
+				!= (dst->FloatingPoint.precision == ArrowPrecision__Half) ||
+				src->FloatingPoint.precision > dst->FloatingPoint.precision)
+				goto not_compatible;
+			lcol->encode = load_float_value;
+			break;
+		case ArrowNodeTag__Decimal:
+			if (dst->tag != ArrowNodeTag__Decimal ||
+				(src->Decimal.bitWidth != 128 &&
+				 src->Decimal.bitWidth != 256))
+				goto not_compatible;
+			lcol->encode = load_numeric_value;
+			break;
+		case ArrowNodeTag__Date:
+			if (dst->tag != ArrowNodeTag__Date)
+				goto not_compatible;
+			lcol->encode = load_date_value;
+			break;
+		case ArrowNodeTag__Time:
+			if (dst->tag != ArrowNodeTag__Time)
+				goto not_compatible;
+			lcol->encode = load_time_value;
+			break;
+		case ArrowNodeTag__Timestamp:
+			if (dst->tag != ArrowNodeTag__Timestamp)
+				goto not_compatible;
+			lcol->encode = load_timestamp_value;
+			break;
+		case ArrowNodeTag__Utf8:
+		case ArrowNodeTag__LargeUtf8:
+		case ArrowNodeTag__Binary:
+		case ArrowNodeTag__LargeBinary:
+			/* raw image of the text, or binary send format */
+			if (!__is_varlena_arrow_type(dst->tag) ||
+				attr->subtypes || attr->element)
+				goto not_compatible;
+			lcol->encode = load_variable_value;
+			break;
+		case ArrowNodeTag__List:
+		case ArrowNodeTag__LargeList:
+			if (!attr->element || field->_num_children != 1)
+				goto not_compatible;
+			lcol->children = palloc0(sizeof(SQLloadColumn));
+			lcol->nchildren = 1;
+			__setup_load_column(loader, &lcol->children[0],
+								attr->element, &field->children[0]);
+			lcol->encode = load_array_value;
+			break;
+		case ArrowNodeTag__Struct:
+			if (!attr->subtypes ||
+				attr->subtypes->nfields != field->_num_children)
+				goto not_compatible;
+			lcol->children = palloc0(sizeof(SQLloadColumn) *
+									 field->_num_children);
+			lcol->nchildren = field->_num_children;
+			for (j=0; j < field->_num_children; j++)
+				__setup_load_column(loader, &lcol->children[j],
+									&attr->subtypes->attrs[j],
+									&field->children[j]);
+			lcol->encode = load_composite_value;
+			break;
+		default:
+			goto not_compatible;
+	}
+	return;
+
+not_compatible:
+	Elog("field '%s' of the arrow file cannot be loaded into '%s' of type %s.%s",
+		 field->name, attr->attname, attr->typnamespace, attr->typname);
+}
+
+/*
+ * pgsql_create_loader - builds the encoders for the fields of the file,
+ * according to the columns of the target table that have the same names.
+ */
+SQLloader *
+pgsql_create_loader(PGconn *conn, ArrowFileMap *af_map,
+					const char *table_name)
+{
+	ArrowSchema *schema = &af_map->footer.schema;
+	int			j, nfields = schema->_num_fields;
+	SQLloader  *loader;
+	SQLtable   *table;
+	PGresult   *res;
+	char	  **attnames;
+	size_t		len = 0;
+	char	   *query;
+	char	   *pos;
+
+	if (nfields == 0)
+		Elog("arrow file '%s' has no fields", af_map->filename);
+	/* list of the target columns */
+	attnames = alloca(sizeof(char *) * nfields);
+	for (j=0; j < nfields; j++)
+	{
+		ArrowField *field = &schema->fields[j];
+
+		attnames[j] = PQescapeIdentifier(conn, field->name,
+										 field->_name_len);
+		if (!attnames[j])
+			Elog("failed on PQescapeIdentifier: %s", PQerrorMessage(conn));
+		len += strlen(attnames[j]) + 2;
+	}
+	query = palloc(len + strlen(table_name) + 100);
+	pos = query + sprintf(query, "SELECT ");
+	for (j=0; j < nfields; j++)
+		pos += sprintf(pos, "%s%s", j > 0 ? "," : "", attnames[j]);
+	sprintf(pos, " FROM %s LIMIT 0", table_name);
+
+	/* target columns, as if they were dumped by pg2arrow */
+	res = PQexecParams(conn, query,
+					   0, NULL, NULL, NULL, NULL,
+					   1);	/* results in binary mode */
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		Elog("SQL execution failed: %s", PQresultErrorMessage(res));
+	table = pgsql_create_buffer(conn, res, 0);
+	PQclear(res);
+
+	loader = palloc0(offsetof(SQLloader, columns[nfields]));
+	loader->af_map = af_map;
+	loader->nfields = nfields;
+	__setup_load_dictionaries(loader);
+	for (j=0; j < nfields; j++)
+		__setup_load_column(loader, &loader->columns[j],
+							&table->attrs[j], &schema->fields[j]);
+
+	/* COPY command */
+	loader->copy_command = palloc(len + strlen(table_name) + 100);
+	pos = loader->copy_command;
+	pos += sprintf(pos, "COPY %s (", table_name);
+	for (j=0; j < nfields; j++)
+	{
+		pos += sprintf(pos, "%s%s", j > 0 ? "," : "", attnames[j]);
+		PQfreemem(attnames[j]);
+	}
+	sprintf(pos, ") FROM STDIN (FORMAT binary)");
+	pfree(query);
+
+	return loader;
+}
+
+static void
+__pgsql_put_copy_data(PGconn *conn, SQLbuffer *buf)
+{
+	if (buf->usage > 0 &&
+		PQputCopyData(conn, buf->ptr, buf->usage) != 1)
+		Elog("failed on PQputCopyData: %s", PQerrorMessage(conn));
+	buf->usage = 0;
+}
+
+/*
+ * pgsql_load_record_batches - loads the record batches in the range by
+ * one COPY command on the connection; it returns the number of rows.
+ */
+int64
+pgsql_load_record_batches(SQLloader *loader, PGconn *conn,
+						  int batch_begin, int batch_end)
+{
+	static const char signature[11] = "PGCOPY\n\377\r\n\0";
+	ArrowFileMap *af_map = loader->af_map;
+	ArrowFooter *footer = &af_map->footer;
+	ArrowColumnView *views;
+	SQLbuffer	buf;
+	PGresult   *res;
+	int64		nrows = 0;
+	int			j, k;
+
+	res = PQexec(conn, loader->copy_command);
+	if (PQresultStatus(res) != PGRES_COPY_IN)
+		Elog("unable to begin COPY: %s", PQresultErrorMessage(res));
+	PQclear(res);
+
+	sql_buffer_init(&buf);
+	sql_buffer_append(&buf, signature, sizeof(signature));
+	__append_be32(&buf, 0);		/* flags */
+	__append_be32(&buf, 0);		/* length of the header extension */
+	views = palloc0(sizeof(ArrowColumnView) * loader->nfields);
+	for (k=batch_begin; k < batch_end; k++)
+	{
+		ArrowBlock *b = &footer->recordBatches[k];
+		ArrowMessage message;
+		ArrowRecordBatch *rbatch;
+		const char *body;
+		const char *errmsg;
+		int64		i;
+
+		errmsg = readArrowBlockView(af_map, b, &message, &body);
+		if (errmsg)
+			Elog("record batch %d: %s", k, errmsg);
+		if (message.body.tag != ArrowNodeTag__RecordBatch)
+			Elog("record batch %d: block is not RecordBatch", k);
+		rbatch = &message.body.recordBatch;
+		errmsg = setupArrowColumnViews(rbatch, body, b->bodyLength,
+									   footer->schema.fields,
+									   loader->nfields, views);
+		if (errmsg)
+			Elog("record batch %d: %s", k, errmsg);
+		for (i=0; i < rbatch->length; i++)
+		{
+			__append_be16(&buf, loader->nfields);
+			for (j=0; j < loader->nfields; j++)
+				__load_encode_item(&loader->columns[j], &views[j], i, &buf);
+			if (buf.usage >= LOAD_COPY_CHUNK_SZ)
+				__pgsql_put_copy_data(conn, &buf);
+		}
+		nrows += rbatch->length;
+		releaseArrowColumnViews(views, loader->nfields);
+		if (rbatch->nodes)
+			pfree(rbatch->nodes);
+		if (rbatch->buffers)
+			pfree(rbatch->buffers);
+	}
+	__append_be16(&buf, (uint16)-1);	/* trailer */
+	__pgsql_put_copy_data(conn, &buf);
+	if (PQputCopyEnd(conn, NULL) != 1)
+		Elog("failed on PQputCopyEnd: %s", PQerrorMessage(conn));
+	while ((res = PQgetResult(conn)) != NULL)
+	{
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			Elog("COPY failed: %s", PQresultErrorMessage(res));
+		PQclear(res);
+	}
+	pfree(views);
+	sql_buffer_free(&buf);
+
+	return nrows;
+}
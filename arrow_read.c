@@ -29,10 +29,6 @@ typedef struct
 	int32		headOffset;
 } FBMetaData;
 
-/* static variables/functions */
-static const char  *file_map_head;
-static const char  *file_map_tail;
-
 static inline FBTable
 fetchFBTable(void *p_table)
 {
@@ -164,6 +160,9 @@ readArrowTypeDecimal(ArrowTypeDecimal *node, const char *pos)
 
 	node->precision = fetchInt(&t, 0);
 	node->scale     = fetchInt(&t, 1);
+	node->bitWidth  = fetchInt(&t, 2);
+	if (node->bitWidth == 0)
+		node->bitWidth = 128;	/* default */
 }
 
 static void
@@ -325,6 +324,15 @@ readArrowType(ArrowType *type, int type_tag, const char *type_pos)
 			if (type_pos)
 				readArrowTypeMap(&type->Map, type_pos);
 			break;
+		case ArrowType__LargeBinary:
+			type->tag = ArrowNodeTag__LargeBinary;
+			break;
+		case ArrowType__LargeUtf8:
+			type->tag = ArrowNodeTag__LargeUtf8;
+			break;
+		case ArrowType__LargeList:
+			type->tag = ArrowNodeTag__LargeList;
+			break;
 		default:
 			printf("type code = %d is not supported now\n", type_tag);
 			break;
@@ -484,6 +492,17 @@ readArrowBuffer(ArrowBuffer *node, const char *pos)
 
 }
 
+static void
+readArrowBodyCompression(ArrowBodyCompression *compress, const char *pos)
+{
+	FBTable		t = fetchFBTable((int32 *)pos);
+
+	memset(compress, 0, sizeof(ArrowBodyCompression));
+	compress->tag		= ArrowNodeTag__BodyCompression;
+	compress->codec		= fetchChar(&t, 0);
+	compress->method	= fetchChar(&t, 1);
+}
+
 static void
 readArrowRecordBatch(ArrowRecordBatch *rbatch, const char *pos)
 {
@@ -513,6 +532,11 @@ readArrowRecordBatch(ArrowRecordBatch *rbatch, const char *pos)
 			next += readArrowBuffer(&rbatch->buffers[i], next);
 	}
 	rbatch->_num_buffers = nitems;
+
+	/* compression: BodyCompression (optional) */
+	next = fetchOffset(&t, 3);
+	if (next)
+		readArrowBodyCompression(&rbatch->compression, next);
 }
 
 static void
@@ -543,7 +567,8 @@ readArrowMessage(ArrowMessage *message, const char *pos)
 	next				= fetchOffset(&t, 2);
 	message->bodyLength	= fetchLong(&t, 3);
 
-	if (message->version != ArrowMetadataVersion__V4)
+	if (message->version != ArrowMetadataVersion__V4 &&
+		message->version != ArrowMetadataVersion__V5)
 		Elog("metadata version %d is not supported", message->version);
 
 	switch (mtype)
@@ -628,72 +653,1478 @@ readArrowFooter(ArrowFooter *node, const char *pos)
 }
 
 /*
- * readArrowFile - read the supplied apache arrow file
+ * __readFileImage - reads the portion of the file into a palloc'd buffer
+ */
+static char *
+__readFileImage(int fdesc, const char *pathname, off_t offset, size_t length)
+{
+	char	   *buffer = palloc(length + 1);
+	size_t		count = 0;
+	ssize_t		nbytes;
+
+	while (count < length)
+	{
+		nbytes = pread(fdesc, buffer + count, length - count, offset + count);
+		if (nbytes < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			Elog("failed on pread('%s'): %m", pathname);
+		}
+		if (nbytes == 0)
+			Elog("unexpected EOF on '%s'", pathname);
+		count += nbytes;
+	}
+	buffer[length] = '\0';
+
+	return buffer;
+}
+
+/*
+ * __readArrowBlockMessage - reads the message of the block, and its body
+ * if p_body is given
+ */
+static void
+__readArrowBlockMessage(int fdesc, const char *pathname, ArrowBlock *b,
+						ArrowMessage *message, const char **p_body)
+{
+	size_t		length = b->metaDataLength;
+	char	   *image;
+	FBMetaData *meta;
+
+	if (p_body)
+		length += b->bodyLength;
+	image = __readFileImage(fdesc, pathname, b->offset, length);
+	meta = (FBMetaData *)image;
+	if (b->metaDataLength != meta->metaLength + sizeof(int32))
+		Elog("metadata length mismatch");
+	readArrowMessage(message, (const char *)&meta->headOffset +
+					 meta->headOffset);
+	if (p_body)
+		*p_body = image + b->metaDataLength;
+}
+
+/*
+ * readArrowFileInfo - read the footer and the dictionary batches of the
+ * supplied apache arrow file
+ *
+ * The file is read by pread(2), not mmap(2), because --append overwrites
+ * the footer portion of the file, and all the metadata has to survive.
  */
 void
-readArrowFile(const char *pathname)
+readArrowFileInfo(const char *pathname, ArrowFileInfo *af_info)
 {
 	int				fdesc;
 	struct stat		st_buf;
-	size_t			mmap_sz;
-	FBMetaData	   *meta;
-	const char	   *pos;
+	char		   *image;
 	int32			i, offset;
-	ArrowFooter		footer;
-	ArrowMessage	message;
+	size_t			length;
 
+	memset(af_info, 0, sizeof(ArrowFileInfo));
 	fdesc = open(pathname, O_RDONLY);
 	if (fdesc < 0)
 		Elog("failed on open('%s'): %m", pathname);
 	if (fstat(fdesc, &st_buf) != 0)
 		Elog("failed on fstat('%s'): %m", pathname);
-	mmap_sz = TYPEALIGN(sysconf(_SC_PAGESIZE), st_buf.st_size);
+	if (st_buf.st_size < 8 + sizeof(int32) + 6)
+		Elog("file '%s' is too small for apache arrow", pathname);
+	af_info->filename = pathname;
+	af_info->file_sz = st_buf.st_size;
 
-	file_map_head = mmap(NULL, mmap_sz, PROT_READ, MAP_SHARED, fdesc, 0);
-	if (file_map_head == MAP_FAILED)
-		Elog("failed on mmap(2): %m");
-	file_map_tail = file_map_head + st_buf.st_size;
 	/* signature checks */
-	if (memcmp(file_map_head, "ARROW1\0\0", 8) != 0 ||
-		memcmp(file_map_tail - 6, "ARROW1", 6) != 0)
+	image = __readFileImage(fdesc, pathname, 0, 8);
+	if (memcmp(image, "ARROW1\0\0", 8) != 0)
+		Elog("file signature mismatch");
+	image = __readFileImage(fdesc, pathname,
+							st_buf.st_size - 6 - sizeof(int32),
+							6 + sizeof(int32));
+	if (memcmp(image + sizeof(int32), "ARROW1", 6) != 0)
 		Elog("file signature mismatch");
 
 	/* read ArrowFooter on the tail of file */
-	pos = file_map_tail - 6 - sizeof(int32);
-	offset = *((int32 *)pos);
-	pos -= offset;
-	offset = *((int32 *)pos);
-	readArrowFooter(&footer, pos + offset);
+	length = *((int32 *)image);
+	if (length < sizeof(int32) ||
+		length > st_buf.st_size - 8 - 6 - sizeof(int32))
+		Elog("footer length is not valid");
+	af_info->footer_offset = st_buf.st_size - 6 - sizeof(int32) - length;
+	image = __readFileImage(fdesc, pathname,
+							af_info->footer_offset, length);
+	offset = *((int32 *)image);
+	readArrowFooter(&af_info->footer, image + offset);
+
+	/* read DictionaryBatches */
+	if (af_info->footer._num_dictionaries > 0)
+	{
+		int		nitems = af_info->footer._num_dictionaries;
+
+		af_info->dictionaries = palloc0(sizeof(ArrowMessage) * nitems);
+		af_info->dictionaryBodies = palloc0(sizeof(char *) * nitems);
+		for (i=0; i < nitems; i++)
+		{
+			ArrowMessage   *message = &af_info->dictionaries[i];
+
+			__readArrowBlockMessage(fdesc, pathname,
+									&af_info->footer.dictionaries[i],
+									message,
+									&af_info->dictionaryBodies[i]);
+			if (message->body.dictionaryBatch.tag !=
+				ArrowNodeTag__DictionaryBatch)
+				Elog("block of the dictionary is not DictionaryBatch");
+		}
+	}
+	close(fdesc);
+}
+
+/*
+ * readArrowFile - read the supplied apache arrow file
+ */
+void
+readArrowFile(const char *pathname)
+{
+	ArrowFileInfo	af_info;
+	ArrowMessage	message;
+	int				fdesc;
+	int32			i;
+
+	readArrowFileInfo(pathname, &af_info);
 
 	printf("[Footer]\n");
-	dumpArrowNode((ArrowNode *)&footer, stdout);
+	dumpArrowNode((ArrowNode *)&af_info.footer, stdout);
 	putchar('\n');
 
-	for (i=0; i < footer._num_dictionaries; i++)
+	for (i=0; i < af_info.footer._num_dictionaries; i++)
 	{
-		ArrowBlock	   *b = &footer.dictionaries[i];
-
-		meta = (FBMetaData *)(file_map_head + b->offset);
-		if (b->metaDataLength != meta->metaLength + sizeof(int32))
-			Elog("metadata length mismatch");
-		pos = (const char *)&meta->headOffset + meta->headOffset;
-		readArrowMessage(&message, pos);
 		printf("[Dictionary Batch %d]\n", i);
-		dumpArrowNode((ArrowNode *)&message, stdout);
+		dumpArrowNode((ArrowNode *)&af_info.dictionaries[i], stdout);
 		putchar('\n');
 	}
 
-	for (i=0; i < footer._num_recordBatches; i++)
+	fdesc = open(pathname, O_RDONLY);
+	if (fdesc < 0)
+		Elog("failed on open('%s'): %m", pathname);
+	for (i=0; i < af_info.footer._num_recordBatches; i++)
 	{
-		ArrowBlock	   *b = &footer.recordBatches[i];
-
-		meta = (FBMetaData *)(file_map_head + b->offset);
-		if (b->metaDataLength != meta->metaLength + sizeof(int32))
-			Elog("metadata length mismatch");
-		pos = (const char *)&meta->headOffset + meta->headOffset;
-		readArrowMessage(&message, pos);
+		__readArrowBlockMessage(fdesc, pathname,
+								&af_info.footer.recordBatches[i],
+								&message, NULL);
 		printf("[Record Batch %d]\n", i);
 		dumpArrowNode((ArrowNode *)&message, stdout);
 		putchar('\n');
 	}
+	close(fdesc);
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Scanner of the arrow file
+ *
+ * The file is mapped read-only, then the record batches are accessed
+ * as views of the column buffers, without copy. The views are built on
+ * the metadata of each record batch, and the buffers are checked to be
+ * within the body of the message, but the contents are not.
+ *
+ * ----------------------------------------------------------------
+ */
+
+/*
+ * openArrowFileMap - maps the arrow file, and reads its footer
+ */
+void
+openArrowFileMap(const char *pathname, ArrowFileMap *af_map)
+{
+	struct stat	st_buf;
+	char	   *head;
+	const char *tail;
+	int32		length;
+	int32		offset;
+
+	memset(af_map, 0, sizeof(ArrowFileMap));
+	af_map->fdesc = open(pathname, O_RDONLY);
+	if (af_map->fdesc < 0)
+		Elog("failed on open('%s'): %m", pathname);
+	if (fstat(af_map->fdesc, &st_buf) != 0)
+		Elog("failed on fstat('%s'): %m", pathname);
+	if (st_buf.st_size < 8 + sizeof(int32) + 6)
+		Elog("file '%s' is too small for apache arrow", pathname);
+	head = mmap(NULL, st_buf.st_size, PROT_READ, MAP_SHARED,
+				af_map->fdesc, 0);
+	if (head == MAP_FAILED)
+		Elog("failed on mmap('%s'): %m", pathname);
+	if (madvise(head, st_buf.st_size, MADV_SEQUENTIAL) != 0)
+		Elog("failed on madvise('%s'): %m", pathname);
+	af_map->filename = pathname;
+	af_map->file_map_head = head;
+	af_map->file_sz = st_buf.st_size;
+
+	/* signature checks */
+	tail = head + st_buf.st_size - 6 - sizeof(int32);
+	if (memcmp(head, "ARROW1\0\0", 8) != 0 ||
+		memcmp(tail + sizeof(int32), "ARROW1", 6) != 0)
+		Elog("file signature mismatch");
+
+	/* read ArrowFooter on the tail of file */
+	memcpy(&length, tail, sizeof(int32));
+	if (length < sizeof(int32) ||
+		length > st_buf.st_size - 8 - 6 - sizeof(int32))
+		Elog("footer length is not valid");
+	memcpy(&offset, tail - length, sizeof(int32));
+	if (offset < sizeof(int32) || offset >= length)
+		Elog("footer is corrupted");
+	readArrowFooter(&af_map->footer, tail - length + offset);
+}
+
+/*
+ * closeArrowFileMap
+ */
+void
+closeArrowFileMap(ArrowFileMap *af_map)
+{
+	if (munmap((void *)af_map->file_map_head, af_map->file_sz) != 0)
+		Elog("failed on munmap('%s'): %m", af_map->filename);
+	close(af_map->fdesc);
+}
+
+/*
+ * readArrowBlockView - reads the message of the block on the file mapping.
+ * It returns the reason if the block is not valid, or NULL.
+ */
+const char *
+readArrowBlockView(ArrowFileMap *af_map, ArrowBlock *b,
+				   ArrowMessage *message, const char **p_body)
+{
+	const FBMetaData *meta;
+
+	if (b->offset < 8 ||
+		b->metaDataLength < sizeof(FBMetaData) ||
+		b->bodyLength < 0 ||
+		b->offset + b->metaDataLength + b->bodyLength > af_map->file_sz)
+		return psprintf("block (offset=%ld, metaDataLength=%d, bodyLength=%ld) is out of the file",
+						b->offset, b->metaDataLength, b->bodyLength);
+	meta = (const FBMetaData *)(af_map->file_map_head + b->offset);
+	if (b->metaDataLength != meta->metaLength + sizeof(int32))
+		return "metadata length mismatch";
+	if (meta->headOffset < sizeof(int32) ||
+		meta->headOffset >= meta->metaLength)
+		return "metadata is corrupted";
+	readArrowMessage(message, (const char *)&meta->headOffset +
+					 meta->headOffset);
+	if (message->bodyLength != b->bodyLength)
+		return psprintf("body length mismatch (message=%lu, block=%ld)",
+						message->bodyLength, b->bodyLength);
+	if (p_body)
+		*p_body = af_map->file_map_head + b->offset + b->metaDataLength;
+	return NULL;
+}
+
+typedef struct
+{
+	ArrowRecordBatch *rbatch;
+	const char *body;
+	size_t		body_sz;
+	int			node_index;		/* next FieldNode to be consumed */
+	int			buffer_index;	/* next Buffer to be consumed */
+} ArrowViewContext;
+
+static const char *
+__setupArrowBufferView(ArrowViewContext *con, ArrowColumnView *view,
+					   const char **p_addr, size_t *p_length)
+{
+	ArrowRecordBatch *rbatch = con->rbatch;
+	ArrowBuffer *buf;
+	const char *errmsg = NULL;
+	char	   *image;
+
+	if (con->buffer_index >= rbatch->_num_buffers)
+		return "number of buffers is less than the schema";
+	buf = &rbatch->buffers[con->buffer_index++];
+	if (buf->offset < 0 || buf->length < 0 ||
+		buf->offset + buf->length > con->body_sz)
+		return psprintf("buffer (offset=%ld, length=%ld) is out of the body",
+						buf->offset, buf->length);
+	*p_addr = NULL;
+	*p_length = 0;
+	view->stored_len += buf->length;
+	if (buf->length == 0)
+		return NULL;
+	if (!view->compressed)
+	{
+		*p_addr = con->body + buf->offset;
+		*p_length = buf->length;
+		return NULL;
+	}
+	image = sql_buffer_decompress(rbatch->compression.codec,
+								  con->body + buf->offset,
+								  buf->length,
+								  p_length, &errmsg);
+	if (!image)
+		return errmsg;
+	if (*p_length == 0)
+		pfree(image);
+	else
+		*p_addr = image;
+	return NULL;
+}
+
+static const char *
+__setupArrowColumnView(ArrowViewContext *con, ArrowField *field,
+					   ArrowColumnView *view)
+{
+	ArrowRecordBatch *rbatch = con->rbatch;
+	ArrowFieldNode *node;
+	const char *errmsg;
+	int			j;
+
+	memset(view, 0, sizeof(ArrowColumnView));
+	view->field = field;
+	view->compressed = (rbatch->compression.tag ==
+						ArrowNodeTag__BodyCompression);
+	if (con->node_index >= rbatch->_num_nodes)
+		return "number of field nodes is less than the schema";
+	node = &rbatch->nodes[con->node_index++];
+	view->length = node->length;
+	view->null_count = node->null_count;
+
+	/* Null type has no buffers */
+	if (field->type.tag == ArrowNodeTag__Null)
+		return NULL;
+	if (field->type.tag == ArrowNodeTag__Union)
+		return "Union type is not supported";
+	errmsg = __setupArrowBufferView(con, view,
+									&view->nullmap,
+									&view->nullmap_len);
+	if (errmsg)
+		return errmsg;
+	/* dictionary indexes; values are in the DictionaryBatch */
+	if (field->dictionary.tag == ArrowNodeTag__DictionaryEncoding)
+		return __setupArrowBufferView(con, view,
+									  &view->values,
+									  &view->values_len);
+	switch (field->type.tag)
+	{
+		case ArrowNodeTag__Struct:
+		case ArrowNodeTag__FixedSizeList:
+			break;
+		case ArrowNodeTag__Utf8:
+		case ArrowNodeTag__Binary:
+		case ArrowNodeTag__LargeUtf8:
+		case ArrowNodeTag__LargeBinary:
+			errmsg = __setupArrowBufferView(con, view,
+											&view->values,
+											&view->values_len);
+			if (errmsg)
+				return errmsg;
+			errmsg = __setupArrowBufferView(con, view,
+											&view->extra,
+											&view->extra_len);
+			break;
+		default:
+			errmsg = __setupArrowBufferView(con, view,
+											&view->values,
+											&view->values_len);
+			break;
+	}
+	if (errmsg)
+		return errmsg;
+
+	if (field->_num_children > 0)
+	{
+		view->children = palloc0(sizeof(ArrowColumnView) *
+								 field->_num_children);
+		view->nchildren = field->_num_children;
+		for (j=0; j < field->_num_children; j++)
+		{
+			errmsg = __setupArrowColumnView(con, &field->children[j],
+											&view->children[j]);
+			if (errmsg)
+				return errmsg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * setupArrowColumnViews - builds the views of the columns of the record
+ * batch, according to the fields of the schema. It returns the reason if
+ * the record batch does not match the schema, or NULL. The views have to
+ * be released by releaseArrowColumnViews() in either case.
+ */
+const char *
+setupArrowColumnViews(ArrowRecordBatch *rbatch,
+					  const char *body, size_t body_sz,
+					  ArrowField *fields, int nfields,
+					  ArrowColumnView *views)
+{
+	ArrowViewContext con;
+	const char *errmsg;
+	int			j;
+
+	memset(views, 0, sizeof(ArrowColumnView) * nfields);
+	memset(&con, 0, sizeof(ArrowViewContext));
+	con.rbatch = rbatch;
+	con.body = body;
+	con.body_sz = body_sz;
+	for (j=0; j < nfields; j++)
+	{
+		errmsg = __setupArrowColumnView(&con, &fields[j], &views[j]);
+		if (errmsg)
+			return psprintf("column '%s': %s", fields[j].name, errmsg);
+		if (views[j].length != rbatch->length)
+			return psprintf("column '%s': length %ld mismatch to the record batch (%ld)",
+							fields[j].name, views[j].length, rbatch->length);
+	}
+	if (con.node_index != rbatch->_num_nodes)
+		return psprintf("number of field nodes mismatch (%d of %d)",
+						con.node_index, rbatch->_num_nodes);
+	if (con.buffer_index != rbatch->_num_buffers)
+		return psprintf("number of buffers mismatch (%d of %d)",
+						con.buffer_index, rbatch->_num_buffers);
+	return NULL;
+}
+
+/*
+ * releaseArrowColumnViews
+ */
+void
+releaseArrowColumnViews(ArrowColumnView *views, int nfields)
+{
+	int			j;
+
+	for (j=0; j < nfields; j++)
+	{
+		ArrowColumnView *view = &views[j];
+
+		if (view->compressed)
+		{
+			if (view->nullmap)
+				pfree((void *)view->nullmap);
+			if (view->values)
+				pfree((void *)view->values);
+			if (view->extra)
+				pfree((void *)view->extra);
+		}
+		if (view->children)
+		{
+			releaseArrowColumnViews(view->children, view->nchildren);
+			pfree(view->children);
+		}
+	}
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Validator of the arrow file (--verify)
+ *
+ * It checks the buffers of every record batch against the metadata:
+ * buffer bounds, null_count of the null bitmap, monotonicity of the
+ * offsets, and range of the dictionary indexes. Dictionary batches are
+ * checked first to know the number of labels, then the record batches
+ * are checked by multiple threads, one batch per job.
+ *
+ * ----------------------------------------------------------------
+ */
+#define VERIFY_MAX_THREADS		16
+
+typedef struct
+{
+	ArrowFileMap *af_map;
+	int64	   *dict_ids;
+	int64	   *dict_nitems;	/* number of labels, including deltas */
+	int			num_dicts;
+	int			next_index;		/* atomic */
+	int64		nrows;			/* atomic */
+	const char **errors;		/* the first error of each record batch */
+} ArrowVerifyState;
+
+static const char *
+__verifyArrowNullmap(ArrowColumnView *view)
+{
+	const uint8 *bitmap = (const uint8 *)view->nullmap;
+	int64		nvalids = 0;
+	int64		i, nwords;
+	uint64		word;
+
+	if (!bitmap)
+	{
+		if (view->null_count != 0)
+			return psprintf("null_count is %ld, but no null bitmap",
+							view->null_count);
+		return NULL;
+	}
+	if (view->nullmap_len < (view->length + 7) / 8)
+		return psprintf("null bitmap (%zu bytes) is too short for %ld items",
+						view->nullmap_len, view->length);
+	nwords = view->length / 64;
+	for (i=0; i < nwords; i++)
+	{
+		memcpy(&word, bitmap + i * sizeof(uint64), sizeof(uint64));
+		nvalids += __builtin_popcountl(word);
+	}
+	for (i = nwords * 64; i < view->length; i++)
+	{
+		if ((bitmap[i >> 3] & (1 << (i & 7))) != 0)
+			nvalids++;
+	}
+	if (view->length - nvalids != view->null_count)
+		return psprintf("null_count is %ld, but null bitmap has %ld nulls",
+						view->null_count, view->length - nvalids);
+	return NULL;
+}
+
+static const char *
+__verifyArrowFixedWidth(ArrowColumnView *view, size_t width)
+{
+	if (view->values_len < view->length * width)
+		return psprintf("values (%zu bytes) are too short for %ld items of %zu bytes",
+						view->values_len, view->length, width);
+	return NULL;
+}
+
+static const char *
+__verifyArrowOffsets(ArrowColumnView *view, bool is_large, int64 limit)
+{
+	size_t		width = (is_large ? sizeof(int64) : sizeof(int32));
+	int64		prev, curr;
+	int64		i;
+
+	if (view->length == 0 && view->values_len == 0)
+		return NULL;
+	if (view->values_len < (view->length + 1) * width)
+		return psprintf("offsets (%zu bytes) are too short for %ld items",
+						view->values_len, view->length);
+	prev = (is_large
+			? ((const int64 *)view->values)[0]
+			: ((const int32 *)view->values)[0]);
+	if (prev < 0)
+		return psprintf("offsets begin with a negative value %ld", prev);
+	for (i=1; i <= view->length; i++)
+	{
+		curr = (is_large
+				? ((const int64 *)view->values)[i]
+				: ((const int32 *)view->values)[i]);
+		if (curr < prev)
+			return psprintf("offsets are not monotonic at %ld (%ld -> %ld)",
+							i, prev, curr);
+		prev = curr;
+	}
+	if (prev > limit)
+		return psprintf("the last offset %ld exceeds the length of values (%ld)",
+						prev, limit);
+	return NULL;
+}
+
+static const char *
+__verifyArrowDictIndexes(ArrowVerifyState *state, ArrowColumnView *view)
+{
+	ArrowDictionaryEncoding *dict = &view->field->dictionary;
+	int			width = dict->indexType.bitWidth / 8;
+	int64		nitems = -1;
+	int64		i, index;
+	const char *errmsg;
+
+	if (width != 1 && width != 2 && width != 4 && width != 8)
+		return psprintf("index type of the dictionary is not valid (bitWidth=%d)",
+						dict->indexType.bitWidth);
+	errmsg = __verifyArrowFixedWidth(view, width);
+	if (errmsg)
+		return errmsg;
+	for (i=0; i < state->num_dicts; i++)
+	{
+		if (state->dict_ids[i] == dict->id)
+		{
+			nitems = state->dict_nitems[i];
+			break;
+		}
+	}
+	if (nitems < 0)
+		return psprintf("dictionary (id=%ld) is missing", dict->id);
+	for (i=0; i < view->length; i++)
+	{
+		if (!arrow_view_isvalid(view, i))
+			continue;
+		switch (width)
+		{
+			case 1:
+				index = ((const int8 *)view->values)[i];
+				break;
+			case 2:
+				index = ((const int16 *)view->values)[i];
+				break;
+			case 4:
+				index = ((const int32 *)view->values)[i];
+				break;
+			default:
+				index = ((const int64 *)view->values)[i];
+				break;
+		}
+		if (index < 0 || index >= nitems)
+			return psprintf("dictionary index %ld at %ld is out of the dictionary (%ld labels)",
+							index, i, nitems);
+	}
+	return NULL;
+}
+
+static const char *
+__verifyArrowColumnView(ArrowVerifyState *state, ArrowColumnView *view)
+{
+	ArrowField *field = view->field;
+	ArrowType  *type = &field->type;
+	const char *errmsg = NULL;
+	int			j;
+
+	if (view->length < 0 ||
+		view->null_count < 0 ||
+		view->null_count > view->length)
+		return psprintf("field node (length=%ld, null_count=%ld) is not valid",
+						view->length, view->null_count);
+	if (type->tag == ArrowNodeTag__Null)
+	{
+		if (view->null_count != view->length)
+			return psprintf("null_count of Null type is %ld, not %ld",
+							view->null_count, view->length);
+		return NULL;
+	}
+	errmsg = __verifyArrowNullmap(view);
+	if (errmsg)
+		return errmsg;
+	if (field->dictionary.tag == ArrowNodeTag__DictionaryEncoding)
+		return __verifyArrowDictIndexes(state, view);
+
+	switch (type->tag)
+	{
+		case ArrowNodeTag__Int:
+			errmsg = __verifyArrowFixedWidth(view, type->Int.bitWidth / 8);
+			break;
+		case ArrowNodeTag__FloatingPoint:
+			switch (type->FloatingPoint.precision)
+			{
+				case ArrowPrecision__Half:
+					errmsg = __verifyArrowFixedWidth(view, sizeof(int16));
+					break;
+				case ArrowPrecision__Single:
+					errmsg = __verifyArrowFixedWidth(view, sizeof(float));
+					break;
+				default:
+					errmsg = __verifyArrowFixedWidth(view, sizeof(double));
+					break;
+			}
+			break;
+		case ArrowNodeTag__Decimal:
+			errmsg = __verifyArrowFixedWidth(view, type->Decimal.bitWidth / 8);
+			break;
+		case ArrowNodeTag__Date:
+			errmsg = __verifyArrowFixedWidth(view, (type->Date.unit ==
+													ArrowDateUnit__Day
+													? sizeof(int32)
+													: sizeof(int64)));
+			break;
+		case ArrowNodeTag__Time:
+			errmsg = __verifyArrowFixedWidth(view, type->Time.bitWidth / 8);
+			break;
+		case ArrowNodeTag__Timestamp:
+			errmsg = __verifyArrowFixedWidth(view, sizeof(int64));
+			break;
+		case ArrowNodeTag__Interval:
+			errmsg = __verifyArrowFixedWidth(view, (type->Interval.unit ==
+													ArrowIntervalUnit__Year_Month
+													? sizeof(int32)
+													: sizeof(int64)));
+			break;
+		case ArrowNodeTag__FixedSizeBinary:
+			errmsg = __verifyArrowFixedWidth(view,
+											 type->FixedSizeBinary.byteWidth);
+			break;
+		case ArrowNodeTag__Bool:
+			if (view->values_len < (view->length + 7) / 8)
+				errmsg = psprintf("values (%zu bytes) are too short for %ld booleans",
+								  view->values_len, view->length);
+			break;
+		case ArrowNodeTag__Utf8:
+		case ArrowNodeTag__Binary:
+			errmsg = __verifyArrowOffsets(view, false, view->extra_len);
+			break;
+		case ArrowNodeTag__LargeUtf8:
+		case ArrowNodeTag__LargeBinary:
+			errmsg = __verifyArrowOffsets(view, true, view->extra_len);
+			break;
+		case ArrowNodeTag__List:
+		case ArrowNodeTag__LargeList:
+		case ArrowNodeTag__Map:
+			if (view->nchildren != 1)
+				return psprintf("%s type has %d children",
+								type->tag == ArrowNodeTag__Map ? "Map" : "List",
+								view->nchildren);
+			errmsg = __verifyArrowOffsets(view, (type->tag ==
+												 ArrowNodeTag__LargeList),
+										  view->children[0].length);
+			break;
+		case ArrowNodeTag__FixedSizeList:
+			if (view->nchildren != 1)
+				return psprintf("FixedSizeList type has %d children",
+								view->nchildren);
+			if (view->children[0].length <
+				view->length * type->FixedSizeList.listSize)
+				errmsg = psprintf("child has %ld items, less than %ld x %d",
+								  view->children[0].length, view->length,
+								  type->FixedSizeList.listSize);
+			break;
+		case ArrowNodeTag__Struct:
+			for (j=0; j < view->nchildren; j++)
+			{
+				if (view->children[j].length < view->length)
+					return psprintf("child '%s' has %ld items, less than %ld",
+									view->children[j].field->name,
+									view->children[j].length,
+									view->length);
+			}
+			break;
+		default:
+			return psprintf("unknown type tag: %d", type->tag);
+	}
+	if (errmsg)
+		return errmsg;
+
+	for (j=0; j < view->nchildren; j++)
+	{
+		errmsg = __verifyArrowColumnView(state, &view->children[j]);
+		if (errmsg)
+			return psprintf("child '%s': %s",
+							view->children[j].field->name, errmsg);
+	}
+	return NULL;
+}
+
+static const char *
+__verifyArrowRecordBatch(ArrowVerifyState *state, ArrowRecordBatch *rbatch,
+						 const char *body, size_t body_sz,
+						 ArrowField *fields, int nfields)
+{
+	ArrowColumnView *views = palloc0(sizeof(ArrowColumnView) *
+									 Max(nfields, 1));
+	const char *errmsg;
+	int			j;
+
+	errmsg = setupArrowColumnViews(rbatch, body, body_sz,
+								   fields, nfields, views);
+	for (j=0; !errmsg && j < nfields; j++)
+	{
+		errmsg = __verifyArrowColumnView(state, &views[j]);
+		if (errmsg)
+			errmsg = psprintf("column '%s': %s", fields[j].name, errmsg);
+	}
+	releaseArrowColumnViews(views, nfields);
+	pfree(views);
+
+	return errmsg;
+}
+
+static ArrowField *
+__lookupArrowDictField(ArrowField *fields, int nfields, int64 dict_id)
+{
+	ArrowField *field;
+	int			j;
+
+	for (j=0; j < nfields; j++)
+	{
+		field = &fields[j];
+		if (field->dictionary.tag == ArrowNodeTag__DictionaryEncoding &&
+			field->dictionary.id == dict_id)
+			return field;
+		field = __lookupArrowDictField(field->children,
+									   field->_num_children, dict_id);
+		if (field)
+			return field;
+	}
+	return NULL;
+}
+
+/*
+ * lookupArrowDictionaryField - the field that refers the dictionary, or
+ * NULL if not found
+ */
+ArrowField *
+lookupArrowDictionaryField(ArrowSchema *schema, int64 dict_id)
+{
+	return __lookupArrowDictField(schema->fields, schema->_num_fields,
+								  dict_id);
+}
+
+static const char *
+__verifyArrowDictionaryBatch(ArrowVerifyState *state, ArrowBlock *b)
+{
+	ArrowFileMap *af_map = state->af_map;
+	ArrowSchema *schema = &af_map->footer.schema;
+	ArrowMessage message;
+	ArrowDictionaryBatch *dbatch;
+	ArrowField *field;
+	ArrowField	vfield;
+	const char *body;
+	const char *errmsg;
+	int			i;
+
+	errmsg = readArrowBlockView(af_map, b, &message, &body);
+	if (errmsg)
+		return errmsg;
+	if (message.body.tag != ArrowNodeTag__DictionaryBatch)
+		return "block is not DictionaryBatch";
+	dbatch = &message.body.dictionaryBatch;
+	field = lookupArrowDictionaryField(schema, dbatch->id);
+	if (!field)
+	{
+		/* harmless, but value type of the dictionary is unknown */
+		fprintf(stderr, "notice: no fields refer the dictionary (id=%ld)\n",
+				dbatch->id);
+	}
+	else
+	{
+		/* the dictionary has the value type of the field */
+		memcpy(&vfield, field, sizeof(ArrowField));
+		memset(&vfield.dictionary, 0, sizeof(ArrowDictionaryEncoding));
+		errmsg = __verifyArrowRecordBatch(state, &dbatch->data,
+										  body, b->bodyLength, &vfield, 1);
+		if (errmsg)
+			return errmsg;
+	}
+
+	for (i=0; i < state->num_dicts; i++)
+	{
+		if (state->dict_ids[i] == dbatch->id)
+			break;
+	}
+	if (i == state->num_dicts)
+	{
+		if (dbatch->isDelta)
+			return psprintf("delta dictionary (id=%ld) has no base",
+							dbatch->id);
+		state->dict_ids[state->num_dicts++] = dbatch->id;
+		state->dict_nitems[i] = 0;
+	}
+	else if (!dbatch->isDelta)
+		state->dict_nitems[i] = 0;
+	state->dict_nitems[i] += dbatch->data.length;
+
+	return NULL;
+}
+
+/*
+ * __releaseArrowBlockPages - drops the pages of the block from the file
+ * mapping, once the scan of the block is done
+ */
+static void
+__releaseArrowBlockPages(ArrowFileMap *af_map, ArrowBlock *b)
+{
+	long		page_sz = sysconf(_SC_PAGESIZE);
+	uintptr_t	head, tail;
+
+	if (b->offset + b->metaDataLength + b->bodyLength > af_map->file_sz)
+		return;
+	head = TYPEALIGN(page_sz, (uintptr_t)af_map->file_map_head +
+					 b->offset);
+	tail = TYPEALIGN_DOWN(page_sz, (uintptr_t)af_map->file_map_head +
+						  b->offset + b->metaDataLength +
+						  b->bodyLength);
+	if (head < tail)
+		madvise((void *)head, tail - head, MADV_DONTNEED);
+}
+
+static void *
+__verifyArrowWorker(void *__state)
+{
+	ArrowVerifyState *state = __state;
+	ArrowFileMap *af_map = state->af_map;
+	ArrowFooter *footer = &af_map->footer;
+	int			i;
+
+	while ((i = __atomic_fetch_add(&state->next_index, 1,
+								   __ATOMIC_SEQ_CST)) < footer->_num_recordBatches)
+	{
+		ArrowBlock *b = &footer->recordBatches[i];
+		ArrowMessage message;
+		const char *body;
+		const char *errmsg;
+
+		errmsg = readArrowBlockView(af_map, b, &message, &body);
+		if (!errmsg && message.body.tag != ArrowNodeTag__RecordBatch)
+			errmsg = "block is not RecordBatch";
+		if (!errmsg)
+		{
+			ArrowRecordBatch *rbatch = &message.body.recordBatch;
+
+			errmsg = __verifyArrowRecordBatch(state, rbatch,
+											  body, b->bodyLength,
+											  footer->schema.fields,
+											  footer->schema._num_fields);
+			__atomic_fetch_add(&state->nrows, rbatch->length,
+							   __ATOMIC_SEQ_CST);
+			if (rbatch->nodes)
+				pfree(rbatch->nodes);
+			if (rbatch->buffers)
+				pfree(rbatch->buffers);
+		}
+		state->errors[i] = errmsg;
+
+		/* pages of the checked record batch are no longer needed */
+		__releaseArrowBlockPages(af_map, b);
+	}
+	return NULL;
+}
+
+/*
+ * verifyArrowFile - checks the buffers of the arrow file; it returns the
+ * number of the broken batches.
+ */
+int
+verifyArrowFile(const char *pathname)
+{
+	ArrowFileMap af_map;
+	ArrowFooter *footer;
+	ArrowVerifyState state;
+	pthread_t	threads[VERIFY_MAX_THREADS];
+	int			nthreads;
+	int			nerrors = 0;
+	long		ncpus;
+	int			i;
+
+	openArrowFileMap(pathname, &af_map);
+	footer = &af_map.footer;
+	memset(&state, 0, sizeof(ArrowVerifyState));
+	state.af_map = &af_map;
+	state.dict_ids = palloc0(sizeof(int64) *
+							 Max(footer->_num_dictionaries, 1));
+	state.dict_nitems = palloc0(sizeof(int64) *
+								Max(footer->_num_dictionaries, 1));
+	state.errors = palloc0(sizeof(const char *) *
+						   Max(footer->_num_recordBatches, 1));
+
+	/* dictionary batches, in the order of the file */
+	for (i=0; i < footer->_num_dictionaries; i++)
+	{
+		const char *errmsg;
+
+		errmsg = __verifyArrowDictionaryBatch(&state,
+											  &footer->dictionaries[i]);
+		if (errmsg)
+		{
+			fprintf(stderr, "%s: dictionary batch %d: %s\n",
+					pathname, i, errmsg);
+			nerrors++;
+		}
+	}
+
+	/* record batches, in parallel */
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = Min(Max(ncpus, 1), VERIFY_MAX_THREADS);
+	nthreads = Max(Min(nthreads, footer->_num_recordBatches), 1);
+	for (i=1; i < nthreads; i++)
+	{
+		if ((errno = pthread_create(&threads[i], NULL,
+									__verifyArrowWorker, &state)) != 0)
+			Elog("failed on pthread_create: %m");
+	}
+	__verifyArrowWorker(&state);
+	for (i=1; i < nthreads; i++)
+	{
+		if ((errno = pthread_join(threads[i], NULL)) != 0)
+			Elog("failed on pthread_join: %m");
+	}
+	for (i=0; i < footer->_num_recordBatches; i++)
+	{
+		if (state.errors[i])
+		{
+			fprintf(stderr, "%s: record batch %d: %s\n",
+					pathname, i, state.errors[i]);
+			nerrors++;
+		}
+	}
+	printf("%s: %d record batches (%ld rows), %d dictionary batches: %s\n",
+		   pathname,
+		   footer->_num_recordBatches,
+		   state.nrows,
+		   footer->_num_dictionaries,
+		   nerrors == 0 ? "OK" : psprintf("%d errors", nerrors));
+	closeArrowFileMap(&af_map);
+
+	return nerrors;
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Summary of the arrow file (--summary)
+ *
+ * It aggregates the record batches per column: number of rows and nulls,
+ * bytes of the null bitmap, values and extra buffers (including the
+ * children of nested types), and the bytes actually stored in the body,
+ * to tell the compression ratio. Record batches are scanned by multiple
+ * threads, one batch per job; each thread has its own counters, then
+ * they are merged at the end.
+ *
+ * ----------------------------------------------------------------
+ */
+#define SUMMARY_MAX_THREADS		16
+
+typedef struct
+{
+	int64		nrows;
+	int64		nnulls;
+	uint64		nullmap_sz;
+	uint64		values_sz;
+	uint64		extra_sz;
+	uint64		stored_sz;		/* compressed length, if compressed */
+} ArrowSummaryColumn;
+
+typedef struct
+{
+	int64		nbatches;
+	int64		nrows;
+	int64		min_rows;
+	int64		max_rows;
+	uint64		body_sz;
+	ArrowSummaryColumn *columns;
+} ArrowSummaryCounter;
+
+typedef struct
+{
+	ArrowFileMap *af_map;
+	int			next_index;		/* atomic */
+	const char **errors;		/* error of each record batch, if any */
+} ArrowSummaryState;
+
+typedef struct
+{
+	ArrowSummaryState *state;
+	ArrowSummaryCounter counter;
+} ArrowSummaryWorker;
+
+static void
+__summaryArrowColumnBuffers(ArrowSummaryColumn *column, ArrowColumnView *view)
+{
+	int			j;
+
+	column->nullmap_sz += view->nullmap_len;
+	column->values_sz  += view->values_len;
+	column->extra_sz   += view->extra_len;
+	column->stored_sz  += view->stored_len;
+	for (j=0; j < view->nchildren; j++)
+		__summaryArrowColumnBuffers(column, &view->children[j]);
+}
+
+static void
+__summaryArrowCounterMerge(ArrowSummaryCounter *dst,
+						   ArrowSummaryCounter *src, int nfields)
+{
+	int			j;
+
+	if (src->nbatches == 0)
+		return;
+	if (dst->nbatches == 0 || dst->min_rows > src->min_rows)
+		dst->min_rows = src->min_rows;
+	if (dst->nbatches == 0 || dst->max_rows < src->max_rows)
+		dst->max_rows = src->max_rows;
+	dst->nbatches += src->nbatches;
+	dst->nrows    += src->nrows;
+	dst->body_sz  += src->body_sz;
+	for (j=0; j < nfields; j++)
+	{
+		ArrowSummaryColumn *d = &dst->columns[j];
+		ArrowSummaryColumn *s = &src->columns[j];
+
+		d->nrows      += s->nrows;
+		d->nnulls     += s->nnulls;
+		d->nullmap_sz += s->nullmap_sz;
+		d->values_sz  += s->values_sz;
+		d->extra_sz   += s->extra_sz;
+		d->stored_sz  += s->stored_sz;
+	}
+}
+
+static void *
+__summaryArrowWorker(void *__worker)
+{
+	ArrowSummaryWorker *worker = __worker;
+	ArrowSummaryState *state = worker->state;
+	ArrowFileMap *af_map = state->af_map;
+	ArrowFooter *footer = &af_map->footer;
+	ArrowField *fields = footer->schema.fields;
+	int			nfields = footer->schema._num_fields;
+	ArrowColumnView *views = palloc0(sizeof(ArrowColumnView) *
+									 Max(nfields, 1));
+	ArrowSummaryCounter batch;
+	int			i, j;
+
+	memset(&batch, 0, sizeof(ArrowSummaryCounter));
+	batch.columns = palloc0(sizeof(ArrowSummaryColumn) * Max(nfields, 1));
+	while ((i = __atomic_fetch_add(&state->next_index, 1,
+								   __ATOMIC_SEQ_CST)) < footer->_num_recordBatches)
+	{
+		ArrowBlock *b = &footer->recordBatches[i];
+		ArrowMessage message;
+		ArrowRecordBatch *rbatch;
+		const char *body;
+		const char *errmsg;
+
+		errmsg = readArrowBlockView(af_map, b, &message, &body);
+		if (!errmsg && message.body.tag != ArrowNodeTag__RecordBatch)
+			errmsg = "block is not RecordBatch";
+		if (errmsg)
+		{
+			state->errors[i] = errmsg;
+			continue;
+		}
+		rbatch = &message.body.recordBatch;
+		errmsg = setupArrowColumnViews(rbatch, body, b->bodyLength,
+									   fields, nfields, views);
+		if (!errmsg)
+		{
+			/* counters of this record batch, merged if it is valid */
+			batch.nbatches = 1;
+			batch.nrows = batch.min_rows = batch.max_rows = rbatch->length;
+			batch.body_sz = b->bodyLength;
+			memset(batch.columns, 0, sizeof(ArrowSummaryColumn) * nfields);
+			for (j=0; j < nfields; j++)
+			{
+				ArrowSummaryColumn *column = &batch.columns[j];
+
+				column->nrows  = views[j].length;
+				column->nnulls = views[j].null_count;
+				__summaryArrowColumnBuffers(column, &views[j]);
+			}
+			__summaryArrowCounterMerge(&worker->counter, &batch, nfields);
+		}
+		state->errors[i] = errmsg;
+		releaseArrowColumnViews(views, nfields);
+		if (rbatch->nodes)
+			pfree(rbatch->nodes);
+		if (rbatch->buffers)
+			pfree(rbatch->buffers);
+
+		__releaseArrowBlockPages(af_map, b);
+	}
+	pfree(batch.columns);
+	pfree(views);
+
+	return NULL;
+}
+
+/*
+ * __summaryArrowTypeName - compact name of the field type
+ */
+static const char *
+__summaryArrowTimeUnit(ArrowTimeUnit unit)
+{
+	return (unit == ArrowTimeUnit__Second ? "s" :
+			unit == ArrowTimeUnit__MilliSecond ? "ms" :
+			unit == ArrowTimeUnit__MicroSecond ? "us" :
+			unit == ArrowTimeUnit__NanoSecond ? "ns" : "??");
+}
+
+static const char *
+__summaryArrowTypeName(ArrowField *field)
+{
+	ArrowType  *type = &field->type;
+	const char *name;
+
+	switch (type->tag)
+	{
+		case ArrowNodeTag__Null:
+			name = "Null";
+			break;
+		case ArrowNodeTag__Int:
+			name = psprintf("%s%d", type->Int.is_signed ? "Int" : "Uint",
+							type->Int.bitWidth);
+			break;
+		case ArrowNodeTag__FloatingPoint:
+			name = (type->FloatingPoint.precision == ArrowPrecision__Half ? "Float16" :
+					type->FloatingPoint.precision == ArrowPrecision__Single ? "Float32" :
+					type->FloatingPoint.precision == ArrowPrecision__Double ? "Float64" :
+					"Float??");
+			break;
+		case ArrowNodeTag__Utf8:
+			name = "Utf8";
+			break;
+		case ArrowNodeTag__Binary:
+			name = "Binary";
+			break;
+		case ArrowNodeTag__Bool:
+			name = "Bool";
+			break;
+		case ArrowNodeTag__Decimal:
+			name = psprintf("Decimal%s(%d,%d)",
+							type->Decimal.bitWidth == 256 ? "256" : "",
+							type->Decimal.precision,
+							type->Decimal.scale);
+			break;
+		case ArrowNodeTag__Date:
+			name = (type->Date.unit == ArrowDateUnit__Day ? "Date[day]" : "Date[ms]");
+			break;
+		case ArrowNodeTag__Time:
+			name = psprintf("Time[%s]", __summaryArrowTimeUnit(type->Time.unit));
+			break;
+		case ArrowNodeTag__Timestamp:
+			name = psprintf("Timestamp[%s%s%s]",
+							__summaryArrowTimeUnit(type->Timestamp.unit),
+							type->Timestamp.timezone ? ", " : "",
+							type->Timestamp.timezone ? type->Timestamp.timezone : "");
+			break;
+		case ArrowNodeTag__Interval:
+			name = (type->Interval.unit == ArrowIntervalUnit__Year_Month
+					? "Interval[year_month]" : "Interval[day_time]");
+			break;
+		case ArrowNodeTag__List:
+		case ArrowNodeTag__LargeList:
+			name = psprintf("%s<%s>",
+							type->tag == ArrowNodeTag__List ? "List" : "LargeList",
+							field->_num_children > 0
+							? __summaryArrowTypeName(&field->children[0]) : "?");
+			break;
+		case ArrowNodeTag__Struct:
+			name = "Struct";
+			break;
+		case ArrowNodeTag__Union:
+			name = "Union";
+			break;
+		case ArrowNodeTag__FixedSizeBinary:
+			name = psprintf("FixedSizeBinary[%d]",
+							type->FixedSizeBinary.byteWidth);
+			break;
+		case ArrowNodeTag__FixedSizeList:
+			name = psprintf("FixedSizeList[%d]",
+							type->FixedSizeList.listSize);
+			break;
+		case ArrowNodeTag__Map:
+			name = "Map";
+			break;
+		case ArrowNodeTag__LargeBinary:
+			name = "LargeBinary";
+			break;
+		case ArrowNodeTag__LargeUtf8:
+			name = "LargeUtf8";
+			break;
+		default:
+			name = "???";
+			break;
+	}
+	if (field->dictionary.tag == ArrowNodeTag__DictionaryEncoding)
+		name = psprintf("%s; dictionary", name);
+	return name;
+}
+
+static double
+__summaryRatio(uint64 raw_sz, uint64 stored_sz)
+{
+	return (stored_sz == 0 ? 1.0 : (double)raw_sz / (double)stored_sz);
+}
+
+static void
+__summaryArrowFileText(ArrowFileMap *af_map, ArrowSummaryCounter *total,
+					   const char *codec, FILE *out)
+{
+	ArrowFooter *footer = &af_map->footer;
+	ArrowField *fields = footer->schema.fields;
+	int			nfields = footer->schema._num_fields;
+	const char **typenames = palloc0(sizeof(char *) * Max(nfields, 1));
+	int			name_width = 6;		/* "column" */
+	int			type_width = 4;		/* "type" */
+	int			j;
+
+	fprintf(out, "%s: %zu bytes, %ld record batches, %d dictionary batches, codec: %s\n",
+			af_map->filename,
+			af_map->file_sz,
+			total->nbatches,
+			footer->_num_dictionaries,
+			codec);
+	fprintf(out, "rows: %ld (per batch: min %ld, avg %.1f, max %ld), body: %lu bytes\n",
+			total->nrows,
+			total->min_rows,
+			total->nbatches == 0 ? 0.0 : (double)total->nrows /
+										 (double)total->nbatches,
+			total->max_rows,
+			total->body_sz);
+	for (j=0; j < nfields; j++)
+	{
+		typenames[j] = __summaryArrowTypeName(&fields[j]);
+		name_width = Max(name_width, strlen(fields[j].name));
+		type_width = Max(type_width, strlen(typenames[j]));
+	}
+	fprintf(out, "%-*s  %-*s  %10s  %10s  %6s  %10s  %10s  %10s  %10s  %6s\n",
+			name_width, "column",
+			type_width, "type",
+			"rows", "nulls", "null%",
+			"nullmap", "values", "extra", "stored", "ratio");
+	for (j=0; j < nfields; j++)
+	{
+		ArrowSummaryColumn *column = &total->columns[j];
+		uint64		raw_sz = (column->nullmap_sz +
+							  column->values_sz +
+							  column->extra_sz);
+
+		fprintf(out, "%-*s  %-*s  %10ld  %10ld  %6.2f  %10lu  %10lu  %10lu  %10lu  %6.2f\n",
+				name_width, fields[j].name,
+				type_width, typenames[j],
+				column->nrows,
+				column->nnulls,
+				column->nrows == 0 ? 0.0 : 100.0 * (double)column->nnulls /
+											 (double)column->nrows,
+				column->nullmap_sz,
+				column->values_sz,
+				column->extra_sz,
+				column->stored_sz,
+				__summaryRatio(raw_sz, column->stored_sz));
+	}
+	pfree(typenames);
+}
+
+static void
+__summaryArrowFileJson(ArrowFileMap *af_map, ArrowSummaryCounter *total,
+					   const char *codec, FILE *out)
+{
+	ArrowFooter *footer = &af_map->footer;
+	ArrowField *fields = footer->schema.fields;
+	int			nfields = footer->schema._num_fields;
+	int			j;
+
+	fprintf(out, "{\"file\": ");
+	print_json_string(out, af_map->filename);
+	fprintf(out, ", \"file_bytes\": %zu, \"codec\": \"%s\",\n"
+			" \"record_batches\": %ld, \"dictionary_batches\": %d,"
+			" \"rows\": %ld, \"min_rows\": %ld, \"max_rows\": %ld,"
+			" \"body_bytes\": %lu,\n"
+			" \"columns\": [",
+			af_map->file_sz,
+			codec,
+			total->nbatches,
+			footer->_num_dictionaries,
+			total->nrows,
+			total->min_rows,
+			total->max_rows,
+			total->body_sz);
+	for (j=0; j < nfields; j++)
+	{
+		ArrowSummaryColumn *column = &total->columns[j];
+		uint64		raw_sz = (column->nullmap_sz +
+							  column->values_sz +
+							  column->extra_sz);
+		const char *type_name = __summaryArrowTypeName(&fields[j]);
+
+		fprintf(out, "%s\n  {\"name\": ", j > 0 ? "," : "");
+		print_json_string(out, fields[j].name);
+		fprintf(out, ", \"type\": ");
+		print_json_string(out, type_name);
+		fprintf(out, ", \"rows\": %ld, \"nulls\": %ld, \"null_fraction\": %.6f,"
+				" \"nullmap_bytes\": %lu, \"values_bytes\": %lu,"
+				" \"extra_bytes\": %lu, \"stored_bytes\": %lu,"
+				" \"compression_ratio\": %.4f}",
+				column->nrows,
+				column->nnulls,
+				column->nrows == 0 ? 0.0 : (double)column->nnulls /
+										   (double)column->nrows,
+				column->nullmap_sz,
+				column->values_sz,
+				column->extra_sz,
+				column->stored_sz,
+				__summaryRatio(raw_sz, column->stored_sz));
+	}
+	fprintf(out, "]}\n");
+}
+
+/*
+ * summaryArrowFile - prints the per-column aggregates of the record batches
+ * in the arrow file, by the STATS_FORMAT__* format; it returns the number
+ * of the record batches that could not be read.
+ */
+int
+summaryArrowFile(const char *pathname, int format)
+{
+	ArrowFileMap af_map;
+	ArrowFooter *footer;
+	ArrowSummaryState state;
+	ArrowSummaryWorker workers[SUMMARY_MAX_THREADS];
+	ArrowSummaryCounter total;
+	pthread_t	threads[SUMMARY_MAX_THREADS];
+	const char *codec = "none";
+	int			nfields;
+	int			nthreads;
+	int			nerrors = 0;
+	long		ncpus;
+	int			i;
+
+	openArrowFileMap(pathname, &af_map);
+	footer = &af_map.footer;
+	nfields = footer->schema._num_fields;
+	memset(&state, 0, sizeof(ArrowSummaryState));
+	state.af_map = &af_map;
+	state.errors = palloc0(sizeof(const char *) *
+						   Max(footer->_num_recordBatches, 1));
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = Min(Max(ncpus, 1), SUMMARY_MAX_THREADS);
+	nthreads = Max(Min(nthreads, footer->_num_recordBatches), 1);
+	memset(workers, 0, sizeof(ArrowSummaryWorker) * nthreads);
+	for (i=0; i < nthreads; i++)
+	{
+		workers[i].state = &state;
+		workers[i].counter.columns = palloc0(sizeof(ArrowSummaryColumn) *
+											 Max(nfields, 1));
+	}
+	for (i=1; i < nthreads; i++)
+	{
+		if ((errno = pthread_create(&threads[i], NULL,
+									__summaryArrowWorker, &workers[i])) != 0)
+			Elog("failed on pthread_create: %m");
+	}
+	__summaryArrowWorker(&workers[0]);
+	for (i=1; i < nthreads; i++)
+	{
+		if ((errno = pthread_join(threads[i], NULL)) != 0)
+			Elog("failed on pthread_join: %m");
+	}
+
+	/* merge the counters of the workers */
+	memset(&total, 0, sizeof(ArrowSummaryCounter));
+	total.columns = palloc0(sizeof(ArrowSummaryColumn) * Max(nfields, 1));
+	for (i=0; i < nthreads; i++)
+	{
+		__summaryArrowCounterMerge(&total, &workers[i].counter, nfields);
+		pfree(workers[i].counter.columns);
+	}
+	for (i=0; i < footer->_num_recordBatches; i++)
+	{
+		if (state.errors[i])
+		{
+			fprintf(stderr, "%s: record batch %d: %s\n",
+					pathname, i, state.errors[i]);
+			nerrors++;
+		}
+	}
+
+	/* the codec of the first record batch, if compressed */
+	if (footer->_num_recordBatches > 0)
+	{
+		ArrowMessage message;
+
+		if (!readArrowBlockView(&af_map, &footer->recordBatches[0],
+								&message, NULL) &&
+			message.body.tag == ArrowNodeTag__RecordBatch)
+		{
+			ArrowRecordBatch *rbatch = &message.body.recordBatch;
+
+			if (rbatch->compression.tag == ArrowNodeTag__BodyCompression)
+				codec = (rbatch->compression.codec ==
+						 ArrowCompressionType__LZ4_FRAME ? "lz4" :
+						 rbatch->compression.codec ==
+						 ArrowCompressionType__ZSTD ? "zstd" : "unknown");
+			if (rbatch->nodes)
+				pfree(rbatch->nodes);
+			if (rbatch->buffers)
+				pfree(rbatch->buffers);
+		}
+	}
+
+	if (format == STATS_FORMAT__JSON)
+		__summaryArrowFileJson(&af_map, &total, codec, stdout);
+	else
+		__summaryArrowFileText(&af_map, &total, codec, stdout);
+	pfree(total.columns);
+	pfree(state.errors);
+	closeArrowFileMap(&af_map);
+
+	return nerrors;
 }
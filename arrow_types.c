@@ -137,74 +137,183 @@ put_inline_64b_value(SQLattribute *attr,
 #define DIV_GUARD_DIGITS	4
 typedef int16				NumericDigit;
 
+static const uint64 __pow10_u64[] = {
+	1UL,
+	10UL,
+	100UL,
+	1000UL,
+	10000UL,
+	100000UL,
+	1000000UL,
+	10000000UL,
+	100000000UL,
+	1000000000UL,
+	10000000000UL,
+	100000000000UL,
+	1000000000000UL,
+	10000000000000UL,
+	100000000000000UL,
+	1000000000000000UL,
+	10000000000000000UL,
+	100000000000000000UL,
+	1000000000000000000UL,
+	10000000000000000000UL,
+};
+
+/*
+ * limbs = limbs * mul + add, in little endian 64bit words; it returns true
+ * if the result overflows.
+ */
+static inline bool
+__decimal_mul_add(uint64 *limbs, int nlimbs, uint64 mul, uint64 add)
+{
+	uint128		carry = add;
+	int			i;
+
+	for (i=0; i < nlimbs; i++)
+	{
+		uint128	temp = (uint128)limbs[i] * (uint128)mul + carry;
+
+		limbs[i] = (uint64)temp;
+		carry = (temp >> 64);
+	}
+	return (carry != 0);
+}
+
+/*
+ * __numeric_to_decimal - converts the binary form of Numeric to the integer
+ * in 10^-scale unit, as two's complement of 'nlimbs' 64bit words; 2 for
+ * Decimal128, or 4 for Decimal256. Digits under the scale are truncated.
+ * It returns false for NaN (and Infinity), that Decimal cannot map, and
+ * raises an error if the value has more digits than 'nlimbs' can hold.
+ *
+ * NBASE digits are combined in 64bit integer up to 19 decimal digits, then
+ * carried to the wider integer. So, values with 19 digits or less (in the
+ * unit of the scale) need no wide arithmetic at all.
+ */
+static inline bool
+__numeric_to_decimal(const char *addr, int sz, int ascale,
+					 uint64 *limbs, int nlimbs)
+{
+	const int16 *rawdata = (const int16 *)addr;
+	int			ndigits	= (int16)ntohs(rawdata[0]);
+	int			weight	= (int16)ntohs(rawdata[1]);
+	int			sign	= (uint16)ntohs(rawdata[2]);
+	const NumericDigit *digits = rawdata + 4;
+	int			nfrac	= (ascale + DEC_DIGITS - 1) / DEC_DIGITS;
+	int			excess	= nfrac * DEC_DIGITS - ascale;
+	int			ntotal	= weight + 1 + nfrac;	/* # of NBASE digits to use */
+	int			nzeros	= 0;
+	uint64		chunk = 0;
+	int			cdigits = 0;
+	bool		wide = false;
+	bool		overflow = false;
+	int			i;
+
+	if ((sign & NUMERIC_SIGN_MASK) == NUMERIC_NAN)
+		return false;
+	memset(limbs, 0, sizeof(uint64) * nlimbs);
+	if (ntotal <= 0)
+		return true;	/* less than the unit of the scale */
+	/* trailing zero digits are omitted in the binary form */
+	if (ndigits < ntotal)
+		nzeros = (ntotal - ndigits) * DEC_DIGITS - excess;
+	else
+		ndigits = ntotal;
+	for (i=0; i < ndigits; i++)
+	{
+		uint32	dig = (uint16)ntohs(digits[i]);
+
+		if (dig >= NBASE)
+			Elog("Numeric digit is out of range: %d", (int)(int16)dig);
+		if (i == ntotal - 1 && excess > 0)
+		{
+			chunk = chunk * __pow10_u64[DEC_DIGITS - excess]
+				+ dig / __pow10_u64[excess];
+			cdigits += DEC_DIGITS - excess;
+		}
+		else
+		{
+			chunk = chunk * NBASE + dig;
+			cdigits += DEC_DIGITS;
+		}
+		if (cdigits > 19 - DEC_DIGITS)
+		{
+			overflow |= __decimal_mul_add(limbs, nlimbs,
+										  __pow10_u64[cdigits], chunk);
+			chunk = 0;
+			cdigits = 0;
+			wide = true;
+		}
+	}
+
+	if (!wide && cdigits + nzeros <= 19)
+	{
+		/* short cut for the common case */
+		limbs[0] = chunk * __pow10_u64[nzeros];
+	}
+	else
+	{
+		overflow |= __decimal_mul_add(limbs, nlimbs,
+									  __pow10_u64[cdigits], chunk);
+		while (nzeros > 0)
+		{
+			int		n = Min(nzeros, 19);
+
+			overflow |= __decimal_mul_add(limbs, nlimbs, __pow10_u64[n], 0);
+			nzeros -= n;
+		}
+	}
+	/* the magnitude must be in the positive range of two's complement */
+	if (overflow || (limbs[nlimbs-1] >> 63) != 0)
+	{
+		if (nlimbs < 4)
+			Elog("Numeric value has too many digits for Decimal128 (see --decimal256)");
+		Elog("Numeric value has too many digits for Decimal256");
+	}
+
+	/* is it a negative value? */
+	if ((sign & NUMERIC_NEG) != 0)
+	{
+		uint64	carry = 1;
+
+		for (i=0; i < nlimbs; i++)
+		{
+			limbs[i] = ~limbs[i] + carry;
+			carry = (carry && limbs[i] == 0);
+		}
+	}
+	return true;
+}
+
 static void
 put_decimal_value(SQLattribute *attr,
 				  const char *addr, int sz)
 {
 	size_t		row_index = attr->nitems++;
+	int			bitWidth = attr->arrow_type.Decimal.bitWidth;
+	uint64		limbs[4];
+
+	if (addr && !__numeric_to_decimal(addr, sz,
+									  attr->arrow_type.Decimal.scale,
+									  limbs, bitWidth / 64))
+	{
+		if (!numeric_nan_as_null)
+			Elog("Decimal%d cannot map NaN or Infinity in PostgreSQL Numeric (see --numeric-nan-as-null)",
+				 bitWidth);
+		addr = NULL;
+	}
 
 	if (!addr)
 	{
 		attr->nullcount++;
 		sql_buffer_clrbit(&attr->nullmap, row_index);
-        sql_buffer_append_zero(&attr->values, sizeof(int128));
+		sql_buffer_append_zero(&attr->values, bitWidth / 8);
 	}
 	else
 	{
-		struct {
-			int16		ndigits;
-			int16		weight;		/* weight of first digit */
-			int16		sign;		/* NUMERIC_(POS|NEG|NAN) */
-			int16		dscale;		/* display scale */
-			NumericDigit digits[FLEXIBLE_ARRAY_MEMBER];
-		}	   *rawdata = (void *)addr;
-		int		ndigits	= ntohs(rawdata->ndigits);
-		int		weight	= ntohs(rawdata->weight);
-		int		sign	= ntohs(rawdata->sign);
-		//int	dscale	= ntohs(rawdata->dscale);
-		//int	precision = attr->arrow_type.Decimal.precision;
-		int		ascale	= attr->arrow_type.Decimal.scale;
-		int128	value = 0;
-		int		d, dig;
-
-		if ((sign & NUMERIC_SIGN_MASK) == NUMERIC_NAN)
-			Elog("Decimal128 cannot map NaN in PostgreSQL Numeric");
-
-		/* makes integer portion first */
-		for (d=0; d <= weight; d++)
-		{
-			dig = (d < ndigits) ? ntohs(rawdata->digits[d]) : 0;
-			if (dig < 0 || dig >= NBASE)
-				Elog("Numeric digit is out of range: %d", (int)dig);
-			value = NBASE * value + (int128)dig;
-		}
-
-		/* makes floating point portion if any */
-		while (ascale > 0)
-		{
-			dig = (d >= 0 && d < ndigits) ? ntohs(rawdata->digits[d]) : 0;
-			if (dig < 0 || dig >= NBASE)
-				Elog("Numeric digit is out of range: %d", (int)dig);
-
-			if (ascale >= DEC_DIGITS)
-				value = NBASE * value + dig;
-			else if (ascale == 3)
-				value = 1000L * value + dig / 10L;
-			else if (ascale == 2)
-				value =  100L * value + dig / 100L;
-			else if (ascale == 1)
-				value =   10L * value + dig / 1000L;
-			else
-				Elog("internal bug");
-			ascale -= DEC_DIGITS;
-			d++;
-		}
-		/* is it a negative value? */
-		if ((sign & NUMERIC_NEG) != 0)
-			value = -value;
-
 		sql_buffer_setbit(&attr->nullmap, row_index);
-		sql_buffer_append(&attr->values, &value, sizeof(value));
+		sql_buffer_append(&attr->values, limbs, bitWidth / 8);
 	}
 }
 #endif
@@ -262,6 +371,33 @@ put_timestamp_value(SQLattribute *attr,
 	}
 }
 
+/*
+ * __put_offset_value - appends an offset of the variable length values;
+ * 64bit for LargeUtf8, LargeBinary and LargeList, or 32bit elsewhere.
+ */
+static inline void
+__put_offset_value(SQLattribute *attr, size_t offset)
+{
+	if (attr->arrow_type.tag == ArrowNodeTag__LargeUtf8 ||
+		attr->arrow_type.tag == ArrowNodeTag__LargeBinary ||
+		attr->arrow_type.tag == ArrowNodeTag__LargeList)
+	{
+		int64		value = offset;
+
+		sql_buffer_append(&attr->values, &value, sizeof(int64));
+	}
+	else
+	{
+		int32		value = offset;
+
+		if (offset > PG_INT32_MAX)
+			Elog("offset of column '%s' exceeds 32bit range; "
+				 "use smaller --segment-size or --large-offset",
+				 attr->attname);
+		sql_buffer_append(&attr->values, &value, sizeof(int32));
+	}
+}
+
 static void
 put_variable_value(SQLattribute *attr,
 				   const char *addr, int sz)
@@ -269,21 +405,43 @@ put_variable_value(SQLattribute *attr,
 	size_t		row_index = attr->nitems++;
 
 	if (row_index == 0)
-		sql_buffer_append_zero(&attr->values, sizeof(uint32));
+		__put_offset_value(attr, 0);
 	if (!addr)
 	{
 		attr->nullcount++;
 		sql_buffer_clrbit(&attr->nullmap, row_index);
-		sql_buffer_append(&attr->values, &attr->extra.usage, sizeof(uint32));
+		__put_offset_value(attr, attr->extra.usage);
 	}
 	else
 	{
 		sql_buffer_setbit(&attr->nullmap, row_index);
 		sql_buffer_append(&attr->extra, addr, sz);
-		sql_buffer_append(&attr->values, &attr->extra.usage, sizeof(uint32));
+		__put_offset_value(attr, attr->extra.usage);
 	}
 }
 
+/*
+ * __bpchar_trim_len - length of bpchar without the padding spaces.
+ * It compares 8 bytes at once while the tail is filled with spaces,
+ * in the source buffer as is.
+ */
+static inline int
+__bpchar_trim_len(const char *addr, int sz)
+{
+	uint64		word;
+
+	while (sz >= sizeof(uint64))
+	{
+		memcpy(&word, addr + sz - sizeof(uint64), sizeof(uint64));
+		if (word != 0x2020202020202020UL)
+			break;
+		sz -= sizeof(uint64);
+	}
+	while (sz > 0 && addr[sz-1] == ' ')
+		sz--;
+	return sz;
+}
+
 static void
 put_bpchar_value(SQLattribute *attr,
 				 const char *addr, int sz)
@@ -291,24 +449,19 @@ put_bpchar_value(SQLattribute *attr,
 	size_t		row_index = attr->nitems++;
 
 	if (row_index == 0)
-		sql_buffer_append_zero(&attr->values, sizeof(uint32));
+		__put_offset_value(attr, 0);
 	if (!addr)
 	{
 		attr->nullcount++;
 		sql_buffer_clrbit(&attr->nullmap, row_index);
-		sql_buffer_append(&attr->values, &attr->extra.usage, sizeof(uint32));
+		__put_offset_value(attr, attr->extra.usage);
 	}
 	else
 	{
-		char   *temp = alloca(sz+1);
-
-		/* trim spaces in the tail */
-		memcpy(temp, addr, sz);
-		while (sz > 0 && temp[sz-1]==' ')
-			sz--;
+		sz = __bpchar_trim_len(addr, sz);
 		sql_buffer_setbit(&attr->nullmap, row_index);
 		sql_buffer_append(&attr->extra, addr, sz);
-		sql_buffer_append(&attr->values, &attr->extra.usage, sizeof(uint32));
+		__put_offset_value(attr, attr->extra.usage);
 	}
 }
 
@@ -320,12 +473,12 @@ put_array_value(SQLattribute *attr,
 	size_t		row_index = attr->nitems++;
 
 	if (row_index == 0)
-		sql_buffer_append_zero(&attr->values, sizeof(uint32));
+		__put_offset_value(attr, 0);
 	if (!addr)
 	{
 		attr->nullcount++;
 		sql_buffer_clrbit(&attr->nullmap, row_index);
-		sql_buffer_append(&attr->values, &element->nitems, sizeof(int32));
+		__put_offset_value(attr, element->nitems);
 	}
 	else
 	{
@@ -374,7 +527,7 @@ put_array_value(SQLattribute *attr,
 			}
 		}
 		sql_buffer_setbit(&attr->nullmap, row_index);
-		sql_buffer_append(&attr->values, &element->nitems, sizeof(int32));
+		__put_offset_value(attr, element->nitems);
 	}
 }
 
@@ -446,6 +599,35 @@ put_composite_value(SQLattribute *attr,
 	}
 }
 
+/*
+ * Dictionary lookup of the enum and text labels
+ *
+ * Runs of the identical labels are common in the real data, so the last
+ * label of the column is memorized, and checked prior to the hash table.
+ * The memo refers the label in the dictionary, which is never released.
+ */
+static inline bool
+__lookup_dictionary_memo(SQLattribute *attr, const char *addr, int sz,
+						 uint32 *p_index)
+{
+	if (attr->dict_memo_label &&
+		attr->dict_memo_len == sz &&
+		memcmp(attr->dict_memo_label, addr, sz) == 0)
+	{
+		*p_index = attr->dict_memo_index;
+		return true;
+	}
+	return false;
+}
+
+static inline void
+__update_dictionary_memo(SQLattribute *attr, SQLdictSlot *slot)
+{
+	attr->dict_memo_label = slot->label;
+	attr->dict_memo_len = slot->label_len;
+	attr->dict_memo_index = slot->index;
+}
+
 static void
 put_dictionary_value(SQLattribute *attr,
 					 const char *addr, int sz)
@@ -460,25 +642,85 @@ put_dictionary_value(SQLattribute *attr,
 	}
 	else
 	{
-		SQLdictionary *enumdict = attr->enumdict;
-		hashItem   *hitem;
-		uint32		hash;
+		uint32		index;
 
-		hash = hash_any((const unsigned char *)addr, sz);
-		for (hitem = enumdict->hslots[hash % enumdict->nslots];
-			 hitem != NULL;
-			 hitem = hitem->next)
+		if (!__lookup_dictionary_memo(attr, addr, sz, &index))
 		{
-			if (hitem->hash == hash &&
-				hitem->label_len == sz &&
-				memcmp(hitem->label, addr, sz) == 0)
-				break;
+			SQLdictionary *enumdict = attr->enumdict;
+			SQLdictSlot *slot;
+
+			slot = sql_dictionary_lookup(enumdict,
+										 hash_any((const unsigned char *)addr, sz),
+										 addr, sz);
+			if (!slot)
+				Elog("Enum label was not found in pg_enum result");
+			__update_dictionary_memo(attr, slot);
+			index = slot->index;
 		}
-		if (!hitem)
-			Elog("Enum label was not found in pg_enum result");
+		sql_buffer_setbit(&attr->nullmap, row_index);
+		sql_buffer_append(&attr->values, &index, sizeof(uint32));
+	}
+}
 
+/*
+ * put_text_dictionary_value - put handler of the text dictionary. Unknown
+ * labels are added to the dictionary under the lock, because it is shared
+ * by the parallel workers. The lookup of the known labels does not need
+ * the lock; see sql_dictionary_lookup().
+ * The first chunk of the results may not represent the rest, so the
+ * dictionary may grow over --dictionary-text=N; it keeps going with 32bit
+ * indexes, and a notice is printed once it crosses N.
+ */
+static void
+put_text_dictionary_value(SQLattribute *attr,
+						  const char *addr, int sz)
+{
+	size_t		row_index = attr->nitems++;
+
+	if (!addr)
+	{
+		attr->nullcount++;
+		sql_buffer_clrbit(&attr->nullmap, row_index);
+		sql_buffer_append_zero(&attr->values, sizeof(uint32));
+	}
+	else
+	{
+		uint32		index;
+
+		if (!__lookup_dictionary_memo(attr, addr, sz, &index))
+		{
+			SQLdictionary *dict = attr->enumdict;
+			SQLdictSlot *slot;
+			uint32		hash;
+
+			hash = hash_any((const unsigned char *)addr, sz);
+			slot = sql_dictionary_lookup(dict, hash, addr, sz);
+			if (!slot)
+			{
+				pthread_mutex_lock(&dict->lock);
+				/* someone may add the label concurrently */
+				slot = sql_dictionary_lookup(dict, hash, addr, sz);
+				if (!slot)
+				{
+					int32	offset;
+
+					if (dict->max_labels > 0 &&
+						dict->nitems == dict->max_labels)
+						fprintf(stderr, "notice: column '%s' has more than %d distinct values, but is still dictionary encoded (see --dictionary-text=N)\n",
+								attr->attname, dict->max_labels);
+					slot = pgsql_dictionary_insert(dict, hash, addr, sz,
+												   dict->nitems++);
+					sql_buffer_append(&dict->extra, addr, sz);
+					offset = dict->extra.usage;
+					sql_buffer_append(&dict->values, &offset, sizeof(int32));
+				}
+				pthread_mutex_unlock(&dict->lock);
+			}
+			__update_dictionary_memo(attr, slot);
+			index = slot->index;
+		}
 		sql_buffer_setbit(&attr->nullmap, row_index);
-        sql_buffer_append(&attr->values,  &hitem->index, sizeof(int32));
+		sql_buffer_append(&attr->values, &index, sizeof(uint32));
 	}
 }
 
@@ -546,7 +788,12 @@ buffer_usage_composite_type(SQLattribute *attr)
  * stat_update handler for each data types (optional)
  *
  * ---------------------------------------------------------------- */
-#define STAT_UPDATE_INLINE_TEMPLATE(TYPENAME,TO_DATUM)			\
+/*
+ * The stat_update handlers are called just after put_value, so they pick
+ * up the value already converted to the physical representation of Arrow
+ * (host byte order, Unix epoch), from the tail of the values buffer.
+ */
+#define STAT_UPDATE_INLINE_TEMPLATE(TYPENAME,MEMBER)				\
 	static void													\
 	stat_update_##TYPENAME##_value(SQLattribute *attr,			\
 								   const char *addr, int sz)	\
@@ -555,30 +802,550 @@ buffer_usage_composite_type(SQLattribute *attr)
 																\
 		if (!addr)												\
 			return;												\
-		value = *((const TYPENAME *)addr);						\
+		assert(attr->values.usage >= sizeof(TYPENAME));			\
+		memcpy(&value, attr->values.ptr +						\
+			   attr->values.usage - sizeof(TYPENAME),			\
+			   sizeof(TYPENAME));								\
 		if (attr->min_isnull)									\
 		{														\
 			attr->min_isnull = false;							\
-			attr->min_value  = TO_DATUM(value);					\
+			attr->min_value.MEMBER = value;						\
 		}														\
-		else if (value < attr->min_value)						\
-			attr->min_value = value;							\
+		else if (value < attr->min_value.MEMBER)				\
+			attr->min_value.MEMBER = value;						\
 																\
 		if (attr->max_isnull)									\
 		{														\
 			attr->max_isnull = false;							\
-			attr->max_value  = TO_DATUM(value);					\
+			attr->max_value.MEMBER = value;						\
 		}														\
-		else if (value > attr->max_value)						\
-			attr->max_value = value;							\
+		else if (value > attr->max_value.MEMBER)				\
+			attr->max_value.MEMBER = value;						\
+	}
+
+STAT_UPDATE_INLINE_TEMPLATE(int8,   i8)
+STAT_UPDATE_INLINE_TEMPLATE(int16,  i16)
+STAT_UPDATE_INLINE_TEMPLATE(int32,  i32)
+STAT_UPDATE_INLINE_TEMPLATE(int64,  i64)
+STAT_UPDATE_INLINE_TEMPLATE(float4, f32)
+STAT_UPDATE_INLINE_TEMPLATE(float8, f64)
+#ifdef PG_INT128_TYPE
+STAT_UPDATE_INLINE_TEMPLATE(int128, i128)
+#endif
+
+/* Bool is packed to bitmap, so it looks at the source */
+static void
+stat_update_bool_value(SQLattribute *attr,
+					   const char *addr, int sz)
+{
+	int8		value;
+
+	if (!addr)
+		return;
+	value = (*addr != 0);
+	if (attr->min_isnull || value < attr->min_value.i8)
+	{
+		attr->min_isnull = false;
+		attr->min_value.i8 = value;
+	}
+	if (attr->max_isnull || value > attr->max_value.i8)
+	{
+		attr->max_isnull = false;
+		attr->max_value.i8 = value;
+	}
+}
+
+#ifdef PG_INT128_TYPE
+/* NaN may be written as null, so it checks the nullmap of the last row */
+static void
+stat_update_decimal_value(SQLattribute *attr,
+						  const char *addr, int sz)
+{
+	size_t		row_index = attr->nitems - 1;
+
+	if (addr && (((uint8 *)attr->nullmap.ptr)[row_index>>3] &
+				 (1 << (row_index & 7))) == 0)
+		return;
+	stat_update_int128_value(attr, addr, sz);
+}
+#endif
+
+/* ----------------------------------------------------------------
+ *
+ * stat_format handler for each data types (optional)
+ *
+ * It returns cstring of the statistics, written to custom_metadata.
+ *
+ * ---------------------------------------------------------------- */
+#define STAT_FORMAT_INLINE_TEMPLATE(TYPENAME,MEMBER,FORMAT)		\
+	static char *												\
+	stat_format_##TYPENAME##_value(SQLstat *stat)				\
+	{															\
+		return psprintf(FORMAT, stat->MEMBER);					\
 	}
 
-STAT_UPDATE_INLINE_TEMPLATE(int8,   Int8GetDatum)
-STAT_UPDATE_INLINE_TEMPLATE(int16,  Int16GetDatum)
-STAT_UPDATE_INLINE_TEMPLATE(int32,  Int32GetDatum)
-STAT_UPDATE_INLINE_TEMPLATE(int64,  Int64GetDatum)
-STAT_UPDATE_INLINE_TEMPLATE(float4, Float4GetDatum)
-STAT_UPDATE_INLINE_TEMPLATE(float8, Float8GetDatum)
+STAT_FORMAT_INLINE_TEMPLATE(int8,   i8,  "%d")
+STAT_FORMAT_INLINE_TEMPLATE(int16,  i16, "%d")
+STAT_FORMAT_INLINE_TEMPLATE(int32,  i32, "%d")
+STAT_FORMAT_INLINE_TEMPLATE(int64,  i64, "%ld")
+STAT_FORMAT_INLINE_TEMPLATE(float4, f32, "%.9g")
+STAT_FORMAT_INLINE_TEMPLATE(float8, f64, "%.17g")
+
+#ifdef PG_INT128_TYPE
+/* printf(3) has no format for int128 */
+static char *
+stat_format_int128_value(SQLstat *stat)
+{
+	uint128		uval = (stat->i128 < 0 ? -(uint128)stat->i128 : stat->i128);
+	char		temp[64];
+	char	   *pos = temp + sizeof(temp);
+
+	*--pos = '\0';
+	do {
+		*--pos = '0' + (uval % 10);
+		uval /= 10;
+	} while (uval > 0);
+	if (stat->i128 < 0)
+		*--pos = '-';
+	return pstrdup(pos);
+}
+#endif
+
+/* ----------------------------------------------------------------
+ *
+ * put_values handler for each data types (optional)
+ *
+ * It decodes a slice of the column at once, instead of put_value and
+ * stat_update for each cell. Buffers are expanded only once per slice,
+ * and the null bitmap is built by 64bit words.
+ *
+ * ---------------------------------------------------------------- */
+static inline uint64 *
+__put_values_expand(SQLattribute *attr, size_t nrows, size_t unitsz)
+{
+	size_t		nwords = (attr->nitems + nrows + 63) / 64;
+
+	sql_buffer_expand(&attr->values, attr->values.usage + nrows * unitsz);
+	sql_buffer_expand(&attr->nullmap, sizeof(uint64) * nwords);
+
+	return (uint64 *)attr->nullmap.ptr;
+}
+
+static inline void
+__put_values_nullbits(uint64 *nullmap, size_t row_index, uint64 nullbits)
+{
+	size_t		shift = row_index & 63;
+	uint64		mask = (shift == 0 ? 0UL : (~0UL >> (64 - shift)));
+
+	/* preserve the bits of rows already in the buffer */
+	nullmap[row_index >> 6] = (nullmap[row_index >> 6] & mask) | nullbits;
+}
+
+#define PUT_VALUES_INLINE_TEMPLATE(NAME,BITS,TYPENAME,ADJUST,MEMBER)		\
+	static void																\
+	put_##NAME##_values(SQLattribute *attr, PGresult *res,					\
+						int column, int row_begin, int row_end)				\
+	{																		\
+		size_t		row_index = attr->nitems;								\
+		size_t		row_head = row_index;									\
+		uint64	   *nullmap;												\
+		uint64		nullbits = 0;											\
+		uint##BITS *values;													\
+		TYPENAME	min_value = 0;											\
+		TYPENAME	max_value = 0;											\
+		bool		stat_valid = !attr->min_isnull;							\
+		int			i;														\
+																			\
+		nullmap = __put_values_expand(attr, row_end - row_begin,			\
+									  sizeof(uint##BITS));					\
+		values = (uint##BITS *)(attr->values.ptr + attr->values.usage);		\
+		if (stat_valid)														\
+		{																	\
+			min_value = attr->min_value.MEMBER;								\
+			max_value = attr->max_value.MEMBER;								\
+		}																	\
+		for (i=row_begin; i < row_end; i++, row_index++)					\
+		{																	\
+			if (PQgetisnull(res, i, column))								\
+			{																\
+				attr->nullcount++;											\
+				*values++ = 0;												\
+			}																\
+			else															\
+			{																\
+				uint##BITS	bits;											\
+				TYPENAME	value;											\
+																			\
+				assert(PQgetlength(res, i, column) == sizeof(uint##BITS));	\
+				memcpy(&bits, PQgetvalue(res, i, column), sizeof(bits));	\
+				bits = __builtin_bswap##BITS(bits) + (ADJUST);				\
+				*values++ = bits;											\
+				nullbits |= (1UL << (row_index & 63));						\
+																			\
+				memcpy(&value, &bits, sizeof(value));						\
+				if (!stat_valid)											\
+				{															\
+					min_value = max_value = value;							\
+					stat_valid = true;										\
+				}															\
+				else if (value < min_value)									\
+					min_value = value;										\
+				else if (value > max_value)									\
+					max_value = value;										\
+			}																\
+			if ((row_index & 63) == 63)										\
+			{																\
+				__put_values_nullbits(nullmap, row_head, nullbits);			\
+				row_head = row_index + 1;									\
+				nullbits = 0;												\
+			}																\
+		}																	\
+		if (row_head < row_index)											\
+			__put_values_nullbits(nullmap, row_head, nullbits);				\
+		attr->nitems = row_index;											\
+		attr->nullmap.usage = Max(attr->nullmap.usage,						\
+								  BITMAPLEN(row_index));					\
+		attr->values.usage = (char *)values - attr->values.ptr;				\
+		if (stat_valid)														\
+		{																	\
+			attr->min_isnull = false;										\
+			attr->max_isnull = false;										\
+			attr->min_value.MEMBER = min_value;								\
+			attr->max_value.MEMBER = max_value;								\
+		}																	\
+	}
+
+PUT_VALUES_INLINE_TEMPLATE(int32, 32, int32, 0, i32)
+PUT_VALUES_INLINE_TEMPLATE(int64, 64, int64, 0, i64)
+PUT_VALUES_INLINE_TEMPLATE(float4, 32, float4, 0, f32)
+PUT_VALUES_INLINE_TEMPLATE(float8, 64, float8, 0, f64)
+PUT_VALUES_INLINE_TEMPLATE(date, 32, int32,
+						   (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE),
+						   i32)
+PUT_VALUES_INLINE_TEMPLATE(timestamp, 64, int64,
+						   (POSTGRES_EPOCH_JDATE -
+							UNIX_EPOCH_JDATE) * USECS_PER_DAY,
+						   i64)
+
+/*
+ * Variable length types reserve the index and extra buffers once per
+ * slice, according to the total length of the values, then copy the
+ * values and write the offsets in a tight loop.
+ * It is the default path of the text, varchar, bytea and bpchar columns
+ * in PGresult; the COPY stream and the nested types still go through
+ * put_value for each cell.
+ */
+static inline void
+__put_varlena_values(SQLattribute *attr, PGresult *res,
+					 int column, int row_begin, int row_end,
+					 bool trim_spaces)
+{
+	size_t		row_index = attr->nitems;
+	size_t		row_head = row_index;
+	size_t		unitsz = (use_large_offset ? sizeof(int64) : sizeof(int32));
+	size_t		total_sz = 0;
+	size_t		offset;
+	uint64	   *nullmap;
+	uint64		nullbits = 0;
+	char	   *values;
+	char	   *extra;
+	int			i;
+
+	/* PQgetlength() returns 0 for nulls */
+	for (i=row_begin; i < row_end; i++)
+		total_sz += PQgetlength(res, i, column);
+	nullmap = __put_values_expand(attr, row_end - row_begin + 1, unitsz);
+	sql_buffer_expand(&attr->extra, attr->extra.usage + total_sz);
+	values = attr->values.ptr + attr->values.usage;
+	extra = attr->extra.ptr;
+	offset = attr->extra.usage;
+	if (row_index == 0)
+	{
+		memset(values, 0, unitsz);
+		values += unitsz;
+	}
+	for (i=row_begin; i < row_end; i++, row_index++)
+	{
+		if (PQgetisnull(res, i, column))
+			attr->nullcount++;
+		else
+		{
+			const char *addr = PQgetvalue(res, i, column);
+			int			sz = PQgetlength(res, i, column);
+
+			if (trim_spaces)
+				sz = __bpchar_trim_len(addr, sz);
+			memcpy(extra + offset, addr, sz);
+			offset += sz;
+			nullbits |= (1UL << (row_index & 63));
+		}
+		if (unitsz == sizeof(int64))
+			*((int64 *)values) = offset;
+		else
+			*((int32 *)values) = offset;
+		values += unitsz;
+
+		if ((row_index & 63) == 63)
+		{
+			__put_values_nullbits(nullmap, row_head, nullbits);
+			row_head = row_index + 1;
+			nullbits = 0;
+		}
+	}
+	if (unitsz == sizeof(int32) && offset > PG_INT32_MAX)
+		Elog("offset of column '%s' exceeds 32bit range; "
+			 "use smaller --segment-size or --large-offset",
+			 attr->attname);
+	if (row_head < row_index)
+		__put_values_nullbits(nullmap, row_head, nullbits);
+	attr->nitems = row_index;
+	attr->nullmap.usage = Max(attr->nullmap.usage, BITMAPLEN(row_index));
+	attr->values.usage = values - attr->values.ptr;
+	attr->extra.usage = offset;
+}
+
+static void
+put_variable_values(SQLattribute *attr, PGresult *res,
+					int column, int row_begin, int row_end)
+{
+	__put_varlena_values(attr, res, column, row_begin, row_end, false);
+}
+
+static void
+put_bpchar_values(SQLattribute *attr, PGresult *res,
+				  int column, int row_begin, int row_end)
+{
+	__put_varlena_values(attr, res, column, row_begin, row_end, true);
+}
+
+/* ----------------------------------------------------------------
+ *
+ * put_copy_row handler for the flat tables (optional)
+ *
+ * If every column of the table has a shape (SQL_SHAPE__*), a row of the
+ * COPY stream is decoded by the put_value and stat_update handlers called
+ * directly, instead of the function pointers of each cell.
+ * The signatures in SQL_ROW_SIGNATURES are expanded to the row decoders
+ * at compile time. The shapes are constants there, so __put_shape_value()
+ * is folded to the monomorphic code for each column, without branches
+ * on the data type. Other flat tables use __put_copy_row_flat(), that
+ * switches on the shape of each column at runtime.
+ * Rows of PGresult are decoded column by column by the put_values
+ * handlers, that are monomorphic per column already; so they have no row
+ * decoder.
+ *
+ * ---------------------------------------------------------------- */
+static inline __attribute__((always_inline)) size_t
+__put_shape_value(SQLattribute *attr, int shape, const char *addr, int sz)
+{
+	switch (shape)
+	{
+		case SQL_SHAPE__BOOL:
+			put_inline_bool_value(attr, addr, sz);
+			stat_update_bool_value(attr, addr, sz);
+			break;
+		case SQL_SHAPE__INT16:
+			put_inline_16b_value(attr, addr, sz);
+			stat_update_int16_value(attr, addr, sz);
+			break;
+		case SQL_SHAPE__INT32:
+			put_inline_32b_value(attr, addr, sz);
+			stat_update_int32_value(attr, addr, sz);
+			break;
+		case SQL_SHAPE__INT64:
+			put_inline_64b_value(attr, addr, sz);
+			stat_update_int64_value(attr, addr, sz);
+			break;
+		case SQL_SHAPE__FLOAT4:
+			put_inline_32b_value(attr, addr, sz);
+			stat_update_float4_value(attr, addr, sz);
+			break;
+		case SQL_SHAPE__FLOAT8:
+			put_inline_64b_value(attr, addr, sz);
+			stat_update_float8_value(attr, addr, sz);
+			break;
+		case SQL_SHAPE__DATE:
+			put_date_value(attr, addr, sz);
+			stat_update_int32_value(attr, addr, sz);
+			break;
+		case SQL_SHAPE__TIMESTAMP:
+			put_timestamp_value(attr, addr, sz);
+			stat_update_int64_value(attr, addr, sz);
+			break;
+		case SQL_SHAPE__VARLENA:
+			put_variable_value(attr, addr, sz);
+			return attr->usage_fixed + sz;
+		case SQL_SHAPE__BPCHAR:
+			put_bpchar_value(attr, addr, sz);
+			return attr->usage_fixed + sz;
+		default:
+			Elog("unexpected shape of column '%s': %d",
+				 attr->attname, shape);
+	}
+	return attr->usage_fixed;
+}
+
+static inline __attribute__((always_inline)) const char *
+__put_shape_copy_value(SQLattribute *attr, int shape,
+					   const char *pos, const char *tail, size_t *p_growth)
+{
+	const char *addr = NULL;
+	int32		sz;
+
+	if (pos + sizeof(int32) > tail)
+		Elog("binary COPY stream corruption");
+	sz = (int32)ntohl(*((const uint32 *)pos));
+	pos += sizeof(int32);
+	if (sz < 0)
+		sz = 0;
+	else
+	{
+		if (pos + sz > tail)
+			Elog("binary COPY stream corruption");
+		addr = pos;
+		pos += sz;
+	}
+	*p_growth += __put_shape_value(attr, shape, addr, sz);
+	return pos;
+}
+
+/*
+ * __put_copy_cell_stats - accounts the cell at 'head' for --stats; the time
+ * since 'tv' is added, if the row is sampled.
+ */
+static inline __attribute__((always_inline)) void
+__put_copy_cell_stats(SQLattribute *attr, const char *head,
+					  bool sampled, uint64 tv)
+{
+	int32		sz = (int32)ntohl(*((const uint32 *)head));
+
+	if (sampled)
+	{
+		attr->perf_decode_ns += perf_clock_ns(CLOCK_MONOTONIC) - tv;
+		attr->perf_nsamples++;
+	}
+	if (sz < 0)
+		attr->perf_nnulls++;
+	else
+		attr->perf_nbytes += sz;
+}
+
+/*
+ * __put_copy_row_flat - generic row decoder of the flat tables, that
+ * switches on the shape of each column at runtime.
+ */
+static const char *
+__put_copy_row_flat(SQLtable *table, const char *pos, const char *tail,
+					size_t *p_growth)
+{
+	bool		sampled = (shows_stats &&
+						   (table->nitems % PERF_SAMPLE_INTERVAL) == 0);
+	uint64		tv = 0;
+	int			j;
+
+	for (j=0; j < table->nfields; j++)
+	{
+		SQLattribute *attr = &table->attrs[j];
+		const char *head = pos;
+
+		if (sampled)
+			tv = perf_clock_ns(CLOCK_MONOTONIC);
+		pos = __put_shape_copy_value(attr, attr->shape,
+									 pos, tail, p_growth);
+		if (shows_stats)
+			__put_copy_cell_stats(attr, head, sampled, tv);
+	}
+	return pos;
+}
+
+/*
+ * SQL_ROW_SIGNATURES - signatures of the row decoders specialized at
+ * compile time, as X(NAME, SHAPE, ...) with up to 8 shapes of the columns.
+ * The list covers the tables of a single flat column, and a few layouts of
+ * a key with measures that are dumped frequently; add a line here for
+ * other ones. Tables not listed take __put_copy_row_flat().
+ */
+#define SQL_ROW_SIGNATURES(X)								\
+	X(bool,				BOOL)								\
+	X(int2,				INT16)								\
+	X(int4,				INT32)								\
+	X(int8,				INT64)								\
+	X(float4,			FLOAT4)								\
+	X(float8,			FLOAT8)								\
+	X(date,				DATE)								\
+	X(timestamp,		TIMESTAMP)							\
+	X(text,				VARLENA)							\
+	X(bpchar,			BPCHAR)								\
+	X(int4_text,		INT32, VARLENA)						\
+	X(int8_text,		INT64, VARLENA)						\
+	X(int8_timestamp_float8, INT64, TIMESTAMP, FLOAT8)		\
+	X(timestamp_int4_float8, TIMESTAMP, INT32, FLOAT8)		\
+	X(int4_int4_float8_text, INT32, INT32, FLOAT8, VARLENA)
+
+/* __ROW_FOREACH(F, a, b, ...) expands to F(0,a) F(1,b) ... */
+#define __ROW_NARGS(...)											\
+	__ROW_NARGS_(__VA_ARGS__,8,7,6,5,4,3,2,1,0)
+#define __ROW_NARGS_(_1,_2,_3,_4,_5,_6,_7,_8,N,...)		N
+#define __ROW_CONCAT(a,b)			__ROW_CONCAT_(a,b)
+#define __ROW_CONCAT_(a,b)			a##b
+#define __ROW_FOREACH(F,...)										\
+	__ROW_CONCAT(__ROW_FOREACH_,__ROW_NARGS(__VA_ARGS__))(F,__VA_ARGS__)
+#define __ROW_FOREACH_1(F,a)			F(0,a)
+#define __ROW_FOREACH_2(F,a,b)			__ROW_FOREACH_1(F,a) F(1,b)
+#define __ROW_FOREACH_3(F,a,b,c)		__ROW_FOREACH_2(F,a,b) F(2,c)
+#define __ROW_FOREACH_4(F,a,b,c,d)		__ROW_FOREACH_3(F,a,b,c) F(3,d)
+#define __ROW_FOREACH_5(F,a,b,c,d,e)	__ROW_FOREACH_4(F,a,b,c,d) F(4,e)
+#define __ROW_FOREACH_6(F,a,b,c,d,e,f)	__ROW_FOREACH_5(F,a,b,c,d,e) F(5,f)
+#define __ROW_FOREACH_7(F,a,b,c,d,e,f,g)							\
+	__ROW_FOREACH_6(F,a,b,c,d,e,f) F(6,g)
+#define __ROW_FOREACH_8(F,a,b,c,d,e,f,g,h)							\
+	__ROW_FOREACH_7(F,a,b,c,d,e,f,g) F(7,h)
+
+#define __PUT_COPY_ROW_CELL(J,SHAPE)								\
+	if (sampled)													\
+		tv = perf_clock_ns(CLOCK_MONOTONIC);						\
+	head = pos;														\
+	pos = __put_shape_copy_value(&table->attrs[J], SQL_SHAPE__##SHAPE,	\
+								 pos, tail, p_growth);				\
+	if (shows_stats)												\
+		__put_copy_cell_stats(&table->attrs[J], head, sampled, tv);
+#define __ROW_SHAPE_ITEM(J,SHAPE)		SQL_SHAPE__##SHAPE,
+
+#define PUT_COPY_ROW_SIGNATURE_TEMPLATE(NAME,...)					\
+	static const char *												\
+	put_##NAME##_copy_row(SQLtable *table, const char *pos,			\
+						  const char *tail, size_t *p_growth)		\
+	{																\
+		bool		sampled = (shows_stats &&						\
+							   (table->nitems % PERF_SAMPLE_INTERVAL) == 0); \
+		uint64		tv = 0;											\
+		const char *head;											\
+																	\
+		__ROW_FOREACH(__PUT_COPY_ROW_CELL, __VA_ARGS__)				\
+		return pos;													\
+	}																\
+	static const int shapes_##NAME##_row[] = {						\
+		__ROW_FOREACH(__ROW_SHAPE_ITEM, __VA_ARGS__)				\
+	};
+
+SQL_ROW_SIGNATURES(PUT_COPY_ROW_SIGNATURE_TEMPLATE)
+
+typedef struct
+{
+	const char *name;
+	int			nfields;
+	const int  *shapes;
+	const char *(*put_copy_row)(SQLtable *table, const char *pos,
+								const char *tail, size_t *p_growth);
+} SQLrowSignature;
+
+#define __ROW_SIGNATURE_ENTRY(NAME,...)								\
+	{ #NAME, lengthof(shapes_##NAME##_row), shapes_##NAME##_row,	\
+	  put_##NAME##_copy_row },
+
+static SQLrowSignature sql_row_signatures[] = {
+	SQL_ROW_SIGNATURES(__ROW_SIGNATURE_ENTRY)
+};
 
 /* ----------------------------------------------------------------
  *
@@ -687,72 +1454,56 @@ setup_buffer_composite_type(SQLattribute *attr,
  * ----------------------------------------------------------------
  */
 static void
-write_buffer_inline_type(SQLattribute *attr, int fdesc)
+write_buffer_inline_type(SQLattribute *attr, SQLiovec *iov)
 {
 	/* nullmap */
-	if (attr->nullcount > 0)
-		__write_buffer_common(fdesc,
-							  attr->nullmap.ptr,
-							  attr->nullmap.usage);
+	sql_iovec_append(iov, attr->nullmap.ptr,
+					 attr->nullcount > 0 ? attr->nullmap.usage : 0);
 	/* fixed length values */
-	__write_buffer_common(fdesc,
-						  attr->values.ptr,
-						  attr->values.usage);
+	sql_iovec_append(iov, attr->values.ptr, attr->values.usage);
 }
 
 static void
-write_buffer_varlena_type(SQLattribute *attr, int fdesc)
+write_buffer_varlena_type(SQLattribute *attr, SQLiovec *iov)
 {
 	/* nullmap */
-	if (attr->nullcount > 0)
-		__write_buffer_common(fdesc,
-							  attr->nullmap.ptr,
-							  attr->nullmap.usage);
+	sql_iovec_append(iov, attr->nullmap.ptr,
+					 attr->nullcount > 0 ? attr->nullmap.usage : 0);
 	/* index values */
-	__write_buffer_common(fdesc,
-						  attr->values.ptr,
-						  attr->values.usage);
+	sql_iovec_append(iov, attr->values.ptr, attr->values.usage);
 	/* extra buffer */
-	__write_buffer_common(fdesc,
-						  attr->extra.ptr,
-						  attr->extra.usage);
+	sql_iovec_append(iov, attr->extra.ptr, attr->extra.usage);
 }
 
 static void
-write_buffer_array_type(SQLattribute *attr, int fdesc)
+write_buffer_array_type(SQLattribute *attr, SQLiovec *iov)
 {
 	SQLattribute *element = attr->element;
 
 	/* nullmap */
-	if (attr->nullcount > 0)
-		__write_buffer_common(fdesc,
-							  attr->nullmap.ptr,
-							  attr->nullmap.usage);
+	sql_iovec_append(iov, attr->nullmap.ptr,
+					 attr->nullcount > 0 ? attr->nullmap.usage : 0);
 	/* offset values */
-	__write_buffer_common(fdesc,
-						  attr->values.ptr,
-						  attr->values.usage);
+	sql_iovec_append(iov, attr->values.ptr, attr->values.usage);
 	/* element values */
-	element->write_buffer(element, fdesc);
+	element->write_buffer(element, iov);
 }
 
 static void
-write_buffer_composite_type(SQLattribute *attr, int fdesc)
+write_buffer_composite_type(SQLattribute *attr, SQLiovec *iov)
 {
 	SQLtable   *subtypes = attr->subtypes;
 	int			i;
 
 	/* nullmap */
-	if (attr->nullcount > 0)
-		__write_buffer_common(fdesc,
-							  attr->nullmap.ptr,
-							  attr->nullmap.usage);
+	sql_iovec_append(iov, attr->nullmap.ptr,
+					 attr->nullcount > 0 ? attr->nullmap.usage : 0);
 	/* sub-types */
 	for (i=0; i < subtypes->nfields; i++)
 	{
 		SQLattribute   *subattr = &subtypes->attrs[i];
 
-		subattr->write_buffer(subattr, fdesc);
+		subattr->write_buffer(subattr, iov);
 	}
 }
 
@@ -774,30 +1525,49 @@ assignArrowTypeInt(SQLattribute *attr, int *p_numBuffers, bool is_signed)
 			attr->arrow_typename = (is_signed ? "Int8" : "Uint8");
 			attr->put_value = put_inline_8b_value;
 			attr->stat_update = stat_update_int8_value;
+			attr->stat_format = stat_format_int8_value;
 			break;
 		case sizeof(short):
 			attr->arrow_type.Int.bitWidth = 16;
 			attr->arrow_typename = (is_signed ? "Int16" : "Uint16");
 			attr->put_value = put_inline_16b_value;
 			attr->stat_update = stat_update_int16_value;
+			attr->stat_format = stat_format_int16_value;
 			break;
 		case sizeof(int):
 			attr->arrow_type.Int.bitWidth = 32;
 			attr->arrow_typename = (is_signed ? "Int32" : "Uint32");
 			attr->put_value = put_inline_32b_value;
+			attr->put_values = put_int32_values;
 			attr->stat_update = stat_update_int32_value;
+			attr->stat_format = stat_format_int32_value;
 			break;
 		case sizeof(long):
 			attr->arrow_type.Int.bitWidth = 64;
 			attr->arrow_typename = (is_signed ? "Int64" : "Uint64");
 			attr->put_value = put_inline_64b_value;
+			attr->put_values = put_int64_values;
 			attr->stat_update = stat_update_int64_value;
+			attr->stat_format = stat_format_int64_value;
 			break;
 		default:
 			Elog("unsupported Int width: %d", attr->attlen);
 			break;
 	}
+	/* unsigned ones are raw binary of the unknown types; no statistics */
+	if (!is_signed)
+	{
+		attr->stat_update = NULL;
+		attr->stat_format = NULL;
+	}
+	else if (attr->attlen == sizeof(short))
+		attr->shape = SQL_SHAPE__INT16;
+	else if (attr->attlen == sizeof(int))
+		attr->shape = SQL_SHAPE__INT32;
+	else if (attr->attlen == sizeof(long))
+		attr->shape = SQL_SHAPE__INT64;
 	attr->buffer_usage = buffer_usage_inline_type;
+	attr->usage_fixed = 1 + attr->attlen;	/* nullmap + values */
 	attr->setup_buffer = setup_buffer_inline_type;
 	attr->write_buffer = write_buffer_inline_type;
 
@@ -819,19 +1589,26 @@ assignArrowTypeFloatingPoint(SQLattribute *attr, int *p_numBuffers)
 			attr->arrow_type.FloatingPoint.precision = ArrowPrecision__Single;
 			attr->arrow_typename = "Float32";
 			attr->put_value = put_inline_32b_value;
+			attr->put_values = put_float4_values;
 			attr->stat_update = stat_update_float4_value;
+			attr->stat_format = stat_format_float4_value;
+			attr->shape = SQL_SHAPE__FLOAT4;
 			break;
 		case sizeof(double):
 			attr->arrow_type.FloatingPoint.precision = ArrowPrecision__Double;
 			attr->arrow_typename = "Float64";
 			attr->put_value = put_inline_64b_value;
+			attr->put_values = put_float8_values;
 			attr->stat_update = stat_update_float8_value;
+			attr->stat_format = stat_format_float8_value;
+			attr->shape = SQL_SHAPE__FLOAT8;
 			break;
 		default:
 			Elog("unsupported floating point width: %d", attr->attlen);
 			break;
 	}
 	attr->buffer_usage = buffer_usage_inline_type;
+	attr->usage_fixed = 1 + attr->attlen;	/* nullmap + values */
 	attr->setup_buffer = setup_buffer_inline_type;
 	attr->write_buffer = write_buffer_inline_type;
 
@@ -841,10 +1618,22 @@ assignArrowTypeFloatingPoint(SQLattribute *attr, int *p_numBuffers)
 static void
 assignArrowTypeBinary(SQLattribute *attr, int *p_numBuffers)
 {
-	attr->arrow_type.tag	= ArrowNodeTag__Binary;
-	attr->arrow_typename	= "Binary";
+	if (use_large_offset)
+	{
+		attr->arrow_type.tag = ArrowNodeTag__LargeBinary;
+		attr->arrow_typename = "LargeBinary";
+	}
+	else
+	{
+		attr->arrow_type.tag = ArrowNodeTag__Binary;
+		attr->arrow_typename = "Binary";
+	}
 	attr->put_value			= put_variable_value;
+	attr->put_values		= put_variable_values;
+	attr->shape				= SQL_SHAPE__VARLENA;
 	attr->buffer_usage		= buffer_usage_varlena_type;
+	attr->usage_fixed		= 1 + (use_large_offset ? sizeof(int64) : sizeof(int32));
+	attr->usage_ratio		= 1;
 	attr->setup_buffer		= setup_buffer_varlena_type;
 	attr->write_buffer		= write_buffer_varlena_type;
 
@@ -854,10 +1643,22 @@ assignArrowTypeBinary(SQLattribute *attr, int *p_numBuffers)
 static void
 assignArrowTypeUtf8(SQLattribute *attr, int *p_numBuffers)
 {
-	attr->arrow_type.tag	= ArrowNodeTag__Utf8;
-	attr->arrow_typename	= "Utf8";
+	if (use_large_offset)
+	{
+		attr->arrow_type.tag = ArrowNodeTag__LargeUtf8;
+		attr->arrow_typename = "LargeUtf8";
+	}
+	else
+	{
+		attr->arrow_type.tag = ArrowNodeTag__Utf8;
+		attr->arrow_typename = "Utf8";
+	}
 	attr->put_value			= put_variable_value;
+	attr->put_values		= put_variable_values;
+	attr->shape				= SQL_SHAPE__VARLENA;
 	attr->buffer_usage		= buffer_usage_varlena_type;
+	attr->usage_fixed		= 1 + (use_large_offset ? sizeof(int64) : sizeof(int32));
+	attr->usage_ratio		= 1;
 	attr->setup_buffer		= setup_buffer_varlena_type;
 	attr->write_buffer		= write_buffer_varlena_type;
 
@@ -867,10 +1668,22 @@ assignArrowTypeUtf8(SQLattribute *attr, int *p_numBuffers)
 static void
 assignArrowTypeBpchar(SQLattribute *attr, int *p_numBuffers)
 {
-	attr->arrow_type.tag	= ArrowNodeTag__Utf8;
-	attr->arrow_typename	= "Utf8";
+	if (use_large_offset)
+	{
+		attr->arrow_type.tag = ArrowNodeTag__LargeUtf8;
+		attr->arrow_typename = "LargeUtf8";
+	}
+	else
+	{
+		attr->arrow_type.tag = ArrowNodeTag__Utf8;
+		attr->arrow_typename = "Utf8";
+	}
 	attr->put_value			= put_bpchar_value;
+	attr->put_values		= put_bpchar_values;
+	attr->shape				= SQL_SHAPE__BPCHAR;
 	attr->buffer_usage		= buffer_usage_varlena_type;
+	attr->usage_fixed		= 1 + (use_large_offset ? sizeof(int64) : sizeof(int32));
+	attr->usage_ratio		= 1;
 	attr->setup_buffer		= setup_buffer_varlena_type;
 	attr->write_buffer		= write_buffer_varlena_type;
 
@@ -883,8 +1696,11 @@ assignArrowTypeBool(SQLattribute *attr, int *p_numBuffers)
 	attr->arrow_type.tag	= ArrowNodeTag__Bool;
 	attr->arrow_typename	= "Bool";
 	attr->put_value			= put_inline_bool_value;
-	attr->stat_update		= stat_update_int8_value;
+	attr->stat_update		= stat_update_bool_value;
+	attr->shape				= SQL_SHAPE__BOOL;
+	attr->stat_format		= stat_format_int8_value;
 	attr->buffer_usage		= buffer_usage_inline_type;
+	attr->usage_fixed		= 2;
 	attr->setup_buffer		= setup_buffer_inline_type;
 	attr->write_buffer		= write_buffer_inline_type;
 
@@ -905,12 +1721,28 @@ assignArrowTypeDecimal(SQLattribute *attr, int *p_numBuffers)
 		precision = (typmod >> 16) & 0xffff;
 		scale = (typmod & 0xffff);
 	}
+	else if (use_decimal256)
+		precision = 76;
 	memset(&attr->arrow_type, 0, sizeof(ArrowType));
 	attr->arrow_type.tag	= ArrowNodeTag__Decimal;
 	attr->arrow_type.Decimal.precision = precision;
 	attr->arrow_type.Decimal.scale = scale;
-	attr->arrow_typename	= "Decimal";
 	attr->put_value			= put_decimal_value;
+	if (!use_decimal256)
+	{
+		attr->arrow_type.Decimal.bitWidth = 128;
+		attr->arrow_typename	= "Decimal";
+		attr->stat_update		= stat_update_decimal_value;
+		attr->stat_format		= stat_format_int128_value;
+		attr->usage_fixed		= 1 + sizeof(int128);
+	}
+	else
+	{
+		/* no min/max statistics, because SQLstat has no 256bit member */
+		attr->arrow_type.Decimal.bitWidth = 256;
+		attr->arrow_typename	= "Decimal256";
+		attr->usage_fixed		= 1 + 2 * sizeof(int128);
+	}
 	attr->buffer_usage		= buffer_usage_inline_type;
 	attr->setup_buffer		= setup_buffer_inline_type;
 	attr->write_buffer		= write_buffer_inline_type;
@@ -918,7 +1750,8 @@ assignArrowTypeDecimal(SQLattribute *attr, int *p_numBuffers)
 	*p_numBuffers += 2;		/* nullmap + values */
 #else
 	/*
-	 * MEMO: Numeric of PostgreSQL is mapped to Decimal128 in Apache Arrow.
+	 * MEMO: Numeric of PostgreSQL is mapped to Decimal128 (or Decimal256)
+	 * in Apache Arrow.
 	 * Due to implementation reason, we require int128 support by compiler.
 	 */
 	Elog("Numeric type of PostgreSQL is not supported in this build");
@@ -932,8 +1765,12 @@ assignArrowTypeDate(SQLattribute *attr, int *p_numBuffers)
 	attr->arrow_type.Date.unit = ArrowDateUnit__Day;
 	attr->arrow_typename	= "Date";
 	attr->put_value			= put_date_value;
+	attr->put_values		= put_date_values;
+	attr->shape				= SQL_SHAPE__DATE;
 	attr->stat_update		= stat_update_int32_value;
+	attr->stat_format		= stat_format_int32_value;
 	attr->buffer_usage		= buffer_usage_inline_type;
+	attr->usage_fixed		= 1 + sizeof(DateADT);
 	attr->setup_buffer		= setup_buffer_inline_type;
 	attr->write_buffer		= write_buffer_inline_type;
 
@@ -948,8 +1785,12 @@ assignArrowTypeTime(SQLattribute *attr, int *p_numBuffers)
 	attr->arrow_type.Time.bitWidth = 64;
 	attr->arrow_typename	= "Time";
 	attr->put_value			= put_inline_64b_value;
+	attr->put_values		= put_int64_values;
+	attr->shape				= SQL_SHAPE__INT64;
 	attr->stat_update		= stat_update_int64_value;
+	attr->stat_format		= stat_format_int64_value;
 	attr->buffer_usage		= buffer_usage_inline_type;
+	attr->usage_fixed		= 1 + sizeof(TimeADT);
 	attr->setup_buffer		= setup_buffer_inline_type;
 	attr->write_buffer		= write_buffer_inline_type;
 
@@ -963,8 +1804,12 @@ assignArrowTypeTimestamp(SQLattribute *attr, int *p_numBuffers)
 	attr->arrow_type.Timestamp.unit = ArrowTimeUnit__MicroSecond;
 	attr->arrow_typename	= "Timestamp";
 	attr->put_value			= put_timestamp_value;
+	attr->put_values		= put_timestamp_values;
+	attr->shape				= SQL_SHAPE__TIMESTAMP;
 	attr->stat_update		= stat_update_int64_value;
+	attr->stat_format		= stat_format_int64_value;
 	attr->buffer_usage		= buffer_usage_inline_type;
+	attr->usage_fixed		= 1 + sizeof(Timestamp);
 	attr->setup_buffer		= setup_buffer_inline_type;
 	attr->write_buffer		= write_buffer_inline_type;
 
@@ -985,10 +1830,23 @@ assignArrowTypeList(SQLattribute *attr, int *p_numBuffers)
 {
 	SQLattribute *element = attr->element;
 
-	attr->arrow_type.tag	= ArrowNodeTag__List;
+	if (use_large_offset)
+	{
+		attr->arrow_type.tag = ArrowNodeTag__LargeList;
+		attr->arrow_typename = psprintf("LargeList<%s>",
+										element->arrow_typename);
+	}
+	else
+	{
+		attr->arrow_type.tag = ArrowNodeTag__List;
+		attr->arrow_typename = psprintf("List<%s>",
+										element->arrow_typename);
+	}
 	attr->put_value			= put_array_value;
-	attr->arrow_typename	= psprintf("List<%s>", element->arrow_typename);
 	attr->buffer_usage		= buffer_usage_array_type;
+	/* every element consumes 4 bytes at least for its length */
+	attr->usage_fixed		= 1 + (use_large_offset ? sizeof(int64) : sizeof(int32));
+	attr->usage_ratio		= (element->usage_fixed + 3) / 4 + element->usage_ratio;
 	attr->setup_buffer		= setup_buffer_array_type;
 	attr->write_buffer		= write_buffer_array_type;
 
@@ -998,11 +1856,23 @@ assignArrowTypeList(SQLattribute *attr, int *p_numBuffers)
 static void
 assignArrowTypeStruct(SQLattribute *attr, int *p_numBuffers)
 {
+	SQLtable   *subtypes = attr->subtypes;
+	int			j;
+
 	assert(attr->subtypes != NULL);
 	attr->arrow_type.tag	= ArrowNodeTag__Struct;
 	attr->arrow_typename	= "Struct";
 	attr->put_value			= put_composite_value;
 	attr->buffer_usage		= buffer_usage_composite_type;
+	attr->usage_fixed		= 1;
+	attr->usage_ratio		= 0;
+	for (j=0; j < subtypes->nfields; j++)
+	{
+		SQLattribute *subattr = &subtypes->attrs[j];
+
+		attr->usage_fixed += subattr->usage_fixed;
+		attr->usage_ratio = Max(attr->usage_ratio, subattr->usage_ratio);
+	}
 	attr->setup_buffer		= setup_buffer_composite_type;
 	attr->write_buffer		= write_buffer_composite_type;
 
@@ -1013,9 +1883,21 @@ static void
 assignArrowTypeDictionary(SQLattribute *attr, int *p_numBuffers)
 {
 	attr->arrow_type.tag	= ArrowNodeTag__Utf8;
-	attr->arrow_typename	= psprintf("Enum; dictionary=%u", attr->atttypid);
-	attr->put_value			= put_dictionary_value;
+	if (attr->typtype == 'e')
+	{
+		attr->arrow_typename	= psprintf("Enum; dictionary=%u", attr->atttypid);
+		attr->put_value			= put_dictionary_value;
+	}
+	else
+	{
+		/* text dictionary (--dictionary-text) */
+		attr->arrow_typename	= "Utf8; dictionary";
+		attr->put_value			= put_text_dictionary_value;
+		attr->put_values		= NULL;	/* was set for Utf8 */
+		attr->shape				= SQL_SHAPE__NONE;
+	}
 	attr->buffer_usage		= buffer_usage_inline_type;
+	attr->usage_fixed		= 1 + sizeof(uint32);
 	attr->setup_buffer		= setup_buffer_inline_type;
 	attr->write_buffer		= write_buffer_inline_type;
 
@@ -1029,6 +1911,7 @@ void
 assignArrowType(SQLattribute *attr, int *p_numBuffers)
 {
 	memset(&attr->arrow_type, 0, sizeof(ArrowType));
+	attr->shape = SQL_SHAPE__NONE;
 	if (attr->subtypes)
 	{
 		/* composite type */
@@ -1041,9 +1924,9 @@ assignArrowType(SQLattribute *attr, int *p_numBuffers)
 		assignArrowTypeList(attr, p_numBuffers);
 		return;
 	}
-	else if (attr->typtype == 'e')
+	else if (attr->enumdict)
 	{
-		/* enum type */
+		/* enum type, or text dictionary */
 		assignArrowTypeDictionary(attr, p_numBuffers);
 		return;
 	}
@@ -1131,3 +2014,40 @@ assignArrowType(SQLattribute *attr, int *p_numBuffers)
 		 attr->typnamespace,
 		 attr->typname);
 }
+
+/*
+ * assignArrowRowDecoder - assigns the row decoder of the COPY stream, if all
+ * the columns are flat; the one specialized for the signature of the table
+ * if any, or __put_copy_row_flat(). It has to be called again, if any
+ * column is reassigned.
+ */
+void
+assignArrowRowDecoder(SQLtable *table)
+{
+	int			j, k;
+
+	table->put_copy_row = NULL;
+	for (j=0; j < table->nfields; j++)
+	{
+		if (table->attrs[j].shape == SQL_SHAPE__NONE)
+			return;		/* generic path */
+	}
+	for (k=0; k < lengthof(sql_row_signatures); k++)
+	{
+		SQLrowSignature *sig = &sql_row_signatures[k];
+
+		if (sig->nfields != table->nfields)
+			continue;
+		for (j=0; j < table->nfields; j++)
+		{
+			if (sig->shapes[j] != table->attrs[j].shape)
+				break;
+		}
+		if (j == table->nfields)
+		{
+			table->put_copy_row = sig->put_copy_row;
+			return;
+		}
+	}
+	table->put_copy_row = __put_copy_row_flat;
+}
@@ -252,6 +252,9 @@ __makeBufferFlatten(FBTableBuf *buf, const char *func_name)
 			*offset = (pos - (char *)offset) + *offset;
 
 			memcpy(pos, buf->extra_buf[i], buf->extra_sz[i]);
+			diff = INTALIGN(buf->extra_sz[i]) - buf->extra_sz[i];
+			if (diff > 0)
+				memset(pos + buf->extra_sz[i], 0, diff);
 			pos += INTALIGN(buf->extra_sz[i]);
 		}
 		buf->length = pos - (char *)&buf->vtable;
@@ -287,11 +290,13 @@ createArrowTypeFloatingPoint(ArrowTypeFloatingPoint *node)
 static FBTableBuf *
 createArrowTypeDecimal(ArrowTypeDecimal *node)
 {
-	FBTableBuf *buf = allocFBTableBuf(2);
+	FBTableBuf *buf = allocFBTableBuf(3);
 
 	assert(node->tag == ArrowNodeTag__Decimal);
+	assert(node->bitWidth == 128 || node->bitWidth == 256);
 	addBufferInt(buf, 0, node->precision);
 	addBufferInt(buf, 1, node->scale);
+	__addBufferInt(buf, 2, node->bitWidth, 128);
 
 	return makeBufferFlatten(buf);
 }
@@ -466,6 +471,15 @@ createArrowType(ArrowType *node, ArrowTypeTag *p_type_tag)
 			tag = ArrowType__Map;
 			buf = createArrowTypeMap((ArrowTypeMap *)node);
 			break;
+		case ArrowNodeTag__LargeBinary:
+			tag = ArrowType__LargeBinary;
+			break;
+		case ArrowNodeTag__LargeUtf8:
+			tag = ArrowType__LargeUtf8;
+			break;
+		case ArrowNodeTag__LargeList:
+			tag = ArrowType__LargeList;
+			break;
 		default:
 			Elog("unknown ArrowNodeTag: %d", node->tag);
 			break;
@@ -633,10 +647,22 @@ createArrowSchema(ArrowSchema *node)
 	return makeBufferFlatten(buf);
 }
 
+static FBTableBuf *
+createArrowBodyCompression(ArrowBodyCompression *node)
+{
+	FBTableBuf *buf = allocFBTableBuf(2);
+
+	assert(node->tag == ArrowNodeTag__BodyCompression);
+	addBufferChar(buf, 0, node->codec);
+	addBufferChar(buf, 1, node->method);
+
+	return makeBufferFlatten(buf);
+}
+
 static FBTableBuf *
 createArrowRecordBatch(ArrowRecordBatch *node)
 {
-	FBTableBuf *buf = allocFBTableBuf(3);
+	FBTableBuf *buf = allocFBTableBuf(4);
 
 	assert(node->tag == ArrowNodeTag__RecordBatch);
 	addBufferLong(buf, 0, node->length);
@@ -646,6 +672,8 @@ createArrowRecordBatch(ArrowRecordBatch *node)
 	addBufferArrowBufferVector(buf, 2,
 							   node->_num_buffers,
 							   node->buffers);
+	if (node->compression.tag == ArrowNodeTag__BodyCompression)
+		addBufferOffset(buf, 3, createArrowBodyCompression(&node->compression));
 	return makeBufferFlatten(buf);
 }
 
@@ -765,8 +793,8 @@ typedef struct
 	char		data[FLEXIBLE_ARRAY_MEMBER];
 } FBMessageFileImage;
 
-ssize_t
-writeFlatBufferMessage(int fdesc, ArrowMessage *message)
+void *
+makeFlatBufferMessage(ArrowMessage *message, size_t *p_length)
 {
 	FBTableBuf *payload = createArrowMessage(message);
 	FBMessageFileImage *image;
@@ -776,9 +804,9 @@ writeFlatBufferMessage(int fdesc, ArrowMessage *message)
 
 	assert(payload->length > 0);
 	offset = INTALIGN(payload->vtable.vlen) - payload->vtable.vlen;
-    nbytes = INTALIGN(offset + payload->length);
+	nbytes = INTALIGN(offset + payload->length);
 	length = offsetof(FBMessageFileImage, data[nbytes]);
-	image = alloca(length);
+	image = palloc(length);
 	image->metaLength = sizeof(int32) + nbytes;
 	image->rootOffset = sizeof(int32) + INTALIGN(payload->vtable.vlen);
 	if (offset > 0)
@@ -787,8 +815,22 @@ writeFlatBufferMessage(int fdesc, ArrowMessage *message)
 	offset += payload->length;
 	if (offset < nbytes)
 		memset(image->data + offset, 0, nbytes - offset);
+	*p_length = length;
+
+	return image;
+}
+
+ssize_t
+writeFlatBufferMessage(int fdesc, ArrowMessage *message)
+{
+	void	   *image;
+	size_t		length;
+
+	image = makeFlatBufferMessage(message, &length);
 	if (write(fdesc, image, length) != length)
 		Elog("failed on write: %m");
+	pfree(image);
+
 	return length;
 }
 
@@ -0,0 +1,813 @@
+/*
+ * bench.c
+ *
+ * micro benchmark of the type handlers and the writer, on the synthetic
+ * cells in the binary format; no PostgreSQL server is needed.
+ *
+ * Copyright 2018-2019 (C) KaiGai Kohei <kaigai@heterodb.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the PostgreSQL License. See the LICENSE file.
+ */
+#include "pg2arrow.h"
+
+/*
+ * Each data type is measured in three stages:
+ *
+ * put_value ... put_value and stat_update handlers are called for each
+ *               cell, as the nested types and the COPY mode do.
+ * append    ... pgsql_append_results() on the synthetic PGresult; it
+ *               uses put_values handlers if any, and the decoder threads
+ *               if --decode-threads is given.
+ * write     ... all the rows are written to an arrow file under --dir,
+ *               includes the schema, the record batches and the footer.
+ *
+ * The throughput (MB/s) is measured by the length of the binary cells,
+ * as libpq hands them to pg2arrow.
+ */
+#define BENCH_CHUNK_NROWS		50000	/* rows per synthetic PGresult */
+#define BENCH_MAX_CELL_SZ		4096
+#define BENCH_NULL_RATIO		16		/* 1 of 16 cells are null */
+#define BENCH_DICT_MAX_LABELS	1000
+
+typedef struct BenchType	BenchType;
+struct BenchType
+{
+	const char *label;			/* name in the report */
+	const char *typname;		/* pg_type.typname */
+	Oid			typid;
+	int			typlen;
+	char		typtype;
+	int			typmod;
+	int		  (*gen_value)(BenchType *btype, char *buf);
+	BenchType  *element;		/* element type, if array */
+	BenchType **subtypes;		/* field types, if composite */
+	bool		dictionary_text;/* --dictionary-text */
+};
+
+/* command options */
+static size_t	bench_nrows = 1000000;
+static size_t	bench_segment_sz = (256UL << 20);
+static const char *bench_type_name = NULL;
+static const char *bench_dir = NULL;
+static int		bench_decode_nthreads = 0;
+static int		bench_pipeline_nbufs = 0;
+
+/*
+ * random number generator (xorshift64*); results have to be reproducible
+ */
+static uint64	bench_seed = 0x2545F4914F6CDD1DUL;
+
+static inline uint64
+bench_random(void)
+{
+	bench_seed ^= bench_seed >> 12;
+	bench_seed ^= bench_seed << 25;
+	bench_seed ^= bench_seed >> 27;
+	return bench_seed * 0x2545F4914F6CDD1DUL;
+}
+
+static inline double
+bench_clock(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Generators of the binary cells (see *_send functions in PostgreSQL)
+ *
+ * ---------------------------------------------------------------- */
+static int
+gen_bool_value(BenchType *btype, char *buf)
+{
+	buf[0] = (bench_random() & 1);
+	return sizeof(char);
+}
+
+static int
+gen_int2_value(BenchType *btype, char *buf)
+{
+	uint16		value = htons((uint16)bench_random());
+
+	memcpy(buf, &value, sizeof(uint16));
+	return sizeof(uint16);
+}
+
+static int
+gen_int4_value(BenchType *btype, char *buf)
+{
+	uint32		value = htonl((uint32)bench_random());
+
+	memcpy(buf, &value, sizeof(uint32));
+	return sizeof(uint32);
+}
+
+static int
+gen_int8_value(BenchType *btype, char *buf)
+{
+	uint64		value = __builtin_bswap64(bench_random());
+
+	memcpy(buf, &value, sizeof(uint64));
+	return sizeof(uint64);
+}
+
+static int
+gen_float4_value(BenchType *btype, char *buf)
+{
+	float4		fval = (float4)(bench_random() % 2000000) / 1000.0 - 1000.0;
+	uint32		value;
+
+	memcpy(&value, &fval, sizeof(uint32));
+	value = htonl(value);
+	memcpy(buf, &value, sizeof(uint32));
+	return sizeof(uint32);
+}
+
+static int
+gen_float8_value(BenchType *btype, char *buf)
+{
+	float8		fval = (float8)(bench_random() % 2000000000) / 1000.0 - 1000000.0;
+	uint64		value;
+
+	memcpy(&value, &fval, sizeof(uint64));
+	value = __builtin_bswap64(value);
+	memcpy(buf, &value, sizeof(uint64));
+	return sizeof(uint64);
+}
+
+static int
+gen_date_value(BenchType *btype, char *buf)
+{
+	/* +/- 20 years from 2000-01-01 */
+	uint32		value = htonl((int32)(bench_random() % 14600) - 7300);
+
+	memcpy(buf, &value, sizeof(uint32));
+	return sizeof(uint32);
+}
+
+static int
+gen_time_value(BenchType *btype, char *buf)
+{
+	uint64		value = __builtin_bswap64(bench_random() % USECS_PER_DAY);
+
+	memcpy(buf, &value, sizeof(uint64));
+	return sizeof(uint64);
+}
+
+static int
+gen_timestamp_value(BenchType *btype, char *buf)
+{
+	int64		range = 14600L * USECS_PER_DAY;
+	uint64		value = (int64)(bench_random() % range) - range / 2;
+
+	value = __builtin_bswap64(value);
+	memcpy(buf, &value, sizeof(uint64));
+	return sizeof(uint64);
+}
+
+static int
+gen_numeric_value(BenchType *btype, char *buf)
+{
+	/* numeric(20,4); up to 16 integer digits and 4 fraction digits */
+	int16	   *rawdata = (int16 *)buf;
+	int			ndigits = 1 + bench_random() % 5;
+	int			weight = (int)(bench_random() % 5) - 1;
+	int			i;
+
+	ndigits = Min(ndigits, weight + 2);
+	rawdata[0] = htons(ndigits);
+	rawdata[1] = htons(weight);
+	rawdata[2] = htons((bench_random() & 1) ? 0x4000 : 0x0000);
+	rawdata[3] = htons(4);
+	for (i=0; i < ndigits; i++)
+		rawdata[4+i] = htons(bench_random() % 10000);
+	return sizeof(int16) * (4 + ndigits);
+}
+
+static int
+gen_text_value(BenchType *btype, char *buf)
+{
+	int			len = bench_random() % 40;
+	int			i;
+
+	for (i=0; i < len; i++)
+		buf[i] = 'a' + bench_random() % 26;
+	return len;
+}
+
+static int
+gen_bpchar_value(BenchType *btype, char *buf)
+{
+	/* bpchar(20) is padded by spaces */
+	int			len = btype->typmod - VARHDRSZ;
+	int			n = bench_random() % len;
+	int			i;
+
+	for (i=0; i < n; i++)
+		buf[i] = 'A' + bench_random() % 26;
+	memset(buf + n, ' ', len - n);
+	return len;
+}
+
+static int
+gen_bytea_value(BenchType *btype, char *buf)
+{
+	int			len = bench_random() % 64;
+	int			i;
+
+	for (i=0; i < len; i++)
+		buf[i] = bench_random();
+	return len;
+}
+
+static const char *bench_enum_labels[] = {
+	"red", "green", "blue", "cyan", "magenta", "yellow", "black", "white",
+};
+#define BENCH_ENUM_NLABELS	lengthof(bench_enum_labels)
+
+static int
+gen_enum_value(BenchType *btype, char *buf)
+{
+	const char *label = bench_enum_labels[bench_random() % BENCH_ENUM_NLABELS];
+	int			len = strlen(label);
+
+	memcpy(buf, label, len);
+	return len;
+}
+
+static int
+gen_label_value(BenchType *btype, char *buf)
+{
+	/* 100 distinct labels, for the text dictionary */
+	return sprintf(buf, "label-%03u", (uint32)(bench_random() % 100));
+}
+
+static int
+gen_array_value(BenchType *btype, char *buf)
+{
+	BenchType  *element = btype->element;
+	int32	   *rawdata = (int32 *)buf;
+	int			nitems = bench_random() % 8;
+	char	   *pos;
+	int			i, len;
+
+	rawdata[0] = htonl(1);				/* ndim */
+	rawdata[1] = htonl(0);				/* hasnull */
+	rawdata[2] = htonl(element->typid);	/* element_type */
+	rawdata[3] = htonl(nitems);			/* dim[0].sz */
+	rawdata[4] = htonl(1);				/* dim[0].lb */
+	pos = (char *)&rawdata[5];
+	for (i=0; i < nitems; i++)
+	{
+		len = element->gen_value(element, pos + sizeof(int32));
+		*((int32 *)pos) = htonl(len);
+		pos += sizeof(int32) + len;
+	}
+	return pos - buf;
+}
+
+static int
+gen_composite_value(BenchType *btype, char *buf)
+{
+	char	   *pos = buf + sizeof(int32);
+	int			j, len;
+
+	for (j=0; btype->subtypes[j] != NULL; j++)
+	{
+		BenchType  *subtype = btype->subtypes[j];
+
+		*((Oid *)pos) = htonl(subtype->typid);
+		pos += sizeof(Oid);
+		len = subtype->gen_value(subtype, pos + sizeof(int32));
+		*((int32 *)pos) = htonl(len);
+		pos += sizeof(int32) + len;
+	}
+	*((int32 *)buf) = htonl(j);			/* nvalids */
+	return pos - buf;
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Data types to be measured; every assignArrowType* mapping is covered
+ *
+ * ---------------------------------------------------------------- */
+static BenchType bench_int4_type =
+	{"int4",      "int4",        23,  4, 'b', -1, gen_int4_value };
+static BenchType bench_text_type =
+	{"text",      "text",        25, -1, 'b', -1, gen_text_value };
+static BenchType bench_float8_type =
+	{"float8",    "float8",     701,  8, 'b', -1, gen_float8_value };
+static BenchType bench_numeric_type =
+	{"numeric",   "numeric",   1700, -1, 'b', ((20 << 16) | 4) + VARHDRSZ,
+	 gen_numeric_value };
+static BenchType *bench_composite_fields[] = {
+	&bench_int4_type,
+	&bench_text_type,
+	&bench_float8_type,
+	&bench_numeric_type,
+	NULL,
+};
+
+static BenchType bench_types[] = {
+	{"bool",      "bool",        16,  1, 'b', -1, gen_bool_value },
+	{"int2",      "int2",        21,  2, 'b', -1, gen_int2_value },
+	{"int4",      "int4",        23,  4, 'b', -1, gen_int4_value },
+	{"int8",      "int8",        20,  8, 'b', -1, gen_int8_value },
+	{"oid",       "oid",         26,  4, 'b', -1, gen_int4_value },
+	{"float4",    "float4",     700,  4, 'b', -1, gen_float4_value },
+	{"float8",    "float8",     701,  8, 'b', -1, gen_float8_value },
+	{"date",      "date",      1082,  4, 'b', -1, gen_date_value },
+	{"time",      "time",      1083,  8, 'b', -1, gen_time_value },
+	{"timestamp", "timestamp", 1114,  8, 'b', -1, gen_timestamp_value },
+	{"timestamptz", "timestamptz", 1184, 8, 'b', -1, gen_timestamp_value },
+	{"numeric",   "numeric",   1700, -1, 'b', ((20 << 16) | 4) + VARHDRSZ,
+	 gen_numeric_value },
+	{"text",      "text",        25, -1, 'b', -1, gen_text_value },
+	{"varchar",   "varchar",   1043, -1, 'b', -1, gen_text_value },
+	{"bpchar",    "bpchar",    1042, -1, 'b', 20 + VARHDRSZ, gen_bpchar_value },
+	{"bytea",     "bytea",       17, -1, 'b', -1, gen_bytea_value },
+	{"enum",      "bench_enum", 90001, 4, 'e', -1, gen_enum_value },
+	{"text-dict", "text",        25, -1, 'b', -1, gen_label_value,
+	 NULL, NULL, true },
+	{"int4[]",    "_int4",     1007, -1, 'b', -1, gen_array_value,
+	 &bench_int4_type },
+	{"text[]",    "_text",     1009, -1, 'b', -1, gen_array_value,
+	 &bench_text_type },
+	{"composite", "bench_comp", 90002, -1, 'c', -1, gen_composite_value,
+	 NULL, bench_composite_fields },
+};
+#define BENCH_NTYPES	lengthof(bench_types)
+
+/*
+ * bench_create_enum_dictionary - dictionary of the enum labels; it is
+ * built like pgsql_create_dictionary(), but without pg_enum
+ */
+static SQLdictionary *
+bench_create_enum_dictionary(BenchType *btype)
+{
+	SQLdictionary *dict;
+	int			i;
+
+	for (dict = pgsql_dictionary_list; dict != NULL; dict = dict->next)
+	{
+		if (dict->enum_typeid == btype->typid)
+			return dict;
+	}
+	dict = pgsql_create_text_dictionary(BENCH_ENUM_NLABELS);
+	dict->enum_typeid = btype->typid;
+	for (i=0; i < BENCH_ENUM_NLABELS; i++)
+	{
+		const char *label = bench_enum_labels[i];
+		size_t		len = strlen(label);
+		int32		offset;
+
+		pgsql_dictionary_insert(dict,
+								hash_any((const unsigned char *)label, len),
+								label, len, i);
+		sql_buffer_append(&dict->extra, label, len);
+		offset = dict->extra.usage;
+		sql_buffer_append(&dict->values, &offset, sizeof(int32));
+	}
+	dict->nitems = BENCH_ENUM_NLABELS;
+
+	return dict;
+}
+
+/*
+ * bench_setup_attribute - same as pgsql_setup_attribute, but by BenchType
+ */
+static void
+bench_setup_attribute(SQLattribute *attr, BenchType *btype,
+					  int *p_numFieldNodes, int *p_numBuffers)
+{
+	memset(attr, 0, sizeof(SQLattribute));
+	attr->attname	= pstrdup(btype->label);
+	attr->atttypid	= btype->typid;
+	attr->atttypmod	= btype->typmod;
+	attr->attlen	= btype->typlen;
+	attr->attbyval	= (btype->typlen > 0 && btype->typlen <= sizeof(Datum));
+	attr->attalign	= (btype->typlen > 0 ? btype->typlen : sizeof(int));
+	attr->typnamespace = "pg_catalog";
+	attr->typname	= btype->typname;
+	attr->typtype	= btype->typtype;
+	if (btype->element)
+	{
+		attr->element = palloc0(sizeof(SQLattribute));
+		bench_setup_attribute(attr->element, btype->element,
+							  p_numFieldNodes, p_numBuffers);
+	}
+	else if (btype->subtypes)
+	{
+		SQLtable   *subtypes;
+		int			j, nfields = 0;
+
+		while (btype->subtypes[nfields] != NULL)
+			nfields++;
+		subtypes = palloc0(offsetof(SQLtable, attrs[nfields]));
+		subtypes->nfields = nfields;
+		for (j=0; j < nfields; j++)
+			bench_setup_attribute(&subtypes->attrs[j],
+								  btype->subtypes[j],
+								  &subtypes->numFieldNodes,
+								  &subtypes->numBuffers);
+		*p_numFieldNodes += subtypes->numFieldNodes;
+		*p_numBuffers += subtypes->numBuffers;
+		attr->subtypes = subtypes;
+	}
+	else if (btype->typtype == 'e')
+		attr->enumdict = bench_create_enum_dictionary(btype);
+	attr->min_isnull = true;
+	attr->max_isnull = true;
+	assignArrowType(attr, p_numBuffers);
+	*p_numFieldNodes += 1;
+}
+
+static SQLtable *
+bench_create_table(BenchType **btypes, int nfields, size_t segment_sz)
+{
+	SQLtable   *table;
+	int			j;
+
+	table = palloc0(offsetof(SQLtable, attrs[nfields]));
+	table->fdesc = -1;
+	table->fdesc_direct = -1;
+	table->shard_id = -1;
+	table->segment_sz = segment_sz;
+	table->nfields = nfields;
+	for (j=0; j < nfields; j++)
+		bench_setup_attribute(&table->attrs[j], btypes[j],
+							  &table->numFieldNodes,
+							  &table->numBuffers);
+	for (j=0; j < nfields; j++)
+	{
+		if (btypes[j]->dictionary_text)
+			pgsql_setup_text_dictionary(table, j,
+						pgsql_create_text_dictionary(BENCH_DICT_MAX_LABELS));
+	}
+	assignArrowRowDecoder(table);
+	return table;
+}
+
+static void
+bench_clear_table(SQLtable *table)
+{
+	int			j;
+
+	for (j=0; j < table->nfields; j++)
+		pgsql_clear_attribute(&table->attrs[j]);
+	table->nitems = 0;
+}
+
+static void
+bench_release_attribute(SQLattribute *attr)
+{
+	int			j;
+
+	sql_buffer_free(&attr->nullmap);
+	sql_buffer_free(&attr->values);
+	sql_buffer_free(&attr->extra);
+	if (attr->element)
+		bench_release_attribute(attr->element);
+	if (attr->subtypes)
+	{
+		for (j=0; j < attr->subtypes->nfields; j++)
+			bench_release_attribute(&attr->subtypes->attrs[j]);
+	}
+}
+
+static void
+bench_release_table(SQLtable *table)
+{
+	int			j;
+
+	for (j=0; j < table->nfields; j++)
+		bench_release_attribute(&table->attrs[j]);
+}
+
+/*
+ * bench_create_result - PGresult of the synthetic rows, in binary format
+ */
+static PGresult *
+bench_create_result(BenchType **btypes, int nfields, size_t *p_total_sz)
+{
+	PGresult   *res = PQmakeEmptyPGresult(NULL, PGRES_TUPLES_OK);
+	PGresAttDesc *attrs = alloca(sizeof(PGresAttDesc) * nfields);
+	char		buf[BENCH_MAX_CELL_SZ];
+	size_t		total_sz = 0;
+	int			i, j, len;
+
+	memset(attrs, 0, sizeof(PGresAttDesc) * nfields);
+	for (j=0; j < nfields; j++)
+	{
+		attrs[j].name = (char *)btypes[j]->label;
+		attrs[j].typid = btypes[j]->typid;
+		attrs[j].typlen = btypes[j]->typlen;
+		attrs[j].atttypmod = btypes[j]->typmod;
+		attrs[j].format = 1;
+	}
+	if (!PQsetResultAttrs(res, nfields, attrs))
+		Elog("failed on PQsetResultAttrs");
+	for (i=0; i < BENCH_CHUNK_NROWS; i++)
+	{
+		for (j=0; j < nfields; j++)
+		{
+			if (bench_random() % BENCH_NULL_RATIO == 0)
+			{
+				if (!PQsetvalue(res, i, j, NULL, -1))
+					Elog("failed on PQsetvalue");
+				continue;
+			}
+			len = btypes[j]->gen_value(btypes[j], buf);
+			assert(len <= BENCH_MAX_CELL_SZ);
+			if (!PQsetvalue(res, i, j, buf, len))
+				Elog("failed on PQsetvalue");
+			total_sz += len;
+		}
+	}
+	*p_total_sz = total_sz;
+	return res;
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Stages of the benchmark; each returns the elapsed time in seconds
+ *
+ * ---------------------------------------------------------------- */
+static double
+bench_put_value(SQLtable *table, PGresult *res, size_t nloops)
+{
+	int			nrows = PQntuples(res);
+	const char **addrs = palloc(sizeof(char *) * nrows);
+	int		   *sizes = palloc(sizeof(int) * nrows);
+	double		elapsed = 0.0;
+	double		tv;
+	size_t		loop;
+	int			i, j;
+
+	for (j=0; j < table->nfields; j++)
+	{
+		SQLattribute *attr = &table->attrs[j];
+
+		for (i=0; i < nrows; i++)
+		{
+			addrs[i] = (PQgetisnull(res, i, j) ? NULL : PQgetvalue(res, i, j));
+			sizes[i] = PQgetlength(res, i, j);
+		}
+		for (loop=0; loop < nloops; loop++)
+		{
+			tv = bench_clock();
+			for (i=0; i < nrows; i++)
+			{
+				attr->put_value(attr, addrs[i], sizes[i]);
+				if (attr->stat_update)
+					attr->stat_update(attr, addrs[i], sizes[i]);
+			}
+			elapsed += bench_clock() - tv;
+			pgsql_clear_attribute(attr);
+		}
+	}
+	pfree(addrs);
+	pfree(sizes);
+
+	return elapsed;
+}
+
+static double
+bench_append(SQLtable *table, PGresult *res, size_t nloops)
+{
+	double		elapsed = 0.0;
+	double		tv;
+	size_t		loop;
+
+	for (loop=0; loop < nloops; loop++)
+	{
+		tv = bench_clock();
+		pgsql_append_results(table, res);
+		elapsed += bench_clock() - tv;
+		bench_clear_table(table);
+	}
+	return elapsed;
+}
+
+static double
+bench_write(SQLtable *table, PGresult *res, size_t nloops,
+			const char *filename, size_t *p_file_sz)
+{
+	struct stat	stat_buf;
+	double		tv = bench_clock();
+	size_t		loop;
+
+	table->fdesc = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (table->fdesc < 0)
+		Elog("failed to open '%s': %m", filename);
+	table->filename = filename;
+	if (write(table->fdesc, "ARROW1\0\0", 8) != 8)
+		Elog("failed on write(2): %m");
+	writeArrowSchema(table);
+	writeArrowDictionaryBatches(table);
+	for (loop=0; loop < nloops; loop++)
+		pgsql_append_results(table, res);
+	if (table->nitems > 0)
+		pgsql_writeout_buffer(table);
+	pgsql_finish_pipeline(table);
+	writeArrowFooter(table);
+	if (fsync(table->fdesc) != 0)
+		Elog("failed on fsync('%s'): %m", filename);
+	tv = bench_clock() - tv;
+
+	if (fstat(table->fdesc, &stat_buf) != 0)
+		Elog("failed on fstat('%s'): %m", filename);
+	*p_file_sz = stat_buf.st_size;
+	close(table->fdesc);
+	if (unlink(filename) != 0)
+		Elog("failed on unlink('%s'): %m", filename);
+	return tv;
+}
+
+static void
+bench_print_result(const char *label, double elapsed,
+				   size_t nrows, size_t total_sz)
+{
+	if (elapsed <= 0.0)
+		elapsed = 1.0e-9;
+	printf(" %9.2f %9.1f%s",
+		   (double)nrows / elapsed / 1000000.0,
+		   (double)total_sz / elapsed / (double)(1UL << 20),
+		   label);
+}
+
+static void
+bench_run(const char *label, BenchType **btypes, int nfields)
+{
+	SQLtable   *table;
+	PGresult   *res;
+	size_t		nloops = (bench_nrows + BENCH_CHUNK_NROWS - 1) / BENCH_CHUNK_NROWS;
+	size_t		nrows = nloops * BENCH_CHUNK_NROWS;
+	size_t		total_sz;
+	size_t		file_sz;
+	char		filename[PATH_MAX];
+	double		elapsed;
+
+	res = bench_create_result(btypes, nfields, &total_sz);
+	total_sz *= nloops;
+	printf("%-12s", label);
+	fflush(stdout);
+
+	/* put_value */
+	table = bench_create_table(btypes, nfields, SIZE_MAX / 2);
+	elapsed = bench_put_value(table, res, nloops);
+	bench_print_result("", elapsed, nrows, total_sz);
+	fflush(stdout);
+
+	/* append */
+	if (bench_decode_nthreads > 1)
+		pgsql_setup_decoder(table, bench_decode_nthreads);
+	elapsed = bench_append(table, res, nloops);
+	bench_print_result("", elapsed, nrows, total_sz);
+	pgsql_shutdown_decoder(table);
+	bench_release_table(table);
+	fflush(stdout);
+
+	/* write */
+	table = bench_create_table(btypes, nfields, bench_segment_sz);
+	if (bench_pipeline_nbufs > 0)
+		pgsql_setup_pipeline(table, bench_pipeline_nbufs);
+	if (bench_decode_nthreads > 1)
+		pgsql_setup_decoder(table, bench_decode_nthreads);
+	snprintf(filename, sizeof(filename), "%s/pg2arrow_bench.%d.arrow",
+			 bench_dir, (int)getpid());
+	elapsed = bench_write(table, res, nloops, filename, &file_sz);
+	bench_print_result("", elapsed, nrows, total_sz);
+	pgsql_shutdown_decoder(table);
+	bench_release_table(table);
+	printf(" %8.1fMB\n", (double)file_sz / (double)(1UL << 20));
+
+	PQclear(res);
+}
+
+static void
+usage(void)
+{
+	fputs("Usage:\n"
+		  "  pg2arrow_bench [OPTION]...\n"
+		  "\n"
+		  "Options:\n"
+		  "  -n, --rows=N            number of rows per data type\n"
+		  "      (default: 1000000)\n"
+		  "  -s, --segment-size=SIZE size of record batch in MB for the write\n"
+		  "      stage (default: 256)\n"
+		  "  -t, --type=NAME         runs only the given data type, or 'all'\n"
+		  "      for the table with all the data types\n"
+		  "  -d, --dir=DIR           directory of the arrow files written\n"
+		  "      (default: /dev/shm, or /tmp if not exists)\n"
+		  "      --decode-threads=N  decodes the columns by N threads\n"
+		  "      --pipeline[=NBUFS]  writes the record batches concurrently\n"
+		  "      --large-offset      uses 64bit offsets for varlena types\n",
+		  stderr);
+	exit(1);
+}
+
+static void
+parse_options(int argc, char * const argv[])
+{
+	static struct option long_options[] = {
+		{"rows",         required_argument,  NULL,  'n' },
+		{"segment-size", required_argument,  NULL,  's' },
+		{"type",         required_argument,  NULL,  't' },
+		{"dir",          required_argument,  NULL,  'd' },
+		{"decode-threads", required_argument, NULL, 1000 },
+		{"pipeline",     optional_argument,  NULL, 1001 },
+		{"large-offset", no_argument,        NULL, 1002 },
+		{"help",         no_argument,        NULL, 9999 },
+		{NULL, 0, NULL, 0},
+	};
+	int			c;
+
+	while ((c = getopt_long(argc, argv, "n:s:t:d:",
+							long_options, NULL)) >= 0)
+	{
+		switch (c)
+		{
+			case 'n':
+				if (atol(optarg) <= 0)
+					Elog("number of rows is not valid: %s", optarg);
+				bench_nrows = atol(optarg);
+				break;
+			case 's':
+				if (atol(optarg) <= 0)
+					Elog("segment size is not valid: %s", optarg);
+				bench_segment_sz = atol(optarg) << 20;
+				break;
+			case 't':
+				bench_type_name = optarg;
+				break;
+			case 'd':
+				bench_dir = optarg;
+				break;
+			case 1000:		/* --decode-threads */
+				bench_decode_nthreads = atoi(optarg);
+				if (bench_decode_nthreads < 1)
+					Elog("number of decode threads is not valid: %s", optarg);
+				break;
+			case 1001:		/* --pipeline */
+				bench_pipeline_nbufs = (optarg ? atoi(optarg) : 2);
+				if (bench_pipeline_nbufs < 1)
+					Elog("number of pipeline buffers is not valid: %s", optarg);
+				break;
+			case 1002:		/* --large-offset */
+				use_large_offset = 1;
+				break;
+			case 9999:		/* --help */
+			default:
+				usage();
+				break;
+		}
+	}
+	if (optind != argc)
+		usage();
+	if (!bench_dir)
+		bench_dir = (access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp");
+}
+
+int main(int argc, char * const argv[])
+{
+	BenchType  *btypes[BENCH_NTYPES];
+	bool		found = false;
+	int			i;
+
+	parse_options(argc, argv);
+	printf("# rows=%zu, segment-size=%zuMB, dir=%s\n",
+		   bench_nrows, bench_segment_sz >> 20, bench_dir);
+	printf("%-12s %19s %19s %19s %10s\n",
+		   "", "put_value", "append", "write", "");
+	printf("%-12s", "type");
+	for (i=0; i < 3; i++)
+		printf(" %9s %9s", "Mrows/s", "MB/s");
+	printf(" %10s\n", "file size");
+
+	for (i=0; i < BENCH_NTYPES; i++)
+	{
+		BenchType  *btype = &bench_types[i];
+
+		btypes[i] = btype;
+		if (bench_type_name && strcmp(bench_type_name, btype->label) != 0)
+			continue;
+		bench_run(btype->label, &btype, 1);
+		found = true;
+	}
+	/* all the data types in a table */
+	if (!bench_type_name || strcmp(bench_type_name, "all") == 0)
+	{
+		bench_run("all", btypes, BENCH_NTYPES);
+		found = true;
+	}
+	pgsql_shutdown_writer();
+	if (!found)
+		Elog("unknown data type: %s", bench_type_name);
+
+	return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * buffer.c
+ *
+ * memory management of SQLbuffer
+ *
+ * Copyright 2018-2019 (C) KaiGai Kohei <kaigai@heterodb.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the PostgreSQL License. See the LICENSE file.
+ */
+#include "pg2arrow.h"
+
+/*
+ * Small buffers are carved from the shared arena segments, instead of
+ * individual mmap(2) for each buffer. It reduces the number of mappings
+ * and page faults on wide tables, and on nested types that have many
+ * tiny buffers. Once a buffer grows larger than ARENA_MAX_CHUNK_SZ, it
+ * moves to a dedicated mapping that is expanded by mremap(2).
+ * Chunks released by the grown buffers are kept in the free list of
+ * each size class, for reuse by other buffers.
+ */
+#define ARENA_SEGMENT_SZ		(64UL << 20)	/* 64MB */
+#define ARENA_MIN_CHUNK_BITS	16				/* 64KB */
+#define ARENA_MAX_CHUNK_BITS	20				/* 1MB */
+#define ARENA_MIN_CHUNK_SZ		(1UL << ARENA_MIN_CHUNK_BITS)
+#define ARENA_MAX_CHUNK_SZ		(1UL << ARENA_MAX_CHUNK_BITS)
+#define DEDICATED_MIN_SZ		(2UL << 20)		/* 2MB */
+
+static pthread_mutex_t	arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static char			   *arena_curr = NULL;
+static size_t			arena_remain = 0;
+static void			   *arena_free_chunks[ARENA_MAX_CHUNK_BITS + 1];
+
+static void *
+__mmap_buffer(size_t length)
+{
+	void	   *ptr;
+
+	if (use_huge_pages == HUGE_PAGES__HUGETLB)
+	{
+		ptr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED)
+			return ptr;
+		/* fallback to the transparent huge pages, if not reserved */
+	}
+	ptr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED)
+		Elog("failed on mmap(len=%zu): %m", length);
+	if (use_huge_pages != HUGE_PAGES__OFF)
+		madvise(ptr, length, MADV_HUGEPAGE);	/* only a hint */
+	return ptr;
+}
+
+static void *
+__arena_alloc_chunk(int nbits)
+{
+	size_t		chunk_sz = (1UL << nbits);
+	void	   *chunk;
+
+	pthread_mutex_lock(&arena_lock);
+	chunk = arena_free_chunks[nbits];
+	if (chunk)
+		arena_free_chunks[nbits] = *((void **)chunk);
+	else
+	{
+		if (arena_remain < chunk_sz)
+		{
+			arena_curr = __mmap_buffer(ARENA_SEGMENT_SZ);
+			arena_remain = ARENA_SEGMENT_SZ;
+		}
+		chunk = arena_curr;
+		arena_curr += chunk_sz;
+		arena_remain -= chunk_sz;
+	}
+	pthread_mutex_unlock(&arena_lock);
+
+	return chunk;
+}
+
+static void
+__arena_free_chunk(void *chunk, size_t chunk_sz)
+{
+	int			nbits = __builtin_ctzl(chunk_sz);
+
+	assert(chunk_sz == (1UL << nbits) &&
+		   nbits >= ARENA_MIN_CHUNK_BITS &&
+		   nbits <= ARENA_MAX_CHUNK_BITS);
+	pthread_mutex_lock(&arena_lock);
+	*((void **)chunk) = arena_free_chunks[nbits];
+	arena_free_chunks[nbits] = chunk;
+	pthread_mutex_unlock(&arena_lock);
+}
+
+/*
+ * sql_buffer_alloc - slow path of sql_buffer_expand
+ */
+void
+sql_buffer_alloc(SQLbuffer *buf, size_t required)
+{
+	char	   *ptr;
+	size_t		length;
+	int			nbits;
+
+	if (buf->ptr == NULL)
+	{
+		/* size hint learned from the previous record batches */
+		length = Max(required, buf->hint);
+		length = Max(length, ARENA_MIN_CHUNK_SZ);
+	}
+	else
+	{
+		length = 2 * buf->length;
+		while (length < required)
+			length *= 2;
+	}
+	nbits = 64 - __builtin_clzl(length - 1);
+
+	if (nbits <= ARENA_MAX_CHUNK_BITS)
+	{
+		/* allocation or expansion within the arena */
+		ptr = __arena_alloc_chunk(nbits);
+		length = (1UL << nbits);
+		if (buf->ptr)
+		{
+			assert(buf->is_arena);
+			memcpy(ptr, buf->ptr, buf->length);
+			__arena_free_chunk(buf->ptr, buf->length);
+			perf_counter_add(buffer_expand, 1);
+		}
+		buf->is_arena = true;
+	}
+	else
+	{
+		length = Max(1UL << nbits, DEDICATED_MIN_SZ);
+		if (!buf->ptr)
+			ptr = __mmap_buffer(length);
+		else if (buf->is_arena)
+		{
+			/* moves to the dedicated mapping */
+			ptr = __mmap_buffer(length);
+			memcpy(ptr, buf->ptr, buf->length);
+			__arena_free_chunk(buf->ptr, buf->length);
+			perf_counter_add(buffer_moves, 1);
+		}
+		else
+		{
+			ptr = mremap(buf->ptr, buf->length, length, MREMAP_MAYMOVE);
+			if (ptr == MAP_FAILED)
+			{
+				/* hugetlb mappings may not be remapped */
+				ptr = __mmap_buffer(length);
+				memcpy(ptr, buf->ptr, buf->length);
+				if (munmap(buf->ptr, buf->length) != 0)
+					Elog("failed on munmap: %m");
+				perf_counter_add(buffer_moves, 1);
+			}
+			else
+				perf_counter_add(buffer_mremap, 1);
+		}
+		buf->is_arena = false;
+	}
+	if (!buf->ptr)
+	{
+		buf->usage = 0;
+		perf_counter_add(buffer_alloc, 1);
+	}
+	buf->ptr = ptr;
+	buf->length = length;
+}
+
+/*
+ * sql_buffer_trim - releases physical pages of the overgrown buffer
+ *
+ * The buffer keeps its virtual address range, so it does not need to
+ * move again, even if a later record batch grows up to the same size.
+ */
+void
+sql_buffer_trim(SQLbuffer *buf)
+{
+	size_t		keep = DEDICATED_MIN_SZ;
+
+	assert(!buf->is_arena);
+	while (keep < 2 * buf->hint)
+		keep *= 2;
+	if (keep < buf->length &&
+		madvise(buf->ptr + keep, buf->length - keep, MADV_DONTNEED) != 0)
+		Elog("failed on madvise(MADV_DONTNEED): %m");
+	buf->resident = Min(buf->resident, keep);
+}
+
+/*
+ * sql_buffer_free - releases the buffer; arena chunks go back to the free
+ * list of the size class
+ */
+void
+sql_buffer_free(SQLbuffer *buf)
+{
+	if (buf->ptr)
+	{
+		if (buf->is_arena)
+			__arena_free_chunk(buf->ptr, buf->length);
+		else if (munmap(buf->ptr, buf->length) != 0)
+			Elog("failed on munmap: %m");
+	}
+	sql_buffer_init(buf);
+}
@@ -0,0 +1,394 @@
+/*
+ * compress.c
+ *
+ * compression of the record batch buffers (LZ4_FRAME or ZSTD)
+ *
+ * Copyright 2018-2019 (C) KaiGai Kohei <kaigai@heterodb.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the PostgreSQL License. See the LICENSE file.
+ */
+#include "pg2arrow.h"
+#ifdef HAVE_LIBLZ4
+#include <lz4.h>
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * Each buffer of the record batch is compressed individually, according
+ * to BodyCompressionMethod::BUFFER. The compressed buffer begins with its
+ * uncompressed length in int64, or -1 if the buffer is stored as is,
+ * because compression does not reduce the size. Empty buffers are kept
+ * empty, without the prefix.
+ * Buffers are compressed by multiple threads, if the record batch is
+ * large enough; one buffer is a unit of the job.
+ */
+#define COMPRESS_MAX_THREADS		16
+#define COMPRESS_PARALLEL_MIN_SZ	(1UL << 20)		/* 1MB */
+
+typedef struct
+{
+	SQLiovec   *iov;
+	size_t	   *offsets;		/* offset of the destination in cbuffer */
+	size_t	   *bounds;			/* capacity of the destination */
+	size_t	   *results;		/* length of the compressed image, or 0 */
+	int			next_index;
+} SQLcompressJob;
+
+#ifdef HAVE_LIBLZ4
+static inline void
+__lz4_preferences(LZ4F_preferences_t *prefs, size_t length)
+{
+	memset(prefs, 0, sizeof(LZ4F_preferences_t));
+	prefs->frameInfo.contentSize = length;
+	prefs->compressionLevel = compression_level;
+}
+#endif
+
+static size_t
+__compress_bound(size_t length)
+{
+	switch (compression_codec)
+	{
+#ifdef HAVE_LIBLZ4
+		case ArrowCompressionType__LZ4_FRAME:
+			{
+				LZ4F_preferences_t	prefs;
+
+				__lz4_preferences(&prefs, length);
+				return LZ4F_compressFrameBound(length, &prefs);
+			}
+#endif
+#ifdef HAVE_LIBZSTD
+		case ArrowCompressionType__ZSTD:
+			return ZSTD_compressBound(length);
+#endif
+		default:
+			Elog("unsupported compression codec: %d", compression_codec);
+	}
+	return 0;	/* not reached */
+}
+
+static size_t
+__compress_buffer(char *dest, size_t dest_sz, const char *src, size_t src_sz)
+{
+	size_t		nbytes = 0;
+
+	switch (compression_codec)
+	{
+#ifdef HAVE_LIBLZ4
+		case ArrowCompressionType__LZ4_FRAME:
+			{
+				LZ4F_preferences_t	prefs;
+
+				__lz4_preferences(&prefs, src_sz);
+				nbytes = LZ4F_compressFrame(dest, dest_sz, src, src_sz, &prefs);
+				if (LZ4F_isError(nbytes))
+					Elog("failed on LZ4F_compressFrame: %s",
+						 LZ4F_getErrorName(nbytes));
+			}
+			break;
+#endif
+#ifdef HAVE_LIBZSTD
+		case ArrowCompressionType__ZSTD:
+			nbytes = ZSTD_compress(dest, dest_sz, src, src_sz,
+								   compression_level);
+			if (ZSTD_isError(nbytes))
+				Elog("failed on ZSTD_compress: %s",
+					 ZSTD_getErrorName(nbytes));
+			break;
+#endif
+		default:
+			Elog("unsupported compression codec: %d", compression_codec);
+	}
+	return nbytes;
+}
+
+static void *
+__compress_worker(void *__job)
+{
+	SQLcompressJob *job = __job;
+	SQLiovec   *iov = job->iov;
+	int			k;
+
+	while ((k = __atomic_fetch_add(&job->next_index, 1,
+								   __ATOMIC_SEQ_CST)) < iov->nraws)
+	{
+		struct iovec *raw = &iov->raws[k];
+		char	   *dest = iov->cbuffer + job->offsets[k];
+		size_t		nbytes;
+
+		job->results[k] = 0;
+		if (raw->iov_len == 0)
+			continue;
+		nbytes = __compress_buffer(dest + sizeof(int64),
+								   job->bounds[k],
+								   raw->iov_base,
+								   raw->iov_len);
+		if (nbytes < raw->iov_len)
+		{
+			*((int64 *)dest) = raw->iov_len;
+			job->results[k] = sizeof(int64) + nbytes;
+		}
+		else
+		{
+			/* stored as is */
+			*((int64 *)dest) = -1L;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * sql_iovec_compress - compresses the raw buffers collected by the
+ * write_buffer handlers, then builds the iovec of the record batch body.
+ * buffers[] are updated according to the compressed length.
+ * It returns the total length of the body.
+ */
+size_t
+sql_iovec_compress(SQLiovec *iov, ArrowBuffer *buffers, int nbuffers)
+{
+	SQLcompressJob job;
+	pthread_t	threads[COMPRESS_MAX_THREADS];
+	size_t		total_len = 0;
+	size_t		total_raw = 0;
+	int			nthreads = 1;
+	int			i, k;
+
+	assert(iov->compress && iov->nraws == nbuffers && iov->length == 0);
+	memset(&job, 0, sizeof(SQLcompressJob));
+	job.iov = iov;
+	job.offsets = palloc(sizeof(size_t) * Max(nbuffers, 1));
+	job.bounds  = palloc(sizeof(size_t) * Max(nbuffers, 1));
+	job.results = palloc(sizeof(size_t) * Max(nbuffers, 1));
+	for (k=0; k < nbuffers; k++)
+	{
+		size_t	len = iov->raws[k].iov_len;
+
+		job.offsets[k] = total_len;
+		job.bounds[k] = (len > 0 ? __compress_bound(len) : 0);
+		if (len > 0)
+			total_len += MAXALIGN(sizeof(int64) + job.bounds[k]);
+		total_raw += len;
+	}
+	if (total_len > 0)
+		iov->cbuffer = palloc(total_len);
+
+	/* compression by multiple threads, if large enough */
+	if (total_raw >= COMPRESS_PARALLEL_MIN_SZ)
+	{
+		long	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nthreads = Min(Max(ncpus, 1), COMPRESS_MAX_THREADS);
+		nthreads = Min(nthreads, nbuffers);
+	}
+	for (i=1; i < nthreads; i++)
+	{
+		if ((errno = pthread_create(&threads[i], NULL,
+									__compress_worker, &job)) != 0)
+			Elog("failed on pthread_create: %m");
+	}
+	__compress_worker(&job);
+	for (i=1; i < nthreads; i++)
+	{
+		if ((errno = pthread_join(threads[i], NULL)) != 0)
+			Elog("failed on pthread_join: %m");
+	}
+
+	/* setup the iovec and buffers */
+	for (k=0; k < nbuffers; k++)
+	{
+		struct iovec *raw = &iov->raws[k];
+		char	   *dest = iov->cbuffer + job.offsets[k];
+
+		buffers[k].offset = iov->length;
+		if (raw->iov_len == 0)
+			;	/* empty buffer */
+		else if (job.results[k] > 0)
+			__sql_iovec_append(iov, dest, job.results[k]);
+		else
+		{
+			__sql_iovec_append(iov, dest, sizeof(int64));
+			__sql_iovec_append(iov, raw->iov_base, raw->iov_len);
+		}
+		buffers[k].length = iov->length - buffers[k].offset;
+		__sql_iovec_padding(iov);
+	}
+	pfree(job.offsets);
+	pfree(job.bounds);
+	pfree(job.results);
+
+	return iov->length;
+}
+
+/*
+ * sql_buffer_decompress - expands a buffer of the record batch body,
+ * compressed according to BodyCompressionMethod::BUFFER.
+ * It returns a palloc'd image of the buffer, or NULL with the reason in
+ * *p_errmsg, if the buffer is corrupted.
+ */
+char *
+sql_buffer_decompress(int codec, const char *src, size_t src_sz,
+					  size_t *p_length, const char **p_errmsg)
+{
+	int64		length;
+	char	   *dest;
+
+	if (src_sz == 0)
+	{
+		*p_length = 0;
+		return palloc(1);
+	}
+	if (src_sz < sizeof(int64))
+	{
+		*p_errmsg = "compressed buffer is shorter than its prefix";
+		return NULL;
+	}
+	memcpy(&length, src, sizeof(int64));
+	src += sizeof(int64);
+	src_sz -= sizeof(int64);
+	if (length == -1)
+	{
+		/* stored as is */
+		dest = palloc(Max(src_sz, 1));
+		memcpy(dest, src, src_sz);
+		*p_length = src_sz;
+		return dest;
+	}
+	if (length < 0)
+	{
+		*p_errmsg = psprintf("uncompressed length %ld is not valid",
+							 (long)length);
+		return NULL;
+	}
+	dest = palloc(Max(length, 1));
+
+	switch (codec)
+	{
+#ifdef HAVE_LIBLZ4
+		case ArrowCompressionType__LZ4_FRAME:
+			{
+				LZ4F_decompressionContext_t dctx;
+				size_t		dest_pos = 0;
+				size_t		rv;
+
+				rv = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+				if (LZ4F_isError(rv))
+					Elog("failed on LZ4F_createDecompressionContext: %s",
+						 LZ4F_getErrorName(rv));
+				do {
+					size_t	dest_len = length - dest_pos;
+					size_t	src_len = src_sz;
+
+					rv = LZ4F_decompress(dctx, dest + dest_pos, &dest_len,
+										 src, &src_len, NULL);
+					if (LZ4F_isError(rv))
+					{
+						*p_errmsg = psprintf("failed on LZ4F_decompress: %s",
+											 LZ4F_getErrorName(rv));
+						break;
+					}
+					dest_pos += dest_len;
+					src += src_len;
+					src_sz -= src_len;
+					if (rv != 0 && dest_len == 0 && src_len == 0)
+					{
+						*p_errmsg = "LZ4 frame is truncated";
+						break;
+					}
+				} while (rv != 0);
+				LZ4F_freeDecompressionContext(dctx);
+				if (rv != 0)
+				{
+					pfree(dest);
+					return NULL;
+				}
+				if (dest_pos != length)
+				{
+					*p_errmsg = psprintf("uncompressed length mismatch (%zu of %ld)",
+										 dest_pos, (long)length);
+					pfree(dest);
+					return NULL;
+				}
+			}
+			break;
+#endif
+#ifdef HAVE_LIBZSTD
+		case ArrowCompressionType__ZSTD:
+			{
+				size_t	nbytes = ZSTD_decompress(dest, length, src, src_sz);
+
+				if (ZSTD_isError(nbytes))
+				{
+					*p_errmsg = psprintf("failed on ZSTD_decompress: %s",
+										 ZSTD_getErrorName(nbytes));
+					pfree(dest);
+					return NULL;
+				}
+				if (nbytes != length)
+				{
+					*p_errmsg = psprintf("uncompressed length mismatch (%zu of %ld)",
+										 nbytes, (long)length);
+					pfree(dest);
+					return NULL;
+				}
+			}
+			break;
+#endif
+		default:
+			*p_errmsg = psprintf("unsupported compression codec: %d", codec);
+			pfree(dest);
+			return NULL;
+	}
+	*p_length = length;
+	return dest;
+}
+
+/*
+ * sql_block_compress - compresses a page of Parquet output, by the codec
+ * of --compress; LZ4_RAW is the block format of LZ4, without the frame.
+ * It returns a palloc'd image, even if it is not shorter than the source,
+ * because Parquet applies the codec to all the pages of the column chunk.
+ */
+char *
+sql_block_compress(const char *src, size_t src_sz, size_t *p_length)
+{
+	char	   *dest = NULL;
+
+	switch (compression_codec)
+	{
+#ifdef HAVE_LIBLZ4
+		case ArrowCompressionType__LZ4_FRAME:
+			{
+				size_t	dest_sz;
+				int		nbytes;
+
+				if (src_sz > LZ4_MAX_INPUT_SIZE)
+					Elog("page is too large for LZ4: %zu", src_sz);
+				dest_sz = LZ4_compressBound(src_sz);
+				dest = palloc(Max(dest_sz, 1));
+				nbytes = LZ4_compress_default(src, dest, src_sz, dest_sz);
+				if (nbytes <= 0 && src_sz > 0)
+					Elog("failed on LZ4_compress_default");
+				*p_length = nbytes;
+			}
+			break;
+#endif
+#ifdef HAVE_LIBZSTD
+		case ArrowCompressionType__ZSTD:
+			{
+				size_t	dest_sz = ZSTD_compressBound(src_sz);
+
+				dest = palloc(dest_sz);
+				*p_length = __compress_buffer(dest, dest_sz, src, src_sz);
+			}
+			break;
+#endif
+		default:
+			Elog("unsupported compression codec: %d", compression_codec);
+	}
+	return dest;
+}
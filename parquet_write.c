@@ -0,0 +1,1004 @@
+/*
+ * parquet_write.c
+ *
+ * routines to write out the SQLtable buffers in Apache Parquet format
+ * (--format=parquet)
+ *
+ * Copyright 2018-2019 (C) KaiGai Kohei <kaigai@heterodb.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the PostgreSQL License. See the LICENSE file.
+ */
+#include "pg2arrow.h"
+#include <math.h>
+
+/*
+ * Each record batch becomes a row group, and each column of the record
+ * batch becomes a column chunk; a dictionary page for the enum and text
+ * dictionary columns, then the data pages (v1) of PARQUET_PAGE_SZ or so.
+ * All the columns are OPTIONAL, so the definition levels are encoded in
+ * the RLE/bit-packed hybrid of bit width 1; it is just the null bitmap of
+ * the column as is. The values are PLAIN encoded, except for the indexes
+ * of the dictionary columns (RLE_DICTIONARY).
+ * The metadata is serialized by Thrift compact protocol.
+ */
+#define PARQUET_PAGE_SZ			(1UL << 20)		/* 1MB */
+#define PARQUET_CREATED_BY		"pg2arrow"
+
+/* parquet::Type */
+#define PQ_TYPE__BOOLEAN		0
+#define PQ_TYPE__INT32			1
+#define PQ_TYPE__INT64			2
+#define PQ_TYPE__FLOAT			4
+#define PQ_TYPE__DOUBLE			5
+#define PQ_TYPE__BYTE_ARRAY		6
+#define PQ_TYPE__FIXED_LEN_BYTE_ARRAY 7
+/* parquet::ConvertedType */
+#define PQ_CONVERTED__NONE		(-1)
+#define PQ_CONVERTED__UTF8		0
+#define PQ_CONVERTED__DECIMAL	5
+#define PQ_CONVERTED__DATE		6
+#define PQ_CONVERTED__TIME_MICROS 8
+#define PQ_CONVERTED__TIMESTAMP_MICROS 10
+#define PQ_CONVERTED__UINT_8	11
+#define PQ_CONVERTED__INT_8		15
+/* parquet::LogicalType; field-id of the union */
+#define PQ_LOGICAL__NONE		0
+#define PQ_LOGICAL__STRING		1
+#define PQ_LOGICAL__DECIMAL		5
+#define PQ_LOGICAL__DATE		6
+#define PQ_LOGICAL__TIME		7
+#define PQ_LOGICAL__TIMESTAMP	8
+#define PQ_LOGICAL__INTEGER		10
+/* parquet::Encoding */
+#define PQ_ENCODING__PLAIN		0
+#define PQ_ENCODING__RLE		3
+#define PQ_ENCODING__RLE_DICTIONARY 8
+/* parquet::PageType */
+#define PQ_PAGE__DATA_PAGE		0
+#define PQ_PAGE__DICTIONARY_PAGE 2
+/* parquet::CompressionCodec */
+#define PQ_CODEC__UNCOMPRESSED	0
+#define PQ_CODEC__ZSTD			6
+#define PQ_CODEC__LZ4_RAW		7
+
+/* type of the thrift compact protocol */
+#define TC_TYPE__BOOLEAN_TRUE	1
+#define TC_TYPE__BOOLEAN_FALSE	2
+#define TC_TYPE__BYTE			3
+#define TC_TYPE__I32			5
+#define TC_TYPE__I64			6
+#define TC_TYPE__BINARY			8
+#define TC_TYPE__LIST			9
+#define TC_TYPE__STRUCT			12
+
+/*
+ * PQbuffer - palloc'd buffer that grows
+ */
+typedef struct
+{
+	char	   *data;
+	size_t		len;
+	size_t		cap;
+} PQbuffer;
+
+static inline void
+pq_reserve(PQbuffer *buf, size_t len)
+{
+	if (buf->len + len > buf->cap)
+	{
+		size_t	cap = Max(buf->cap, 4096);
+
+		while (cap < buf->len + len)
+			cap *= 2;
+		buf->data = (buf->data ? repalloc(buf->data, cap) : palloc(cap));
+		buf->cap = cap;
+	}
+}
+
+static inline void
+pq_append(PQbuffer *buf, const void *src, size_t len)
+{
+	pq_reserve(buf, len);
+	memcpy(buf->data + buf->len, src, len);
+	buf->len += len;
+}
+
+static inline void
+pq_putc(PQbuffer *buf, int c)
+{
+	pq_reserve(buf, 1);
+	buf->data[buf->len++] = c;
+}
+
+static void
+pq_varint(PQbuffer *buf, uint64 value)
+{
+	while (value >= 0x80)
+	{
+		pq_putc(buf, (value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	pq_putc(buf, value);
+}
+
+/*
+ * Thrift compact protocol
+ */
+typedef struct
+{
+	PQbuffer   *buf;
+	int			depth;
+	int16		last_id[16];	/* last field-id for each nested struct */
+} ThriftWriter;
+
+static void
+tc_field(ThriftWriter *tw, int16 id, int type)
+{
+	int16		delta = id - tw->last_id[tw->depth];
+
+	if (delta > 0 && delta <= 15)
+		pq_putc(tw->buf, (delta << 4) | type);
+	else
+	{
+		pq_putc(tw->buf, type);
+		pq_varint(tw->buf, (uint16)((id << 1) ^ (id >> 15)));
+	}
+	tw->last_id[tw->depth] = id;
+}
+
+static void
+tc_i32(ThriftWriter *tw, int16 id, int32 value)
+{
+	tc_field(tw, id, TC_TYPE__I32);
+	pq_varint(tw->buf, ((uint32)value << 1) ^ (uint32)(value >> 31));
+}
+
+static void
+tc_i64(ThriftWriter *tw, int16 id, int64 value)
+{
+	tc_field(tw, id, TC_TYPE__I64);
+	pq_varint(tw->buf, ((uint64)value << 1) ^ (uint64)(value >> 63));
+}
+
+static void
+tc_byte(ThriftWriter *tw, int16 id, int8 value)
+{
+	tc_field(tw, id, TC_TYPE__BYTE);
+	pq_putc(tw->buf, value);
+}
+
+static void
+tc_bool(ThriftWriter *tw, int16 id, bool value)
+{
+	tc_field(tw, id, value ? TC_TYPE__BOOLEAN_TRUE : TC_TYPE__BOOLEAN_FALSE);
+}
+
+static void
+tc_binary(ThriftWriter *tw, int16 id, const void *addr, size_t len)
+{
+	tc_field(tw, id, TC_TYPE__BINARY);
+	pq_varint(tw->buf, len);
+	pq_append(tw->buf, addr, len);
+}
+
+static void
+tc_list(ThriftWriter *tw, int16 id, int elem_type, int nitems)
+{
+	tc_field(tw, id, TC_TYPE__LIST);
+	if (nitems < 15)
+		pq_putc(tw->buf, (nitems << 4) | elem_type);
+	else
+	{
+		pq_putc(tw->buf, 0xf0 | elem_type);
+		pq_varint(tw->buf, nitems);
+	}
+}
+
+/* begins a struct; either a field (id > 0) or an element of the list */
+static void
+tc_struct_begin(ThriftWriter *tw, int16 id)
+{
+	if (id > 0)
+		tc_field(tw, id, TC_TYPE__STRUCT);
+	if (++tw->depth >= lengthof(tw->last_id))
+		Elog("thrift struct nested too deep");
+	tw->last_id[tw->depth] = 0;
+}
+
+static void
+tc_struct_end(ThriftWriter *tw)
+{
+	pq_putc(tw->buf, 0);	/* STOP */
+	tw->depth--;
+}
+
+static void
+tc_empty_struct(ThriftWriter *tw, int16 id)
+{
+	tc_struct_begin(tw, id);
+	tc_struct_end(tw);
+}
+
+/*
+ * PQcolumnType - mapping of the column to Parquet
+ */
+typedef struct
+{
+	int			physical;		/* PQ_TYPE__* */
+	int			type_length;	/* width of FIXED_LEN_BYTE_ARRAY */
+	int			converted;		/* PQ_CONVERTED__* */
+	int			logical;		/* PQ_LOGICAL__* */
+	int			width;			/* width of the values in SQLattribute,
+								 * or 0 for bitmap and varlena */
+} PQcolumnType;
+
+static bool
+__parquetColumnType(SQLattribute *attr, PQcolumnType *t)
+{
+	ArrowType  *type = &attr->arrow_type;
+
+	memset(t, 0, sizeof(PQcolumnType));
+	t->converted = PQ_CONVERTED__NONE;
+	if (attr->subtypes || attr->element)
+		return false;
+	switch (type->tag)
+	{
+		case ArrowNodeTag__Bool:
+			t->physical = PQ_TYPE__BOOLEAN;
+			return true;
+		case ArrowNodeTag__Int:
+			t->width = type->Int.bitWidth / 8;
+			t->physical = (t->width <= sizeof(int32)
+						   ? PQ_TYPE__INT32 : PQ_TYPE__INT64);
+			/* INT_8, INT_16, INT_32, INT_64 or UINT_* */
+			t->converted = ((type->Int.is_signed
+							 ? PQ_CONVERTED__INT_8
+							 : PQ_CONVERTED__UINT_8) +
+							__builtin_ctz(t->width));
+			t->logical = PQ_LOGICAL__INTEGER;
+			return true;
+		case ArrowNodeTag__FloatingPoint:
+			if (type->FloatingPoint.precision == ArrowPrecision__Single)
+			{
+				t->physical = PQ_TYPE__FLOAT;
+				t->width = sizeof(float4);
+				return true;
+			}
+			if (type->FloatingPoint.precision == ArrowPrecision__Double)
+			{
+				t->physical = PQ_TYPE__DOUBLE;
+				t->width = sizeof(float8);
+				return true;
+			}
+			return false;
+		case ArrowNodeTag__Decimal:
+			t->physical = PQ_TYPE__FIXED_LEN_BYTE_ARRAY;
+			t->type_length = type->Decimal.bitWidth / 8;
+			t->width = t->type_length;
+			t->converted = PQ_CONVERTED__DECIMAL;
+			t->logical = PQ_LOGICAL__DECIMAL;
+			return true;
+		case ArrowNodeTag__Date:
+			t->physical = PQ_TYPE__INT32;
+			t->width = sizeof(int32);
+			t->converted = PQ_CONVERTED__DATE;
+			t->logical = PQ_LOGICAL__DATE;
+			return true;
+		case ArrowNodeTag__Time:
+			t->physical = PQ_TYPE__INT64;
+			t->width = sizeof(int64);
+			t->converted = PQ_CONVERTED__TIME_MICROS;
+			t->logical = PQ_LOGICAL__TIME;
+			return true;
+		case ArrowNodeTag__Timestamp:
+			t->physical = PQ_TYPE__INT64;
+			t->width = sizeof(int64);
+			/* TIMESTAMP_MICROS implies the values adjusted to UTC */
+			if (type->Timestamp.timezone)
+				t->converted = PQ_CONVERTED__TIMESTAMP_MICROS;
+			t->logical = PQ_LOGICAL__TIMESTAMP;
+			return true;
+		case ArrowNodeTag__Utf8:
+		case ArrowNodeTag__LargeUtf8:
+			t->physical = PQ_TYPE__BYTE_ARRAY;
+			t->converted = PQ_CONVERTED__UTF8;
+			t->logical = PQ_LOGICAL__STRING;
+			if (attr->enumdict)
+				t->width = sizeof(uint32);		/* index of the label */
+			return true;
+		case ArrowNodeTag__Binary:
+		case ArrowNodeTag__LargeBinary:
+			t->physical = PQ_TYPE__BYTE_ARRAY;
+			return true;
+		default:
+			break;
+	}
+	return false;
+}
+
+static inline bool
+__is_large_offset(SQLattribute *attr)
+{
+	return (attr->arrow_type.tag == ArrowNodeTag__LargeUtf8 ||
+			attr->arrow_type.tag == ArrowNodeTag__LargeBinary);
+}
+
+static inline size_t
+__fetch_offset(SQLattribute *attr, size_t index)
+{
+	if (__is_large_offset(attr))
+		return ((int64 *)attr->values.ptr)[index];
+	return ((uint32 *)attr->values.ptr)[index];
+}
+
+static inline bool
+__row_isvalid(SQLattribute *attr, size_t index)
+{
+	return (((uint8 *)attr->nullmap.ptr)[index >> 3] & (1 << (index & 7))) != 0;
+}
+
+/*
+ * __countValidRows - number of non-null rows in [r0, r1); r0 is multiple of 8
+ */
+static size_t
+__countValidRows(SQLattribute *attr, size_t r0, size_t r1)
+{
+	const uint8 *bitmap = (const uint8 *)attr->nullmap.ptr;
+	size_t		count = 0;
+	size_t		i;
+
+	assert((r0 & 7) == 0);
+	if (attr->nullcount == 0)
+		return r1 - r0;
+	for (i = r0 >> 3; i < (r1 >> 3); i++)
+		count += __builtin_popcount(bitmap[i]);
+	if ((r1 & 7) != 0)
+		count += __builtin_popcount(bitmap[r1 >> 3] & ((1U << (r1 & 7)) - 1));
+	return count;
+}
+
+/*
+ * __nextPageBoundary - end of the data page that begins at r0; it is
+ * multiple of 8, unless the last one, to slice the null bitmap by bytes.
+ */
+static size_t
+__nextPageBoundary(SQLattribute *attr, PQcolumnType *t, size_t r0)
+{
+	size_t		nrows = attr->nitems;
+	size_t		r1;
+
+	if (t->physical == PQ_TYPE__BOOLEAN)
+		r1 = r0 + 8 * PARQUET_PAGE_SZ;
+	else if (t->width > 0)
+		r1 = r0 + Max(PARQUET_PAGE_SZ / t->width, 8);
+	else
+	{
+		/* varlena; walks on the offsets by 8 rows */
+		size_t	head = __fetch_offset(attr, r0);
+
+		r1 = r0;
+		do {
+			r1 = Min(r1 + 8, nrows);
+		} while (r1 < nrows &&
+				 (__fetch_offset(attr, r1) - head) +
+				 sizeof(int32) * (r1 - r0) < PARQUET_PAGE_SZ);
+	}
+	if (r1 >= nrows)
+		return nrows;
+	return Max(r1 & ~7UL, r0 + 8);
+}
+
+/*
+ * __writeDefinitionLevels - definition levels of the rows in [r0, r1),
+ * with the length prefix of the data page v1
+ */
+static void
+__writeDefinitionLevels(PQbuffer *body, SQLattribute *attr,
+						size_t r0, size_t r1, size_t nvalids)
+{
+	size_t		head = body->len;
+	size_t		nrows = r1 - r0;
+	uint32		length = 0;
+
+	pq_append(body, &length, sizeof(uint32));	/* set later */
+	if (nvalids == nrows || nvalids == 0)
+	{
+		/* a RLE run */
+		pq_varint(body, nrows << 1);
+		pq_putc(body, nvalids > 0 ? 1 : 0);
+	}
+	else
+	{
+		/* a bit-packed run; the null bitmap as is */
+		size_t	ngroups = (nrows + 7) / 8;
+
+		pq_varint(body, (ngroups << 1) | 1);
+		pq_append(body, attr->nullmap.ptr + (r0 >> 3), ngroups);
+		if ((nrows & 7) != 0)
+			body->data[body->len - 1] &= (1U << (nrows & 7)) - 1;
+	}
+	length = body->len - head - sizeof(uint32);
+	memcpy(body->data + head, &length, sizeof(uint32));
+}
+
+/*
+ * __writeBitPackedRun - a bit-packed run of the RLE/bit-packed hybrid,
+ * for the dictionary indexes
+ */
+static void
+__writeBitPackedRun(PQbuffer *body, const uint32 *values, size_t nitems,
+					int bit_width)
+{
+	size_t		ngroups = (nitems + 7) / 8;
+	size_t		i;
+	uint64		bits = 0;
+	int			nbits = 0;
+
+	pq_varint(body, (ngroups << 1) | 1);
+	for (i=0; i < 8 * ngroups; i++)
+	{
+		bits |= (uint64)(i < nitems ? values[i] : 0) << nbits;
+		nbits += bit_width;
+		while (nbits >= 8)
+		{
+			pq_putc(body, bits & 0xff);
+			bits >>= 8;
+			nbits -= 8;
+		}
+	}
+	assert(nbits == 0);
+}
+
+static inline int
+__dictionaryBitWidth(int nlabels)
+{
+	return (nlabels <= 1 ? 1 : 32 - __builtin_clz(nlabels - 1));
+}
+
+/*
+ * __writeValues - PLAIN (or RLE_DICTIONARY) encoded non-null values in
+ * [r0, r1)
+ */
+static void
+__writeValues(PQbuffer *body, SQLattribute *attr, PQcolumnType *t,
+			  size_t r0, size_t r1, size_t nvalids, int bit_width)
+{
+	const char *values = attr->values.ptr;
+	bool		has_nulls = (nvalids < r1 - r0);
+	size_t		i;
+
+	if (attr->enumdict)
+	{
+		uint32	   *indexes = palloc(sizeof(uint32) * Max(nvalids, 1));
+		size_t		k = 0;
+
+		for (i=r0; i < r1; i++)
+		{
+			if (!has_nulls || __row_isvalid(attr, i))
+				indexes[k++] = ((const uint32 *)values)[i];
+		}
+		pq_putc(body, bit_width);
+		if (k > 0)
+			__writeBitPackedRun(body, indexes, k, bit_width);
+		pfree(indexes);
+	}
+	else if (t->physical == PQ_TYPE__BOOLEAN)
+	{
+		uint8		bits = 0;
+		size_t		k = 0;
+
+		if (!has_nulls)
+		{
+			pq_append(body, values + (r0 >> 3), (r1 - r0 + 7) / 8);
+			if (((r1 - r0) & 7) != 0)
+				body->data[body->len - 1] &= (1U << ((r1 - r0) & 7)) - 1;
+			return;
+		}
+		for (i=r0; i < r1; i++)
+		{
+			if (!__row_isvalid(attr, i))
+				continue;
+			if (values[i >> 3] & (1 << (i & 7)))
+				bits |= (1 << (k & 7));
+			if ((++k & 7) == 0)
+			{
+				pq_putc(body, bits);
+				bits = 0;
+			}
+		}
+		if ((k & 7) != 0)
+			pq_putc(body, bits);
+	}
+	else if (t->physical == PQ_TYPE__BYTE_ARRAY)
+	{
+		for (i=r0; i < r1; i++)
+		{
+			size_t	head = __fetch_offset(attr, i);
+			uint32	len = __fetch_offset(attr, i+1) - head;
+
+			if (has_nulls && !__row_isvalid(attr, i))
+				continue;
+			pq_append(body, &len, sizeof(uint32));
+			pq_append(body, attr->extra.ptr + head, len);
+		}
+	}
+	else if (t->physical == PQ_TYPE__FIXED_LEN_BYTE_ARRAY)
+	{
+		/* Decimal; big-endian two's complement */
+		int		width = t->width;
+
+		pq_reserve(body, width * nvalids);
+		for (i=r0; i < r1; i++)
+		{
+			const char *src = values + width * i;
+			char	   *dest = body->data + body->len;
+			int			k;
+
+			if (has_nulls && !__row_isvalid(attr, i))
+				continue;
+			for (k=0; k < width; k++)
+				dest[k] = src[width - 1 - k];
+			body->len += width;
+		}
+	}
+	else if (t->width < sizeof(int32))
+	{
+		/* Int8 and Int16 are expanded to INT32 */
+		bool	is_signed = attr->arrow_type.Int.is_signed;
+		int32	value;
+
+		pq_reserve(body, sizeof(int32) * nvalids);
+		for (i=r0; i < r1; i++)
+		{
+			if (has_nulls && !__row_isvalid(attr, i))
+				continue;
+			if (t->width == sizeof(int8))
+				value = (is_signed ? ((const int8 *)values)[i]
+						 : ((const uint8 *)values)[i]);
+			else
+				value = (is_signed ? ((const int16 *)values)[i]
+						 : ((const uint16 *)values)[i]);
+			memcpy(body->data + body->len, &value, sizeof(int32));
+			body->len += sizeof(int32);
+		}
+	}
+	else if (!has_nulls)
+	{
+		pq_append(body, values + t->width * r0, t->width * (r1 - r0));
+	}
+	else
+	{
+		int		width = t->width;
+
+		pq_reserve(body, width * nvalids);
+		for (i=r0; i < r1; i++)
+		{
+			if (!__row_isvalid(attr, i))
+				continue;
+			memcpy(body->data + body->len, values + width * i, width);
+			body->len += width;
+		}
+	}
+}
+
+/*
+ * __writePage - appends a page with header; the body is compressed by
+ * the codec of --compress
+ */
+static void
+__writePage(PQbuffer *out, PQbuffer *body, int page_type,
+			int num_values, int encoding, ParquetColumnChunk *cc)
+{
+	ThriftWriter tw;
+	char	   *image = body->data;
+	size_t		length = body->len;
+	size_t		head = out->len;
+
+	if (compression_codec != COMPRESSION__NONE)
+		image = sql_block_compress(body->data, body->len, &length);
+	if (body->len > PG_INT32_MAX || length > PG_INT32_MAX)
+		Elog("Parquet page is too large (%zu bytes)", body->len);
+
+	memset(&tw, 0, sizeof(ThriftWriter));
+	tw.buf = out;
+	tc_i32(&tw, 1, page_type);
+	tc_i32(&tw, 2, body->len);
+	tc_i32(&tw, 3, length);
+	if (page_type == PQ_PAGE__DATA_PAGE)
+	{
+		tc_struct_begin(&tw, 5);
+		tc_i32(&tw, 1, num_values);
+		tc_i32(&tw, 2, encoding);
+		tc_i32(&tw, 3, PQ_ENCODING__RLE);	/* definition levels */
+		tc_i32(&tw, 4, PQ_ENCODING__RLE);	/* repetition levels */
+		tc_struct_end(&tw);
+	}
+	else
+	{
+		tc_struct_begin(&tw, 7);
+		tc_i32(&tw, 1, num_values);
+		tc_i32(&tw, 2, encoding);
+		tc_struct_end(&tw);
+	}
+	pq_putc(out, 0);	/* STOP of PageHeader */
+	cc->total_uncompressed_size += (out->len - head) + body->len;
+	cc->total_compressed_size += (out->len - head) + length;
+	pq_append(out, image, length);
+	if (image != body->data)
+		pfree(image);
+}
+
+/*
+ * __writeDictionaryPage - labels of the dictionary, PLAIN encoded.
+ * Text dictionary may get new labels concurrently, so the labels are
+ * copied under the lock; they are enough for the indexes of the rows
+ * already in the buffer.
+ */
+static int
+__writeDictionaryPage(PQbuffer *out, PQbuffer *body, SQLdictionary *dict,
+					  ParquetColumnChunk *cc)
+{
+	int			nlabels;
+	int			k;
+
+	body->len = 0;
+	pthread_mutex_lock(&dict->lock);
+	nlabels = dict->nitems;
+	for (k=0; k < nlabels; k++)
+	{
+		uint32	head = ((uint32 *)dict->values.ptr)[k];
+		uint32	len  = ((uint32 *)dict->values.ptr)[k+1] - head;
+
+		pq_append(body, &len, sizeof(uint32));
+		pq_append(body, dict->extra.ptr + head, len);
+	}
+	pthread_mutex_unlock(&dict->lock);
+
+	__writePage(out, body, PQ_PAGE__DICTIONARY_PAGE,
+				nlabels, PQ_ENCODING__PLAIN, cc);
+	return nlabels;
+}
+
+/*
+ * __parquetStatValue - min/max value in the PLAIN encoding, or 0 if none
+ */
+static int
+__parquetStatValue(SQLattribute *attr, PQcolumnType *t,
+				   SQLstat *stat, char *dest)
+{
+	int32		ival;
+	int			k;
+
+	if (!attr->stat_format || attr->enumdict)
+		return 0;
+	switch (t->physical)
+	{
+		case PQ_TYPE__BOOLEAN:
+			dest[0] = (stat->i8 != 0);
+			return 1;
+		case PQ_TYPE__INT32:
+			if (t->width == sizeof(int8))
+				ival = stat->i8;
+			else if (t->width == sizeof(int16))
+				ival = stat->i16;
+			else
+				ival = stat->i32;
+			memcpy(dest, &ival, sizeof(int32));
+			return sizeof(int32);
+		case PQ_TYPE__INT64:
+			memcpy(dest, &stat->i64, sizeof(int64));
+			return sizeof(int64);
+		case PQ_TYPE__FLOAT:
+			if (isnan(stat->f32))
+				return 0;
+			memcpy(dest, &stat->f32, sizeof(float4));
+			return sizeof(float4);
+		case PQ_TYPE__DOUBLE:
+			if (isnan(stat->f64))
+				return 0;
+			memcpy(dest, &stat->f64, sizeof(float8));
+			return sizeof(float8);
+#ifdef PG_INT128_TYPE
+		case PQ_TYPE__FIXED_LEN_BYTE_ARRAY:
+			if (t->type_length != sizeof(int128))
+				return 0;
+			for (k=0; k < sizeof(int128); k++)
+				dest[k] = ((char *)&stat->i128)[sizeof(int128) - 1 - k];
+			return sizeof(int128);
+#endif
+		default:
+			break;
+	}
+	return 0;
+}
+
+/*
+ * __writeColumnChunk - writes out the pages of the column
+ */
+static void
+__writeColumnChunk(PQbuffer *out, PQbuffer *body, SQLattribute *attr,
+				   ParquetColumnChunk *cc)
+{
+	PQcolumnType t;
+	size_t		nrows = attr->nitems;
+	size_t		r0, r1;
+	int			encoding = PQ_ENCODING__PLAIN;
+	int			bit_width = 0;
+
+	if (!__parquetColumnType(attr, &t))
+		Elog("column '%s' of %s is not supported in Parquet output",
+			 attr->attname, attr->arrow_typename);
+	memset(cc, 0, sizeof(ParquetColumnChunk));
+	cc->dictionary_page_offset = -1;
+	cc->num_values = nrows;
+	cc->null_count = attr->nullcount;
+	if (attr->enumdict)
+	{
+		cc->dictionary_page_offset = out->len;
+		bit_width = __dictionaryBitWidth(__writeDictionaryPage(out, body,
+															   attr->enumdict,
+															   cc));
+		encoding = PQ_ENCODING__RLE_DICTIONARY;
+	}
+	cc->data_page_offset = out->len;
+	for (r0 = 0; r0 < nrows; r0 = r1)
+	{
+		size_t	nvalids;
+
+		r1 = __nextPageBoundary(attr, &t, r0);
+		nvalids = __countValidRows(attr, r0, r1);
+		body->len = 0;
+		__writeDefinitionLevels(body, attr, r0, r1, nvalids);
+		__writeValues(body, attr, &t, r0, r1, nvalids, bit_width);
+		__writePage(out, body, PQ_PAGE__DATA_PAGE, r1 - r0, encoding, cc);
+	}
+	if (!attr->min_isnull && !attr->max_isnull)
+	{
+		int		len = __parquetStatValue(attr, &t, &attr->min_value,
+										 cc->min_value);
+
+		if (len > 0 &&
+			__parquetStatValue(attr, &t, &attr->max_value,
+							   cc->max_value) == len)
+			cc->stat_len = len;
+	}
+}
+
+/*
+ * setupParquetRowGroup - builds the row group image of the table on the
+ * iovec, and its metadata on table->rowGroupPending.
+ */
+void
+setupParquetRowGroup(SQLtable *table, SQLiovec *iov, size_t *p_length)
+{
+	ParquetRowGroup *rg;
+	PQbuffer	out;
+	PQbuffer	body;
+	int			j;
+
+	memset(iov, 0, sizeof(SQLiovec));
+	memset(&out, 0, sizeof(PQbuffer));
+	memset(&body, 0, sizeof(PQbuffer));
+	rg = palloc0(offsetof(ParquetRowGroup, columns[table->nfields]));
+	rg->num_rows = table->nitems;
+	rg->nfields = table->nfields;
+	for (j=0; j < table->nfields; j++)
+	{
+		ParquetColumnChunk *cc = &rg->columns[j];
+
+		__writeColumnChunk(&out, &body, &table->attrs[j], cc);
+		rg->total_byte_size += cc->total_uncompressed_size;
+	}
+	if (body.data)
+		pfree(body.data);
+	assert(!table->rowGroupPending);
+	table->rowGroupPending = rg;
+
+	iov->image = out.data;
+	__sql_iovec_append(iov, out.data, out.len);
+	*p_length = out.len;
+}
+
+/*
+ * writeParquetHeader - checks the columns, then writes the magic
+ */
+void
+writeParquetHeader(SQLtable *table)
+{
+	PQcolumnType t;
+	int			j;
+
+	for (j=0; j < table->nfields; j++)
+	{
+		SQLattribute *attr = &table->attrs[j];
+
+		if (!__parquetColumnType(attr, &t))
+			Elog("column '%s' of %s is not supported in Parquet output",
+				 attr->attname, attr->arrow_typename);
+	}
+	if (write(table->fdesc, "PAR1", 4) != 4)
+		Elog("failed on write(2): %m");
+}
+
+static void
+__writeSchemaElement(ThriftWriter *tw, SQLattribute *attr)
+{
+	PQcolumnType t;
+
+	__parquetColumnType(attr, &t);
+	tc_struct_begin(tw, 0);
+	tc_i32(tw, 1, t.physical);
+	if (t.physical == PQ_TYPE__FIXED_LEN_BYTE_ARRAY)
+		tc_i32(tw, 2, t.type_length);
+	tc_i32(tw, 3, 1);		/* OPTIONAL */
+	tc_binary(tw, 4, attr->attname, strlen(attr->attname));
+	if (t.converted != PQ_CONVERTED__NONE)
+		tc_i32(tw, 6, t.converted);
+	if (t.logical == PQ_LOGICAL__DECIMAL)
+	{
+		tc_i32(tw, 7, attr->arrow_type.Decimal.scale);
+		tc_i32(tw, 8, attr->arrow_type.Decimal.precision);
+	}
+	if (t.logical != PQ_LOGICAL__NONE)
+	{
+		tc_struct_begin(tw, 10);	/* LogicalType */
+		switch (t.logical)
+		{
+			case PQ_LOGICAL__DECIMAL:
+				tc_struct_begin(tw, t.logical);
+				tc_i32(tw, 1, attr->arrow_type.Decimal.scale);
+				tc_i32(tw, 2, attr->arrow_type.Decimal.precision);
+				tc_struct_end(tw);
+				break;
+			case PQ_LOGICAL__TIME:
+			case PQ_LOGICAL__TIMESTAMP:
+				tc_struct_begin(tw, t.logical);
+				tc_bool(tw, 1, (t.logical == PQ_LOGICAL__TIMESTAMP &&
+								attr->arrow_type.Timestamp.timezone != NULL));
+				tc_struct_begin(tw, 2);		/* TimeUnit */
+				tc_empty_struct(tw, 2);		/* MICROS */
+				tc_struct_end(tw);
+				tc_struct_end(tw);
+				break;
+			case PQ_LOGICAL__INTEGER:
+				tc_struct_begin(tw, t.logical);
+				tc_byte(tw, 1, attr->arrow_type.Int.bitWidth);
+				tc_bool(tw, 2, attr->arrow_type.Int.is_signed);
+				tc_struct_end(tw);
+				break;
+			default:
+				/* STRING and DATE have no parameters */
+				tc_empty_struct(tw, t.logical);
+				break;
+		}
+		tc_struct_end(tw);
+	}
+	tc_struct_end(tw);
+}
+
+static void
+__writeColumnChunkMeta(ThriftWriter *tw, SQLattribute *attr,
+					   ParquetColumnChunk *cc, int64 base)
+{
+	PQcolumnType t;
+	int64		first_page;
+
+	__parquetColumnType(attr, &t);
+	first_page = base + (cc->dictionary_page_offset >= 0
+						 ? cc->dictionary_page_offset
+						 : cc->data_page_offset);
+	tc_struct_begin(tw, 0);		/* ColumnChunk */
+	tc_i64(tw, 2, first_page);
+	tc_struct_begin(tw, 3);		/* ColumnMetaData */
+	tc_i32(tw, 1, t.physical);
+	if (attr->enumdict)
+	{
+		tc_list(tw, 2, TC_TYPE__I32, 3);
+		pq_varint(tw->buf, PQ_ENCODING__PLAIN << 1);
+		pq_varint(tw->buf, PQ_ENCODING__RLE << 1);
+		pq_varint(tw->buf, PQ_ENCODING__RLE_DICTIONARY << 1);
+	}
+	else
+	{
+		tc_list(tw, 2, TC_TYPE__I32, 2);
+		pq_varint(tw->buf, PQ_ENCODING__PLAIN << 1);
+		pq_varint(tw->buf, PQ_ENCODING__RLE << 1);
+	}
+	tc_list(tw, 3, TC_TYPE__BINARY, 1);
+	pq_varint(tw->buf, strlen(attr->attname));
+	pq_append(tw->buf, attr->attname, strlen(attr->attname));
+	switch (compression_codec)
+	{
+		case ArrowCompressionType__LZ4_FRAME:
+			tc_i32(tw, 4, PQ_CODEC__LZ4_RAW);
+			break;
+		case ArrowCompressionType__ZSTD:
+			tc_i32(tw, 4, PQ_CODEC__ZSTD);
+			break;
+		default:
+			tc_i32(tw, 4, PQ_CODEC__UNCOMPRESSED);
+			break;
+	}
+	tc_i64(tw, 5, cc->num_values);
+	tc_i64(tw, 6, cc->total_uncompressed_size);
+	tc_i64(tw, 7, cc->total_compressed_size);
+	tc_i64(tw, 9, base + cc->data_page_offset);
+	if (cc->dictionary_page_offset >= 0)
+		tc_i64(tw, 11, base + cc->dictionary_page_offset);
+	tc_struct_begin(tw, 12);	/* Statistics */
+	tc_i64(tw, 3, cc->null_count);
+	if (cc->stat_len > 0)
+	{
+		tc_binary(tw, 5, cc->max_value, cc->stat_len);
+		tc_binary(tw, 6, cc->min_value, cc->stat_len);
+	}
+	tc_struct_end(tw);
+	tc_struct_end(tw);
+	tc_struct_end(tw);
+}
+
+/*
+ * writeParquetFooter - writes FileMetaData and the tail of the file
+ */
+ssize_t
+writeParquetFooter(SQLtable *table)
+{
+	ThriftWriter tw;
+	PQbuffer	buf;
+	int64		num_rows = 0;
+	uint32		length;
+	ssize_t		nbytes, offset = 0;
+	int			i, j;
+
+	memset(&buf, 0, sizeof(PQbuffer));
+	memset(&tw, 0, sizeof(ThriftWriter));
+	tw.buf = &buf;
+	for (i=0; i < table->numRecordBatches; i++)
+		num_rows += table->rowGroups[i]->num_rows;
+
+	tc_i32(&tw, 1, 1);			/* version */
+	tc_list(&tw, 2, TC_TYPE__STRUCT, table->nfields + 1);
+	tc_struct_begin(&tw, 0);	/* root of the schema */
+	tc_binary(&tw, 4, "schema", 6);
+	tc_i32(&tw, 5, table->nfields);
+	tc_struct_end(&tw);
+	for (j=0; j < table->nfields; j++)
+		__writeSchemaElement(&tw, &table->attrs[j]);
+	tc_i64(&tw, 3, num_rows);
+	tc_list(&tw, 4, TC_TYPE__STRUCT, table->numRecordBatches);
+	for (i=0; i < table->numRecordBatches; i++)
+	{
+		ParquetRowGroup *rg = table->rowGroups[i];
+		int64		base = table->recordBatches[i].offset;
+
+		tc_struct_begin(&tw, 0);
+		tc_list(&tw, 1, TC_TYPE__STRUCT, rg->nfields);
+		for (j=0; j < rg->nfields; j++)
+			__writeColumnChunkMeta(&tw, &table->attrs[j],
+								   &rg->columns[j], base);
+		tc_i64(&tw, 2, rg->total_byte_size);
+		tc_i64(&tw, 3, rg->num_rows);
+		tc_struct_end(&tw);
+	}
+	tc_binary(&tw, 6, PARQUET_CREATED_BY, strlen(PARQUET_CREATED_BY));
+	pq_putc(&buf, 0);			/* STOP of FileMetaData */
+
+	length = buf.len;
+	pq_append(&buf, &length, sizeof(uint32));
+	pq_append(&buf, "PAR1", 4);
+	while (offset < buf.len)
+	{
+		nbytes = write(table->fdesc, buf.data + offset, buf.len - offset);
+		if (nbytes < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			Elog("failed on write(2): %m");
+		}
+		offset += nbytes;
+	}
+	pfree(buf.data);
+
+	return offset;
+}
@@ -10,21 +10,64 @@
 
 /* static functions */
 #define CURSOR_NAME		"curr_pg2arrow"
-static PGresult *pgsql_begin_query(PGconn *conn, const char *query);
+#define FETCH_MODE__CURSOR		1	/* DECLARE CURSOR + FETCH FORWARD */
+#define FETCH_MODE__ROW			2	/* single row mode */
+#define FETCH_MODE__CHUNK		3	/* chunked rows mode (libpq v17) */
+#define FETCH_MODE__COPY		4	/* COPY ... TO STDOUT (FORMAT binary) */
+static PGresult *pgsql_begin_query(PGconn *conn, const char *query,
+								   const char *snapshot);
 static PGresult *pgsql_next_result(PGconn *conn);
 static void      pgsql_end_query(PGconn *conn);
 
 /* command options */
 static char	   *sql_command = NULL;
+static char	   *sql_table_name = NULL;
+static int		num_workers = 0;
+static int		pipeline_nbufs = 0;
+static int		decode_nthreads = 0;
+static int		fetch_mode = 0;
+static int		fetch_size = 0;
 static char	   *output_filename = NULL;
 static size_t	batch_segment_sz = 0;
+static size_t	memory_limit = 0;
+static size_t	memory_result_budget = 0;	/* per PGresult, in bytes */
+static size_t	memory_row_width = 0;		/* estimated; atomic */
 static char	   *pgsql_hostname = NULL;
 static char	   *pgsql_portno = NULL;
 static char	   *pgsql_username = NULL;
 static int		pgsql_password_prompt = 0;
+static char	   *pgsql_password = NULL;
 static char	   *pgsql_database = NULL;
 static char	   *dump_arrow_filename = NULL;
+static char	   *verify_arrow_filename = NULL;
+static char	   *summary_arrow_filename = NULL;
+static int		summary_format = STATS_FORMAT__TEXT;
+static char	   *load_arrow_filename = NULL;
+static int		use_direct_io = 0;
+static int		append_mode = 0;
+static int		resume_mode = 0;
+static char	   *checkpoint_key = NULL;
+static int		dict_text_max_labels = 0;
+char		   *checkpoint_filename = NULL;
+int				output_format = OUTPUT_FORMAT__ARROW;
+char		   *partition_key = NULL;
+int				batch_boundary = 0;
+int64			batch_boundary_width = 0;
+static char	   *batch_boundary_spec = NULL;
 int				shows_progress = 0;
+int				shows_stats = 0;
+SQLperfStats	perf_stats;
+__thread SQLperfTimer *perf_curr_timer = NULL;
+int				use_large_offset = 0;
+int				use_decimal256 = 0;
+int				numeric_nan_as_null = 0;
+int				use_huge_pages = HUGE_PAGES__OFF;
+int				use_ipc_stream = 0;
+int				compression_codec = COMPRESSION__NONE;
+int				compression_level = 0;
+size_t			shard_max_file_sz = 0;
+size_t			shard_max_nitems = 0;
+static int		arrow_metadata_version = ArrowMetadataVersion__V4;
 
 static void
 usage(void)
@@ -36,13 +79,91 @@ usage(void)
 		  "  -d, --dbname=DBNAME     database name to connect to\n"
 		  "  -c, --command=COMMAND   SQL command to run\n"
 		  "  -f, --file=FILENAME     SQL command from file\n"
-		  "      (-c and -f are exclusive, either of them must be specified)\n"
+		  "  -t, --table=TABLENAME   dump the whole table\n"
+		  "      (-c, -f and -t are exclusive, either of them must be specified)\n"
 		  "  -o, --output=FILENAME   result file in Apache Arrow format\n"
 		  "      (default creates a temporary file)\n"
+		  "      --format=FORMAT     either 'arrow' (default) or 'parquet';\n"
+		  "      each record batch is written as a row group of Parquet, with\n"
+		  "      the codec of --compress. Composite and array columns are not\n"
+		  "      supported in Parquet\n"
+		  "      --stream            writes the Apache Arrow IPC stream format,\n"
+		  "      instead of the file format. FILENAME may be '-' (default) for\n"
+		  "      stdout, or 'tcp://HOST:PORT' to connect to the consumer\n"
+		  "      --append            appends the results to the existing file\n"
+		  "      given by -o, as new record batches; the schema must match\n"
+		  "      --max-file-size=SIZE switches the output to the next file once\n"
+		  "      it reaches SIZE; files are named FILENAME with the sequence\n"
+		  "      number before the suffix, like 'out.0000.arrow'\n"
+		  "      --max-rows-per-file=N switches the output to the next file\n"
+		  "      once it has N rows. Both limits are checked for each record\n"
+		  "      batch, so -s controls the granularity. With -n, each worker\n"
+		  "      writes its own sequence of files, like 'out.1.0000.arrow'\n"
+		  "      --checkpoint[=COLUMN] records the progress to FILENAME.ckpt\n"
+		  "      for each record batch. With COLUMN, the results are ordered by\n"
+		  "      the unique and non-null COLUMN, and the last value is recorded;\n"
+		  "      elsewhere, the number of rows, so the query must return the\n"
+		  "      rows in a deterministic order\n"
+		  "      --resume            continues the dump from FILENAME.ckpt,\n"
+		  "      after the last record batch in the checkpoint\n"
 		  "\n"
 		  "Arrow format options:\n"
 		  "  -s, --segment-size=SIZE size of record batch for each\n"
 		  "      (default is 512MB)\n"
+		  "      --memory-limit=SIZE caps the memory of the record batches and\n"
+		  "      the fetched results, total of all workers; -s is reduced to\n"
+		  "      fit, and the rows per FETCH follow the observed row width\n"
+		  "      --partition-key=COLUMN\n"
+		  "      --batch-boundary=UNIT aligns the record batches to the key\n"
+		  "      ranges of COLUMN; the results are ordered by COLUMN, and a\n"
+		  "      record batch never has rows of two ranges. UNIT is either\n"
+		  "      'hour', 'day', 'month' or 'year' of date or timestamp (in UTC),\n"
+		  "      or N for the ranges of every N of integer, or N days of date.\n"
+		  "      The key must not be null.\n"
+		  "      --large-offset      uses LargeUtf8, LargeBinary and LargeList\n"
+		  "      with 64bit offsets, for record batches larger than 2GB\n"
+		  "      --huge-pages[=MODE] allocates the buffers on huge pages; MODE is\n"
+		  "      'madvise' (default) for transparent huge pages, or 'hugetlb'\n"
+		  "      for the reserved ones\n"
+		  "      --direct-io         writes the record batches with O_DIRECT,\n"
+		  "      aligned to 4KB boundary, bypassing the page cache\n"
+		  "      --compress=CODEC[:LEVEL] compresses the buffers of record\n"
+		  "      batches; CODEC is 'lz4' or 'zstd'\n"
+		  "      --dictionary-text[=N] writes text and varchar columns with\n"
+		  "      dictionary encoding, if the first chunk of the results has at\n"
+		  "      most N distinct values (default: 1000) and repeats them;\n"
+		  "      the dictionary keeps growing if the later rows have more;\n"
+		  "      not available with --fetch-mode=row or copy\n"
+		  "      --decimal256        writes numeric columns as Decimal256,\n"
+		  "      instead of Decimal128, for the values over 38 digits\n"
+		  "      --numeric-nan-as-null writes NaN and Infinity of numeric\n"
+		  "      columns as null, instead of raising an error\n"
+		  "\n"
+		  "Parallel dump options:\n"
+		  "  -n, --num-workers=N     number of worker connections to run\n"
+		  "      the query in parallel, on the snapshot exported by the first\n"
+		  "      one. The SQL command has to contain $(WORKER_ID) and\n"
+		  "      $(N_WORKERS) to split the scan range, unless -t is given;\n"
+		  "      in this case, the table is split by ctid block ranges.\n"
+		  "      --pipeline[=NBUFS]  runs network fetch, decode and file write\n"
+		  "      concurrently, using NBUFS buffer sets per worker (default: 2)\n"
+		  "      --decode-threads=N  decodes the columns of the fetched results\n"
+		  "      by N threads per worker\n"
+		  "\n"
+		  "Fetch options:\n"
+		  "      --fetch-mode=MODE   one of 'cursor' (default), 'row', 'chunk'\n"
+		  "      or 'copy'. 'row' and 'chunk' stream the results by single row\n"
+		  "      mode or chunked rows mode of libpq, instead of the binary cursor.\n"
+		  "      'copy' parses the stream of COPY TO STDOUT (FORMAT binary).\n"
+		  "      --fetch-size=N      number of rows per FETCH or chunk\n"
+		  "      (default: 500000 for cursor, 10000 for chunk)\n"
+		  "\n"
+		  "Load options:\n"
+		  "      --load=FILENAME     loads the arrow file into the table of\n"
+		  "      -t TABLENAME by COPY FROM STDIN (FORMAT binary), instead of\n"
+		  "      the dump. The fields are loaded into the columns with the same\n"
+		  "      names. -n N splits the record batches to N connections; each\n"
+		  "      one commits its own portion.\n"
 		  "\n"
 		  "Connection options:\n"
 		  "  -h, --host=HOSTNAME     database server host\n"
@@ -53,13 +174,123 @@ usage(void)
 		  "\n"
 		  "Debug options:\n"
 		  "      --dump=FILENAME     dump information of arrow file\n"
+		  "      --verify=FILENAME   checks the buffers of arrow file; null\n"
+		  "      bitmaps, offsets and dictionary indexes against the metadata\n"
+		  "      --summary=FILENAME  prints rows, nulls, bytes of the buffers and\n"
+		  "      compression ratio of each column in arrow file\n"
+		  "      --summary-format=FORMAT output of --summary; FORMAT is either\n"
+		  "      'text' (default) or 'json'\n"
 		  "      --progress          shows progress of the job.\n"
+		  "      --stats[=FORMAT]    prints time of the phases (fetch, decode,\n"
+		  "      build and write) and cost of the columns on exit; FORMAT is\n"
+		  "      either 'text' (default) or 'json'\n"
 		  "\n"
 		  "Report bugs to <pgstrom@heterodb.com>.\n",
 		  stderr);
 	exit(1);
 }
 
+/*
+ * parse_size_value - size with optional unit (k, m or g), or 0 if invalid
+ */
+static size_t
+parse_size_value(const char *value)
+{
+	const char *pos = value;
+
+	while (isdigit(*pos))
+		pos++;
+	if (pos == value)
+		return 0;
+	if (*pos == '\0')
+		return atol(value);
+	if (strcasecmp(pos, "k") == 0 || strcasecmp(pos, "kb") == 0)
+		return atol(value) * (1UL << 10);
+	if (strcasecmp(pos, "m") == 0 || strcasecmp(pos, "mb") == 0)
+		return atol(value) * (1UL << 20);
+	if (strcasecmp(pos, "g") == 0 || strcasecmp(pos, "gb") == 0)
+		return atol(value) * (1UL << 30);
+	return 0;
+}
+
+/*
+ * Memory governor (--memory-limit)
+ *
+ * Each worker has an equal share of the limit, except for the fixed
+ * overhead. It holds the record batch being built, the shadow tables of
+ * the pipelined writer, and the compressed image of the batch being
+ * written; the segment size is reduced so that they fit in 3/4 of the
+ * share. The rest is for the PGresults in flight: the current one and the
+ * prefetched ones (--pipeline), if they are fetched by a cursor or chunks.
+ * The number of rows per FETCH follows the widest average row observed,
+ * and the prefetch waits while the queued results fill their budget.
+ * The first FETCH takes MEMORY_PROBE_NROWS rows to learn the row width.
+ */
+#define SEGMENT_SZ_DEFAULT			(1UL << 29)		/* 512MB */
+#define MEMORY_FIXED_OVERHEAD		(64UL << 20)	/* catalog, libpq, I/O */
+#define MEMORY_MIN_SEGMENT_SZ		(1UL << 20)
+/* alignment of the buffers, and the free chunks of the arena */
+#define MEMORY_BATCH_SLACK(sz)		((sz) + (sz) / 4)
+#define MEMORY_PROBE_NROWS			1000
+#define MEMORY_RESULT_CELL_SZ		16	/* PGresAttValue of libpq */
+
+static void
+setupMemoryLimit(void)
+{
+	size_t		share;
+	size_t		segment_sz;
+	int			nbatches = 1;
+	int			nresults = 0;
+
+	if (memory_limit <= 2 * MEMORY_FIXED_OVERHEAD)
+		Elog("--memory-limit must be larger than %luMB",
+			 (2 * MEMORY_FIXED_OVERHEAD) >> 20);
+	share = (memory_limit - MEMORY_FIXED_OVERHEAD) / num_workers;
+	if (pipeline_nbufs > 0)
+		nbatches += pipeline_nbufs - 1;		/* shadow tables */
+	if (compression_codec != COMPRESSION__NONE)
+		nbatches++;							/* compressed image */
+	if (fetch_mode == FETCH_MODE__CURSOR || fetch_mode == FETCH_MODE__CHUNK)
+		nresults = 1 + pipeline_nbufs;
+	segment_sz = (nresults > 0 ? share / 4 * 3 : share) / nbatches;
+	segment_sz = segment_sz / 5 * 4;		/* see MEMORY_BATCH_SLACK */
+	if (segment_sz < MEMORY_MIN_SEGMENT_SZ)
+		Elog("--memory-limit is too small for %d workers with %d buffers each",
+			 num_workers, nbatches);
+	batch_segment_sz = Min(batch_segment_sz, segment_sz);
+	if (nresults > 0)
+		memory_result_budget = (share - nbatches *
+								MEMORY_BATCH_SLACK(batch_segment_sz)) / nresults;
+	if (shows_progress)
+	{
+		/* stdout may be the IPC stream */
+		FILE   *out = (use_ipc_stream ? stderr : stdout);
+
+		fprintf(out, "memory limit: %zuMB per worker, segment-size=%zuMB",
+				share >> 20, batch_segment_sz >> 20);
+		if (nresults > 0)
+			fprintf(out, ", %zuMB per fetched result",
+					memory_result_budget >> 20);
+		fputc('\n', out);
+	}
+}
+
+/*
+ * __partitionKeyCommand - orders the results by --partition-key, to align
+ * the record batches to the key ranges
+ */
+static char *
+__partitionKeyCommand(const char *command)
+{
+	char	   *buffer = pstrdup(command);
+	char	   *pos = buffer + strlen(buffer);
+
+	while (pos > buffer && (isspace((unsigned char)pos[-1]) || pos[-1] == ';'))
+		*--pos = '\0';
+	return psprintf("SELECT * FROM (%s) __part ORDER BY %s",
+					buffer, partition_key);
+}
+
 static void
 parse_options(int argc, char * const argv[])
 {
@@ -67,6 +298,8 @@ parse_options(int argc, char * const argv[])
 		{"dbname",       required_argument,  NULL,  'd' },
 		{"command",      required_argument,  NULL,  'c' },
 		{"file",         required_argument,  NULL,  'f' },
+		{"table",        required_argument,  NULL,  't' },
+		{"num-workers",  required_argument,  NULL,  'n' },
 		{"output",       required_argument,  NULL,  'o' },
 		{"segment-size", required_argument,  NULL,  's' },
 		{"host",         required_argument,  NULL,  'h' },
@@ -76,6 +309,32 @@ parse_options(int argc, char * const argv[])
 		{"password",     no_argument,        NULL,  'W' },
 		{"dump",         required_argument,  NULL, 1000 },
 		{"progress",     no_argument,        NULL, 1001 },
+		{"pipeline",     optional_argument,  NULL, 1002 },
+		{"decode-threads", required_argument, NULL, 1003 },
+		{"fetch-mode",   required_argument,  NULL, 1004 },
+		{"fetch-size",   required_argument,  NULL, 1005 },
+		{"large-offset", no_argument,        NULL, 1006 },
+		{"huge-pages",   optional_argument,  NULL, 1007 },
+		{"direct-io",    no_argument,        NULL, 1008 },
+		{"compress",     required_argument,  NULL, 1009 },
+		{"append",       no_argument,        NULL, 1010 },
+		{"max-file-size", required_argument, NULL, 1011 },
+		{"max-rows-per-file", required_argument, NULL, 1012 },
+		{"stream",       no_argument,        NULL, 1013 },
+		{"dictionary-text", optional_argument, NULL, 1014 },
+		{"decimal256",   no_argument,        NULL, 1015 },
+		{"numeric-nan-as-null", no_argument, NULL, 1016 },
+		{"stats",        optional_argument,  NULL, 1017 },
+		{"verify",       required_argument,  NULL, 1018 },
+		{"load",         required_argument,  NULL, 1019 },
+		{"memory-limit", required_argument,  NULL, 1020 },
+		{"checkpoint",   optional_argument,  NULL, 1021 },
+		{"resume",       no_argument,        NULL, 1022 },
+		{"format",       required_argument,  NULL, 1023 },
+		{"summary",      required_argument,  NULL, 1024 },
+		{"summary-format", required_argument, NULL, 1025 },
+		{"partition-key", required_argument, NULL, 1026 },
+		{"batch-boundary", required_argument, NULL, 1027 },
 		{"help",         no_argument,        NULL, 9999 },
 		{NULL, 0, NULL, 0},
 	};
@@ -83,7 +342,7 @@ parse_options(int argc, char * const argv[])
 	char	   *pos;
 	char	   *sql_file = NULL;
 
-	while ((c = getopt_long(argc, argv, "d:c:f:o:s:n:dh:p:U:wW",
+	while ((c = getopt_long(argc, argv, "d:c:f:t:o:s:n:h:p:U:wW",
 							long_options, NULL)) >= 0)
 	{
 		switch (c)
@@ -96,17 +355,31 @@ parse_options(int argc, char * const argv[])
 			case 'c':
 				if (sql_command)
 					Elog("-c option specified twice");
-				if (sql_file)
-					Elog("-c and -f options are exclusive");
+				if (sql_file || sql_table_name)
+					Elog("-c, -f and -t options are exclusive");
 				sql_command = optarg;
 				break;
 			case 'f':
 				if (sql_file)
 					Elog("-f option specified twice");
-				if (sql_command)
-					Elog("-c and -f options are exclusive");
+				if (sql_command || sql_table_name)
+					Elog("-c, -f and -t options are exclusive");
 				sql_file = optarg;
 				break;
+			case 't':
+				if (sql_table_name)
+					Elog("-t option specified twice");
+				if (sql_command || sql_file)
+					Elog("-c, -f and -t options are exclusive");
+				sql_table_name = optarg;
+				break;
+			case 'n':
+				if (num_workers != 0)
+					Elog("-n option specified twice");
+				num_workers = atoi(optarg);
+				if (num_workers < 1)
+					Elog("number of workers is not valid: %s", optarg);
+				break;
 			case 'o':
 				if (output_filename)
 					Elog("-o option specified twice");
@@ -115,21 +388,8 @@ parse_options(int argc, char * const argv[])
 			case 's':
 				if (batch_segment_sz != 0)
 					Elog("-s option specified twice");
-				pos = optarg;
-				while (isdigit(*pos))
-					pos++;
-				if (*pos == '\0')
-					batch_segment_sz = atol(optarg);
-				else if (strcasecmp(pos, "k") == 0 ||
-						 strcasecmp(pos, "kb") == 0)
-					batch_segment_sz = atol(optarg) * (1UL << 10);
-				else if (strcasecmp(pos, "m") == 0 ||
-						 strcasecmp(pos, "mb") == 0)
-					batch_segment_sz = atol(optarg) * (1UL << 20);
-				else if (strcasecmp(pos, "g") == 0 ||
-						 strcasecmp(pos, "gb") == 0)
-					batch_segment_sz = atol(optarg) * (1UL << 30);
-				else
+				batch_segment_sz = parse_size_value(optarg);
+				if (batch_segment_sz == 0)
 					Elog("segment size is not valid: %s", optarg);
 				break;
 			case 'h':
@@ -165,6 +425,214 @@ parse_options(int argc, char * const argv[])
 			case 1001:		/* --progress */
 				shows_progress = 1;
 				break;
+			case 1002:		/* --pipeline */
+				if (pipeline_nbufs != 0)
+					Elog("--pipeline option specified twice");
+				pipeline_nbufs = (optarg ? atoi(optarg) : 2);
+				if (pipeline_nbufs < 2)
+					Elog("number of buffer sets is not valid: %s", optarg);
+				break;
+			case 1003:		/* --decode-threads */
+				if (decode_nthreads != 0)
+					Elog("--decode-threads option specified twice");
+				decode_nthreads = atoi(optarg);
+				if (decode_nthreads < 1)
+					Elog("number of decode threads is not valid: %s", optarg);
+				break;
+			case 1004:		/* --fetch-mode */
+				if (fetch_mode != 0)
+					Elog("--fetch-mode option specified twice");
+				if (strcmp(optarg, "cursor") == 0)
+					fetch_mode = FETCH_MODE__CURSOR;
+				else if (strcmp(optarg, "row") == 0)
+					fetch_mode = FETCH_MODE__ROW;
+				else if (strcmp(optarg, "copy") == 0)
+					fetch_mode = FETCH_MODE__COPY;
+				else if (strcmp(optarg, "chunk") == 0)
+				{
+#ifdef LIBPQ_HAS_CHUNK_MODE
+					fetch_mode = FETCH_MODE__CHUNK;
+#else
+					Elog("--fetch-mode=chunk requires libpq v17 or later");
+#endif
+				}
+				else
+					Elog("unknown fetch mode: %s", optarg);
+				break;
+			case 1005:		/* --fetch-size */
+				if (fetch_size != 0)
+					Elog("--fetch-size option specified twice");
+				fetch_size = atoi(optarg);
+				if (fetch_size < 1)
+					Elog("fetch size is not valid: %s", optarg);
+				break;
+			case 1006:		/* --large-offset */
+				use_large_offset = 1;
+				break;
+			case 1007:		/* --huge-pages */
+				if (!optarg || strcmp(optarg, "madvise") == 0)
+					use_huge_pages = HUGE_PAGES__MADVISE;
+				else if (strcmp(optarg, "hugetlb") == 0)
+					use_huge_pages = HUGE_PAGES__HUGETLB;
+				else if (strcmp(optarg, "off") == 0)
+					use_huge_pages = HUGE_PAGES__OFF;
+				else
+					Elog("unknown huge pages mode: %s", optarg);
+				break;
+			case 1008:		/* --direct-io */
+				use_direct_io = 1;
+				break;
+			case 1009:		/* --compress */
+				if (compression_codec != COMPRESSION__NONE)
+					Elog("--compress option specified twice");
+				pos = strchr(optarg, ':');
+				if (pos)
+				{
+					*pos++ = '\0';
+					compression_level = atoi(pos);
+				}
+				if (strcmp(optarg, "lz4") == 0)
+				{
+#ifndef HAVE_LIBLZ4
+					Elog("pg2arrow was built without lz4 support");
+#endif
+					compression_codec = ArrowCompressionType__LZ4_FRAME;
+				}
+				else if (strcmp(optarg, "zstd") == 0)
+				{
+#ifndef HAVE_LIBZSTD
+					Elog("pg2arrow was built without zstd support");
+#endif
+					compression_codec = ArrowCompressionType__ZSTD;
+					if (!pos)
+						compression_level = 3;	/* default of zstd */
+				}
+				else
+					Elog("unknown compression codec: %s", optarg);
+				/* BodyCompression is a feature of V5 metadata */
+				arrow_metadata_version = ArrowMetadataVersion__V5;
+				break;
+			case 1010:		/* --append */
+				append_mode = 1;
+				break;
+			case 1011:		/* --max-file-size */
+				if (shard_max_file_sz != 0)
+					Elog("--max-file-size option specified twice");
+				shard_max_file_sz = parse_size_value(optarg);
+				if (shard_max_file_sz == 0)
+					Elog("file size is not valid: %s", optarg);
+				break;
+			case 1012:		/* --max-rows-per-file */
+				if (shard_max_nitems != 0)
+					Elog("--max-rows-per-file option specified twice");
+				shard_max_nitems = atol(optarg);
+				if (atol(optarg) <= 0)
+					Elog("number of rows is not valid: %s", optarg);
+				break;
+			case 1013:		/* --stream */
+				use_ipc_stream = 1;
+				break;
+			case 1014:		/* --dictionary-text */
+				if (!optarg)
+					dict_text_max_labels = 1000;
+				else
+				{
+					dict_text_max_labels = atoi(optarg);
+					if (dict_text_max_labels <= 0)
+						Elog("number of labels is not valid: %s", optarg);
+				}
+				break;
+			case 1015:		/* --decimal256 */
+				use_decimal256 = 1;
+				/* Decimal::bitWidth is a feature of V5 metadata */
+				arrow_metadata_version = ArrowMetadataVersion__V5;
+				break;
+			case 1016:		/* --numeric-nan-as-null */
+				numeric_nan_as_null = 1;
+				break;
+			case 1017:		/* --stats */
+				if (!optarg || strcmp(optarg, "text") == 0)
+					shows_stats = STATS_FORMAT__TEXT;
+				else if (strcmp(optarg, "json") == 0)
+					shows_stats = STATS_FORMAT__JSON;
+				else
+					Elog("unknown --stats format: %s", optarg);
+				break;
+			case 1018:		/* --verify */
+				if (verify_arrow_filename)
+					Elog("--verify option specified twice");
+				verify_arrow_filename = optarg;
+				break;
+			case 1019:		/* --load */
+				if (load_arrow_filename)
+					Elog("--load option specified twice");
+				load_arrow_filename = optarg;
+				break;
+			case 1020:		/* --memory-limit */
+				if (memory_limit != 0)
+					Elog("--memory-limit option specified twice");
+				memory_limit = parse_size_value(optarg);
+				if (memory_limit == 0)
+					Elog("memory limit is not valid: %s", optarg);
+				break;
+			case 1021:		/* --checkpoint */
+				if (checkpoint_filename)
+					Elog("--checkpoint option specified twice");
+				checkpoint_filename = "";	/* set up later */
+				if (optarg)
+					checkpoint_key = optarg;
+				break;
+			case 1022:		/* --resume */
+				resume_mode = 1;
+				break;
+			case 1023:		/* --format */
+				if (strcmp(optarg, "arrow") == 0)
+					output_format = OUTPUT_FORMAT__ARROW;
+				else if (strcmp(optarg, "parquet") == 0)
+					output_format = OUTPUT_FORMAT__PARQUET;
+				else
+					Elog("unknown output format: %s", optarg);
+				break;
+			case 1024:		/* --summary */
+				if (summary_arrow_filename)
+					Elog("--summary option specified twice");
+				summary_arrow_filename = optarg;
+				break;
+			case 1025:		/* --summary-format */
+				if (strcmp(optarg, "text") == 0)
+					summary_format = STATS_FORMAT__TEXT;
+				else if (strcmp(optarg, "json") == 0)
+					summary_format = STATS_FORMAT__JSON;
+				else
+					Elog("unknown --summary-format: %s", optarg);
+				break;
+			case 1026:		/* --partition-key */
+				if (partition_key)
+					Elog("--partition-key option specified twice");
+				partition_key = optarg;
+				break;
+			case 1027:		/* --batch-boundary */
+				if (batch_boundary != 0)
+					Elog("--batch-boundary option specified twice");
+				if (strcmp(optarg, "hour") == 0)
+					batch_boundary = BATCH_BOUNDARY__HOUR;
+				else if (strcmp(optarg, "day") == 0)
+					batch_boundary = BATCH_BOUNDARY__DAY;
+				else if (strcmp(optarg, "month") == 0)
+					batch_boundary = BATCH_BOUNDARY__MONTH;
+				else if (strcmp(optarg, "year") == 0)
+					batch_boundary = BATCH_BOUNDARY__YEAR;
+				else
+				{
+					char   *end;
+
+					batch_boundary = BATCH_BOUNDARY__WIDTH;
+					batch_boundary_width = strtol(optarg, &end, 10);
+					if (*end != '\0' || batch_boundary_width <= 0)
+						Elog("batch boundary is not valid: %s", optarg);
+				}
+				batch_boundary_spec = optarg;
+				break;
 			case 9999:		/* --help */
 			default:
 				usage();
@@ -196,8 +664,85 @@ parse_options(int argc, char * const argv[])
 		readArrowFile(dump_arrow_filename);
 		exit(0);
 	}
+	if (verify_arrow_filename)
+		exit(verifyArrowFile(verify_arrow_filename) == 0 ? 0 : 1);
+	if (summary_arrow_filename)
+		exit(summaryArrowFile(summary_arrow_filename,
+							  summary_format) == 0 ? 0 : 1);
+	if (load_arrow_filename)
+	{
+		if (!sql_table_name)
+			Elog("--load option requires -t, --table=TABLENAME");
+		if (sql_command || sql_file)
+			Elog("--load option cannot be used with -c or -f");
+		if (num_workers == 0)
+			num_workers = 1;
+		return;
+	}
+	if (append_mode && !output_filename)
+		Elog("--append option requires -o, --output=FILENAME");
+	if (use_ipc_stream)
+	{
+		if (append_mode)
+			Elog("--append option cannot be used with --stream");
+		if (shard_max_file_sz > 0 || shard_max_nitems > 0)
+			Elog("--max-file-size and --max-rows-per-file options cannot be used with --stream");
+		if (use_direct_io)
+			Elog("--direct-io option cannot be used with --stream");
+	}
+	else if (output_filename &&
+			 (strcmp(output_filename, "-") == 0 ||
+			  strncmp(output_filename, "tcp://", 6) == 0))
+		Elog("output to '%s' requires --stream, because the file format needs seekable output",
+			 output_filename);
+	if (shard_max_file_sz > 0 || shard_max_nitems > 0)
+	{
+		if (!output_filename)
+			Elog("--max-file-size and --max-rows-per-file options require -o, --output=FILENAME");
+		if (append_mode)
+			Elog("--append option cannot be used with --max-file-size or --max-rows-per-file");
+	}
+	if (output_format == OUTPUT_FORMAT__PARQUET)
+	{
+		if (use_ipc_stream)
+			Elog("--format=parquet cannot be used with --stream");
+		if (append_mode)
+			Elog("--format=parquet cannot be used with --append");
+		if (checkpoint_filename || resume_mode)
+			Elog("--format=parquet cannot be used with --checkpoint or --resume");
+	}
+	if (!partition_key != !batch_boundary)
+		Elog("--partition-key and --batch-boundary options must be used together");
+	if (partition_key && checkpoint_key &&
+		strcmp(partition_key, checkpoint_key) != 0)
+		Elog("--checkpoint=COLUMN must be the --partition-key column, not to break the order of the results");
+	if (resume_mode && !checkpoint_filename)
+		checkpoint_filename = "";	/* --resume implies --checkpoint */
+	if (checkpoint_filename)
+	{
+		if (!output_filename)
+			Elog("--checkpoint option requires -o, --output=FILENAME");
+		if (use_ipc_stream)
+			Elog("--checkpoint option cannot be used with --stream");
+		if (shard_max_file_sz > 0 || shard_max_nitems > 0)
+			Elog("--checkpoint option cannot be used with --max-file-size or --max-rows-per-file");
+		if (num_workers > 1)
+			Elog("--checkpoint option cannot be used with -n, because the workers do not write the record batches in order");
+		checkpoint_filename = psprintf("%s.ckpt", output_filename);
+	}
 	if (batch_segment_sz == 0)
-		batch_segment_sz = (1UL << 29);		/* 512MB in default */
+		batch_segment_sz = SEGMENT_SZ_DEFAULT;
+	if (num_workers == 0)
+		num_workers = 1;
+	if (fetch_mode == 0)
+		fetch_mode = FETCH_MODE__CURSOR;
+	if (fetch_size == 0)
+		fetch_size = (fetch_mode == FETCH_MODE__CHUNK ? 10000 : 500000);
+	if (dict_text_max_labels > 0 && !append_mode &&
+		(fetch_mode == FETCH_MODE__ROW || fetch_mode == FETCH_MODE__COPY))
+		Elog("--dictionary-text option cannot be used with --fetch-mode=row or copy, because their first result has too few rows to sample");
+	if (memory_limit > 0)
+		setupMemoryLimit();
 	if (sql_file)
 	{
 		int			fdesc;
@@ -227,8 +772,22 @@ parse_options(int argc, char * const argv[])
 
 		sql_command = buffer;
 	}
+	else if (sql_table_name)
+	{
+		char	   *buffer = palloc(strlen(sql_table_name) + 100);
+
+		sprintf(buffer, "SELECT * FROM %s", sql_table_name);
+		sql_command = buffer;
+	}
 	else if (!sql_command)
-		Elog("Neither -c nor -f options are specified");
+		Elog("Neither -c, -f nor -t options are specified");
+	if (partition_key)
+		sql_command = __partitionKeyCommand(sql_command);
+
+	if (num_workers > 1 && !sql_table_name &&
+		(!strstr(sql_command, "$(WORKER_ID)") ||
+		 !strstr(sql_command, "$(N_WORKERS)")))
+		Elog("SQL command must contain $(WORKER_ID) and $(N_WORKERS) for parallel dump, unless -t option is specified");
 }
 
 static PGconn *
@@ -266,8 +825,11 @@ pgsql_server_connect(void)
 	}
 	if (pgsql_password_prompt > 0)
 	{
+		/* never prompt twice, even if multiple workers connect */
+		if (!pgsql_password)
+			pgsql_password = pstrdup(getpass("Password: "));
 		keys[index] = "password";
-		values[index] = getpass("Password: ");
+		values[index] = pgsql_password;
 		index++;
 	}
 	keys[index] = "application_name";
@@ -291,16 +853,83 @@ pgsql_server_connect(void)
  * pgsql_begin_query
  */
 static PGresult *
-pgsql_begin_query(PGconn *conn, const char *query)
+pgsql_begin_query(PGconn *conn, const char *query, const char *snapshot)
 {
 	PGresult   *res;
 	char	   *buffer;
 
-	/* set transaction read-only */
-	res = PQexec(conn, "BEGIN READ ONLY");
-	if (PQresultStatus(res) != PGRES_COMMAND_OK)
-		Elog("unable to begin transaction: %s", PQresultErrorMessage(res));
-	PQclear(res);
+	if (!snapshot)
+	{
+		/* set transaction read-only */
+		res = PQexec(conn, "BEGIN READ ONLY");
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			Elog("unable to begin transaction: %s", PQresultErrorMessage(res));
+		PQclear(res);
+	}
+	else
+	{
+		/* import the snapshot exported by the leader connection */
+		res = PQexec(conn, "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY");
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			Elog("unable to begin transaction: %s", PQresultErrorMessage(res));
+		PQclear(res);
+
+		buffer = alloca(strlen(snapshot) + 100);
+		sprintf(buffer, "SET TRANSACTION SNAPSHOT '%s'", snapshot);
+		res = PQexec(conn, buffer);
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			Elog("unable to import snapshot '%s': %s",
+				 snapshot, PQresultErrorMessage(res));
+		PQclear(res);
+	}
+
+	if (fetch_mode == FETCH_MODE__COPY)
+	{
+		PGresult   *desc;
+
+		/* fetch the definition of the results */
+		res = PQprepare(conn, "", query, 0, NULL);
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			Elog("unable to prepare the query: %s", PQresultErrorMessage(res));
+		PQclear(res);
+		desc = PQdescribePrepared(conn, "");
+		if (PQresultStatus(desc) != PGRES_COMMAND_OK)
+			Elog("unable to describe the query: %s",
+				 PQresultErrorMessage(desc));
+		/* kick COPY TO STDOUT */
+		buffer = palloc(strlen(query) + 2048);
+		sprintf(buffer, "COPY (%s) TO STDOUT (FORMAT binary)", query);
+		res = PQexec(conn, buffer);
+		if (PQresultStatus(res) != PGRES_COPY_OUT)
+			Elog("unable to run COPY TO STDOUT: %s",
+				 PQresultErrorMessage(res));
+		PQclear(res);
+		/*
+		 * The result description with no rows; the rows shall be read by
+		 * pgsql_append_copy_results().
+		 */
+		return desc;
+	}
+	else if (fetch_mode != FETCH_MODE__CURSOR)
+	{
+		/* send the query, then receive the results row by row */
+		if (!PQsendQueryParams(conn, query,
+							   0, NULL, NULL, NULL, NULL,
+							   1))	/* results in binary mode */
+			Elog("unable to send query: %s", PQerrorMessage(conn));
+#ifdef LIBPQ_HAS_CHUNK_MODE
+		if (fetch_mode == FETCH_MODE__CHUNK)
+		{
+			if (!PQsetChunkedRowsMode(conn, pgsql_fetch_count()))
+				Elog("unable to set chunked rows mode: %s",
+					 PQerrorMessage(conn));
+		}
+		else
+#endif
+		if (!PQsetSingleRowMode(conn))
+			Elog("unable to set single row mode: %s", PQerrorMessage(conn));
+		return pgsql_next_result(conn);
+	}
 
 	/* declare cursor */
 	buffer = palloc(strlen(query) + 2048);
@@ -314,15 +943,87 @@ pgsql_begin_query(PGconn *conn, const char *query)
 }
 
 /*
- * pgsql_next_result
+ * pgsql_fetch_count - number of rows per FETCH or chunk
+ */
+static int
+pgsql_fetch_count(void)
+{
+	size_t		width;
+
+	if (memory_result_budget == 0)
+		return fetch_size;
+	width = __atomic_load_n(&memory_row_width, __ATOMIC_SEQ_CST);
+	if (width == 0)
+		return Min(fetch_size, MEMORY_PROBE_NROWS);
+	return Max(Min(memory_result_budget / width, fetch_size), 1);
+}
+
+/*
+ * pgsql_result_memory - estimates the memory of the PGresult, then updates
+ * the row width for the next FETCH
+ */
+static size_t
+pgsql_result_memory(PGresult *res)
+{
+	int			i, ntuples = PQntuples(res);
+	int			j, nfields = PQnfields(res);
+	size_t		total = 0;
+	size_t		width, curr;
+
+	if (memory_result_budget == 0 || ntuples == 0)
+		return 0;
+	for (i=0; i < ntuples; i++)
+	{
+		total += sizeof(void *) + MEMORY_RESULT_CELL_SZ * nfields;
+		for (j=0; j < nfields; j++)
+			total += MAXALIGN(PQgetlength(res, i, j) + 1);
+	}
+	width = (total + ntuples - 1) / ntuples;
+	curr = __atomic_load_n(&memory_row_width, __ATOMIC_SEQ_CST);
+	while (curr < width &&
+		   !__atomic_compare_exchange_n(&memory_row_width, &curr, width,
+										false,
+										__ATOMIC_SEQ_CST,
+										__ATOMIC_SEQ_CST));
+	return total;
+}
+
+/*
+ * __pgsql_next_result
  */
 static PGresult *
-pgsql_next_result(PGconn *conn)
+__pgsql_next_result(PGconn *conn)
 {
 	PGresult   *res;
-	/* fetch results per half million rows */
-	res = PQexecParams(conn,
-					   "FETCH FORWARD 500000 FROM " CURSOR_NAME,
+	char		query[200];
+
+	if (fetch_mode != FETCH_MODE__CURSOR)
+	{
+		res = PQgetResult(conn);
+		if (!res)
+			return NULL;
+		switch (PQresultStatus(res))
+		{
+			case PGRES_SINGLE_TUPLE:
+#ifdef LIBPQ_HAS_CHUNK_MODE
+			case PGRES_TUPLES_CHUNK:
+#endif
+				return res;
+			case PGRES_TUPLES_OK:
+				/* end of the results; no rows are contained */
+				PQclear(res);
+				while ((res = PQgetResult(conn)) != NULL)
+					PQclear(res);
+				return NULL;
+			default:
+				Elog("SQL execution failed: %s", PQresultErrorMessage(res));
+		}
+	}
+
+	/* fetch results per half million rows in default */
+	snprintf(query, sizeof(query),
+			 "FETCH FORWARD %d FROM " CURSOR_NAME, pgsql_fetch_count());
+	res = PQexecParams(conn, query,
 					   0, NULL, NULL, NULL, NULL,
 					   1);	/* results in binary mode */
 	if (PQresultStatus(res) != PGRES_TUPLES_OK)
@@ -336,17 +1037,46 @@ pgsql_next_result(PGconn *conn)
 }
 
 /*
- * pgsql_end_query
+ * pgsql_next_result - a round trip to fetch the next results
+ */
+static PGresult *
+pgsql_next_result(PGconn *conn)
+{
+	SQLperfTimer timer;
+	PGresult   *res;
+
+	perf_timer_begin(&timer);
+	res = __pgsql_next_result(conn);
+	perf_update_fetch_max(perf_timer_end(&timer, PERF_PHASE__FETCH, 0));
+	if (res)
+		pgsql_result_memory(res);
+
+	return res;
+}
+
+/*
+ * pgsql_end_query - closes the cursor if any, then the transaction opened
+ * by pgsql_begin_query in every fetch mode. In the streaming modes, the
+ * results are already drained by __pgsql_next_result or COPY.
  */
 static void
 pgsql_end_query(PGconn *conn)
 {
 	PGresult   *res;
-	/* close the cursor */
-	res = PQexec(conn, "CLOSE " CURSOR_NAME);
+
+	if (fetch_mode == FETCH_MODE__CURSOR)
+	{
+		/* close the cursor */
+		res = PQexec(conn, "CLOSE " CURSOR_NAME);
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			Elog("failed on close cursor '%s': %s", CURSOR_NAME,
+				 PQresultErrorMessage(res));
+		PQclear(res);
+	}
+	/* end the read-only transaction */
+	res = PQexec(conn, "COMMIT");
 	if (PQresultStatus(res) != PGRES_COMMAND_OK)
-		Elog("failed on close cursor '%s': %s", CURSOR_NAME,
-			 PQresultErrorMessage(res));
+		Elog("failed on commit transaction: %s", PQresultErrorMessage(res));
 	PQclear(res);
 }
 
@@ -376,8 +1106,15 @@ setupArrowFieldNode(ArrowFieldNode *node, SQLattribute *attr)
 	return count;
 }
 
+/*
+ * setupArrowRecordBatch - builds the RecordBatch message, then fills up
+ * the iovec with the serialized message and the buffers of the attributes.
+ * The first item is the message image. The iovec shall be released by
+ * sql_iovec_release() once it is written.
+ */
 void
-writeArrowRecordBatch(SQLtable *table,
+setupArrowRecordBatch(SQLtable *table,
+					  SQLiovec *iov,
 					  size_t *p_metaLength,
 					  size_t *p_bodyLength)
 {
@@ -408,10 +1145,25 @@ writeArrowRecordBatch(SQLtable *table,
 	}
 	assert(j == table->numBuffers);
 
+	/* collect the buffers; the first item is reserved for the message */
+	memset(iov, 0, sizeof(SQLiovec));
+	iov->nrooms = 2 * table->numBuffers + 1;
+	iov->iov = palloc(sizeof(struct iovec) * iov->nrooms);
+	iov->nitems = 1;
+	iov->compress = (compression_codec != COMPRESSION__NONE);
+	for (i=0; i < table->nfields; i++)
+	{
+		SQLattribute   *attr = &table->attrs[i];
+		attr->write_buffer(attr, iov);
+	}
+	if (iov->compress)
+		bodyLength = sql_iovec_compress(iov, buffers, table->numBuffers);
+	assert(iov->length == bodyLength);
+
 	/* setup Message of Schema */
 	memset(&message, 0, sizeof(ArrowMessage));
 	message.tag = ArrowNodeTag__Message;
-	message.version = ArrowMetadataVersion__V4;
+	message.version = arrow_metadata_version;
 	message.bodyLength = bodyLength;
 
 	rbatch = &message.body.recordBatch;
@@ -421,13 +1173,18 @@ writeArrowRecordBatch(SQLtable *table,
 	rbatch->_num_nodes = table->numFieldNodes;
 	rbatch->buffers = buffers;
 	rbatch->_num_buffers = table->numBuffers;
-	/* serialization */
-	metaLength = writeFlatBufferMessage(table->fdesc, &message);
-	for (i=0; i < table->nfields; i++)
+	if (iov->compress)
 	{
-		SQLattribute   *attr = &table->attrs[i];
-		attr->write_buffer(attr, table->fdesc);
+		rbatch->compression.tag = ArrowNodeTag__BodyCompression;
+		rbatch->compression.codec = compression_codec;
+		rbatch->compression.method = ArrowBodyCompressionMethod__BUFFER;
 	}
+	/* serialization */
+	iov->image = makeFlatBufferMessage(&message, &metaLength);
+	iov->iov[0].iov_base = iov->image;
+	iov->iov[0].iov_len  = metaLength;
+	iov->length += metaLength;
+
 	*p_metaLength = metaLength;
 	*p_bodyLength = bodyLength;
 }
@@ -475,11 +1232,108 @@ setupArrowField(ArrowField *field, SQLattribute *attr)
 		for (i=0; i < sub->nfields; i++)
 			setupArrowField(&field->children[i], &sub->attrs[i]);
 	}
-	//custom_metadata here?
-	//min_values,max_values
 }
 
-static ssize_t
+/*
+ * setupArrowFieldStats - attaches min/max statistics of the column for
+ * each record batch, as custom_metadata of the field in the footer.
+ * 'min_values' and 'max_values' are comma separated list of the values
+ * in the physical representation of Arrow, in order of the recordBatches.
+ * The record batch without statistics (e.g, all nulls) has an empty item
+ * in the list; nothing is attached if no record batch has statistics.
+ */
+static void
+setupArrowFieldStats(ArrowField *field, SQLtable *table, int j)
+{
+	ArrowKeyValue  *kv;
+	char		   *values[2];
+	size_t			len[2] = {0, 0};
+	int				i, k, count = 0;
+
+	if (!table->attrs[j].stat_format || table->numRecordBatches == 0)
+		return;
+	for (i=0; i < table->numRecordBatches; i++)
+	{
+		char  **stats = table->recordStats + 2 * (table->nfields * i + j);
+
+		if (stats[0] && stats[1])
+		{
+			for (k=0; k < 2; k++)
+				len[k] += strlen(stats[k]);
+			count++;
+		}
+		for (k=0; k < 2; k++)
+			len[k]++;
+	}
+	if (count == 0)
+		return;
+	for (k=0; k < 2; k++)
+	{
+		char   *pos = values[k] = palloc(len[k]);
+
+		for (i=0; i < table->numRecordBatches; i++)
+		{
+			char  **stats = table->recordStats + 2 * (table->nfields * i + j);
+
+			if (i > 0)
+				*pos++ = ',';
+			if (stats[0] && stats[1])
+			{
+				strcpy(pos, stats[k]);
+				pos += strlen(stats[k]);
+			}
+		}
+		*pos = '\0';
+	}
+	kv = palloc0(sizeof(ArrowKeyValue) * 2);
+	kv[0].tag = ArrowNodeTag__KeyValue;
+	kv[0].key = "min_values";
+	kv[0]._key_len = strlen(kv[0].key);
+	kv[0].value = values[0];
+	kv[0]._value_len = strlen(values[0]);
+	kv[1].tag = ArrowNodeTag__KeyValue;
+	kv[1].key = "max_values";
+	kv[1]._key_len = strlen(kv[1].key);
+	kv[1].value = values[1];
+	kv[1]._value_len = strlen(values[1]);
+
+	field->custom_metadata = kv;
+	field->_num_custom_metadata = 2;
+}
+
+/*
+ * setupArrowFieldBoundary - attaches 'batch_boundary' to the field of
+ * --partition-key, to tell the readers that each record batch has the
+ * rows of one key range; the range is the one of 'min_values'.
+ * It is not attached if --append adds batches to the file that was not
+ * aligned to the same boundary.
+ */
+static bool		batch_boundary_inherited = true;
+
+static void
+setupArrowFieldBoundary(ArrowField *field, SQLtable *table, int j)
+{
+	ArrowKeyValue  *kv;
+	int				nitems = field->_num_custom_metadata;
+
+	if (!partition_key ||
+		!batch_boundary_inherited ||
+		strcmp(table->attrs[j].attname, partition_key) != 0)
+		return;
+	kv = palloc0(sizeof(ArrowKeyValue) * (nitems + 1));
+	if (nitems > 0)
+		memcpy(kv, field->custom_metadata, sizeof(ArrowKeyValue) * nitems);
+	kv[nitems].tag = ArrowNodeTag__KeyValue;
+	kv[nitems].key = "batch_boundary";
+	kv[nitems]._key_len = strlen(kv[nitems].key);
+	kv[nitems].value = batch_boundary_spec;
+	kv[nitems]._value_len = strlen(batch_boundary_spec);
+
+	field->custom_metadata = kv;
+	field->_num_custom_metadata = nitems + 1;
+}
+
+ssize_t
 writeArrowSchema(SQLtable *table)
 {
 	ArrowMessage	message;
@@ -489,7 +1343,7 @@ writeArrowSchema(SQLtable *table)
 	/* setup Message of Schema */
 	memset(&message, 0, sizeof(ArrowMessage));
 	message.tag = ArrowNodeTag__Message;
-	message.version = ArrowMetadataVersion__V4;
+	message.version = arrow_metadata_version;
 	schema = &message.body.schema;
 	schema->tag = ArrowNodeTag__Schema;
 	schema->endianness = ArrowEndianness__Little;
@@ -501,36 +1355,63 @@ writeArrowSchema(SQLtable *table)
 	return writeFlatBufferMessage(table->fdesc, &message);
 }
 
+/*
+ * __writeArrowDictionaryBatch - writes out the labels of the dictionary
+ * from the 'base' index. If base > 0, it is a delta dictionary batch that
+ * adds the labels to the dictionary already written (--append, or the
+ * text dictionary).
+ * 'block' may be NULL for the IPC stream, because it has no footer.
+ */
 static void
-__writeArrowDictionaryBatch(int fdesc, ArrowBlock *block, SQLdictionary *dict)
+__writeArrowDictionaryBatch(int fdesc, ArrowBlock *block,
+							SQLdictionary *dict, int base)
 {
 	ArrowMessage	message;
 	ArrowDictionaryBatch *dbatch;
 	ArrowRecordBatch *rbatch;
 	ArrowBuffer	   *buffer;
-	loff_t			currPos;
+	loff_t			currPos = 0;
+	int32		   *offsets = (int32 *)dict->values.ptr;
+	int32		   *values = offsets;
+	size_t			values_sz = dict->values.usage;
+	const char	   *extra = dict->extra.ptr;
+	size_t			extra_sz = dict->extra.usage;
+	int				nitems = dict->nitems - base;
 	size_t			metaLength = 0;
 	size_t			bodyLength = 0;
+	int				i;
+
+	assert(base >= 0 && base <= dict->nitems);
+	if (base > 0)
+	{
+		/* offsets are rebased to the first label of the delta */
+		values_sz = sizeof(int32) * (nitems + 1);
+		values = alloca(values_sz);
+		for (i=0; i <= nitems; i++)
+			values[i] = offsets[base + i] - offsets[base];
+		extra += offsets[base];
+		extra_sz = offsets[dict->nitems] - offsets[base];
+	}
 
 	/* setup Message of DictionaryBatch */
 	memset(&message, 0, sizeof(ArrowMessage));
     message.tag = ArrowNodeTag__Message;
-    message.version = ArrowMetadataVersion__V4;
+    message.version = arrow_metadata_version;
 
 	/* DictionaryBatch portion */
 	dbatch = &message.body.dictionaryBatch;
 	dbatch->tag = ArrowNodeTag__DictionaryBatch;
 	dbatch->id = dict->dict_id;
-	dbatch->isDelta = false;
+	dbatch->isDelta = (base > 0);
 
 	/* RecordBatch portion */
 	rbatch = &dbatch->data;
 	rbatch->tag = ArrowNodeTag__RecordBatch;
-	rbatch->length = dict->nitems;
+	rbatch->length = nitems;
 	rbatch->_num_nodes = 1;
     rbatch->nodes = alloca(sizeof(ArrowFieldNode));
 	rbatch->nodes[0].tag = ArrowNodeTag__FieldNode;
-	rbatch->nodes[0].length = dict->nitems;
+	rbatch->nodes[0].length = nitems;
 	rbatch->nodes[0].null_count = 0;
 	rbatch->_num_buffers = 3;	/* empty nullmap + offset + extra buffer */
 	rbatch->buffers = alloca(sizeof(ArrowBuffer) * 3);
@@ -543,32 +1424,38 @@ __writeArrowDictionaryBatch(int fdesc, ArrowBlock *block, SQLdictionary *dict)
 	buffer = &rbatch->buffers[1];
     buffer->tag = ArrowNodeTag__Buffer;
     buffer->offset = bodyLength;
-    buffer->length = ARROWALIGN(dict->values.usage);
+    buffer->length = ARROWALIGN(values_sz);
 	bodyLength += buffer->length;
 	/* buffer:2 - extra buffer */
 	buffer = &rbatch->buffers[2];
 	buffer->tag = ArrowNodeTag__Buffer;
     buffer->offset = bodyLength;
-	buffer->length = ARROWALIGN(dict->extra.usage);
+	buffer->length = ARROWALIGN(extra_sz);
 	bodyLength += buffer->length;
 
 	/* serialization */
 	message.bodyLength = bodyLength;
-	currPos = lseek(fdesc, 0, SEEK_CUR);
-	if (currPos < 0)
-		Elog("unable to get current position of the file");
+	if (block)
+	{
+		currPos = lseek(fdesc, 0, SEEK_CUR);
+		if (currPos < 0)
+			Elog("unable to get current position of the file");
+	}
 	metaLength = writeFlatBufferMessage(fdesc, &message);
-	__write_buffer_common(fdesc, dict->values.ptr, dict->values.usage);
-	__write_buffer_common(fdesc, dict->extra.ptr,  dict->extra.usage);
+	__write_buffer_common(fdesc, values, values_sz);
+	__write_buffer_common(fdesc, extra,  extra_sz);
 
 	/* setup Block of Footer */
-	block->tag = ArrowNodeTag__Block;
-	block->offset = currPos;
-	block->metaDataLength = metaLength;
-	block->bodyLength = bodyLength;
+	if (block)
+	{
+		block->tag = ArrowNodeTag__Block;
+		block->offset = currPos;
+		block->metaDataLength = metaLength;
+		block->bodyLength = bodyLength;
+	}
 }
 
-static void
+void
 writeArrowDictionaryBatches(SQLtable *table)
 {
 	SQLdictionary  *dict;
@@ -580,21 +1467,118 @@ writeArrowDictionaryBatches(SQLtable *table)
 	for (dict = pgsql_dictionary_list, count=0;
 		 dict != NULL;
 		 dict = dict->next, count++);
+	table->numDictionaries = 0;
+	table->dictionaries = palloc0(sizeof(ArrowBlock) * count);
+	if (!table->dictNloaded)
+		table->dictNloaded = palloc0(sizeof(int) * count);
+
+	for (dict = pgsql_dictionary_list, index=0;
+		 dict != NULL;
+		 dict = dict->next, index++)
+	{
+		ArrowBlock *block = table->dictionaries + table->numDictionaries;
+
+		/*
+		 * Labels of the text dictionary may be added by the other workers.
+		 * If empty, it is not written here, because only one non-delta
+		 * dictionary batch is allowed for each id; the first call of
+		 * flushArrowTextDictionaries() writes it instead.
+		 */
+		pthread_mutex_lock(&dict->lock);
+		if (dict->enum_typeid != InvalidOid || dict->nitems > 0)
+		{
+			__writeArrowDictionaryBatch(table->fdesc,
+										use_ipc_stream ? NULL : block,
+										dict, 0);
+			table->numDictionaries++;
+		}
+		table->dictNloaded[index] = dict->nitems;
+		pthread_mutex_unlock(&dict->lock);
+	}
+}
+
+/*
+ * writeArrowDeltaDictionaryBatches - writes out the labels newly added to
+ * the enum types, for --append. The dictionary batches already in the
+ * file are kept as is.
+ */
+static void
+writeArrowDeltaDictionaryBatches(SQLtable *table, ArrowFileInfo *af_info)
+{
+	SQLdictionary  *dict;
+	int				index, count, k;
+
+	count = af_info->footer._num_dictionaries;
+	for (dict = pgsql_dictionary_list, k=0; dict != NULL; dict = dict->next, k++)
+	{
+		if (dict->nitems > dict->nloaded)
+			count++;
+	}
+	if (k > 0)
+		table->dictNloaded = palloc0(sizeof(int) * k);
+	if (count == 0)
+		return;
 	table->numDictionaries = count;
 	table->dictionaries = palloc0(sizeof(ArrowBlock) * count);
+	memcpy(table->dictionaries, af_info->footer.dictionaries,
+		   sizeof(ArrowBlock) * af_info->footer._num_dictionaries);
+	index = af_info->footer._num_dictionaries;
+	for (dict = pgsql_dictionary_list, k=0; dict != NULL; dict = dict->next, k++)
+	{
+		if (dict->nitems > dict->nloaded)
+			__writeArrowDictionaryBatch(table->fdesc,
+										table->dictionaries + index++,
+										dict, dict->nloaded);
+		table->dictNloaded[k] = dict->nitems;
+	}
+	assert(index == count);
+}
+
+/*
+ * flushArrowTextDictionaries - writes out the labels newly added to the
+ * text dictionaries since the last call, as delta dictionary batches.
+ * It is called under the pgsql_writeout_lock, prior to the record batch
+ * that may refer the new labels. The dictNloaded is shared by the tables
+ * that write to the same file.
+ */
+void
+flushArrowTextDictionaries(SQLtable *table)
+{
+	SQLdictionary  *dict;
+	int				index;
 
 	for (dict = pgsql_dictionary_list, index=0;
 		 dict != NULL;
 		 dict = dict->next, index++)
 	{
-		__writeArrowDictionaryBatch(table->fdesc,
-									table->dictionaries + index,
-									dict);
+		ArrowBlock *block = NULL;
+
+		if (dict->enum_typeid != InvalidOid)
+			continue;
+		pthread_mutex_lock(&dict->lock);
+		if (dict->nitems > table->dictNloaded[index])
+		{
+			if (!use_ipc_stream)
+			{
+				int		count = table->numDictionaries + 1;
+
+				if (!table->dictionaries)
+					table->dictionaries = palloc(sizeof(ArrowBlock) * count);
+				else
+					table->dictionaries = repalloc(table->dictionaries,
+												   sizeof(ArrowBlock) * count);
+				block = &table->dictionaries[table->numDictionaries++];
+			}
+			__writeArrowDictionaryBatch(table->fdesc, block, dict,
+										table->dictNloaded[index]);
+			table->dictNloaded[index] = dict->nitems;
+		}
+		pthread_mutex_unlock(&dict->lock);
 	}
 }
 
 static ssize_t
-writeArrowFooter(SQLtable *table)
+__writeArrowFooter(SQLtable *table, int fdesc)
 {
 	ArrowFooter		footer;
 	ArrowSchema	   *schema;
@@ -603,7 +1587,7 @@ writeArrowFooter(SQLtable *table)
 	/* setup Footer */
 	memset(&footer, 0, sizeof(ArrowFooter));
 	footer.tag = ArrowNodeTag__Footer;
-	footer.version = ArrowMetadataVersion__V4;
+	footer.version = arrow_metadata_version;
 	/* setup Schema of Footer */
 	schema = &footer.schema;
 	schema->tag = ArrowNodeTag__Schema;
@@ -611,7 +1595,11 @@ writeArrowFooter(SQLtable *table)
 	schema->fields = alloca(sizeof(ArrowField) * table->nfields);
 	schema->_num_fields = table->nfields;
 	for (i=0; i < table->nfields; i++)
+	{
 		setupArrowField(&schema->fields[i], &table->attrs[i]);
+		setupArrowFieldStats(&schema->fields[i], table, i);
+		setupArrowFieldBoundary(&schema->fields[i], table, i);
+	}
 	/* [dictionaries] */
 	footer.dictionaries = table->dictionaries;
 	footer._num_dictionaries = table->numDictionaries;
@@ -621,66 +1609,1593 @@ writeArrowFooter(SQLtable *table)
 	footer._num_recordBatches = table->numRecordBatches;
 
 	/* serialization */
-	return writeFlatBufferFooter(table->fdesc, &footer);
+	return writeFlatBufferFooter(fdesc, &footer);
+}
+
+ssize_t
+writeArrowFooter(SQLtable *table)
+{
+	return __writeArrowFooter(table, table->fdesc);
 }
 
 /*
- * Entrypoint of pg2arrow
+ * Checkpoint support (--checkpoint, --resume)
+ *
+ * Once a record batch gets written, the checkpoint file (FILENAME.ckpt)
+ * records the end of the batch, the number of rows written and the last
+ * value of the key column, if any, followed by the footer image that
+ * covers the record batches and dictionary batches written so far.
+ * It is replaced atomically by rename(2), after fsync of the output file.
+ *
+ * --resume truncates the output file to the end of the last checkpoint,
+ * puts the saved footer there, then continues the dump as --append with
+ * the rest of the query results; either the rows after the last key, or
+ * the rows after OFFSET of the rows written.
  */
-int main(int argc, char * const argv[])
-{
-	PGconn	   *conn;
-	PGresult   *res;
-	SQLtable   *table = NULL;
-	ssize_t		nbytes;
+#define CHECKPOINT_SIGNATURE	"PG2ARROW CHECKPOINT 1"
 
-	parse_options(argc, argv);
-	/* open PostgreSQL connection */
-	conn = pgsql_server_connect();
-	/* run SQL command */
-	res = pgsql_begin_query(conn, sql_command);
-	if (!res)
-		Elog("SQL command returned an empty result");
-	table = pgsql_create_buffer(conn, res, batch_segment_sz);
-	/* open the output file */
-	if (output_filename)
+static off_t	checkpoint_offset = 0;		/* end of the last record batch */
+static uint64	checkpoint_nitems = 0;		/* rows written by the query */
+static char	   *checkpoint_last_key = NULL;	/* SQL expression of the last key */
+static char	   *checkpoint_footer = NULL;	/* footer image to be restored */
+static size_t	checkpoint_footer_sz = 0;
+static int		checkpoint_key_index = -1;
+
+/*
+ * __checkpointKeyExpr - SQL expression of the key value, from the min/max
+ * statistics in the arrow representation
+ */
+static char *
+__checkpointKeyExpr(SQLattribute *attr, const char *value)
+{
+	int64		ival;
+
+	switch (attr->arrow_type.tag)
 	{
-		table->fdesc = open(output_filename,
-							O_RDWR | O_CREAT | O_TRUNC, 0644);
-		if (table->fdesc < 0)
-			Elog("failed to open '%s'", output_filename);
-		table->filename = output_filename;
+		case ArrowNodeTag__Bool:
+		case ArrowNodeTag__Int:
+			return psprintf("'%s'", value);
+		case ArrowNodeTag__Date:
+			return psprintf("('epoch'::date + %s)", value);
+		case ArrowNodeTag__Time:
+			ival = atol(value);
+			return psprintf("('00:00:00'::time + '%ld seconds %ld microseconds'::interval)",
+							ival / 1000000L, ival % 1000000L);
+		case ArrowNodeTag__Timestamp:
+			/* hours, seconds and microseconds, to fit int32 of each */
+			ival = atol(value);
+			return psprintf("('epoch'::%s + '%ld hours %ld seconds %ld microseconds'::interval)",
+							attr->arrow_type.Timestamp.timezone
+							? "timestamptz" : "timestamp",
+							ival / 3600000000L,
+							(ival % 3600000000L) / 1000000L,
+							ival % 1000000L);
+		case ArrowNodeTag__Decimal:
+			{
+				int		scale = attr->arrow_type.Decimal.scale;
+				bool	negative = (*value == '-');
+				int		len;
+
+				if (negative)
+					value++;
+				len = strlen(value);
+				if (scale <= 0)
+					return psprintf("'%s%s'", negative ? "-" : "", value);
+				if (len <= scale)
+				{
+					char   *zeros = alloca(scale - len + 1);
+
+					memset(zeros, '0', scale - len);
+					zeros[scale - len] = '\0';
+					return psprintf("'%s0.%s%s'", negative ? "-" : "",
+									zeros, value);
+				}
+				return psprintf("'%s%.*s.%s'", negative ? "-" : "",
+								len - scale, value, value + len - scale);
+			}
+		default:
+			break;
+	}
+	return NULL;
+}
+
+/*
+ * setupArrowCheckpoint - loads the checkpoint on --resume, and rewrites
+ * the SQL command to fetch the rest of the results
+ */
+static void
+setupArrowCheckpoint(void)
+{
+	char	   *buffer = NULL;
+	char	   *key = NULL;
+	char	   *pos;
+	char	   *tail;
+	struct stat	st_buf;
+	ssize_t		nbytes, offset = 0;
+	int			fdesc;
+
+	fdesc = open(checkpoint_filename, O_RDONLY);
+	if (fdesc < 0)
+	{
+		if (errno != ENOENT)
+			Elog("failed to open '%s': %m", checkpoint_filename);
+		if (resume_mode)
+			fprintf(stderr, "notice: no checkpoint '%s', so the dump starts from the beginning\n",
+					checkpoint_filename);
+	}
+	else if (!resume_mode)
+	{
+		/* the former checkpoint is stale once the file is truncated */
+		close(fdesc);
+		if (unlink(checkpoint_filename) != 0)
+			Elog("failed on unlink('%s'): %m", checkpoint_filename);
 	}
 	else
 	{
-		char	temp_filename[128];
+		if (fstat(fdesc, &st_buf) != 0)
+			Elog("failed on fstat('%s'): %m", checkpoint_filename);
+		buffer = palloc(st_buf.st_size + 1);
+		while (offset < st_buf.st_size)
+		{
+			nbytes = read(fdesc, buffer + offset, st_buf.st_size - offset);
+			if (nbytes < 0)
+			{
+				if (errno != EINTR)
+					Elog("failed on read('%s'): %m", checkpoint_filename);
+			}
+			else if (nbytes == 0)
+				break;
+			else
+				offset += nbytes;
+		}
+		buffer[offset] = '\0';
+		close(fdesc);
+
+		/* header lines, terminated by an empty line */
+		tail = buffer + offset;
+		pos = strchr(buffer, '\n');
+		if (!pos || strncmp(buffer, CHECKPOINT_SIGNATURE "\n",
+							sizeof(CHECKPOINT_SIGNATURE)) != 0)
+			Elog("'%s' is not a checkpoint of pg2arrow", checkpoint_filename);
+		for (pos++; pos < tail && *pos != '\n'; )
+		{
+			char   *line = pos;
+
+			pos = strchr(line, '\n');
+			if (!pos)
+				Elog("checkpoint '%s' is truncated", checkpoint_filename);
+			*pos++ = '\0';
+			if (strncmp(line, "offset: ", 8) == 0)
+				checkpoint_offset = atol(line + 8);
+			else if (strncmp(line, "nrows: ", 7) == 0)
+				checkpoint_nitems = strtoul(line + 7, NULL, 10);
+			else if (strncmp(line, "key: ", 5) == 0)
+				key = line + 5;
+			else if (strncmp(line, "last: ", 6) == 0)
+				checkpoint_last_key = line + 6;
+			else
+				Elog("checkpoint '%s' has unknown line: %s",
+					 checkpoint_filename, line);
+		}
+		if (pos >= tail)
+			Elog("checkpoint '%s' is truncated", checkpoint_filename);
+		checkpoint_footer = pos + 1;
+		checkpoint_footer_sz = tail - checkpoint_footer;
+		if (checkpoint_offset <= 0 || checkpoint_footer_sz < 10 ||
+			memcmp(tail - 6, "ARROW1", 6) != 0)
+			Elog("checkpoint '%s' is corrupted", checkpoint_filename);
+		if ((key && !checkpoint_key) ||
+			(!key && checkpoint_key) ||
+			(key && strcmp(key, checkpoint_key) != 0))
+			Elog("checkpoint '%s' was made with --checkpoint=%s",
+				 checkpoint_filename, key ? key : "");
+
+		/* truncate the output file, then restore the footer */
+		fdesc = open(output_filename, O_RDWR);
+		if (fdesc < 0)
+			Elog("failed to open '%s': %m", output_filename);
+		if (fstat(fdesc, &st_buf) != 0)
+			Elog("failed on fstat('%s'): %m", output_filename);
+		if (st_buf.st_size < checkpoint_offset)
+			Elog("'%s' is shorter than the checkpoint", output_filename);
+		if (ftruncate(fdesc, checkpoint_offset) != 0)
+			Elog("failed on ftruncate('%s'): %m", output_filename);
+		if (pwrite(fdesc, checkpoint_footer, checkpoint_footer_sz,
+				   checkpoint_offset) != checkpoint_footer_sz)
+			Elog("failed on pwrite('%s'): %m", output_filename);
+		if (fsync(fdesc) != 0)
+			Elog("failed on fsync('%s'): %m", output_filename);
+		close(fdesc);
+		append_mode = 1;
+
+		if (shows_progress)
+			printf("resume from checkpoint: offset=%lu rows=%lu%s%s\n",
+				   checkpoint_offset, checkpoint_nitems,
+				   checkpoint_last_key ? " last=" : "",
+				   checkpoint_last_key ? checkpoint_last_key : "");
+	}
+
+	/* rewrite the SQL command to fetch the rest */
+	buffer = pstrdup(sql_command);
+	pos = buffer + strlen(buffer);
+	while (pos > buffer && (isspace((unsigned char)pos[-1]) || pos[-1] == ';'))
+		*--pos = '\0';
+	if (checkpoint_key && checkpoint_last_key)
+		sql_command = psprintf("SELECT * FROM (%s) __ckpt"
+							   " WHERE %s > %s ORDER BY %s",
+							   buffer, checkpoint_key,
+							   checkpoint_last_key, checkpoint_key);
+	else if (checkpoint_key)
+		sql_command = psprintf("SELECT * FROM (%s) __ckpt ORDER BY %s",
+							   buffer, checkpoint_key);
+	else if (checkpoint_nitems > 0)
+		sql_command = psprintf("SELECT * FROM (%s) __ckpt OFFSET %lu",
+							   buffer, checkpoint_nitems);
+}
+
+/*
+ * lookupCheckpointKey - checks the key column of --checkpoint=COLUMN
+ */
+static void
+lookupCheckpointKey(SQLtable *table)
+{
+	int			j;
+
+	for (j=0; j < table->nfields; j++)
+	{
+		SQLattribute *attr = &table->attrs[j];
 
-		strcpy(temp_filename, "/tmp/XXXXXX.arrow");
-		table->fdesc = mkostemps(temp_filename, 6,
-								 O_RDWR | O_CREAT | O_TRUNC);
-		if (table->fdesc < 0)
-			Elog("failed to open '%s' : %m", temp_filename);
-		table->filename = pstrdup(temp_filename);
-		fprintf(stderr,
-				"notice: -o, --output=FILENAME options was not specified,\n"
-				"        so, a temporary file '%s' was built instead.\n",
-				temp_filename);
+		if (strcmp(attr->attname, checkpoint_key) != 0)
+			continue;
+		if (!attr->stat_format || !__checkpointKeyExpr(attr, "0"))
+			Elog("checkpoint key '%s' must be integer, numeric, date, time or timestamp",
+				 checkpoint_key);
+		checkpoint_key_index = j;
+		return;
 	}
-	/* write header portion */
-	nbytes = write(table->fdesc, "ARROW1\0\0", 8);
-	if (nbytes != 8)
+	Elog("checkpoint key '%s' is not in the results", checkpoint_key);
+}
+
+/*
+ * writeArrowCheckpoint - records the checkpoint after the record batch
+ * at 'index' gets written; 'table' holds the rows of the batch.
+ */
+void
+writeArrowCheckpoint(SQLtable *root, SQLtable *table, int index)
+{
+	ArrowBlock *b = &root->recordBatches[index];
+	char	   *temp_filename;
+	char	   *dir_name;
+	char	   *pos;
+	int			fdesc;
+
+	checkpoint_offset = b->offset + b->metaDataLength + b->bodyLength;
+	checkpoint_nitems += table->nitems;
+	if (checkpoint_key_index >= 0)
+	{
+		SQLattribute *attr = &table->attrs[checkpoint_key_index];
+		char	  **stats = root->recordStats + 2 * root->nfields * index;
+
+		if (attr->nullcount > 0)
+			Elog("checkpoint key '%s' has null values", checkpoint_key);
+		if (stats[2 * checkpoint_key_index + 1])
+			checkpoint_last_key =
+				__checkpointKeyExpr(attr, stats[2 * checkpoint_key_index + 1]);
+	}
+	/* the record batch must be durable prior to the checkpoint */
+	if (fdatasync(root->fdesc) != 0)
+		Elog("failed on fdatasync('%s'): %m", root->filename);
+
+	temp_filename = psprintf("%s.tmp", checkpoint_filename);
+	fdesc = open(temp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fdesc < 0)
+		Elog("failed to open '%s': %m", temp_filename);
+	dprintf(fdesc, CHECKPOINT_SIGNATURE "\n"
+			"offset: %lu\n"
+			"nrows: %lu\n",
+			checkpoint_offset, checkpoint_nitems);
+	if (checkpoint_key)
+		dprintf(fdesc, "key: %s\n", checkpoint_key);
+	if (checkpoint_last_key)
+		dprintf(fdesc, "last: %s\n", checkpoint_last_key);
+	dprintf(fdesc, "\n");
+	__writeArrowFooter(root, fdesc);
+	if (fsync(fdesc) != 0)
+		Elog("failed on fsync('%s'): %m", temp_filename);
+	close(fdesc);
+	if (rename(temp_filename, checkpoint_filename) != 0)
+		Elog("failed on rename('%s'): %m", temp_filename);
+	/* also makes the rename durable */
+	dir_name = pstrdup(checkpoint_filename);
+	pos = strrchr(dir_name, '/');
+	if (!pos)
+		strcpy(dir_name, ".");
+	else if (pos == dir_name)
+		pos[1] = '\0';
+	else
+		*pos = '\0';
+	fdesc = open(dir_name, O_RDONLY);
+	if (fdesc >= 0)
+	{
+		fsync(fdesc);
+		close(fdesc);
+	}
+	pfree(dir_name);
+	pfree(temp_filename);
+}
+
+/*
+ * IPC stream support (--stream)
+ *
+ * The stream begins with the schema and the dictionary batches, then the
+ * record batches follow as soon as they are built. It has neither the
+ * file signature nor the footer, so the consumer can read it from a pipe
+ * or a socket without seek.
+ */
+static int
+openArrowStream(const char *dest)
+{
+	struct addrinfo	hints;
+	struct addrinfo *res, *ai;
+	char	   *host;
+	char	   *port;
+	int			fdesc = -1;
+	int			rc;
+
+	if (!dest || strcmp(dest, "-") == 0)
+		return STDOUT_FILENO;
+	if (strncmp(dest, "tcp://", 6) != 0)
+	{
+		/* regular file or named pipe */
+		fdesc = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fdesc < 0)
+			Elog("failed to open '%s': %m", dest);
+		return fdesc;
+	}
+	/* tcp://HOST:PORT */
+	host = pstrdup(dest + 6);
+	port = strrchr(host, ':');
+	if (!port || port[1] == '\0')
+		Elog("port number is missing: %s", dest);
+	*port++ = '\0';
+	if (host[0] == '[' && port - host > 2 && port[-2] == ']')
+	{
+		/* IPv6 address in brackets */
+		port[-2] = '\0';
+		host++;
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	rc = getaddrinfo(host, port, &hints, &res);
+	if (rc != 0)
+		Elog("failed on getaddrinfo('%s'): %s", dest, gai_strerror(rc));
+	for (ai = res; ai != NULL; ai = ai->ai_next)
+	{
+		fdesc = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fdesc < 0)
+			continue;
+		if (connect(fdesc, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(fdesc);
+		fdesc = -1;
+	}
+	freeaddrinfo(res);
+	if (fdesc < 0)
+		Elog("failed to connect '%s': %m", dest);
+	return fdesc;
+}
+
+static void
+writeArrowStreamEOS(int fdesc)
+{
+	/* continuation token with zero length is the end-of-stream marker */
+	int32		eos[2] = { -1, 0 };
+
+	if (write(fdesc, eos, sizeof(eos)) != sizeof(eos))
 		Elog("failed on write(2): %m");
-	nbytes = writeArrowSchema(table);
-	writeArrowDictionaryBatches(table);
+}
+
+/*
+ * Output sharding support (--max-file-size, --max-rows-per-file)
+ *
+ * Each shard is a complete arrow file with its own schema, dictionary
+ * batches and footer. In parallel dump mode, each worker has its own
+ * sequence of the shards, so the workers do not need to coordinate.
+ */
+static void
+openArrowShardFile(SQLtable *table)
+{
+	const char *suffix = strrchr(output_filename, '.');
+	ssize_t		nbytes;
+	int			len;
+
+	if (!suffix || strchr(suffix, '/'))
+		suffix = output_filename + strlen(output_filename);
+	len = suffix - output_filename;
+	if (num_workers > 1)
+		table->filename = psprintf("%.*s.%d.%04d%s",
+								   len, output_filename,
+								   table->worker_id,
+								   table->shard_id,
+								   suffix);
+	else
+		table->filename = psprintf("%.*s.%04d%s",
+								   len, output_filename,
+								   table->shard_id,
+								   suffix);
+	table->fdesc = open(table->filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (table->fdesc < 0)
+		Elog("failed to open '%s': %m", table->filename);
+	table->recordBatches = NULL;
+	table->numRecordBatches = 0;
+	table->recordStats = NULL;
+	table->rowGroups = NULL;
+	table->shard_nitems = 0;
+
+	/* write header portion */
+	if (output_format == OUTPUT_FORMAT__PARQUET)
+		writeParquetHeader(table);
+	else
+	{
+		nbytes = write(table->fdesc, "ARROW1\0\0", 8);
+		if (nbytes != 8)
+			Elog("failed on write(2): %m");
+		writeArrowSchema(table);
+		writeArrowDictionaryBatches(table);
+	}
+	if (use_direct_io)
+		pgsql_setup_direct_io(table);
+}
+
+static void
+closeArrowShardFile(SQLtable *table)
+{
+	if (output_format == OUTPUT_FORMAT__PARQUET)
+		writeParquetFooter(table);
+	else
+		writeArrowFooter(table);
+	if (table->fdesc_direct >= 0)
+	{
+		close(table->fdesc_direct);
+		table->fdesc_direct = -1;
+	}
+	if (close(table->fdesc) != 0)
+		Elog("failed on close('%s'): %m", table->filename);
+	table->fdesc = -1;
+	if (shows_progress)
+		printf("Shard %s: %d record batches, %zu rows\n",
+			   table->filename,
+			   table->numRecordBatches,
+			   table->shard_nitems);
+}
+
+/*
+ * rotateArrowOutputFile - closes the current shard, then opens the next.
+ * It is called under the pgsql_writeout_lock, after all the record batches
+ * of the current shard are written.
+ */
+void
+rotateArrowOutputFile(SQLtable *table)
+{
+	assert(table->shard_id >= 0);
+	closeArrowShardFile(table);
+	table->shard_id++;
+	openArrowShardFile(table);
+}
+
+/*
+ * Incremental append support (--append)
+ *
+ * New record batches are written over the footer of the existing file,
+ * then the footer is rebuilt with the record batches in the file and the
+ * new ones. The result set must have the identical schema to the file.
+ */
+static bool
+__arrowTypeIsEqual(ArrowType *a, ArrowType *b)
+{
+	if (a->tag != b->tag)
+		return false;
+	switch (a->tag)
+	{
+		case ArrowNodeTag__Int:
+			return (a->Int.bitWidth == b->Int.bitWidth &&
+					a->Int.is_signed == b->Int.is_signed);
+		case ArrowNodeTag__FloatingPoint:
+			return (a->FloatingPoint.precision == b->FloatingPoint.precision);
+		case ArrowNodeTag__Decimal:
+			return (a->Decimal.precision == b->Decimal.precision &&
+					a->Decimal.scale == b->Decimal.scale &&
+					a->Decimal.bitWidth == b->Decimal.bitWidth);
+		case ArrowNodeTag__Date:
+			return (a->Date.unit == b->Date.unit);
+		case ArrowNodeTag__Time:
+			return (a->Time.unit == b->Time.unit &&
+					a->Time.bitWidth == b->Time.bitWidth);
+		case ArrowNodeTag__Timestamp:
+			return (a->Timestamp.unit == b->Timestamp.unit &&
+					a->Timestamp._timezone_len == b->Timestamp._timezone_len &&
+					(a->Timestamp._timezone_len == 0 ||
+					 memcmp(a->Timestamp.timezone,
+							b->Timestamp.timezone,
+							a->Timestamp._timezone_len) == 0));
+		case ArrowNodeTag__Interval:
+			return (a->Interval.unit == b->Interval.unit);
+		case ArrowNodeTag__FixedSizeBinary:
+			return (a->FixedSizeBinary.byteWidth ==
+					b->FixedSizeBinary.byteWidth);
+		default:
+			break;
+	}
+	return true;
+}
+
+static void
+__checkArrowFieldCompatibility(SQLattribute *attr, ArrowField *field)
+{
+	ArrowType  *a = &attr->arrow_type;
+	ArrowType  *b = &field->type;
+	int			i;
+
+	if (field->_name_len != strlen(attr->attname) ||
+		strncmp(field->name, attr->attname, field->_name_len) != 0)
+		Elog("--append: column '%s' does not match to the field '%.*s'",
+			 attr->attname, field->_name_len, field->name);
+	if (!__arrowTypeIsEqual(a, b))
+	{
+		if ((a->tag == ArrowNodeTag__Utf8 &&
+			 b->tag == ArrowNodeTag__LargeUtf8) ||
+			(a->tag == ArrowNodeTag__Binary &&
+			 b->tag == ArrowNodeTag__LargeBinary) ||
+			(a->tag == ArrowNodeTag__List &&
+			 b->tag == ArrowNodeTag__LargeList))
+			Elog("--append: column '%s' was written with --large-offset",
+				 attr->attname);
+		if ((a->tag == ArrowNodeTag__LargeUtf8 &&
+			 b->tag == ArrowNodeTag__Utf8) ||
+			(a->tag == ArrowNodeTag__LargeBinary &&
+			 b->tag == ArrowNodeTag__Binary) ||
+			(a->tag == ArrowNodeTag__LargeList &&
+			 b->tag == ArrowNodeTag__List))
+			Elog("--append: column '%s' was written without --large-offset",
+				 attr->attname);
+		Elog("--append: column '%s' (%s) is not compatible to the field in the file",
+			 attr->attname, attr->arrow_typename);
+	}
+	/* enum types */
+	if ((attr->enumdict != NULL) !=
+		(field->dictionary.indexType.tag == ArrowNodeTag__Int))
+		Elog("--append: column '%s' is not compatible to the dictionary of the field",
+			 attr->attname);
+	if (attr->enumdict)
+	{
+		SQLdictionary  *dict = attr->enumdict;
+
+		if (dict->dict_id < 0)
+			dict->dict_id = field->dictionary.id;
+		else if (dict->dict_id != field->dictionary.id)
+			Elog("--append: column '%s' refers the dictionary %ld, but %d is expected",
+				 attr->attname, field->dictionary.id, dict->dict_id);
+	}
+	/* array type */
+	if (attr->element)
+	{
+		if (field->_num_children != 1)
+			Elog("--append: column '%s' has %d children in the file",
+				 attr->attname, field->_num_children);
+		__checkArrowFieldCompatibility(attr->element, field->children);
+	}
+	/* composite type */
+	if (attr->subtypes)
+	{
+		SQLtable   *sub = attr->subtypes;
+
+		if (field->_num_children != sub->nfields)
+			Elog("--append: column '%s' has %d children in the file, but %d expected",
+				 attr->attname, field->_num_children, sub->nfields);
+		for (i=0; i < sub->nfields; i++)
+			__checkArrowFieldCompatibility(&sub->attrs[i],
+										   &field->children[i]);
+	}
+}
+
+/*
+ * __setupArrowAppendDictionary - rebuilds the dictionary on the labels
+ * already written in the file, as base and delta dictionary batches.
+ */
+static void
+__setupArrowAppendDictionary(SQLdictionary *dict, ArrowFileInfo *af_info)
+{
+	const char **labels;
+	int		   *label_lens;
+	int			nlabels = 0;
+	int			i, k;
+
+	for (i=0; i < af_info->footer._num_dictionaries; i++)
+	{
+		ArrowDictionaryBatch *dbatch = &af_info->dictionaries[i].body.dictionaryBatch;
+
+		if (dbatch->id == dict->dict_id)
+			nlabels += dbatch->data.length;
+	}
+	labels = palloc(sizeof(char *) * Max(nlabels, 1));
+	label_lens = palloc(sizeof(int) * Max(nlabels, 1));
+	nlabels = 0;
+	for (i=0; i < af_info->footer._num_dictionaries; i++)
+	{
+		ArrowDictionaryBatch *dbatch = &af_info->dictionaries[i].body.dictionaryBatch;
+		ArrowRecordBatch *rbatch = &dbatch->data;
+		const char *body = af_info->dictionaryBodies[i];
+		const int32 *offsets;
+		const char *extra;
+
+		if (dbatch->id != dict->dict_id)
+			continue;
+		if (rbatch->compression.tag == ArrowNodeTag__BodyCompression)
+			Elog("--append: compressed dictionary batch is not supported");
+		if (rbatch->_num_buffers != 3 ||
+			rbatch->buffers[1].length < sizeof(int32) * (rbatch->length + 1))
+			Elog("--append: dictionary batch %ld is not valid", dbatch->id);
+		offsets = (const int32 *)(body + rbatch->buffers[1].offset);
+		extra = body + rbatch->buffers[2].offset;
+		if (!dbatch->isDelta)
+			nlabels = 0;
+		for (k=0; k < rbatch->length; k++)
+		{
+			if (offsets[k] > offsets[k+1] ||
+				offsets[k+1] > rbatch->buffers[2].length)
+				Elog("--append: dictionary batch %ld is corrupted", dbatch->id);
+			labels[nlabels] = extra + offsets[k];
+			label_lens[nlabels] = offsets[k+1] - offsets[k];
+			nlabels++;
+		}
+	}
+	pgsql_rebase_dictionary(dict, nlabels, labels, label_lens);
+}
+
+/*
+ * __setupArrowAppendStats - loads the min/max statistics of the record
+ * batches in the file, from the custom_metadata of the footer. An empty
+ * item means the record batch has no statistics.
+ */
+static void
+__setupArrowAppendStats(SQLtable *table, ArrowFileInfo *af_info)
+{
+	int			nbatches = table->numRecordBatches;
+	int			i, j, k, n;
+
+	if (nbatches == 0)
+		return;
+	table->recordStats = palloc0(sizeof(char *) * 2 * table->nfields * nbatches);
+	for (j=0; j < table->nfields; j++)
+	{
+		ArrowField *field = &af_info->footer.schema.fields[j];
+		const char *values[2] = {NULL, NULL};
+		int			values_len[2] = {0, 0};
+		char	  **stats;
+
+		if (partition_key && strcmp(field->name, partition_key) == 0)
+			batch_boundary_inherited = false;	/* unless the same one */
+		for (k=0; k < field->_num_custom_metadata; k++)
+		{
+			ArrowKeyValue *kv = &field->custom_metadata[k];
+
+			if (partition_key &&
+				strcmp(field->name, partition_key) == 0 &&
+				kv->_key_len == 14 &&
+				strncmp(kv->key, "batch_boundary", 14) == 0 &&
+				kv->_value_len == strlen(batch_boundary_spec) &&
+				strncmp(kv->value, batch_boundary_spec, kv->_value_len) == 0)
+				batch_boundary_inherited = true;
+			if (kv->_key_len == 10 && strncmp(kv->key, "min_values", 10) == 0)
+			{
+				values[0] = kv->value;
+				values_len[0] = kv->_value_len;
+			}
+			else if (kv->_key_len == 10 && strncmp(kv->key, "max_values", 10) == 0)
+			{
+				values[1] = kv->value;
+				values_len[1] = kv->_value_len;
+			}
+		}
+		if (!values[0] || !values[1])
+			continue;
+		for (k=0; k < 2; k++)
+		{
+			const char *pos = values[k];
+			const char *end = values[k] + values_len[k];
+
+			for (i=0; i < nbatches && pos <= end; i++)
+			{
+				const char *tail = memchr(pos, ',', end - pos);
+
+				if (!tail)
+					tail = end;
+				stats = table->recordStats + 2 * (table->nfields * i + j);
+				if (tail > pos)
+				{
+					stats[k] = palloc(tail - pos + 1);
+					memcpy(stats[k], pos, tail - pos);
+					stats[k][tail - pos] = '\0';
+				}
+				pos = tail + 1;
+			}
+			if (i < nbatches || pos <= end)
+			{
+				/* number of the items mismatch; drop them */
+				for (n=0; n < nbatches; n++)
+				{
+					stats = table->recordStats + 2 * (table->nfields * n + j);
+					stats[0] = stats[1] = NULL;
+				}
+				break;
+			}
+		}
+	}
+}
+
+static void
+setupArrowAppend(SQLtable *table, ArrowFileInfo *af_info)
+{
+	ArrowSchema	   *schema = &af_info->footer.schema;
+	SQLdictionary  *dict;
+	SQLdictionary  *curr;
+	int				j;
+
+	if (schema->_num_fields != table->nfields)
+		Elog("--append: number of columns (%d) does not match to the file (%d)",
+			 table->nfields, schema->_num_fields);
+	for (dict = pgsql_dictionary_list; dict != NULL; dict = dict->next)
+		dict->dict_id = -1;
+	for (j=0; j < table->nfields; j++)
+		__checkArrowFieldCompatibility(&table->attrs[j], &schema->fields[j]);
+	for (dict = pgsql_dictionary_list; dict != NULL; dict = dict->next)
+	{
+		for (curr = dict->next; curr != NULL; curr = curr->next)
+		{
+			if (dict->dict_id == curr->dict_id)
+				Elog("--append: dictionary %d is shared by different enum types",
+					 dict->dict_id);
+		}
+		__setupArrowAppendDictionary(dict, af_info);
+	}
+	/* record batches already in the file */
+	if (af_info->footer._num_recordBatches > 0)
+	{
+		table->recordBatches = af_info->footer.recordBatches;
+		table->numRecordBatches = af_info->footer._num_recordBatches;
+		__setupArrowAppendStats(table, af_info);
+	}
+	/* metadata version must not go back */
+	arrow_metadata_version = Max(arrow_metadata_version,
+								 af_info->footer.version);
+}
+
+/*
+ * Parallel dump support
+ */
+typedef struct
+{
+	int			worker_id;
+	PGconn	   *conn;
+	PGresult   *res;		/* the first chunk of the results */
+	SQLtable   *table;		/* NULL, if worker got an empty result */
+	pthread_t	thread;
+	/* prefetch of the results, if --pipeline */
+	pthread_t	fetch_thread;
+	pthread_mutex_t fetch_lock;
+	pthread_cond_t	fetch_cond;
+	PGresult  **fetch_queue;	/* ring buffer of pipeline_nbufs entries */
+	size_t	   *fetch_sizes;	/* estimated memory of the queued results */
+	size_t		fetch_nbytes;
+	int			fetch_head;
+	int			fetch_nitems;
+	bool		fetch_done;
+} pgsqlWorker;
+
+/*
+ * pgsql_export_snapshot - begins a transaction on the leader connection,
+ * then exports its snapshot for the worker connections.
+ */
+static char *
+pgsql_export_snapshot(PGconn *conn)
+{
+	PGresult   *res;
+	char	   *snapshot;
+
+	res = PQexec(conn, "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY");
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		Elog("unable to begin transaction: %s", PQresultErrorMessage(res));
+	PQclear(res);
+
+	res = PQexec(conn, "SELECT pg_catalog.pg_export_snapshot()");
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		Elog("unable to export snapshot: %s", PQresultErrorMessage(res));
+	if (PQntuples(res) != 1 || PQgetisnull(res, 0, 0))
+		Elog("unexpected result of pg_export_snapshot()");
+	snapshot = pstrdup(PQgetvalue(res, 0, 0));
+	PQclear(res);
+
+	return snapshot;
+}
+
+/*
+ * pgsql_table_nblocks - number of blocks of the table to be dumped
+ */
+static uint32
+pgsql_table_nblocks(PGconn *conn, const char *table_name)
+{
+	PGresult   *res;
+	char	   *ident;
+	char	   *query;
+	uint32		nblocks;
+
+	ident = PQescapeLiteral(conn, table_name, strlen(table_name));
+	if (!ident)
+		Elog("failed on PQescapeLiteral: %s", PQerrorMessage(conn));
+	query = alloca(strlen(ident) + 200);
+	sprintf(query,
+			"SELECT pg_catalog.pg_relation_size(%s::regclass) /"
+			"       pg_catalog.current_setting('block_size')::int",
+			ident);
+	PQfreemem(ident);
+
+	res = PQexec(conn, query);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		Elog("unable to get size of the table '%s': %s",
+			 table_name, PQresultErrorMessage(res));
+	if (PQntuples(res) != 1 || PQgetisnull(res, 0, 0))
+		Elog("unexpected result of pg_relation_size()");
+	nblocks = strtoul(PQgetvalue(res, 0, 0), NULL, 10);
+	PQclear(res);
+
+	return nblocks;
+}
+
+/*
+ * pgsql_worker_command - constructs the SQL command for each worker
+ */
+static char *
+pgsql_worker_command(int worker_id, uint32 nblocks)
+{
+	char	   *buffer;
+	const char *src;
+	char	   *dst;
+	size_t		len;
+
+	if (sql_table_name && num_workers > 1)
+	{
+		uint32	lower = ((uint64)nblocks * worker_id) / num_workers;
+		uint32	upper = ((uint64)nblocks * (worker_id+1)) / num_workers;
+
+		buffer = palloc(strlen(sql_table_name) + 200);
+		if (worker_id == 0)
+			sprintf(buffer, "SELECT * FROM %s"
+					" WHERE ctid < '(%u,0)'::tid",
+					sql_table_name, upper);
+		else if (worker_id == num_workers - 1)
+			sprintf(buffer, "SELECT * FROM %s"
+					" WHERE ctid >= '(%u,0)'::tid",
+					sql_table_name, lower);
+		else
+			sprintf(buffer, "SELECT * FROM %s"
+					" WHERE ctid >= '(%u,0)'::tid"
+					"   AND ctid <  '(%u,0)'::tid",
+					sql_table_name, lower, upper);
+		if (partition_key)
+			buffer = __partitionKeyCommand(buffer);
+		return buffer;
+	}
+
+	/* replace $(WORKER_ID) and $(N_WORKERS) */
+	len = strlen(sql_command);
+	buffer = palloc(2 * len + 100);
+	for (src = sql_command, dst = buffer; *src != '\0'; )
+	{
+		if (strncmp(src, "$(WORKER_ID)", 12) == 0)
+		{
+			dst += sprintf(dst, "%d", worker_id);
+			src += 12;
+		}
+		else if (strncmp(src, "$(N_WORKERS)", 12) == 0)
+		{
+			dst += sprintf(dst, "%d", num_workers);
+			src += 12;
+		}
+		else
+			*dst++ = *src++;
+	}
+	*dst = '\0';
+
+	return buffer;
+}
+
+/*
+ * pgsql_fetch_main - keeps the next results in-flight, if --pipeline
+ */
+static void *
+pgsql_fetch_main(void *__worker)
+{
+	pgsqlWorker *worker = __worker;
+	PGresult   *res;
+
 	do {
-		pgsql_append_results(table, res);
-		PQclear(res);
-		res = pgsql_next_result(conn);
+		if (memory_result_budget > 0)
+		{
+			/*
+			 * --memory-limit; the next FETCH has to wait for the room,
+			 * apart from the result under decoding
+			 */
+			pthread_mutex_lock(&worker->fetch_lock);
+			while (worker->fetch_nitems > 0 &&
+				   worker->fetch_nbytes > (memory_result_budget *
+										   (pipeline_nbufs - 1)))
+				pthread_cond_wait(&worker->fetch_cond, &worker->fetch_lock);
+			pthread_mutex_unlock(&worker->fetch_lock);
+		}
+		res = pgsql_next_result(worker->conn);
+
+		pthread_mutex_lock(&worker->fetch_lock);
+		while (worker->fetch_nitems >= pipeline_nbufs)
+			pthread_cond_wait(&worker->fetch_cond, &worker->fetch_lock);
+		if (!res)
+			worker->fetch_done = true;
+		else
+		{
+			int		index = ((worker->fetch_head +
+							  worker->fetch_nitems) % pipeline_nbufs);
+			worker->fetch_queue[index] = res;
+			worker->fetch_sizes[index] = (PQntuples(res) *
+										  __atomic_load_n(&memory_row_width,
+														  __ATOMIC_SEQ_CST));
+			worker->fetch_nbytes += worker->fetch_sizes[index];
+			worker->fetch_nitems++;
+		}
+		pthread_cond_broadcast(&worker->fetch_cond);
+		pthread_mutex_unlock(&worker->fetch_lock);
 	} while (res != NULL);
-	pgsql_end_query(conn);
-	if (table->nitems > 0)
-		pgsql_writeout_buffer(table);
-	nbytes = writeArrowFooter(table);
+
+	return NULL;
+}
+
+/*
+ * pgsql_worker_next_result
+ */
+static PGresult *
+pgsql_worker_next_result(pgsqlWorker *worker)
+{
+	PGresult   *res = NULL;
+
+	if (pipeline_nbufs == 0)
+		return pgsql_next_result(worker->conn);
+
+	pthread_mutex_lock(&worker->fetch_lock);
+	while (worker->fetch_nitems == 0 && !worker->fetch_done)
+		pthread_cond_wait(&worker->fetch_cond, &worker->fetch_lock);
+	if (worker->fetch_nitems > 0)
+	{
+		res = worker->fetch_queue[worker->fetch_head];
+		worker->fetch_nbytes -= worker->fetch_sizes[worker->fetch_head];
+		worker->fetch_head = (worker->fetch_head + 1) % pipeline_nbufs;
+		worker->fetch_nitems--;
+		pthread_cond_broadcast(&worker->fetch_cond);
+	}
+	pthread_mutex_unlock(&worker->fetch_lock);
+
+	return res;
+}
+
+/*
+ * pgsql_worker_main - fetch and write out the results of a worker
+ */
+static void *
+pgsql_worker_main(void *__worker)
+{
+	pgsqlWorker *worker = __worker;
+	SQLtable   *table = worker->table;
+	PGresult   *res = worker->res;
+
+	if (table && fetch_mode == FETCH_MODE__COPY)
+	{
+		/* COPY stream is directly parsed, no need to prefetch */
+		PQclear(res);
+		pgsql_append_copy_results(table, worker->conn);
+		if (table->nitems > 0)
+			pgsql_writeout_buffer(table);
+		pgsql_shutdown_decoder(table);
+	}
+	else if (table)
+	{
+		if (pipeline_nbufs > 0)
+		{
+			pthread_mutex_init(&worker->fetch_lock, NULL);
+			pthread_cond_init(&worker->fetch_cond, NULL);
+			worker->fetch_queue = palloc0(sizeof(PGresult *) *
+										  pipeline_nbufs);
+			worker->fetch_sizes = palloc0(sizeof(size_t) * pipeline_nbufs);
+			if ((errno = pthread_create(&worker->fetch_thread, NULL,
+										pgsql_fetch_main, worker)) != 0)
+				Elog("failed on pthread_create: %m");
+		}
+		do {
+			pgsql_append_results(table, res);
+			PQclear(res);
+			res = pgsql_worker_next_result(worker);
+		} while (res != NULL);
+		if (table->nitems > 0)
+			pgsql_writeout_buffer(table);
+		if (pipeline_nbufs > 0)
+		{
+			if ((errno = pthread_join(worker->fetch_thread, NULL)) != 0)
+				Elog("failed on pthread_join: %m");
+		}
+		pgsql_shutdown_decoder(table);
+	}
+	pgsql_end_query(worker->conn);
+
+	return NULL;
+}
+
+/*
+ * Adaptive dictionary encoding of text columns (--dictionary-text)
+ *
+ * Type of the field is fixed once the schema is written, so cardinality of
+ * the text and varchar columns is estimated on the first chunk of the
+ * results. A column is dictionary encoded if it has at most N distinct
+ * values, and each value appears twice or more on average; elsewhere, it
+ * is kept in plain Utf8. Labels that appear later are added to the
+ * dictionary on the fly, then written as delta dictionary batches.
+ * The first result of --fetch-mode=row has only one row, and the one of
+ * --fetch-mode=copy has no rows, so the option is rejected with them. On
+ * --append, the encoding follows the fields in the existing file.
+ */
+static void
+setupTextDictionaries(pgsqlWorker *workers, ArrowFileInfo *af_info)
+{
+	SQLtable   *table = NULL;
+	PGresult   *sample = NULL;
+	int			i, j;
+
+	for (i=0; i < num_workers && !table; i++)
+	{
+		table = workers[i].table;
+		sample = workers[i].res;
+	}
+	assert(table != NULL);
+	for (j=0; j < table->nfields; j++)
+	{
+		SQLattribute *attr = &table->attrs[j];
+		SQLdictionary *dict;
+		int			ndistinct = -1;
+
+		if (!pgsql_is_text_attribute(attr))
+			continue;
+		if (af_info)
+		{
+			ArrowSchema *schema = &af_info->footer.schema;
+
+			if (j >= schema->_num_fields ||
+				schema->fields[j].dictionary.indexType.tag != ArrowNodeTag__Int)
+				continue;
+		}
+		else if (dict_text_max_labels > 0)
+		{
+			if (PQntuples(sample) == 0)
+				continue;
+			ndistinct = pgsql_count_distinct(sample, j, dict_text_max_labels);
+			if (ndistinct > dict_text_max_labels ||
+				2 * ndistinct > PQntuples(sample))
+				continue;
+		}
+		else
+			continue;
+
+		dict = pgsql_create_text_dictionary(dict_text_max_labels);
+		for (i=0; i < num_workers; i++)
+		{
+			if (workers[i].table)
+				pgsql_setup_text_dictionary(workers[i].table, j, dict);
+		}
+		if (shows_progress && ndistinct >= 0)
+			fprintf(use_ipc_stream ? stderr : stdout,
+					"Column '%s' is dictionary encoded (%d distinct values in %d rows)\n",
+					attr->attname, ndistinct, PQntuples(sample));
+	}
+}
+
+/*
+ * Report of the instrumentation (--stats)
+ */
+static const char *perf_phase_names[PERF_NUM_PHASES] = {
+	"fetch", "decode", "build", "write"
+};
+
+/*
+ * print_json_string - prints a string literal of JSON
+ */
+void
+print_json_string(FILE *out, const char *str)
+{
+	const char *pos;
+
+	fputc('"', out);
+	for (pos = str; *pos != '\0'; pos++)
+	{
+		int		c = (unsigned char)*pos;
+
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static void
+printPerfStats(pgsqlWorker *workers, uint64 start_ns)
+{
+	SQLtable   *table = NULL;
+	SQLattribute *attrs;
+	struct rusage ru;
+	double		elapsed;
+	double		utime, stime;
+	uint64		nfetches;
+	uint64		nrows = perf_stats.nrows;
+	int			i, j, k;
+	FILE	   *out = stderr;
+
+	elapsed = (double)(perf_clock_ns(CLOCK_MONOTONIC) - start_ns) / 1.0e9;
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		Elog("failed on getrusage: %m");
+	utime = (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec / 1.0e6;
+	stime = (double)ru.ru_stime.tv_sec + (double)ru.ru_stime.tv_usec / 1.0e6;
+
+	/* sum up the per-column counters of the workers */
+	for (i=0; i < num_workers; i++)
+	{
+		if (workers[i].table)
+		{
+			table = workers[i].table;
+			break;
+		}
+	}
+	if (!table)
+		return;
+	attrs = palloc0(sizeof(SQLattribute) * table->nfields);
+	for (i=0; i < num_workers; i++)
+	{
+		SQLtable   *__table = workers[i].table;
+
+		if (!__table)
+			continue;
+		for (j=0; j < __table->nfields; j++)
+		{
+			SQLattribute *src = &__table->attrs[j];
+			SQLattribute *dst = &attrs[j];
+
+			dst->attname = src->attname;
+			dst->arrow_typename = src->arrow_typename;
+			dst->perf_nbytes += src->perf_nbytes;
+			dst->perf_nnulls += src->perf_nnulls;
+			dst->perf_decode_ns += src->perf_decode_ns;
+			dst->perf_nsamples += src->perf_nsamples;
+			dst->perf_arrow_bytes += src->perf_arrow_bytes;
+		}
+	}
+	nfetches = Max(perf_stats.count[PERF_PHASE__FETCH], 1);
+
+	if (shows_stats == STATS_FORMAT__JSON)
+	{
+		fprintf(out,
+				"{\"elapsed\": %.6f, \"user\": %.6f, \"sys\": %.6f,"
+				" \"rows\": %lu, \"record_batches\": %lu,\n"
+				" \"phases\": {",
+				elapsed, utime, stime, nrows,
+				perf_stats.count[PERF_PHASE__WRITE]);
+		for (k=0; k < PERF_NUM_PHASES; k++)
+			fprintf(out, "%s\n  \"%s\": {\"wall\": %.6f, \"cpu\": %.6f,"
+					" \"count\": %lu, \"bytes\": %lu}",
+					k > 0 ? "," : "",
+					perf_phase_names[k],
+					(double)perf_stats.wall_ns[k] / 1.0e9,
+					(double)perf_stats.cpu_ns[k] / 1.0e9,
+					perf_stats.count[k],
+					perf_stats.nbytes[k]);
+		fprintf(out,
+				"},\n"
+				" \"fetch_avg\": %.6f, \"fetch_max\": %.6f,\n"
+				" \"buffers\": {\"alloc\": %lu, \"expand\": %lu,"
+				" \"moves\": %lu, \"mremap\": %lu},\n"
+				" \"columns\": [",
+				(double)perf_stats.wall_ns[PERF_PHASE__FETCH] /
+				(double)nfetches / 1.0e9,
+				(double)perf_stats.fetch_max_ns / 1.0e9,
+				perf_stats.buffer_alloc,
+				perf_stats.buffer_expand,
+				perf_stats.buffer_moves,
+				perf_stats.buffer_mremap);
+		for (j=0; j < table->nfields; j++)
+		{
+			SQLattribute *attr = &attrs[j];
+			double	ns_per_cell = (attr->perf_nsamples == 0 ? 0.0 :
+								   (double)attr->perf_decode_ns /
+								   (double)attr->perf_nsamples);
+
+			fprintf(out, "%s\n  {\"name\": ", j > 0 ? "," : "");
+			print_json_string(out, attr->attname);
+			fprintf(out, ", \"type\": ");
+			print_json_string(out, attr->arrow_typename);
+			fprintf(out, ", \"nulls\": %lu, \"src_bytes\": %lu,"
+					" \"arrow_bytes\": %lu, \"ns_per_cell\": %.1f,"
+					" \"decode\": %.6f}",
+					attr->perf_nnulls,
+					attr->perf_nbytes,
+					attr->perf_arrow_bytes,
+					ns_per_cell,
+					ns_per_cell * (double)nrows / 1.0e9);
+		}
+		fprintf(out, "]}\n");
+	}
+	else
+	{
+		fprintf(out,
+				"pg2arrow: %lu rows, %lu record batches in %.3fs"
+				" (user %.3fs, sys %.3fs)\n"
+				"  phase        wall[s]     cpu[s]      count        bytes\n",
+				nrows, perf_stats.count[PERF_PHASE__WRITE],
+				elapsed, utime, stime);
+		for (k=0; k < PERF_NUM_PHASES; k++)
+			fprintf(out, "  %-8s %10.3f %10.3f %10lu %12lu\n",
+					perf_phase_names[k],
+					(double)perf_stats.wall_ns[k] / 1.0e9,
+					(double)perf_stats.cpu_ns[k] / 1.0e9,
+					perf_stats.count[k],
+					perf_stats.nbytes[k]);
+		fprintf(out,
+				"  fetch round trip: avg %.3fms, max %.3fms\n"
+				"  buffers: %lu alloc, %lu expand, %lu moves, %lu mremap\n"
+				"  %-20s %-14s %10s %12s %12s %8s %9s\n",
+				(double)perf_stats.wall_ns[PERF_PHASE__FETCH] /
+				(double)nfetches / 1.0e6,
+				(double)perf_stats.fetch_max_ns / 1.0e6,
+				perf_stats.buffer_alloc,
+				perf_stats.buffer_expand,
+				perf_stats.buffer_moves,
+				perf_stats.buffer_mremap,
+				"column", "arrow type", "nulls", "src bytes",
+				"arrow bytes", "ns/cell", "decode[s]");
+		for (j=0; j < table->nfields; j++)
+		{
+			SQLattribute *attr = &attrs[j];
+			double	ns_per_cell = (attr->perf_nsamples == 0 ? 0.0 :
+								   (double)attr->perf_decode_ns /
+								   (double)attr->perf_nsamples);
+
+			fprintf(out, "  %-20s %-14s %10lu %12lu %12lu %8.1f %9.3f\n",
+					attr->attname,
+					attr->arrow_typename,
+					attr->perf_nnulls,
+					attr->perf_nbytes,
+					attr->perf_arrow_bytes,
+					ns_per_cell,
+					ns_per_cell * (double)nrows / 1.0e9);
+		}
+	}
+	pfree(attrs);
+}
+
+/*
+ * loadArrowFile - loads the record batches of the arrow file into the
+ * table (--load); each worker connection runs COPY for a disjoint range
+ * of the record batches.
+ */
+typedef struct
+{
+	SQLloader  *loader;
+	PGconn	   *conn;
+	pthread_t	thread;
+	int			batch_begin;
+	int			batch_end;
+	int64		nrows;
+} pgsqlLoadWorker;
+
+static void *
+loadArrowWorkerMain(void *__worker)
+{
+	pgsqlLoadWorker *worker = __worker;
+
+	worker->nrows = pgsql_load_record_batches(worker->loader,
+											  worker->conn,
+											  worker->batch_begin,
+											  worker->batch_end);
+	return NULL;
+}
+
+static int
+loadArrowFile(void)
+{
+	ArrowFileMap af_map;
+	SQLloader  *loader;
+	pgsqlLoadWorker *workers;
+	int			nbatches;
+	int64		nrows = 0;
+	int			i;
+
+	openArrowFileMap(load_arrow_filename, &af_map);
+	nbatches = af_map.footer._num_recordBatches;
+	num_workers = Max(Min(num_workers, nbatches), 1);
+	workers = palloc0(sizeof(pgsqlLoadWorker) * num_workers);
+	for (i=0; i < num_workers; i++)
+	{
+		pgsqlLoadWorker *w = &workers[i];
+
+		w->conn = pgsql_server_connect();
+		w->batch_begin = ((int64)nbatches * i) / num_workers;
+		w->batch_end = ((int64)nbatches * (i+1)) / num_workers;
+	}
+	loader = pgsql_create_loader(workers[0].conn, &af_map, sql_table_name);
+	for (i=0; i < num_workers; i++)
+		workers[i].loader = loader;
+
+	for (i=1; i < num_workers; i++)
+	{
+		if ((errno = pthread_create(&workers[i].thread, NULL,
+									loadArrowWorkerMain, &workers[i])) != 0)
+			Elog("failed on pthread_create: %m");
+	}
+	loadArrowWorkerMain(&workers[0]);
+	for (i=1; i < num_workers; i++)
+	{
+		if ((errno = pthread_join(workers[i].thread, NULL)) != 0)
+			Elog("failed on pthread_join: %m");
+	}
+	for (i=0; i < num_workers; i++)
+	{
+		nrows += workers[i].nrows;
+		PQfinish(workers[i].conn);
+	}
+	if (shows_progress)
+		printf("%ld rows loaded from '%s' into %s\n",
+			   nrows, load_arrow_filename, sql_table_name);
+	closeArrowFileMap(&af_map);
+
+	return 0;
+}
+
+/*
+ * Entrypoint of pg2arrow
+ */
+int main(int argc, char * const argv[])
+{
+	PGconn	   *leader = NULL;
+	SQLtable   *table = NULL;
+	pgsqlWorker *workers;
+	ArrowFileInfo af_info;
+	char	   *snapshot = NULL;
+	uint32		nblocks = 0;
+	ssize_t		nbytes;
+	uint64		start_ns;
+	int			i;
+
+	parse_options(argc, argv);
+	if (load_arrow_filename)
+		return loadArrowFile();
+	if (checkpoint_filename)
+		setupArrowCheckpoint();
+	start_ns = perf_clock_ns(CLOCK_MONOTONIC);
+	/*
+	 * In parallel dump mode, the leader connection exports its snapshot,
+	 * then every worker connection imports it to scan the disjoint ranges
+	 * of the consistent data set.
+	 */
+	if (num_workers > 1)
+	{
+		leader = pgsql_server_connect();
+		snapshot = pgsql_export_snapshot(leader);
+		if (sql_table_name)
+			nblocks = pgsql_table_nblocks(leader, sql_table_name);
+	}
+	/* open PostgreSQL connection, and run SQL command */
+	workers = palloc0(sizeof(pgsqlWorker) * num_workers);
+	for (i=0; i < num_workers; i++)
+	{
+		pgsqlWorker *w = &workers[i];
+
+		w->worker_id = i;
+		w->conn = pgsql_server_connect();
+		w->res = pgsql_begin_query(w->conn,
+								   pgsql_worker_command(i, nblocks),
+								   snapshot);
+		if (w->res)
+		{
+			w->table = pgsql_create_buffer(w->conn, w->res,
+										   batch_segment_sz);
+			if (!table)
+				table = w->table;
+		}
+	}
+	if (!table)
+		Elog("SQL command returned an empty result");
+	if (checkpoint_key)
+		lookupCheckpointKey(table);
+	if (append_mode)
+	{
+		readArrowFileInfo(output_filename, &af_info);
+		setupTextDictionaries(workers, &af_info);
+	}
+	else if (dict_text_max_labels > 0)
+		setupTextDictionaries(workers, NULL);
+	/* open the output file */
+	if (shard_max_file_sz > 0 || shard_max_nitems > 0)
+	{
+		/* each worker writes its own sequence of the shards */
+		for (i=0; i < num_workers; i++)
+		{
+			SQLtable   *__table = workers[i].table;
+
+			if (__table)
+			{
+				__table->worker_id = i;
+				__table->shard_id = 0;
+				openArrowShardFile(__table);
+			}
+		}
+	}
+	else
+	{
+		if (append_mode)
+		{
+			setupArrowAppend(table, &af_info);
+			table->fdesc = open(output_filename, O_RDWR);
+			if (table->fdesc < 0)
+				Elog("failed to open '%s': %m", output_filename);
+			table->filename = output_filename;
+		}
+		else if (use_ipc_stream)
+		{
+			table->fdesc = openArrowStream(output_filename);
+			table->filename = (output_filename ? output_filename : "-");
+		}
+		else if (output_filename)
+		{
+			table->fdesc = open(output_filename,
+								O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if (table->fdesc < 0)
+				Elog("failed to open '%s'", output_filename);
+			table->filename = output_filename;
+		}
+		else
+		{
+			char	temp_filename[128];
+
+			strcpy(temp_filename, "/tmp/XXXXXX.arrow");
+			table->fdesc = mkostemps(temp_filename, 6,
+									 O_RDWR | O_CREAT | O_TRUNC);
+			if (table->fdesc < 0)
+				Elog("failed to open '%s' : %m", temp_filename);
+			table->filename = pstrdup(temp_filename);
+			fprintf(stderr,
+					"notice: -o, --output=FILENAME options was not specified,\n"
+					"        so, a temporary file '%s' was built instead.\n",
+					temp_filename);
+		}
+		if (append_mode)
+		{
+			/* new record batches overwrite the footer */
+			if (lseek(table->fdesc, af_info.footer_offset, SEEK_SET) < 0)
+				Elog("failed on lseek(2): %m");
+			writeArrowDeltaDictionaryBatches(table, &af_info);
+		}
+		else if (use_ipc_stream)
+		{
+			/* no file signature in the stream */
+			nbytes = writeArrowSchema(table);
+			writeArrowDictionaryBatches(table);
+		}
+		else if (output_format == OUTPUT_FORMAT__PARQUET)
+			writeParquetHeader(table);
+		else
+		{
+			/* write header portion */
+			nbytes = write(table->fdesc, "ARROW1\0\0", 8);
+			if (nbytes != 8)
+				Elog("failed on write(2): %m");
+			nbytes = writeArrowSchema(table);
+			writeArrowDictionaryBatches(table);
+		}
+		if (use_direct_io)
+			pgsql_setup_direct_io(table);
+		/* the other workers share the output file */
+		for (i=0; i < num_workers; i++)
+		{
+			SQLtable   *__table = workers[i].table;
+
+			if (__table && __table != table)
+			{
+				__table->fdesc = table->fdesc;
+				__table->fdesc_direct = table->fdesc_direct;
+				__table->filename = table->filename;
+				__table->dictNloaded = table->dictNloaded;
+			}
+		}
+	}
+	for (i=0; i < num_workers; i++)
+	{
+		SQLtable   *__table = workers[i].table;
+
+		if (__table && pipeline_nbufs > 0)
+			pgsql_setup_pipeline(__table, pipeline_nbufs);
+		if (__table && decode_nthreads > 1)
+			pgsql_setup_decoder(__table, decode_nthreads);
+	}
+	/* fetch and write out the results by the workers */
+	for (i=1; i < num_workers; i++)
+	{
+		if ((errno = pthread_create(&workers[i].thread, NULL,
+									pgsql_worker_main, &workers[i])) != 0)
+			Elog("failed on pthread_create: %m");
+	}
+	pgsql_worker_main(&workers[0]);
+	for (i=1; i < num_workers; i++)
+	{
+		if ((errno = pthread_join(workers[i].thread, NULL)) != 0)
+			Elog("failed on pthread_join: %m");
+	}
+	/* wait for completion of the pipelined writer */
+	for (i=0; i < num_workers; i++)
+	{
+		if (workers[i].table)
+			pgsql_finish_pipeline(workers[i].table);
+	}
+	pgsql_shutdown_writer();
+	if (shard_max_file_sz > 0 || shard_max_nitems > 0)
+	{
+		/* close the last shard of the workers */
+		for (i=0; i < num_workers; i++)
+		{
+			if (workers[i].table)
+				closeArrowShardFile(workers[i].table);
+		}
+	}
+	else if (use_ipc_stream)
+		writeArrowStreamEOS(table->fdesc);
+	else
+	{
+		/* merge record batches written by the other workers */
+		for (i=0; i < num_workers; i++)
+		{
+			SQLtable   *__table = workers[i].table;
+
+			if (__table && __table != table)
+				pgsql_merge_record_batches(table, __table);
+		}
+		if (output_format == OUTPUT_FORMAT__PARQUET)
+			nbytes = writeParquetFooter(table);
+		else
+			nbytes = writeArrowFooter(table);
+		if (append_mode)
+		{
+			/* the new footer may be shorter than the former one */
+			off_t	currPos = lseek(table->fdesc, 0, SEEK_CUR);
+
+			if (currPos < 0 || ftruncate(table->fdesc, currPos) != 0)
+				Elog("failed on ftruncate('%s'): %m", table->filename);
+		}
+		if (checkpoint_filename)
+		{
+			/* the file is complete, so the checkpoint is no longer needed */
+			if (fsync(table->fdesc) != 0)
+				Elog("failed on fsync('%s'): %m", table->filename);
+			if (unlink(checkpoint_filename) != 0 && errno != ENOENT)
+				Elog("failed on unlink('%s'): %m", checkpoint_filename);
+		}
+	}
+	if (leader)
+		PQfinish(leader);
+	if (shows_stats)
+		printPerfStats(workers, start_ns);
 
 	return 0;
 }
@@ -15,11 +15,17 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <netdb.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <time.h>
 
@@ -27,19 +33,103 @@
 #include "arrow_defs.h"
 
 #define	ARROWALIGN(LEN)		TYPEALIGN(64, (LEN))
+#define InvalidOid			((Oid) 0)
 
 typedef struct SQLbuffer		SQLbuffer;
 typedef struct SQLtable			SQLtable;
 typedef struct SQLattribute		SQLattribute;
 typedef struct SQLdictionary	SQLdictionary;
+typedef struct SQLdecoder		SQLdecoder;
+typedef struct SQLiovec			SQLiovec;
 
 struct SQLbuffer
 {
 	char	   *ptr;
-	uint32		usage;
-	uint32		length;
+	size_t		usage;
+	size_t		length;
+	size_t		hint;		/* size hint learned from the previous batches */
+	size_t		resident;	/* upper bound of the touched area */
+	bool		is_arena;	/* true, if chunk of the shared arena */
 };
 
+/*
+ * SQLstat - min/max statistics in the physical representation of Arrow
+ */
+typedef union
+{
+	int8		i8;
+	int16		i16;
+	int32		i32;
+	int64		i64;
+	float4		f32;
+	float8		f64;
+#ifdef PG_INT128_TYPE
+	int128		i128;
+#endif
+} SQLstat;
+
+/*
+ * SQLiovec - a bunch of the buffers to be written at once
+ */
+struct SQLiovec
+{
+	int			nitems;
+	int			nrooms;
+	size_t		length;		/* total length, including padding */
+	struct iovec *iov;
+	void	   *image;		/* message image on the head */
+	/* raw buffers to be compressed, if --compress */
+	bool		compress;
+	int			nraws;
+	int			nrooms_raw;
+	struct iovec *raws;
+	char	   *cbuffer;	/* destination of the compressed buffers */
+};
+
+/*
+ * ParquetColumnChunk / ParquetRowGroup - metadata of the row group written
+ * in Parquet format (--format=parquet), for the footer. The page offsets
+ * are relative to the head of the row group, because its file range is
+ * reserved after the pages are built.
+ */
+typedef struct
+{
+	int64		dictionary_page_offset;	/* or -1 */
+	int64		data_page_offset;
+	int64		num_values;
+	int64		total_uncompressed_size;
+	int64		total_compressed_size;
+	int64		null_count;
+	int			stat_len;		/* length of min/max_value, or 0 */
+	char		min_value[32];
+	char		max_value[32];
+} ParquetColumnChunk;
+
+typedef struct
+{
+	int64		num_rows;
+	int64		total_byte_size;
+	int			nfields;
+	ParquetColumnChunk columns[FLEXIBLE_ARRAY_MEMBER];
+} ParquetRowGroup;
+
+/*
+ * SQL_SHAPE__* - shape of the flat columns; scalar types without nesting
+ * or dictionary, for the row decoder of the COPY stream that calls their
+ * handlers directly (see assignArrowRowDecoder)
+ */
+#define SQL_SHAPE__NONE			0	/* put_value and stat_update */
+#define SQL_SHAPE__BOOL			1
+#define SQL_SHAPE__INT16		2
+#define SQL_SHAPE__INT32		3
+#define SQL_SHAPE__INT64		4	/* int8 and time */
+#define SQL_SHAPE__FLOAT4		5
+#define SQL_SHAPE__FLOAT8		6
+#define SQL_SHAPE__DATE			7
+#define SQL_SHAPE__TIMESTAMP	8
+#define SQL_SHAPE__VARLENA		9	/* text, varchar and binary */
+#define SQL_SHAPE__BPCHAR		10
+
 struct SQLattribute
 {
 	char	   *attname;
@@ -50,22 +140,32 @@ struct SQLattribute
 	uint8		attalign;		/* 1, 2, 4 or 8 */
 	SQLtable   *subtypes;		/* valid, if composite type */
 	SQLattribute *element;		/* valid, if array type */
-	SQLdictionary *enumdict;	/* valid, if enum type */
+	SQLdictionary *enumdict;	/* valid, if enum type or text dictionary */
+	const char *dict_memo_label;	/* memo of the last label, or NULL */
+	uint32		dict_memo_len;
+	uint32		dict_memo_index;
 	const char *typnamespace;	/* name of pg_type.typnamespace */
 	const char *typname;		/* pg_type.typname */
 	char		typtype;		/* pg_type.typtype */
 	ArrowType	arrow_type;		/* type in apache arrow */
 	const char *arrow_typename;	/* typename in apache arrow */
+	int			shape;			/* one of SQL_SHAPE__* */
 	/* data buffer and handler */
 	void   (*put_value)(SQLattribute *attr,
 						const char *addr, int sz);
+	void   (*put_values)(SQLattribute *attr, PGresult *res,
+						 int column, int row_begin, int row_end);
 	void   (*stat_update)(SQLattribute *attr,
 						  const char *addr, int sz);
+	char  *(*stat_format)(SQLstat *stat);
 	size_t (*buffer_usage)(SQLattribute *attr);
 	int	   (*setup_buffer)(SQLattribute *attr,
 						   ArrowBuffer *node,
 						   size_t *p_offset);
-	void   (*write_buffer)(SQLattribute *attr, int fdesc);
+	void   (*write_buffer)(SQLattribute *attr, SQLiovec *iov);
+	/* upper bound of buffer_usage growth per row (fixed + ratio * sz) */
+	uint32		usage_fixed;
+	uint32		usage_ratio;
 
 	long		nitems;			/* number of rows */
 	long		nullcount;		/* number of null values */
@@ -75,67 +175,313 @@ struct SQLattribute
 	/* statistics */
 	bool		min_isnull;
 	bool		max_isnull;
-	Datum		min_value;
-	Datum		max_value;
+	SQLstat		min_value;
+	SQLstat		max_value;
+	/* instrumentation (--stats); kept across the record batches */
+	uint64		perf_nbytes;	/* length of the binary cells */
+	uint64		perf_nnulls;
+	uint64		perf_decode_ns;	/* decode time of the measured cells */
+	uint64		perf_nsamples;	/* number of the measured cells */
+	uint64		perf_arrow_bytes; /* length of the buffers written */
 };
 
 struct SQLtable
 {
 	const char *filename;		/* output filename */
 	int			fdesc;			/* output file descriptor */
+	int			fdesc_direct;	/* descriptor with O_DIRECT, or -1 */
+	int			worker_id;		/* worker which owns the table */
+	int			shard_id;		/* sequence of the output shard, or -1 */
+	size_t		shard_nitems;	/* # of rows written to the current shard */
 	ArrowBlock *recordBatches;	/* recordBatches written in the past */
 	int			numRecordBatches;
+	char	  **recordStats;	/* min/max of the columns for each record
+								 * batch; [numRecordBatches][nfields][2] */
+	ParquetRowGroup **rowGroups; /* [numRecordBatches], if Parquet */
+	ParquetRowGroup *rowGroupPending; /* row group built, not written yet */
 	ArrowBlock *dictionaries;	/* dictionaryBatches written in the past */
 	int			numDictionaries;
+	int		   *dictNloaded;	/* # of labels written to the file, for
+								 * each entry of pgsql_dictionary_list */
 	int			numFieldNodes;	/* # of FieldNode vector elements */
 	int			numBuffers;		/* # of Buffer vector elements */
 	size_t		segment_sz;		/* threshold of the memory usage */
+	/* pipelined writer */
+	SQLtable   *shadows;		/* free shadow tables */
+	int			numShadows;		/* # of shadow tables assigned */
+	int			numFreeShadows;	/* # of shadow tables in the free list */
+	SQLtable   *owner;			/* valid, if shadow table */
+	SQLtable   *next;			/* link of free list or writer queue */
+	SQLdecoder *decoder;		/* valid, if column-parallel decoding */
+	/* row decoder of the flat table, or NULL for the generic path */
+	const char *(*put_copy_row)(SQLtable *table, const char *pos,
+								const char *tail, size_t *p_growth);
+	size_t		usage_bound;	/* upper bound of the current buffer usage */
+	/* --partition-key; rows of a record batch are in the same key range */
+	SQLattribute *partition_attr; /* key column, or NULL */
+	int64		partition_range; /* key range of the rows in the buffer */
 	size_t		nitems;			/* current number of rows */
 	int			nfields;		/* number of attributes */
 	SQLattribute attrs[FLEXIBLE_ARRAY_MEMBER];
 };
 
-typedef struct hashItem		hashItem;
-struct hashItem
+/*
+ * SQLdictSlot - entry of the open addressing hash table of SQLdictionary.
+ * The first DICT_LABEL_HEAD_SZ bytes of the label are kept inline, so
+ * short labels are compared without pointer chase.
+ */
+#define DICT_LABEL_HEAD_SZ		12
+typedef struct
 {
-	struct hashItem	*next;
 	uint32		hash;
-	uint32		index;
+	uint32		index;			/* index of the label in the dictionary */
 	uint32		label_len;
-	char		label[FLEXIBLE_ARRAY_MEMBER];
-};
+	char		label_head[DICT_LABEL_HEAD_SZ];
+	const char *label;			/* NULL, if empty slot */
+} SQLdictSlot;
+
+typedef struct
+{
+	uint32		mask;			/* number of slots - 1; power of 2 */
+	uint32		nused;			/* number of slots in use */
+	SQLdictSlot	slots[FLEXIBLE_ARRAY_MEMBER];
+} SQLdictHash;
 
 struct SQLdictionary
 {
 	struct SQLdictionary *next;
-	Oid			enum_typeid;
+	Oid			enum_typeid;	/* InvalidOid, if text dictionary */
 	int			dict_id;
 	SQLbuffer	values;
 	SQLbuffer	extra;
 	int			nitems;
-	int			nslots;			/* width of hash slot */
-	hashItem   *hslots[FLEXIBLE_ARRAY_MEMBER];
+	int			nloaded;		/* # of labels already in the file */
+	int			max_labels;		/* --dictionary-text=N, or 0 */
+	pthread_mutex_t lock;		/* serializes additions of text labels */
+	SQLdictHash *htab;			/* hash table of the labels */
+};
+
+/*
+ * ArrowFileInfo - metadata of an existing arrow file, for --append
+ */
+typedef struct ArrowFileInfo	ArrowFileInfo;
+struct ArrowFileInfo
+{
+	const char *filename;
+	size_t		file_sz;
+	off_t		footer_offset;	/* head of the footer to be overwritten */
+	ArrowFooter	footer;
+	ArrowMessage *dictionaries;	/* DictionaryBatch of footer.dictionaries */
+	const char **dictionaryBodies;
+};
+
+/*
+ * ArrowFileMap - read-only mapping of an arrow file, for the scanners
+ *
+ * ArrowColumnView is a view of the buffers of a column in a record batch;
+ * they point to the file mapping (zero-copy), or palloc'd images if the
+ * record batch is compressed.
+ */
+typedef struct ArrowFileMap		ArrowFileMap;
+struct ArrowFileMap
+{
+	const char *filename;
+	int			fdesc;
+	const char *file_map_head;
+	size_t		file_sz;
+	ArrowFooter	footer;
+};
+
+typedef struct ArrowColumnView	ArrowColumnView;
+struct ArrowColumnView
+{
+	ArrowField *field;
+	int64		length;
+	int64		null_count;
+	bool		compressed;		/* buffers are palloc'd */
+	const char *nullmap;		/* NULL, if no null bitmap */
+	size_t		nullmap_len;
+	const char *values;			/* values, offsets or dictionary indexes */
+	size_t		values_len;
+	const char *extra;			/* body of the variable length values */
+	size_t		extra_len;
+	size_t		stored_len;		/* length of the buffers in the body */
+	ArrowColumnView *children;
+	int			nchildren;
+};
+
+/*
+ * SQLperfStats - instrumentation of the hot paths (--stats)
+ *
+ * Phase timers are taken per round trip, per chunk of the results, and
+ * per record batch, so they are cheap enough to leave on. If a phase
+ * begins inside another one on the same thread (e.g, a record batch is
+ * written during decode), the time is accounted to the inner phase only.
+ * Decode time of the columns is measured for each slice by the decoder
+ * threads, or sampled on every PERF_SAMPLE_INTERVAL rows elsewhere.
+ */
+#define PERF_PHASE__FETCH		0	/* round trip to the server */
+#define PERF_PHASE__DECODE		1	/* put_value and stat_update */
+#define PERF_PHASE__BUILD		2	/* record batch, with compression */
+#define PERF_PHASE__WRITE		3	/* write(2) of the record batch */
+#define PERF_NUM_PHASES			4
+#define PERF_SAMPLE_INTERVAL	64
+
+typedef struct
+{
+	uint64		wall_ns[PERF_NUM_PHASES];
+	uint64		cpu_ns[PERF_NUM_PHASES];
+	uint64		count[PERF_NUM_PHASES];
+	uint64		nbytes[PERF_NUM_PHASES];
+	uint64		fetch_max_ns;	/* the slowest round trip */
+	uint64		nrows;			/* number of rows decoded */
+	/* slow path of SQLbuffer */
+	uint64		buffer_alloc;	/* new buffers */
+	uint64		buffer_expand;	/* copied to the larger arena chunk */
+	uint64		buffer_moves;	/* copied to the dedicated mapping */
+	uint64		buffer_mremap;	/* dedicated mapping expanded by mremap */
+} SQLperfStats;
+
+typedef struct SQLperfTimer		SQLperfTimer;
+struct SQLperfTimer
+{
+	bool		active;
+	SQLperfTimer *outer;		/* the phase interrupted, if any */
+	uint64		wall_ns;
+	uint64		cpu_ns;
+	uint64		inner_wall_ns;	/* time of the inner phases */
+	uint64		inner_cpu_ns;
 };
 
 /* pg2arrow.c */
+#define HUGE_PAGES__OFF			0
+#define HUGE_PAGES__MADVISE		1	/* transparent huge pages */
+#define HUGE_PAGES__HUGETLB		2	/* MAP_HUGETLB, if reserved */
+#define COMPRESSION__NONE		(-1)
+#define STATS_FORMAT__TEXT		1
+#define STATS_FORMAT__JSON		2
+#define OUTPUT_FORMAT__ARROW	1
+#define OUTPUT_FORMAT__PARQUET	2
+#define BATCH_BOUNDARY__WIDTH	1	/* every N of the key value */
+#define BATCH_BOUNDARY__HOUR	2
+#define BATCH_BOUNDARY__DAY		3
+#define BATCH_BOUNDARY__MONTH	4
+#define BATCH_BOUNDARY__YEAR	5
 extern int			shows_progress;
-extern void			writeArrowRecordBatch(SQLtable *table,
+extern int			shows_stats;		/* STATS_FORMAT__*, or 0 */
+extern SQLperfStats	perf_stats;
+extern __thread SQLperfTimer *perf_curr_timer;
+extern int			use_large_offset;
+extern int			use_decimal256;
+extern int			numeric_nan_as_null;
+extern int			use_huge_pages;
+extern int			use_ipc_stream;
+extern int			compression_codec;	/* ArrowCompressionType, or NONE */
+extern int			compression_level;
+extern size_t		shard_max_file_sz;	/* --max-file-size, or 0 */
+extern size_t		shard_max_nitems;	/* --max-rows-per-file, or 0 */
+extern char		   *checkpoint_filename; /* --checkpoint, or NULL */
+extern int			output_format;		/* OUTPUT_FORMAT__* */
+extern char		   *partition_key;		/* --partition-key, or NULL */
+extern int			batch_boundary;		/* BATCH_BOUNDARY__* */
+extern int64		batch_boundary_width; /* N of --batch-boundary=N */
+extern void			setupArrowRecordBatch(SQLtable *table,
+										  SQLiovec *iov,
 										  size_t *p_metaLength,
 										  size_t *p_bodyLength);
+extern ssize_t		writeArrowSchema(SQLtable *table);
+extern void			writeArrowDictionaryBatches(SQLtable *table);
+extern ssize_t		writeArrowFooter(SQLtable *table);
+extern void			writeArrowCheckpoint(SQLtable *root, SQLtable *table,
+										 int index);
+extern void			rotateArrowOutputFile(SQLtable *table);
+extern void			flushArrowTextDictionaries(SQLtable *table);
+extern void			print_json_string(FILE *out, const char *str);
 /* query.c */
 extern SQLdictionary *pgsql_dictionary_list;
 extern SQLtable	   *pgsql_create_buffer(PGconn *conn, PGresult *res,
 								size_t segment_sz);
 extern void			pgsql_append_results(SQLtable *table, PGresult *res);
+extern void			pgsql_append_copy_results(SQLtable *table, PGconn *conn);
+extern void			pgsql_clear_attribute(SQLattribute *attr);
+extern void			perf_timer_begin(SQLperfTimer *timer);
+extern uint64		perf_timer_end(SQLperfTimer *timer, int phase,
+								   uint64 nbytes);
+extern void			pgsql_setup_decoder(SQLtable *table, int nthreads);
+extern void			pgsql_shutdown_decoder(SQLtable *table);
 extern void 		pgsql_writeout_buffer(SQLtable *table);
+extern void			pgsql_merge_record_batches(SQLtable *dst, SQLtable *src);
+extern void			pgsql_setup_pipeline(SQLtable *table, int nbufs);
+extern void			pgsql_finish_pipeline(SQLtable *table);
+extern void			pgsql_shutdown_writer(void);
+extern void			pgsql_setup_direct_io(SQLtable *table);
+extern int			pgsql_count_distinct(PGresult *res, int column, int limit);
+extern bool			pgsql_is_text_attribute(SQLattribute *attr);
+extern SQLdictionary *pgsql_create_text_dictionary(int max_labels);
+extern void			pgsql_setup_text_dictionary(SQLtable *table, int column,
+												SQLdictionary *dict);
+extern SQLdictSlot  *pgsql_dictionary_insert(SQLdictionary *dict,
+											uint32 hash,
+											const char *label,
+											uint32 len,
+											uint32 index);
+extern void			pgsql_rebase_dictionary(SQLdictionary *dict,
+											int nlabels,
+											const char **labels,
+											const int *label_lens);
 extern void			pgsql_dump_buffer(SQLtable *table);
+/* buffer.c */
+extern void			sql_buffer_alloc(SQLbuffer *buf, size_t required);
+extern void			sql_buffer_trim(SQLbuffer *buf);
+extern void			sql_buffer_free(SQLbuffer *buf);
+/* compress.c */
+extern size_t		sql_iovec_compress(SQLiovec *iov,
+									   ArrowBuffer *buffers, int nbuffers);
+extern char		   *sql_buffer_decompress(int codec,
+										  const char *src, size_t src_sz,
+										  size_t *p_length,
+										  const char **p_errmsg);
+extern char		   *sql_block_compress(const char *src, size_t src_sz,
+										size_t *p_length);
 /* arrow_write.c */
+extern void		   *makeFlatBufferMessage(ArrowMessage *message,
+										  size_t *p_length);
 extern ssize_t		writeFlatBufferMessage(int fdesc, ArrowMessage *message);
 extern ssize_t		writeFlatBufferFooter(int fdesc, ArrowFooter *footer);
 /* arrow_types.c */
 extern void			assignArrowType(SQLattribute *attr, int *p_numBuffers);
+extern void			assignArrowRowDecoder(SQLtable *table);
 /* arrow_read.c */
+extern void			readArrowFileInfo(const char *pathname,
+									  ArrowFileInfo *af_info);
 extern void			readArrowFile(const char *pathname);
+extern void			openArrowFileMap(const char *pathname,
+									 ArrowFileMap *af_map);
+extern void			closeArrowFileMap(ArrowFileMap *af_map);
+extern const char  *readArrowBlockView(ArrowFileMap *af_map, ArrowBlock *b,
+									   ArrowMessage *message,
+									   const char **p_body);
+extern const char  *setupArrowColumnViews(ArrowRecordBatch *rbatch,
+										  const char *body, size_t body_sz,
+										  ArrowField *fields, int nfields,
+										  ArrowColumnView *views);
+extern void			releaseArrowColumnViews(ArrowColumnView *views,
+											int nfields);
+extern ArrowField   *lookupArrowDictionaryField(ArrowSchema *schema,
+												int64 dict_id);
+extern int			verifyArrowFile(const char *pathname);
+extern int			summaryArrowFile(const char *pathname, int format);
+/* arrow_load.c */
+typedef struct SQLloader	SQLloader;
+extern SQLloader   *pgsql_create_loader(PGconn *conn, ArrowFileMap *af_map,
+										const char *table_name);
+extern int64		pgsql_load_record_batches(SQLloader *loader, PGconn *conn,
+											  int batch_begin, int batch_end);
+/* parquet_write.c */
+extern void			writeParquetHeader(SQLtable *table);
+extern void			setupParquetRowGroup(SQLtable *table, SQLiovec *iov,
+										 size_t *p_length);
+extern ssize_t		writeParquetFooter(SQLtable *table);
 /* arrow_dump.c */
 extern void			dumpArrowNode(ArrowNode *node, FILE *out);
 
@@ -149,6 +495,47 @@ extern void			dumpArrowNode(ArrowNode *node, FILE *out);
 		exit(1);									\
 	} while(0)
 
+/*
+ * Instrumentation routines (--stats)
+ */
+static inline uint64
+perf_clock_ns(clockid_t clock_id)
+{
+	struct timespec	ts;
+
+	clock_gettime(clock_id, &ts);
+	return (uint64)ts.tv_sec * 1000000000UL + (uint64)ts.tv_nsec;
+}
+
+#define perf_counter_add(FIELD, VALUE)									\
+	do {																\
+		if (shows_stats)												\
+			__atomic_fetch_add(&perf_stats.FIELD, (VALUE),				\
+							   __ATOMIC_RELAXED);						\
+	} while(0)
+
+static inline void
+perf_update_fetch_max(uint64 wall_ns)
+{
+	uint64		curr = __atomic_load_n(&perf_stats.fetch_max_ns,
+									   __ATOMIC_RELAXED);
+
+	while (curr < wall_ns &&
+		   !__atomic_compare_exchange_n(&perf_stats.fetch_max_ns,
+										&curr, wall_ns, false,
+										__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+ * arrow_view_isvalid - checks the null bitmap of the column view
+ */
+static inline bool
+arrow_view_isvalid(ArrowColumnView *view, int64 index)
+{
+	return (!view->nullmap ||
+			(view->nullmap[index >> 3] & (1 << (index & 7))) != 0);
+}
+
 /*
  * SQLbuffer related routines
  */
@@ -158,41 +545,16 @@ sql_buffer_init(SQLbuffer *buf)
 	buf->ptr = NULL;
 	buf->usage = 0;
 	buf->length = 0;
+	buf->hint = 0;
+	buf->resident = 0;
+	buf->is_arena = false;
 }
 
 static inline void
 sql_buffer_expand(SQLbuffer *buf, size_t required)
 {
 	if (buf->length < required)
-	{
-		void	   *ptr;
-		size_t		length;
-
-		if (buf->ptr == NULL)
-		{
-			length = (1UL << 21);	/* start from 2MB */
-			while (length < required)
-				length *= 2;
-			ptr = mmap(NULL, length, PROT_READ | PROT_WRITE,
-					   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-			if (ptr == MAP_FAILED)
-				Elog("failed on mmap(len=%zu): %m", length);
-			buf->ptr    = ptr;
-			buf->usage  = 0;
-			buf->length = length;
-		}
-		else
-		{
-			length = 2 * buf->length;
-			while (length < required)
-				length *= 2;
-			ptr = mremap(buf->ptr, buf->length, length, MREMAP_MAYMOVE);
-			if (ptr == MAP_FAILED)
-				Elog("failed on mremap(len=%zu): %m", length);
-			buf->ptr    = ptr;
-			buf->length = length;
-		}
-	}
+		sql_buffer_alloc(buf, required);
 }
 
 static inline void
@@ -218,7 +580,11 @@ sql_buffer_setbit(SQLbuffer *buf, size_t index)
 {
 	size_t		required = BITMAPLEN(index+1);
 	sql_buffer_expand(buf, required);
+	/* the buffer may be recycled, so clear the stale bits first */
+	if ((index & 7) == 0)
+		((uint8 *)buf->ptr)[index>>3] = 0;
 	((uint8 *)buf->ptr)[index>>3] |= (1 << (index & 7));
+	buf->usage = Max(buf->usage, required);
 }
 
 static inline void
@@ -226,15 +592,88 @@ sql_buffer_clrbit(SQLbuffer *buf, size_t index)
 {
 	size_t		required = BITMAPLEN(index+1);
 	sql_buffer_expand(buf, required);
+	if ((index & 7) == 0)
+		((uint8 *)buf->ptr)[index>>3] = 0;
 	((uint8 *)buf->ptr)[index>>3] &= ~(1 << (index & 7));
+	buf->usage = Max(buf->usage, required);
 }
 
 static inline void
 sql_buffer_clear(SQLbuffer *buf)
 {
+	/* size hint decays, if the later record batches get smaller */
+	buf->hint = Max(buf->usage, buf->hint / 2);
+	buf->resident = Max(buf->resident, buf->usage);
+	if (!buf->is_arena && buf->resident > 4 * Max(buf->hint, 1UL << 20))
+		sql_buffer_trim(buf);
 	buf->usage = 0;
 }
 
+/*
+ * SQLiovec related routines
+ */
+static inline void
+__sql_iovec_append(SQLiovec *iov, const void *addr, size_t len)
+{
+	if (len == 0)
+		return;
+	if (iov->nitems >= iov->nrooms)
+	{
+		iov->nrooms = 2 * iov->nrooms + 32;
+		iov->iov = repalloc(iov->iov, sizeof(struct iovec) * iov->nrooms);
+	}
+	iov->iov[iov->nitems].iov_base = (void *)addr;
+	iov->iov[iov->nitems].iov_len  = len;
+	iov->nitems++;
+	iov->length += len;
+}
+
+/* explicit padding, up to ARROWALIGN() */
+static inline void
+__sql_iovec_padding(SQLiovec *iov)
+{
+	static const char zero_padding[ARROWALIGN(1)];
+
+	__sql_iovec_append(iov, zero_padding, ARROWALIGN(iov->length) - iov->length);
+}
+
+/*
+ * sql_iovec_append - appends a buffer for each ArrowBuffer, even if empty
+ */
+static inline void
+sql_iovec_append(SQLiovec *iov, const void *addr, size_t len)
+{
+	if (!iov->compress)
+	{
+		__sql_iovec_append(iov, addr, len);
+		__sql_iovec_padding(iov);
+		return;
+	}
+	/* compressed on sql_iovec_compress() later */
+	if (iov->nraws >= iov->nrooms_raw)
+	{
+		iov->nrooms_raw = 2 * iov->nrooms_raw + 32;
+		iov->raws = repalloc(iov->raws, sizeof(struct iovec) * iov->nrooms_raw);
+	}
+	iov->raws[iov->nraws].iov_base = (void *)addr;
+	iov->raws[iov->nraws].iov_len  = len;
+	iov->nraws++;
+}
+
+static inline void
+sql_iovec_release(SQLiovec *iov)
+{
+	if (iov->image)
+		pfree(iov->image);
+	if (iov->raws)
+		pfree(iov->raws);
+	if (iov->cbuffer)
+		pfree(iov->cbuffer);
+	if (iov->iov)
+		pfree(iov->iov);
+	memset(iov, 0, sizeof(SQLiovec));
+}
+
 /*
  * File operations
  */
@@ -614,4 +1053,38 @@ hash_any(const unsigned char *k, int keylen)
 	/* report the result */
 	return c;
 }
+
+/*
+ * sql_dictionary_lookup - looks up the label in the hash table of the
+ * dictionary, or returns NULL if not found.
+ * Labels of the text dictionary may be added by the other workers, so the
+ * hash table and the label of the slot are loaded with acquire semantics;
+ * they are stored at last when a new slot (or hash table) is published.
+ */
+static inline SQLdictSlot *
+sql_dictionary_lookup(SQLdictionary *dict, uint32 hash,
+					  const char *label, uint32 len)
+{
+	SQLdictHash *htab = __atomic_load_n(&dict->htab, __ATOMIC_ACQUIRE);
+	uint32		k = hash & htab->mask;
+
+	for (;;)
+	{
+		SQLdictSlot *slot = &htab->slots[k];
+		const char *__label = __atomic_load_n(&slot->label, __ATOMIC_ACQUIRE);
+
+		if (!__label)
+			return NULL;
+		if (slot->hash == hash &&
+			slot->label_len == len &&
+			memcmp(slot->label_head, label,
+				   Min(len, DICT_LABEL_HEAD_SZ)) == 0 &&
+			(len <= DICT_LABEL_HEAD_SZ ||
+			 memcmp(__label + DICT_LABEL_HEAD_SZ,
+					label + DICT_LABEL_HEAD_SZ,
+					len - DICT_LABEL_HEAD_SZ) == 0))
+			return slot;
+		k = (k + 1) & htab->mask;
+	}
+}
 #endif	/* PG2ARROW_H */
@@ -9,19 +9,31 @@
 #include "pg2arrow.h"
 
 #define atooid(x)		((Oid) strtoul((x), NULL, 10))
-#define InvalidOid		((Oid) 0)
 
 /* Dictionary Batch */
 SQLdictionary  *pgsql_dictionary_list = NULL;
 static int		pgsql_dictionary_count = 0;
 
+/* serialization of the concurrent writes by parallel workers */
+static pthread_mutex_t pgsql_writeout_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* number of record batches written to the IPC stream, if --stream */
+static int		pgsql_stream_nbatches = 0;
+
 /* forward declarations */
 static SQLtable *
-pgsql_create_composite_type(PGconn *conn, Oid comptype_relid);
+pgsql_create_composite_type(PGconn *conn, Oid comptype_oid);
 static SQLattribute *
 pgsql_create_array_element(PGconn *conn, Oid array_elemid,
 						   int *p_numFieldNode,
 						   int *p_numBuffers);
+static void
+__pgsql_reset_usage_bound(SQLtable *table, size_t usage);
+static void
+__pgsql_setup_partition_key(SQLtable *table);
+static void
+__pgsql_append_results_columns(SQLtable *table, PGresult *res,
+							   int row_begin, int row_end);
 static inline bool
 pg_strtobool(const char *v)
 {
@@ -46,14 +58,328 @@ pg_strtochar(const char *v)
 	return *v;
 }
 
+/* ----------------------------------------------------------------
+ *
+ * Type catalog cache
+ *
+ * pg_type entries of the result columns, and of the types nested in them
+ * (array elements, composite fields), are fetched once by a recursive
+ * set-based query, with attributes of the composite types and labels of
+ * the enum types. So, number of round trips does not depend on the
+ * number of columns.
+ *
+ * ----------------------------------------------------------------
+ */
+typedef struct SQLtypeCache	SQLtypeCache;
+struct SQLtypeCache
+{
+	SQLtypeCache *next;			/* hash chain */
+	Oid			type_oid;
+	int			typlen;
+	bool		typbyval;
+	char		typalign;
+	char		typtype;
+	Oid			typrelid;
+	Oid			typelem;
+	char	   *nspname;
+	char	   *typname;
+	/* attributes, if composite type */
+	int			natts;
+	char	  **attnames;
+	Oid		   *atttypids;
+	int		   *atttypmods;
+	/* labels, if enum type */
+	int			nlabels;
+	char	  **labels;
+};
+
+#define TYPE_CACHE_NSLOTS	1024
+static SQLtypeCache *pgsql_type_cache_slots[TYPE_CACHE_NSLOTS];
+
+static SQLtypeCache *
+__pgsql_lookup_type_cache(Oid type_oid)
+{
+	SQLtypeCache *tcache;
+
+	for (tcache = pgsql_type_cache_slots[type_oid % TYPE_CACHE_NSLOTS];
+		 tcache != NULL;
+		 tcache = tcache->next)
+	{
+		if (tcache->type_oid == type_oid)
+			return tcache;
+	}
+	return NULL;
+}
+
+static char *
+__build_oid_array(Oid *oids, int noids)
+{
+	char	   *buf = palloc(12 * noids + 4);
+	char	   *pos = buf;
+	int			i;
+
+	*pos++ = '{';
+	for (i=0; i < noids; i++)
+		pos += sprintf(pos, "%s%u", i > 0 ? "," : "", oids[i]);
+	*pos++ = '}';
+	*pos = '\0';
+
+	return buf;
+}
+
+static PGresult *
+__pgsql_exec_oid_array_query(PGconn *conn, const char *query,
+							 Oid *oids, int noids)
+{
+	PGresult   *res;
+	const char *params[1];
+
+	params[0] = __build_oid_array(oids, noids);
+	res = PQexecParams(conn, query,
+					   1, NULL, params, NULL, NULL,
+					   0);	/* results in text mode */
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		Elog("failed on system catalog query: %s",
+			 PQresultErrorMessage(res));
+	pfree((void *)params[0]);
+	return res;
+}
+
+/*
+ * pgsql_fetch_type_cache - loads the type catalog of the supplied types,
+ * and types nested in them, if not cached yet.
+ */
+static void
+pgsql_fetch_type_cache(PGconn *conn, Oid *type_oids, int num_types)
+{
+	PGresult   *res;
+	Oid		   *oids = alloca(sizeof(Oid) * Max(num_types, 1));
+	Oid		   *comp_oids;
+	Oid		   *enum_oids;
+	int			i, j, noids = 0;
+	int			ncomps = 0;
+	int			nenums = 0;
+
+	for (i=0; i < num_types; i++)
+	{
+		if (!__pgsql_lookup_type_cache(type_oids[i]))
+			oids[noids++] = type_oids[i];
+	}
+	if (noids == 0)
+		return;
+
+	/* pg_type of the types and nested types */
+	res = __pgsql_exec_oid_array_query(conn,
+		"WITH RECURSIVE __types(oid) AS ("
+		"  SELECT pg_catalog.unnest($1::pg_catalog.oid[])"
+		" UNION"
+		"  SELECT x.oid"
+		"    FROM __types r"
+		"    JOIN pg_catalog.pg_type y ON y.oid = r.oid,"
+		"         LATERAL (SELECT y.typelem"
+		"                   WHERE y.typelem <> 0"
+		"                  UNION ALL"
+		"                  SELECT a.atttypid"
+		"                    FROM pg_catalog.pg_attribute a"
+		"                   WHERE a.attrelid = y.typrelid"
+		"                     AND y.typrelid <> 0"
+		"                     AND a.attnum > 0"
+		"                     AND NOT a.attisdropped) x(oid)"
+		")"
+		"SELECT t.oid, t.typlen, t.typbyval, t.typalign, t.typtype,"
+		"       t.typrelid, t.typelem, n.nspname, t.typname"
+		"  FROM pg_catalog.pg_type t,"
+		"       pg_catalog.pg_namespace n"
+		" WHERE t.typnamespace = n.oid"
+		"   AND t.oid IN (SELECT oid FROM __types)",
+		oids, noids);
+	comp_oids = alloca(sizeof(Oid) * (PQntuples(res) + 1));
+	enum_oids = alloca(sizeof(Oid) * (PQntuples(res) + 1));
+	for (i=0; i < PQntuples(res); i++)
+	{
+		SQLtypeCache *tcache;
+		Oid		type_oid = atooid(PQgetvalue(res, i, 0));
+
+		if (__pgsql_lookup_type_cache(type_oid))
+			continue;
+		tcache = palloc0(sizeof(SQLtypeCache));
+		tcache->type_oid = type_oid;
+		tcache->typlen   = atoi(PQgetvalue(res, i, 1));
+		tcache->typbyval = pg_strtobool(PQgetvalue(res, i, 2));
+		tcache->typalign = pg_strtochar(PQgetvalue(res, i, 3));
+		tcache->typtype  = pg_strtochar(PQgetvalue(res, i, 4));
+		tcache->typrelid = atooid(PQgetvalue(res, i, 5));
+		tcache->typelem  = atooid(PQgetvalue(res, i, 6));
+		tcache->nspname  = pstrdup(PQgetvalue(res, i, 7));
+		tcache->typname  = pstrdup(PQgetvalue(res, i, 8));
+		if (tcache->typtype == 'c')
+			comp_oids[ncomps++] = tcache->typrelid;
+		else if (tcache->typtype == 'e')
+			enum_oids[nenums++] = tcache->type_oid;
+
+		j = type_oid % TYPE_CACHE_NSLOTS;
+		tcache->next = pgsql_type_cache_slots[j];
+		pgsql_type_cache_slots[j] = tcache;
+	}
+	PQclear(res);
+
+	/* pg_attribute of the composite types */
+	if (ncomps > 0)
+	{
+		res = __pgsql_exec_oid_array_query(conn,
+			"SELECT t.oid, a.attname, a.atttypid, a.atttypmod"
+			"  FROM pg_catalog.pg_attribute a,"
+			"       pg_catalog.pg_type t"
+			" WHERE a.attrelid = t.typrelid"
+			"   AND a.attrelid = ANY($1::pg_catalog.oid[])"
+			"   AND a.attnum > 0"
+			"   AND NOT a.attisdropped"
+			" ORDER BY a.attrelid, a.attnum",
+			comp_oids, ncomps);
+		for (i=0; i < PQntuples(res); i++)
+		{
+			SQLtypeCache *tcache;
+
+			tcache = __pgsql_lookup_type_cache(atooid(PQgetvalue(res, i, 0)));
+			if (!tcache)
+				Elog("unexpected result from pg_attribute system catalog");
+			j = tcache->natts++;
+			tcache->attnames = repalloc(tcache->attnames,
+										sizeof(char *) * (j+1));
+			tcache->atttypids = repalloc(tcache->atttypids,
+										 sizeof(Oid) * (j+1));
+			tcache->atttypmods = repalloc(tcache->atttypmods,
+										  sizeof(int) * (j+1));
+			tcache->attnames[j]   = pstrdup(PQgetvalue(res, i, 1));
+			tcache->atttypids[j]  = atooid(PQgetvalue(res, i, 2));
+			tcache->atttypmods[j] = atoi(PQgetvalue(res, i, 3));
+		}
+		PQclear(res);
+	}
+
+	/* pg_enum of the enum types */
+	if (nenums > 0)
+	{
+		res = __pgsql_exec_oid_array_query(conn,
+			"SELECT enumtypid, enumlabel"
+			"  FROM pg_catalog.pg_enum"
+			" WHERE enumtypid = ANY($1::pg_catalog.oid[])"
+			" ORDER BY enumtypid, enumsortorder",
+			enum_oids, nenums);
+		for (i=0; i < PQntuples(res); i++)
+		{
+			SQLtypeCache *tcache;
+
+			if (PQgetisnull(res, i, 1) != 0)
+				Elog("Unexpected result from pg_enum system catalog");
+			tcache = __pgsql_lookup_type_cache(atooid(PQgetvalue(res, i, 0)));
+			if (!tcache)
+				Elog("unexpected result from pg_enum system catalog");
+			j = tcache->nlabels++;
+			tcache->labels = repalloc(tcache->labels,
+									  sizeof(char *) * (j+1));
+			tcache->labels[j] = pstrdup(PQgetvalue(res, i, 1));
+		}
+		PQclear(res);
+	}
+}
+
+static SQLtypeCache *
+pgsql_lookup_type_cache(PGconn *conn, Oid type_oid)
+{
+	SQLtypeCache *tcache = __pgsql_lookup_type_cache(type_oid);
+
+	if (!tcache)
+	{
+		pgsql_fetch_type_cache(conn, &type_oid, 1);
+		tcache = __pgsql_lookup_type_cache(type_oid);
+		if (!tcache)
+			Elog("cache lookup failed for type %u", type_oid);
+	}
+	return tcache;
+}
+
+/*
+ * Hash table of the dictionary
+ *
+ * Labels are kept in the open addressing hash table with linear probing,
+ * and its load factor is kept 50% or less. Once it gets full, the labels
+ * are moved to the new hash table twice as large as before. The former
+ * one is not released, because the other workers may still look at it
+ * without the lock; it never changes after the move.
+ */
+static void
+__pgsql_dictionary_reserve(SQLdictionary *dict, uint32 nrooms)
+{
+	SQLdictHash *htab_old = dict->htab;
+	SQLdictHash *htab_new;
+	uint32		nslots = 64;
+	uint32		i, k;
+
+	while (nslots < 2 * nrooms)
+		nslots *= 2;
+	if (htab_old && nslots <= htab_old->mask + 1)
+		return;
+	htab_new = palloc0(offsetof(SQLdictHash, slots[nslots]));
+	htab_new->mask = nslots - 1;
+	if (htab_old)
+	{
+		for (i=0; i <= htab_old->mask; i++)
+		{
+			SQLdictSlot *slot = &htab_old->slots[i];
+
+			if (!slot->label)
+				continue;
+			for (k = slot->hash & htab_new->mask;
+				 htab_new->slots[k].label != NULL;
+				 k = (k + 1) & htab_new->mask);
+			memcpy(&htab_new->slots[k], slot, sizeof(SQLdictSlot));
+		}
+		htab_new->nused = htab_old->nused;
+	}
+	__atomic_store_n(&dict->htab, htab_new, __ATOMIC_RELEASE);
+}
+
+/*
+ * pgsql_dictionary_insert - adds a new label to the hash table of the
+ * dictionary. Caller must hold the dict->lock, if text dictionary.
+ * It does not touch the values/extra buffers of the dictionary.
+ */
+SQLdictSlot *
+pgsql_dictionary_insert(SQLdictionary *dict, uint32 hash,
+						const char *label, uint32 len, uint32 index)
+{
+	SQLdictHash *htab;
+	SQLdictSlot *slot;
+	char	   *copy;
+	uint32		k;
+
+	__pgsql_dictionary_reserve(dict, dict->htab->nused + 1);
+	htab = dict->htab;
+	for (k = hash & htab->mask;
+		 htab->slots[k].label != NULL;
+		 k = (k + 1) & htab->mask);
+	slot = &htab->slots[k];
+	copy = palloc(len + 1);
+	memcpy(copy, label, len);
+	copy[len] = '\0';
+
+	slot->hash = hash;
+	slot->index = index;
+	slot->label_len = len;
+	memcpy(slot->label_head, label, Min(len, DICT_LABEL_HEAD_SZ));
+	htab->nused++;
+	__atomic_store_n(&slot->label, copy, __ATOMIC_RELEASE);
+
+	return slot;
+}
+
 static SQLdictionary *
 pgsql_create_dictionary(PGconn *conn, Oid enum_typeid)
 {
 	SQLdictionary *dict;
-	PGresult   *res;
-	char		query[4096];
-	int			i, j, nitems;
-	int			nslots;
+	SQLtypeCache *tcache;
+	int			i, nitems;
 
 	for (dict = pgsql_dictionary_list; dict != NULL; dict = dict->next)
 	{
@@ -61,57 +387,201 @@ pgsql_create_dictionary(PGconn *conn, Oid enum_typeid)
 			return dict;
 	}
 
-	snprintf(query, sizeof(query),
-			 "SELECT enumlabel"
-			 "  FROM pg_catalog.pg_enum"
-			 " WHERE enumtypid = %u", enum_typeid);
-	res = PQexec(conn, query);
-	if (PQresultStatus(res) != PGRES_TUPLES_OK)
-		Elog("failed on pg_enum system catalog query: %s",
-			 PQresultErrorMessage(res));
-
-	nitems = PQntuples(res);
-	nslots = Min(Max(nitems, 1<<10), 1<<18);
-	dict = palloc0(offsetof(SQLdictionary, hslots[nslots]));
+	tcache = pgsql_lookup_type_cache(conn, enum_typeid);
+	nitems = tcache->nlabels;
+	dict = palloc0(sizeof(SQLdictionary));
 	dict->enum_typeid = enum_typeid;
 	dict->dict_id = pgsql_dictionary_count++;
 	sql_buffer_init(&dict->values);
 	sql_buffer_init(&dict->extra);
-	dict->nitems = nitems;
-	dict->nslots = nslots;
+	pthread_mutex_init(&dict->lock, NULL);
+	__pgsql_dictionary_reserve(dict, nitems);
 	sql_buffer_append_zero(&dict->values, sizeof(int32));
 	for (i=0; i < nitems; i++)
 	{
-		const char *enumlabel = PQgetvalue(res, i, 0);
-		hashItem   *hitem;
-		uint32		hash;
+		const char *enumlabel = tcache->labels[i];
+		int32		offset;
 		size_t		len;
 
-		if (PQgetisnull(res, i, 0) != 0)
-			Elog("Unexpected result from pg_enum system catalog");
-
 		len = strlen(enumlabel);
-		hash = hash_any((const unsigned char *)enumlabel, len);
-		j = hash % nslots;
-		hitem = palloc0(offsetof(hashItem, label[len + 1]));
-		strcpy(hitem->label, enumlabel);
-		hitem->label_len = len;
-		hitem->index = i;
-		hitem->hash = hash;
-		hitem->next = dict->hslots[j];
-		dict->hslots[j] = hitem;
-
+		pgsql_dictionary_insert(dict,
+								hash_any((const unsigned char *)enumlabel, len),
+								enumlabel, len, i);
 		sql_buffer_append(&dict->extra, enumlabel, len);
-		sql_buffer_append(&dict->values, &dict->extra.usage, sizeof(int32));
+		offset = dict->extra.usage;
+		sql_buffer_append(&dict->values, &offset, sizeof(int32));
 	}
 	dict->nitems = nitems;
 	dict->next = pgsql_dictionary_list;
 	pgsql_dictionary_list = dict;
-	PQclear(res);
 
 	return dict;
 }
 
+/*
+ * pgsql_create_text_dictionary - creates an empty dictionary for the text
+ * columns (--dictionary-text). Unlike enum types, labels are added on the
+ * fly by put_value handler, and sent as delta dictionary batches.
+ * max_labels is the hint of --dictionary-text=N; a notice is printed once
+ * the dictionary gets more labels.
+ */
+SQLdictionary *
+pgsql_create_text_dictionary(int max_labels)
+{
+	SQLdictionary *dict;
+
+	dict = palloc0(sizeof(SQLdictionary));
+	dict->enum_typeid = InvalidOid;
+	dict->dict_id = pgsql_dictionary_count++;
+	sql_buffer_init(&dict->values);
+	sql_buffer_init(&dict->extra);
+	dict->nitems = 0;
+	dict->max_labels = max_labels;
+	pthread_mutex_init(&dict->lock, NULL);
+	__pgsql_dictionary_reserve(dict, Min(max_labels, 1<<16));
+	sql_buffer_append_zero(&dict->values, sizeof(int32));
+	dict->next = pgsql_dictionary_list;
+	pgsql_dictionary_list = dict;
+
+	return dict;
+}
+
+/*
+ * pgsql_is_text_attribute - true, if the attribute is text or varchar at
+ * the top level, thus, a candidate of the text dictionary.
+ */
+bool
+pgsql_is_text_attribute(SQLattribute *attr)
+{
+	if (attr->subtypes || attr->element || attr->enumdict)
+		return false;
+	if (attr->typtype != 'b' ||
+		strcmp(attr->typnamespace, "pg_catalog") != 0)
+		return false;
+	return (strcmp(attr->typname, "text") == 0 ||
+			strcmp(attr->typname, "varchar") == 0);
+}
+
+/*
+ * pgsql_count_distinct - counts the distinct non-null values of the column
+ * in the result set. It stops counting once it exceeds the 'limit'.
+ */
+int
+pgsql_count_distinct(PGresult *res, int column, int limit)
+{
+	int			nrows = PQntuples(res);
+	int			nslots = 1024;
+	int		   *slots;
+	int			i, ndistinct = 0;
+
+	while (nslots < 2 * (limit + 1))
+		nslots *= 2;
+	slots = palloc(sizeof(int) * nslots);
+	memset(slots, -1, sizeof(int) * nslots);
+	for (i=0; i < nrows && ndistinct <= limit; i++)
+	{
+		const char *addr;
+		int			sz;
+		uint32		k;
+
+		if (PQgetisnull(res, i, column))
+			continue;
+		addr = PQgetvalue(res, i, column);
+		sz = PQgetlength(res, i, column);
+		k = hash_any((const unsigned char *)addr, sz) & (nslots - 1);
+		while (slots[k] >= 0)
+		{
+			int		j = slots[k];
+
+			if (PQgetlength(res, j, column) == sz &&
+				memcmp(PQgetvalue(res, j, column), addr, sz) == 0)
+				break;
+			k = (k + 1) & (nslots - 1);
+		}
+		if (slots[k] < 0)
+		{
+			slots[k] = i;
+			ndistinct++;
+		}
+	}
+	pfree(slots);
+
+	return ndistinct;
+}
+
+/*
+ * pgsql_rebase_dictionary - reorders the enum labels of the dictionary
+ * according to the dictionary already written in the file, for --append.
+ * The labels in the file keep their index, and the labels newly added to
+ * pg_enum follow them; so, only the labels after 'nloaded' shall be
+ * written by the delta dictionary batch. Labels already dropped from
+ * pg_enum are kept, not to change the index of the others.
+ */
+void
+pgsql_rebase_dictionary(SQLdictionary *dict, int nlabels,
+						const char **labels, const int *label_lens)
+{
+	SQLdictHash *htab;
+	SQLdictSlot **order;
+	SQLdictSlot *slot;
+	int			i, nitems = 0;
+	int32		offset;
+
+	/* slots must not move during the rebase, for the dropped labels */
+	__pgsql_dictionary_reserve(dict, dict->htab->nused + nlabels);
+	htab = dict->htab;
+
+	/* labels of pg_enum, in order of the current index */
+	order = palloc0(sizeof(SQLdictSlot *) * Max(dict->nitems, 1));
+	for (i=0; i <= htab->mask; i++)
+	{
+		slot = &htab->slots[i];
+		if (!slot->label)
+			continue;
+		assert(slot->index < dict->nitems);
+		order[slot->index] = slot;
+		slot->index = UINT_MAX;
+	}
+	sql_buffer_clear(&dict->values);
+	sql_buffer_clear(&dict->extra);
+	sql_buffer_append_zero(&dict->values, sizeof(int32));
+	for (i=0; i < nlabels; i++)
+	{
+		const char *label = labels[i];
+		int			len = label_lens[i];
+		uint32		hash;
+
+		hash = hash_any((const unsigned char *)label, len);
+		slot = sql_dictionary_lookup(dict, hash, label, len);
+		if (!slot)
+		{
+			/* label already dropped from pg_enum */
+			slot = pgsql_dictionary_insert(dict, hash, label, len, UINT_MAX);
+		}
+		else if (slot->index != UINT_MAX)
+			Elog("enum label '%s' appeared twice in the dictionary",
+				 slot->label);
+		slot->index = nitems++;
+		sql_buffer_append(&dict->extra, label, len);
+		offset = dict->extra.usage;
+		sql_buffer_append(&dict->values, &offset, sizeof(int32));
+	}
+	dict->nloaded = nitems;
+	/* labels newly added to pg_enum */
+	for (i=0; i < dict->nitems; i++)
+	{
+		slot = order[i];
+		if (!slot || slot->index != UINT_MAX)
+			continue;
+		slot->index = nitems++;
+		sql_buffer_append(&dict->extra, slot->label, slot->label_len);
+		offset = dict->extra.usage;
+		sql_buffer_append(&dict->values, &offset, sizeof(int32));
+	}
+	dict->nitems = nitems;
+	pfree(order);
+}
+
 /*
  * pgsql_setup_attribute
  */
@@ -165,7 +635,7 @@ pgsql_setup_attribute(PGconn *conn,
 		SQLtable   *subtypes;
 
 		assert(comp_typrelid != 0);
-		subtypes = pgsql_create_composite_type(conn, comp_typrelid);
+		subtypes = pgsql_create_composite_type(conn, atttypid);
 		*p_numFieldNodes += subtypes->numFieldNodes;
 		*p_numBuffers += subtypes->numBuffers;
 
@@ -181,74 +651,65 @@ pgsql_setup_attribute(PGconn *conn,
 	/* init statistics */
 	attr->min_isnull = true;
 	attr->max_isnull = true;
-	attr->min_value  = 0UL;
-	attr->max_value  = 0UL;
+	memset(&attr->min_value, 0, sizeof(SQLstat));
+	memset(&attr->max_value, 0, sizeof(SQLstat));
 	/* assign properties of Apache Arrow Type */
 	assignArrowType(attr, p_numBuffers);
 	*p_numFieldNodes += 1;
 }
 
+/*
+ * pgsql_setup_attribute_by_cache
+ */
+static void
+pgsql_setup_attribute_by_cache(PGconn *conn,
+							   SQLattribute *attr,
+							   const char *attname,
+							   Oid atttypid,
+							   int atttypmod,
+							   int *p_numFieldNodes,
+							   int *p_numBuffers)
+{
+	SQLtypeCache *tcache = pgsql_lookup_type_cache(conn, atttypid);
+
+	pgsql_setup_attribute(conn,
+						  attr,
+						  attname,
+						  atttypid,
+						  atttypmod,
+						  tcache->typlen,
+						  tcache->typbyval,
+						  tcache->typalign,
+						  tcache->typtype,
+						  tcache->typrelid,
+						  tcache->typelem,
+						  tcache->nspname,
+						  tcache->typname,
+						  p_numFieldNodes,
+						  p_numBuffers);
+}
+
 /*
  * pgsql_create_composite_type
  */
 static SQLtable *
-pgsql_create_composite_type(PGconn *conn, Oid comptype_relid)
+pgsql_create_composite_type(PGconn *conn, Oid comptype_oid)
 {
-	PGresult   *res;
+	SQLtypeCache *tcache = pgsql_lookup_type_cache(conn, comptype_oid);
 	SQLtable   *table;
-	char		query[4096];
-	int			j, nfields;
-
-	snprintf(query, sizeof(query),
-			 "SELECT attname, attnum, atttypid, atttypmod, attlen,"
-			 "       attbyval, attalign, typtype, typrelid, typelem,"
-			 "       nspname, typname"
-			 "  FROM pg_catalog.pg_attribute a,"
-			 "       pg_catalog.pg_type t,"
-			 "       pg_catalog.pg_namespace n"
-			 " WHERE t.typnamespace = n.oid"
-			 "   AND a.atttypid = t.oid"
-			 "   AND a.attrelid = %u", comptype_relid);
-	res = PQexec(conn, query);
-	if (PQresultStatus(res) != PGRES_TUPLES_OK)
-		Elog("failed on pg_type system catalog query: %s",
-			 PQresultErrorMessage(res));
+	int			j, nfields = tcache->natts;
 
-	nfields = PQntuples(res);
 	table = palloc0(offsetof(SQLtable, attrs[nfields]));
 	table->nfields = nfields;
 	for (j=0; j < nfields; j++)
 	{
-		const char *attname   = PQgetvalue(res, j, 0);
-		const char *attnum    = PQgetvalue(res, j, 1);
-		const char *atttypid  = PQgetvalue(res, j, 2);
-		const char *atttypmod = PQgetvalue(res, j, 3);
-		const char *attlen    = PQgetvalue(res, j, 4);
-		const char *attbyval  = PQgetvalue(res, j, 5);
-		const char *attalign  = PQgetvalue(res, j, 6);
-		const char *typtype   = PQgetvalue(res, j, 7);
-		const char *typrelid  = PQgetvalue(res, j, 8);
-		const char *typelem   = PQgetvalue(res, j, 9);
-		const char *nspname   = PQgetvalue(res, j, 10);
-		const char *typname   = PQgetvalue(res, j, 11);
-		int			index     = atoi(attnum);
-
-		if (index < 1 || index > nfields)
-			Elog("attribute number is out of range");
-		pgsql_setup_attribute(conn,
-							  &table->attrs[index-1],
-							  attname,
-							  atooid(atttypid),
-							  atoi(atttypmod),
-							  atoi(attlen),
-							  pg_strtobool(attbyval),
-							  pg_strtochar(attalign),
-							  pg_strtochar(typtype),
-							  atooid(typrelid),
-							  atooid(typelem),
-							  nspname, typname,
-							  &table->numFieldNodes,
-							  &table->numBuffers);
+		pgsql_setup_attribute_by_cache(conn,
+									   &table->attrs[j],
+									   tcache->attnames[j],
+									   tcache->atttypids[j],
+									   tcache->atttypmods[j],
+									   &table->numFieldNodes,
+									   &table->numBuffers);
 	}
 	return table;
 }
@@ -259,55 +720,15 @@ pgsql_create_array_element(PGconn *conn, Oid array_elemid,
 						   int *p_numBuffers)
 {
 	SQLattribute   *attr = palloc0(sizeof(SQLattribute));
-	PGresult	   *res;
-	char			query[4096];
-	const char     *nspname;
-	const char	   *typname;
-	const char	   *typlen;
-	const char	   *typbyval;
-	const char	   *typalign;
-	const char	   *typtype;
-	const char	   *typrelid;
-	const char	   *typelem;
-
-	snprintf(query, sizeof(query),
-			 "SELECT nspname, typname,"
-			 "       typlen, typbyval, typalign, typtype,"
-			 "       typrelid, typelem"
-			 "  FROM pg_catalog.pg_type t,"
-			 "       pg_catalog.pg_namespace n"
-			 " WHERE t.typnamespace = n.oid"
-			 "   AND t.oid = %u", array_elemid);
-	res = PQexec(conn, query);
-	if (PQresultStatus(res) != PGRES_TUPLES_OK)
-		Elog("failed on pg_type system catalog query: %s",
-			 PQresultErrorMessage(res));
-	if (PQntuples(res) != 1)
-		Elog("unexpected number of result rows: %d", PQntuples(res));
-	nspname  = PQgetvalue(res, 0, 0);
-	typname  = PQgetvalue(res, 0, 1);
-	typlen   = PQgetvalue(res, 0, 2);
-	typbyval = PQgetvalue(res, 0, 3);
-	typalign = PQgetvalue(res, 0, 4);
-	typtype  = PQgetvalue(res, 0, 5);
-	typrelid = PQgetvalue(res, 0, 6);
-	typelem  = PQgetvalue(res, 0, 7);
+	SQLtypeCache   *tcache = pgsql_lookup_type_cache(conn, array_elemid);
 
-	pgsql_setup_attribute(conn,
-						  attr,
-						  typname,
-						  array_elemid,
-						  -1,
-						  atoi(typlen),
-						  pg_strtobool(typbyval),
-						  pg_strtochar(typalign),
-						  pg_strtochar(typtype),
-						  atooid(typrelid),
-						  atooid(typelem),
-						  nspname,
-						  typname,
-						  p_numFieldNode,
-						  p_numBuffers);
+	pgsql_setup_attribute_by_cache(conn,
+								   attr,
+								   tcache->typname,
+								   array_elemid,
+								   -1,
+								   p_numFieldNode,
+								   p_numBuffers);
 	return attr;
 }
 
@@ -319,71 +740,58 @@ pgsql_create_buffer(PGconn *conn, PGresult *res, size_t segment_sz)
 {
 	int			j, nfields = PQnfields(res);
 	SQLtable   *table;
+	Oid		   *type_oids;
+
+	/* load the type catalog at once */
+	type_oids = alloca(sizeof(Oid) * (nfields + 1));
+	for (j=0; j < nfields; j++)
+		type_oids[j] = PQftype(res, j);
+	pgsql_fetch_type_cache(conn, type_oids, nfields);
 
 	table = palloc0(offsetof(SQLtable, attrs[nfields]));
+	table->fdesc_direct = -1;
+	table->shard_id = -1;
 	table->segment_sz = segment_sz;
 	table->nitems = 0;
 	table->nfields = nfields;
 	for (j=0; j < nfields; j++)
 	{
-		const char *attname = PQfname(res, j);
-		Oid			atttypid = PQftype(res, j);
-		int			atttypmod = PQfmod(res, j);
-		PGresult   *__res;
-		char		query[4096];
-		const char *typlen;
-		const char *typbyval;
-		const char *typalign;
-		const char *typtype;
-		const char *typrelid;
-		const char *typelem;
-		const char *nspname;
-		const char *typname;
-
-		snprintf(query, sizeof(query),
-				 "SELECT typlen, typbyval, typalign, typtype,"
-				 "       typrelid, typelem, nspname, typname"
-				 "  FROM pg_catalog.pg_type t,"
-				 "       pg_catalog.pg_namespace n"
-				 " WHERE t.typnamespace = n.oid"
-				 "   AND t.oid = %u", atttypid);
-		__res = PQexec(conn, query);
-		if (PQresultStatus(__res) != PGRES_TUPLES_OK)
-			Elog("failed on pg_type system catalog query: %s",
-				 PQresultErrorMessage(res));
-		if (PQntuples(__res) != 1)
-			Elog("unexpected number of result rows: %d", PQntuples(__res));
-		typlen   = PQgetvalue(__res, 0, 0);
-		typbyval = PQgetvalue(__res, 0, 1);
-		typalign = PQgetvalue(__res, 0, 2);
-		typtype  = PQgetvalue(__res, 0, 3);
-		typrelid = PQgetvalue(__res, 0, 4);
-		typelem  = PQgetvalue(__res, 0, 5);
-		nspname  = PQgetvalue(__res, 0, 6);
-		typname  = PQgetvalue(__res, 0, 7);
-		pgsql_setup_attribute(conn,
-							  &table->attrs[j],
-                              attname,
-							  atttypid,
-							  atttypmod,
-							  atoi(typlen),
-							  *typbyval,
-							  *typalign,
-							  *typtype,
-							  atoi(typrelid),
-							  atoi(typelem),
-							  nspname, typname,
-							  &table->numFieldNodes,
-							  &table->numBuffers);
-		PQclear(__res);
+		pgsql_setup_attribute_by_cache(conn,
+									   &table->attrs[j],
+									   PQfname(res, j),
+									   PQftype(res, j),
+									   PQfmod(res, j),
+									   &table->numFieldNodes,
+									   &table->numBuffers);
 	}
+	assignArrowRowDecoder(table);
+	__pgsql_reset_usage_bound(table, 0);
+	__pgsql_setup_partition_key(table);
 	return table;
 }
 
+/*
+ * pgsql_setup_text_dictionary - turns the text column of the table into
+ * the dictionary encoded one. It has to be called prior to the schema
+ * definition, and the pipeline or decoder setup.
+ */
+void
+pgsql_setup_text_dictionary(SQLtable *table, int column, SQLdictionary *dict)
+{
+	SQLattribute *attr = &table->attrs[column];
+
+	assert(pgsql_is_text_attribute(attr) && table->nitems == 0);
+	table->numBuffers -= 3;		/* nullmap + index + extra of Utf8 */
+	attr->enumdict = dict;
+	assignArrowType(attr, &table->numBuffers);
+	assignArrowRowDecoder(table);
+	__pgsql_reset_usage_bound(table, 0);
+}
+
 /*
  * pgsql_clear_attribute
  */
-static void
+void
 pgsql_clear_attribute(SQLattribute *attr)
 {
 	attr->nitems = 0;
@@ -405,102 +813,1434 @@ pgsql_clear_attribute(SQLattribute *attr)
 	/* clear statistics */
 	attr->min_isnull = true;
 	attr->max_isnull = true;
-	attr->min_value  = 0UL;
-	attr->max_value  = 0UL;
+	memset(&attr->min_value, 0, sizeof(SQLstat));
+	memset(&attr->max_value, 0, sizeof(SQLstat));
 }
 
 /*
- * pgsql_writeout_buffer
+ * __pgsql_save_record_stats - saves min/max statistics of the columns
+ * of the 'table' for the record batch at 'index' of the 'root' table,
+ * prior to pgsql_clear_attribute()
  */
-void
-pgsql_writeout_buffer(SQLtable *table)
+static void
+__pgsql_save_record_stats(SQLtable *root, SQLtable *table, int index)
 {
-	off_t		currPos;
-	size_t		metaSize;
-	size_t		bodySize;
-	int			j, index;
-	ArrowBlock *b;
+	size_t		unitsz = sizeof(char *) * 2 * table->nfields;
+	char	  **stats;
+	int			j;
 
-	/* write a new record batch */
-	currPos = lseek(table->fdesc, 0, SEEK_CUR);
-	if (currPos < 0)
-		Elog("unable to get current position of the file");
-	writeArrowRecordBatch(table, &metaSize, &bodySize);
+	if (index == 0)
+		root->recordStats = palloc(unitsz);
+	else
+		root->recordStats = repalloc(root->recordStats,
+									 unitsz * (index+1));
+	stats = root->recordStats + 2 * table->nfields * index;
+	memset(stats, 0, unitsz);
+	for (j=0; j < table->nfields; j++)
+	{
+		SQLattribute   *attr = &table->attrs[j];
+
+		if (attr->stat_format && !attr->min_isnull && !attr->max_isnull)
+		{
+			stats[2*j]   = attr->stat_format(&attr->min_value);
+			stats[2*j+1] = attr->stat_format(&attr->max_value);
+		}
+	}
+}
 
-	index = table->numRecordBatches++;
+/*
+ * __pgsql_save_row_group - moves the metadata of the row group built for
+ * the 'table' to the 'root' table, as the row group at 'index'
+ */
+static void
+__pgsql_save_row_group(SQLtable *root, SQLtable *table, int index)
+{
 	if (index == 0)
-		table->recordBatches = palloc(sizeof(ArrowBlock));
+		root->rowGroups = palloc(sizeof(ParquetRowGroup *));
 	else
-		table->recordBatches = repalloc(table->recordBatches,
-										sizeof(ArrowBlock) * (index+1));
-	b = &table->recordBatches[index];
-	b->tag = ArrowNodeTag__Block;
-	b->offset = currPos;
-	b->metaDataLength = metaSize;
-	b->bodyLength = bodySize;
+		root->rowGroups = repalloc(root->rowGroups,
+								   sizeof(ParquetRowGroup *) * (index+1));
+	root->rowGroups[index] = table->rowGroupPending;
+	table->rowGroupPending = NULL;
+}
 
-	/* shows progress (optional) */
-	if (shows_progress)
+/*
+ * __pgsql_pwritev - writes out the iovec at the position, with retry
+ */
+static void
+__pgsql_pwritev(int fdesc, struct iovec *iov, int iovcnt, off_t offset)
+{
+	ssize_t		nbytes;
+
+	while (iovcnt > 0)
 	{
-		printf("RecordBatch %d: offset=%lu length=%lu (meta=%zu, body=%zu)\n",
-			   index, currPos, metaSize + bodySize, metaSize, bodySize);
+		nbytes = pwritev(fdesc, iov, Min(iovcnt, IOV_MAX), offset);
+		if (nbytes < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			Elog("failed on pwritev(2): %m");
+		}
+		offset += nbytes;
+		/* skip the items already written, or partially written */
+		while (iovcnt > 0 && nbytes >= iov->iov_len)
+		{
+			nbytes -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + nbytes;
+			iov->iov_len -= nbytes;
+		}
 	}
-
-	/* makes table/attributes empty again */
-	table->nitems = 0;
-	for (j=0; j < table->nfields; j++)
-		pgsql_clear_attribute(&table->attrs[j]);
 }
 
 /*
- * pgsql_append_results
+ * __pgsql_write_direct - writes out the iovec using O_DIRECT
+ *
+ * Buffers of SQLattribute are not aligned to the logical block size, so
+ * the iovec is copied to the aligned staging buffer for each chunk.
+ * The tail of the last chunk is padded by zero, up to DIRECT_IO_ALIGN.
  */
-void
-pgsql_append_results(SQLtable *table, PGresult *res)
+#define DIRECT_IO_ALIGN			4096
+#define DIRECT_IO_CHUNK_SZ		(8UL << 20)		/* 8MB */
+
+static void
+__pgsql_write_direct(int fdesc, struct iovec *iov, int iovcnt, off_t offset)
 {
-	int		i, ntuples = PQntuples(res);
-	int		j, nfields = PQnfields(res);
-	size_t	usage;
+	char	   *chunk;
+	size_t		usage = 0;
+	size_t		length;
+	ssize_t		nbytes;
+	int			k;
 
-	assert(nfields == table->nfields);
-	for (i=0; i < ntuples; i++)
+	chunk = mmap(NULL, DIRECT_IO_CHUNK_SZ, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (chunk == MAP_FAILED)
+		Elog("failed on mmap(len=%zu): %m", DIRECT_IO_CHUNK_SZ);
+	for (k=0; k <= iovcnt; k++)
 	{
-		usage = 0;
+		char	   *addr = (k < iovcnt ? iov[k].iov_base : NULL);
+		size_t		len  = (k < iovcnt ? iov[k].iov_len  : 0);
 
-		for (j=0; j < nfields; j++)
-		{
-			SQLattribute   *attr = &table->attrs[j];
-			const char	   *addr;
-			size_t			sz;
-			/* data must be binary format */
-			assert(PQfformat(res, j) == 1);
-			if (PQgetisnull(res, i, j))
+		do {
+			if (len > 0)
 			{
-				addr = NULL;
-				sz = 0;
+				nbytes = Min(len, DIRECT_IO_CHUNK_SZ - usage);
+				memcpy(chunk + usage, addr, nbytes);
+				usage += nbytes;
+				addr  += nbytes;
+				len   -= nbytes;
 			}
-			else
+			if (usage == DIRECT_IO_CHUNK_SZ || (k == iovcnt && usage > 0))
 			{
-				addr = PQgetvalue(res, i, j);
-				sz = PQgetlength(res, i, j);
+				length = TYPEALIGN(DIRECT_IO_ALIGN, usage);
+				memset(chunk + usage, 0, length - usage);
+				usage = 0;
+				while (usage < length)
+				{
+					nbytes = pwrite(fdesc,
+									chunk + usage,
+									length - usage,
+									offset + usage);
+					if (nbytes < 0)
+					{
+						if (errno == EINTR)
+							continue;
+						Elog("failed on pwrite(2) with O_DIRECT: %m");
+					}
+					usage += nbytes;
+				}
+				offset += length;
+				usage = 0;
 			}
-			assert(attr->nitems == table->nitems);
-			attr->put_value(attr, addr, sz);
-			if (attr->stat_update)
-				attr->stat_update(attr, addr, sz);
-			usage += attr->buffer_usage(attr);
+		} while (len > 0);
+	}
+	if (munmap(chunk, DIRECT_IO_CHUNK_SZ) != 0)
+		Elog("failed on munmap: %m");
+}
+
+/*
+ * pgsql_setup_direct_io - opens the output file with O_DIRECT
+ *
+ * Only the record batches are written by direct I/O; the header, schema,
+ * dictionary batches and footer are still written by the buffered I/O.
+ */
+void
+pgsql_setup_direct_io(SQLtable *table)
+{
+	table->fdesc_direct = open(table->filename, O_WRONLY | O_DIRECT);
+	if (table->fdesc_direct < 0)
+		Elog("failed to open '%s' with O_DIRECT: %m", table->filename);
+}
+
+/*
+ * __pgsql_writev - writes out the iovec sequentially, for the IPC stream
+ */
+static void
+__pgsql_writev(int fdesc, struct iovec *iov, int iovcnt)
+{
+	ssize_t		nbytes;
+
+	while (iovcnt > 0)
+	{
+		nbytes = writev(fdesc, iov, Min(iovcnt, IOV_MAX));
+		if (nbytes < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			Elog("failed on writev(2): %m");
 		}
-		table->nitems++;
-		/* exceeds the threshold to write? */
-		if (usage > table->segment_sz)
+		/* skip the items already written, or partially written */
+		while (iovcnt > 0 && nbytes >= iov->iov_len)
+		{
+			nbytes -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
 		{
-			if (table->nitems == 0)
-				Elog("A result row is larger than size of record batch!!");
-			pgsql_writeout_buffer(table);
+			iov->iov_base = (char *)iov->iov_base + nbytes;
+			iov->iov_len -= nbytes;
 		}
 	}
 }
 
+/*
+ * __pgsql_write_stream - writes out a record batch to the IPC stream
+ *
+ * Stream is not seekable, so the record batch is written under the
+ * pgsql_writeout_lock, not to mix up with the ones by the other workers.
+ * No ArrowBlock is recorded, because the stream has no footer.
+ */
+static void
+__pgsql_write_stream(SQLtable *root, SQLiovec *iov,
+					 size_t metaSize, size_t bodySize)
+{
+	int			index;
+
+	pthread_mutex_lock(&pgsql_writeout_lock);
+	flushArrowTextDictionaries(root);
+	index = pgsql_stream_nbatches++;
+	__pgsql_writev(root->fdesc, iov->iov, iov->nitems);
+	pthread_mutex_unlock(&pgsql_writeout_lock);
+
+	/* shows progress (optional) */
+	if (shows_progress)
+	{
+		fprintf(stderr, "RecordBatch %d: length=%lu (meta=%zu, body=%zu)\n",
+				index, metaSize + bodySize, metaSize, bodySize);
+	}
+}
+
+/*
+ * __pgsql_write_file - writes out a record batch to the file
+ *
+ * File range of the record batch is reserved under the pgsql_writeout_lock,
+ * then the buffers are written by pwritev(2) without the lock, so parallel
+ * workers can write their record batches concurrently.
+ * The record batch is accounted to the owner table if shadow, because the
+ * output file may be switched to the next shard by the owner.
+ */
+static void
+__pgsql_write_file(SQLtable *root, SQLtable *table, SQLiovec *iov,
+				   size_t metaSize, size_t bodySize)
+{
+	off_t		currPos;
+	size_t		length;
+	int			fdesc;
+	int			fdesc_direct;
+	int			index;
+	ArrowBlock *b;
+
+	/* reserve the file range to write */
+	pthread_mutex_lock(&pgsql_writeout_lock);
+	currPos = lseek(root->fdesc, 0, SEEK_CUR);
+	if (currPos < 0)
+		Elog("unable to get current position of the file");
+	length = iov->length;
+	/* switch to the next shard, if the record batch exceeds the limit */
+	if (root->shard_id >= 0 && root->numRecordBatches > 0 &&
+		((shard_max_nitems > 0 &&
+		  root->shard_nitems + table->nitems > shard_max_nitems) ||
+		 (shard_max_file_sz > 0 &&
+		  currPos + length > shard_max_file_sz)))
+		rotateArrowOutputFile(root);
+	/* new labels of the text dictionaries, prior to the record batch */
+	if (output_format == OUTPUT_FORMAT__ARROW)
+		flushArrowTextDictionaries(root);
+	currPos = lseek(root->fdesc, 0, SEEK_CUR);
+	if (currPos < 0)
+		Elog("unable to get current position of the file");
+	fdesc = root->fdesc;
+	fdesc_direct = root->fdesc_direct;
+	if (fdesc_direct >= 0)
+	{
+		currPos = TYPEALIGN(DIRECT_IO_ALIGN, currPos);
+		length = TYPEALIGN(DIRECT_IO_ALIGN, length);
+	}
+	if (lseek(fdesc, currPos + length, SEEK_SET) < 0)
+		Elog("failed on lseek(2): %m");
+
+	index = root->numRecordBatches++;
+	if (index == 0)
+		root->recordBatches = palloc(sizeof(ArrowBlock));
+	else
+		root->recordBatches = repalloc(root->recordBatches,
+									   sizeof(ArrowBlock) * (index+1));
+	b = &root->recordBatches[index];
+	b->tag = ArrowNodeTag__Block;
+	b->offset = currPos;
+	b->metaDataLength = metaSize;
+	b->bodyLength = bodySize;
+	__pgsql_save_record_stats(root, table, index);
+	if (table->rowGroupPending)
+		__pgsql_save_row_group(root, table, index);
+	root->shard_nitems += table->nitems;
+
+	/* shows progress (optional) */
+	if (shows_progress)
+	{
+		if (output_format == OUTPUT_FORMAT__PARQUET)
+			printf("RowGroup %d: offset=%lu length=%lu rows=%zu\n",
+				   index, currPos, bodySize, table->nitems);
+		else
+			printf("RecordBatch %d: offset=%lu length=%lu (meta=%zu, body=%zu)\n",
+				   index, currPos, metaSize + bodySize, metaSize, bodySize);
+	}
+	pthread_mutex_unlock(&pgsql_writeout_lock);
+
+	/* write out the record batch */
+	if (fdesc_direct >= 0)
+		__pgsql_write_direct(fdesc_direct, iov->iov, iov->nitems, currPos);
+	else
+		__pgsql_pwritev(fdesc, iov->iov, iov->nitems, currPos);
+	if (checkpoint_filename)
+		writeArrowCheckpoint(root, table, index);
+}
+
+/*
+ * perf_timer_begin / perf_timer_end - phase timers of --stats
+ *
+ * perf_timer_end() returns the wall time of the phase in ns, exclusive of
+ * the inner phases.
+ */
+void
+perf_timer_begin(SQLperfTimer *timer)
+{
+	timer->active = (shows_stats != 0);
+	if (!timer->active)
+		return;
+	timer->outer = perf_curr_timer;
+	timer->inner_wall_ns = 0;
+	timer->inner_cpu_ns = 0;
+	timer->wall_ns = perf_clock_ns(CLOCK_MONOTONIC);
+	timer->cpu_ns = perf_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	perf_curr_timer = timer;
+}
+
+uint64
+perf_timer_end(SQLperfTimer *timer, int phase, uint64 nbytes)
+{
+	uint64		wall_ns;
+	uint64		cpu_ns;
+
+	if (!timer->active)
+		return 0;
+	wall_ns = perf_clock_ns(CLOCK_MONOTONIC) - timer->wall_ns;
+	cpu_ns = perf_clock_ns(CLOCK_THREAD_CPUTIME_ID) - timer->cpu_ns;
+	perf_curr_timer = timer->outer;
+	if (timer->outer)
+	{
+		timer->outer->inner_wall_ns += wall_ns;
+		timer->outer->inner_cpu_ns += cpu_ns;
+	}
+	wall_ns -= Min(wall_ns, timer->inner_wall_ns);
+	cpu_ns -= Min(cpu_ns, timer->inner_cpu_ns);
+	perf_counter_add(wall_ns[phase], wall_ns);
+	perf_counter_add(cpu_ns[phase], cpu_ns);
+	perf_counter_add(count[phase], 1);
+	perf_counter_add(nbytes[phase], nbytes);
+	return wall_ns;
+}
+
+/*
+ * __pgsql_writeout_buffer - write out a record batch synchronously
+ */
+static void
+__pgsql_writeout_buffer(SQLtable *table)
+{
+	SQLtable   *root = (table->owner ? table->owner : table);
+	SQLiovec	iov;
+	size_t		metaSize;
+	size_t		bodySize;
+	SQLperfTimer timer;
+	int			j;
+
+	/* build a new record batch, or row group of Parquet */
+	perf_timer_begin(&timer);
+	if (output_format == OUTPUT_FORMAT__PARQUET)
+	{
+		setupParquetRowGroup(table, &iov, &bodySize);
+		metaSize = 0;
+	}
+	else
+		setupArrowRecordBatch(table, &iov, &metaSize, &bodySize);
+	perf_timer_end(&timer, PERF_PHASE__BUILD, metaSize + bodySize);
+
+	perf_timer_begin(&timer);
+	if (use_ipc_stream)
+		__pgsql_write_stream(root, &iov, metaSize, bodySize);
+	else
+		__pgsql_write_file(root, table, &iov, metaSize, bodySize);
+	perf_timer_end(&timer, PERF_PHASE__WRITE, iov.length);
+	sql_iovec_release(&iov);
+
+	/* makes table/attributes empty again */
+	table->nitems = 0;
+	for (j=0; j < table->nfields; j++)
+	{
+		SQLattribute *attr = &table->attrs[j];
+
+		if (shows_stats)
+			__atomic_fetch_add(&root->attrs[j].perf_arrow_bytes,
+							   attr->buffer_usage(attr), __ATOMIC_RELAXED);
+		pgsql_clear_attribute(attr);
+	}
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Pipelined writer
+ *
+ * Once the table gets enough rows, pgsql_writeout_buffer() swaps its
+ * buffers with a free shadow table, then kicks the writer thread to
+ * write out the shadow in background. So, the caller can continue to
+ * fetch and decode the next chunk, while the previous record batch is
+ * written. The shadow tables come back to the free list of the owner
+ * table once they are written.
+ *
+ * ----------------------------------------------------------------
+ */
+static pthread_t		pgsql_writer_thread;
+static bool				pgsql_writer_running = false;
+static bool				pgsql_writer_shutdown = false;
+static pthread_mutex_t	pgsql_writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	pgsql_writer_cond = PTHREAD_COND_INITIALIZER;
+static SQLtable		   *pgsql_writer_queue = NULL;
+
+static SQLtable *__pgsql_duplicate_table(SQLtable *src);
+
+static void
+__pgsql_duplicate_attribute(SQLattribute *dst, SQLattribute *src)
+{
+	memcpy(dst, src, sizeof(SQLattribute));
+	dst->nitems = 0;
+	dst->nullcount = 0;
+	sql_buffer_init(&dst->nullmap);
+	sql_buffer_init(&dst->values);
+	sql_buffer_init(&dst->extra);
+	dst->min_isnull = true;
+	dst->max_isnull = true;
+	memset(&dst->min_value, 0, sizeof(SQLstat));
+	memset(&dst->max_value, 0, sizeof(SQLstat));
+	if (src->subtypes)
+		dst->subtypes = __pgsql_duplicate_table(src->subtypes);
+	if (src->element)
+	{
+		dst->element = palloc0(sizeof(SQLattribute));
+		__pgsql_duplicate_attribute(dst->element, src->element);
+	}
+}
+
+static SQLtable *
+__pgsql_duplicate_table(SQLtable *src)
+{
+	SQLtable   *dst = palloc0(offsetof(SQLtable, attrs[src->nfields]));
+	int			j;
+
+	dst->fdesc = -1;			/* shadow writes to the file of the owner */
+	dst->fdesc_direct = -1;
+	dst->shard_id = -1;
+	dst->numFieldNodes = src->numFieldNodes;
+	dst->numBuffers = src->numBuffers;
+	dst->segment_sz = src->segment_sz;
+	dst->nfields = src->nfields;
+	for (j=0; j < src->nfields; j++)
+		__pgsql_duplicate_attribute(&dst->attrs[j], &src->attrs[j]);
+	return dst;
+}
+
+#define __SWAP(a,b)								\
+	do {										\
+		__typeof__(a) __temp = (a);				\
+		(a) = (b);								\
+		(b) = __temp;							\
+	} while(0)
+
+static void
+__pgsql_swap_attribute(SQLattribute *a, SQLattribute *b)
+{
+	int			j;
+
+	__SWAP(a->nitems,     b->nitems);
+	__SWAP(a->nullcount,  b->nullcount);
+	__SWAP(a->nullmap,    b->nullmap);
+	__SWAP(a->values,     b->values);
+	__SWAP(a->extra,      b->extra);
+	__SWAP(a->min_isnull, b->min_isnull);
+	__SWAP(a->max_isnull, b->max_isnull);
+	__SWAP(a->min_value,  b->min_value);
+	__SWAP(a->max_value,  b->max_value);
+	if (a->subtypes)
+	{
+		assert(a->subtypes->nfields == b->subtypes->nfields);
+		for (j=0; j < a->subtypes->nfields; j++)
+			__pgsql_swap_attribute(&a->subtypes->attrs[j],
+								   &b->subtypes->attrs[j]);
+	}
+	if (a->element)
+		__pgsql_swap_attribute(a->element, b->element);
+}
+
+static void *
+pgsql_writer_main(void *__unused)
+{
+	SQLtable   *shadow;
+	SQLtable   *owner;
+
+	pthread_mutex_lock(&pgsql_writer_lock);
+	for (;;)
+	{
+		if (!pgsql_writer_queue)
+		{
+			if (pgsql_writer_shutdown)
+				break;
+			pthread_cond_wait(&pgsql_writer_cond, &pgsql_writer_lock);
+			continue;
+		}
+		/* pick up the oldest one */
+		shadow = pgsql_writer_queue;
+		pgsql_writer_queue = shadow->next;
+		pthread_mutex_unlock(&pgsql_writer_lock);
+
+		__pgsql_writeout_buffer(shadow);
+
+		pthread_mutex_lock(&pgsql_writer_lock);
+		/* give back the shadow to the owner */
+		owner = shadow->owner;
+		shadow->next = owner->shadows;
+		owner->shadows = shadow;
+		owner->numFreeShadows++;
+		pthread_cond_broadcast(&pgsql_writer_cond);
+	}
+	pthread_mutex_unlock(&pgsql_writer_lock);
+
+	return NULL;
+}
+
+/*
+ * pgsql_setup_pipeline - assigns (nbufs - 1) shadow tables to the table,
+ * and launch the writer thread, if not yet.
+ */
+void
+pgsql_setup_pipeline(SQLtable *table, int nbufs)
+{
+	int			i;
+
+	assert(nbufs > 1 && !table->owner);
+	for (i=1; i < nbufs; i++)
+	{
+		SQLtable   *shadow = __pgsql_duplicate_table(table);
+
+		shadow->owner = table;
+		shadow->next = table->shadows;
+		table->shadows = shadow;
+		table->numShadows++;
+		table->numFreeShadows++;
+	}
+
+	pthread_mutex_lock(&pgsql_writer_lock);
+	if (!pgsql_writer_running)
+	{
+		if ((errno = pthread_create(&pgsql_writer_thread, NULL,
+									pgsql_writer_main, NULL)) != 0)
+			Elog("failed on pthread_create: %m");
+		pgsql_writer_running = true;
+	}
+	pthread_mutex_unlock(&pgsql_writer_lock);
+}
+
+/*
+ * pgsql_finish_pipeline - waits for completion of the record batches
+ * in-flight. They are already accounted to the table.
+ */
+void
+pgsql_finish_pipeline(SQLtable *table)
+{
+	if (table->numShadows == 0)
+		return;
+	pthread_mutex_lock(&pgsql_writer_lock);
+	while (table->numFreeShadows < table->numShadows)
+		pthread_cond_wait(&pgsql_writer_cond, &pgsql_writer_lock);
+	pthread_mutex_unlock(&pgsql_writer_lock);
+}
+
+/*
+ * pgsql_shutdown_writer - terminates the writer thread
+ */
+void
+pgsql_shutdown_writer(void)
+{
+	pthread_mutex_lock(&pgsql_writer_lock);
+	if (!pgsql_writer_running)
+	{
+		pthread_mutex_unlock(&pgsql_writer_lock);
+		return;
+	}
+	pgsql_writer_shutdown = true;
+	pthread_cond_broadcast(&pgsql_writer_cond);
+	pthread_mutex_unlock(&pgsql_writer_lock);
+
+	if ((errno = pthread_join(pgsql_writer_thread, NULL)) != 0)
+		Elog("failed on pthread_join: %m");
+	pgsql_writer_running = false;
+}
+
+/*
+ * pgsql_writeout_buffer
+ */
+void
+pgsql_writeout_buffer(SQLtable *table)
+{
+	SQLtable   *shadow;
+	SQLtable  **tailp;
+	int			j;
+
+	if (table->numShadows == 0)
+	{
+		__pgsql_writeout_buffer(table);
+		return;
+	}
+	/* wait for a free shadow table */
+	pthread_mutex_lock(&pgsql_writer_lock);
+	while (!table->shadows)
+		pthread_cond_wait(&pgsql_writer_cond, &pgsql_writer_lock);
+	shadow = table->shadows;
+	table->shadows = shadow->next;
+	table->numFreeShadows--;
+	pthread_mutex_unlock(&pgsql_writer_lock);
+
+	/* move the current contents to the shadow; it is already empty */
+	__SWAP(table->nitems, shadow->nitems);
+	for (j=0; j < table->nfields; j++)
+		__pgsql_swap_attribute(&table->attrs[j], &shadow->attrs[j]);
+
+	/* enqueue the shadow to the writer */
+	pthread_mutex_lock(&pgsql_writer_lock);
+	shadow->next = NULL;
+	for (tailp = &pgsql_writer_queue; *tailp; tailp = &(*tailp)->next);
+	*tailp = shadow;
+	pthread_cond_broadcast(&pgsql_writer_cond);
+	pthread_mutex_unlock(&pgsql_writer_lock);
+}
+
+static int
+__compare_block_offset(const void *__a, const void *__b)
+{
+	const ArrowBlock *a = __a;
+	const ArrowBlock *b = __b;
+
+	if (a->offset < b->offset)
+		return -1;
+	if (a->offset > b->offset)
+		return 1;
+	return 0;
+}
+
+/*
+ * pgsql_merge_record_batches
+ *
+ * It moves the record batches (and delta dictionary batches, if any)
+ * written by the 'src' table (that shares the output file) to the 'dst'
+ * table, to build a unified footer.
+ */
+void
+pgsql_merge_record_batches(SQLtable *dst, SQLtable *src)
+{
+	int			nitems = dst->numRecordBatches + src->numRecordBatches;
+	size_t		unitsz;
+
+	if (src->numRecordBatches == 0)
+		return;
+	if (dst->numRecordBatches == 0)
+		dst->recordBatches = palloc(sizeof(ArrowBlock) * nitems);
+	else
+		dst->recordBatches = repalloc(dst->recordBatches,
+									  sizeof(ArrowBlock) * nitems);
+	memcpy(dst->recordBatches + dst->numRecordBatches,
+		   src->recordBatches,
+		   sizeof(ArrowBlock) * src->numRecordBatches);
+	/* statistics of the record batches */
+	assert(dst->nfields == src->nfields);
+	unitsz = sizeof(char *) * 2 * src->nfields;
+	if (dst->numRecordBatches == 0)
+		dst->recordStats = palloc(unitsz * nitems);
+	else
+		dst->recordStats = repalloc(dst->recordStats, unitsz * nitems);
+	memcpy(dst->recordStats + 2 * dst->nfields * dst->numRecordBatches,
+		   src->recordStats,
+		   unitsz * src->numRecordBatches);
+	/* metadata of the row groups, if Parquet */
+	if (src->rowGroups)
+	{
+		if (dst->numRecordBatches == 0)
+			dst->rowGroups = palloc(sizeof(ParquetRowGroup *) * nitems);
+		else
+			dst->rowGroups = repalloc(dst->rowGroups,
+									  sizeof(ParquetRowGroup *) * nitems);
+		memcpy(dst->rowGroups + dst->numRecordBatches,
+			   src->rowGroups,
+			   sizeof(ParquetRowGroup *) * src->numRecordBatches);
+	}
+	dst->numRecordBatches = nitems;
+	src->numRecordBatches = 0;
+
+	/* delta dictionary batches, in order of the file offset */
+	if (src->numDictionaries > 0)
+	{
+		nitems = dst->numDictionaries + src->numDictionaries;
+		if (dst->numDictionaries == 0)
+			dst->dictionaries = palloc(sizeof(ArrowBlock) * nitems);
+		else
+			dst->dictionaries = repalloc(dst->dictionaries,
+										 sizeof(ArrowBlock) * nitems);
+		memcpy(dst->dictionaries + dst->numDictionaries,
+			   src->dictionaries,
+			   sizeof(ArrowBlock) * src->numDictionaries);
+		qsort(dst->dictionaries, nitems, sizeof(ArrowBlock),
+			  __compare_block_offset);
+		dst->numDictionaries = nitems;
+		src->numDictionaries = 0;
+	}
+}
+
+/*
+ * Buffer usage accounting
+ *
+ * Sum of buffer_usage for all the columns is not cheap on wide or nested
+ * schema, so the append paths maintain an upper bound of the usage; the
+ * exact usage at the last check, and the growth of appended rows by
+ * usage_fixed and usage_ratio of the attributes. The exact usage is only
+ * computed once the upper bound exceeds the threshold, thus, record
+ * batches are still written out on exactly the same rows. The column-wise
+ * path decodes the rows under the threshold in chunks, and the row that
+ * crosses it alone, for the same reason.
+ */
+static size_t
+__pgsql_usage_slack(SQLattribute *attr)
+{
+	size_t		slack = 0;
+	int			j;
+
+	/* nullmap is not counted until the first NULL appears */
+	if (attr->nullcount == 0)
+		slack += BITMAPLEN(attr->nitems);
+	if (attr->element)
+		slack += __pgsql_usage_slack(attr->element);
+	if (attr->subtypes)
+	{
+		for (j=0; j < attr->subtypes->nfields; j++)
+			slack += __pgsql_usage_slack(&attr->subtypes->attrs[j]);
+	}
+	return slack;
+}
+
+static void
+__pgsql_reset_usage_bound(SQLtable *table, size_t usage)
+{
+	int			j;
+
+	/* ARROWALIGN() of each buffer, and the leading offset of varlena */
+	usage += (2 * ARROWALIGN(1)) * table->numBuffers;
+	for (j=0; j < table->nfields; j++)
+		usage += __pgsql_usage_slack(&table->attrs[j]);
+	table->usage_bound = usage;
+}
+
+static void
+__pgsql_check_usage(SQLtable *table, size_t growth)
+{
+	size_t		usage = 0;
+	int			j;
+
+	table->usage_bound += growth;
+	if (table->usage_bound <= table->segment_sz)
+		return;
+	for (j=0; j < table->nfields; j++)
+	{
+		SQLattribute   *attr = &table->attrs[j];
+
+		usage += attr->buffer_usage(attr);
+	}
+	/* exceeds the threshold to write? */
+	if (usage > table->segment_sz)
+	{
+		pgsql_writeout_buffer(table);
+		usage = 0;
+	}
+	__pgsql_reset_usage_bound(table, usage);
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Alignment of the record batches to the key ranges (--partition-key)
+ *
+ * The results are ordered by the key column, then the record batch is
+ * written out once the key of the next row moves to another range, in
+ * addition to the threshold of the buffer usage. So, each record batch
+ * has the rows of one key range, and its min/max statistics tell the
+ * readers exactly which batches cover the range of their query.
+ * The range is computed on the binary value from the server, prior to
+ * put_value; date and timestamp are in UNIX epoch, like Arrow.
+ *
+ * ----------------------------------------------------------------
+ */
+static void
+__pgsql_setup_partition_key(SQLtable *table)
+{
+	int			j;
+
+	if (!partition_key)
+		return;
+	for (j=0; j < table->nfields; j++)
+	{
+		SQLattribute *attr = &table->attrs[j];
+		ArrowType  *type = &attr->arrow_type;
+
+		if (strcmp(attr->attname, partition_key) != 0)
+			continue;
+		if (type->tag == ArrowNodeTag__Int && type->Int.is_signed)
+		{
+			if (batch_boundary == BATCH_BOUNDARY__WIDTH)
+			{
+				table->partition_attr = attr;
+				return;
+			}
+			Elog("--batch-boundary of partition key '%s' must be N, because it is integer",
+				 partition_key);
+		}
+		else if (type->tag == ArrowNodeTag__Date)
+		{
+			if (batch_boundary != BATCH_BOUNDARY__HOUR)
+			{
+				table->partition_attr = attr;
+				return;
+			}
+			Elog("--batch-boundary of partition key '%s' must be day, month, year or N days, because it is date",
+				 partition_key);
+		}
+		else if (type->tag == ArrowNodeTag__Timestamp)
+		{
+			if (batch_boundary != BATCH_BOUNDARY__WIDTH)
+			{
+				table->partition_attr = attr;
+				return;
+			}
+			Elog("--batch-boundary of partition key '%s' must be hour, day, month or year, because it is timestamp",
+				 partition_key);
+		}
+		Elog("partition key '%s' must be integer, date or timestamp",
+			 partition_key);
+	}
+	Elog("partition key '%s' is not in the results", partition_key);
+}
+
+/*
+ * __pgsql_civil_months - number of months since 1970-01, of the days in
+ * UNIX epoch; the proleptic Gregorian calendar, like PostgreSQL.
+ */
+static int64
+__pgsql_civil_months(int64 days)
+{
+	int64		z = days + 719468;		/* since 0000-03-01 */
+	int64		era = (z >= 0 ? z : z - 146096) / 146097;
+	int64		doe = z - era * 146097;
+	int64		yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	int64		doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	int64		mp = (5 * doy + 2) / 153;
+	int64		m = (mp < 10 ? mp + 3 : mp - 9);
+	int64		y = yoe + era * 400 + (m <= 2 ? 1 : 0);
+
+	return (y - 1970) * 12 + (m - 1);
+}
+
+static inline int64
+__pgsql_floor_div(int64 x, int64 y)
+{
+	return (x >= 0 ? x / y : -((-x + y - 1) / y));
+}
+
+static int64
+__pgsql_partition_range(SQLtable *table, const char *addr, int sz)
+{
+	SQLattribute *attr = table->partition_attr;
+	int64		value;
+	int64		days;
+
+	if (!addr)
+		Elog("partition key '%s' has null values", partition_key);
+	switch (attr->arrow_type.tag)
+	{
+		case ArrowNodeTag__Int:
+			if (sz == sizeof(int16))
+				value = (int16)ntohs(*((const uint16 *)addr));
+			else if (sz == sizeof(int32))
+				value = (int32)ntohl(*((const uint32 *)addr));
+			else if (sz == sizeof(int64))
+				value = (int64)((uint64)ntohl(((const uint32 *)addr)[0]) << 32 |
+								(uint64)ntohl(((const uint32 *)addr)[1]));
+			else
+				Elog("unexpected length of partition key: %d", sz);
+			return __pgsql_floor_div(value, batch_boundary_width);
+
+		case ArrowNodeTag__Date:
+			if (sz != sizeof(DateADT))
+				Elog("unexpected length of partition key: %d", sz);
+			days = (int32)ntohl(*((const uint32 *)addr));
+			days += (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE);
+			break;
+
+		case ArrowNodeTag__Timestamp:
+			if (sz != sizeof(Timestamp))
+				Elog("unexpected length of partition key: %d", sz);
+			value = (int64)((uint64)ntohl(((const uint32 *)addr)[0]) << 32 |
+							(uint64)ntohl(((const uint32 *)addr)[1]));
+			value += (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY;
+			if (batch_boundary == BATCH_BOUNDARY__HOUR)
+				return __pgsql_floor_div(value, USECS_PER_HOUR);
+			days = __pgsql_floor_div(value, USECS_PER_DAY);
+			break;
+
+		default:
+			Elog("unexpected type of partition key");
+	}
+	switch (batch_boundary)
+	{
+		case BATCH_BOUNDARY__WIDTH:
+			return __pgsql_floor_div(days, batch_boundary_width);
+		case BATCH_BOUNDARY__DAY:
+			return days;
+		case BATCH_BOUNDARY__MONTH:
+			return __pgsql_civil_months(days);
+		case BATCH_BOUNDARY__YEAR:
+			return __pgsql_floor_div(__pgsql_civil_months(days), 12);
+		default:
+			Elog("unexpected batch boundary: %d", batch_boundary);
+	}
+	return 0;	/* not reached */
+}
+
+/*
+ * __pgsql_check_partition - writes out the rows in the buffer, if the next
+ * row is in the different key range
+ */
+static void
+__pgsql_check_partition(SQLtable *table, int64 range)
+{
+	if (table->nitems > 0 && range != table->partition_range)
+	{
+		pgsql_writeout_buffer(table);
+		__pgsql_reset_usage_bound(table, 0);
+	}
+	table->partition_range = range;
+}
+
+static inline int64
+__pgsql_partition_range_of_row(SQLtable *table, PGresult *res, int row)
+{
+	int			j = table->partition_attr - table->attrs;
+
+	if (PQgetisnull(res, row, j))
+		return __pgsql_partition_range(table, NULL, 0);
+	return __pgsql_partition_range(table,
+								   PQgetvalue(res, row, j),
+								   PQgetlength(res, row, j));
+}
+
+/*
+ * pgsql_append_results
+ */
+void
+pgsql_append_results(SQLtable *table, PGresult *res)
+{
+	int		i, k, ntuples = PQntuples(res);
+	SQLperfTimer timer;
+
+	assert(PQnfields(res) == table->nfields);
+	perf_timer_begin(&timer);
+	perf_counter_add(nrows, ntuples);
+	if (!table->partition_attr)
+		__pgsql_append_results_columns(table, res, 0, ntuples);
+	else
+	{
+		/* appends the rows for each run of the same key range */
+		for (i=0; i < ntuples; i=k)
+		{
+			int64	range = __pgsql_partition_range_of_row(table, res, i);
+
+			__pgsql_check_partition(table, range);
+			for (k=i+1; k < ntuples; k++)
+			{
+				if (__pgsql_partition_range_of_row(table, res, k) != range)
+					break;
+			}
+			__pgsql_append_results_columns(table, res, i, k);
+		}
+	}
+	perf_timer_end(&timer, PERF_PHASE__DECODE, 0);
+}
+
+/*
+ * pgsql_append_copy_results
+ *
+ * It parses the stream of COPY ... TO STDOUT (FORMAT binary), then puts
+ * the fields on the buffer of libpq to the put_value handlers directly,
+ * without construction of PGresult.
+ */
+static const char *
+pgsql_append_copy_tuple(SQLtable *table, const char *pos, const char *tail)
+{
+	int16		nfields;
+	int32		sz;
+	size_t		growth = 0;
+	bool		sampled = (shows_stats &&
+						   (table->nitems % PERF_SAMPLE_INTERVAL) == 0);
+	uint64		tv = 0;
+	int			j;
+
+	if (pos + sizeof(int16) > tail)
+		Elog("binary COPY stream corruption");
+	nfields = (int16)ntohs(*((const uint16 *)pos));
+	pos += sizeof(int16);
+	if (nfields == -1)
+		return NULL;		/* end of the stream */
+	if (nfields != table->nfields)
+		Elog("unexpected number of fields in the COPY stream: %d", nfields);
+	if (table->partition_attr)
+	{
+		const char *field = pos;
+		int			key_index = table->partition_attr - table->attrs;
+
+		/* walks to the key field, to check its range prior to the row */
+		for (j=0; ; j++)
+		{
+			if (field + sizeof(int32) > tail)
+				Elog("binary COPY stream corruption");
+			sz = (int32)ntohl(*((const uint32 *)field));
+			field += sizeof(int32);
+			if (j == key_index)
+				break;
+			if (sz > 0)
+				field += sz;
+		}
+		if (sz >= 0 && field + sz > tail)
+			Elog("binary COPY stream corruption");
+		__pgsql_check_partition(table,
+								__pgsql_partition_range(table,
+														sz < 0 ? NULL : field,
+														Max(sz, 0)));
+	}
+	if (table->put_copy_row)
+	{
+		pos = table->put_copy_row(table, pos, tail, &growth);
+		table->nitems++;
+		perf_counter_add(nrows, 1);
+		__pgsql_check_usage(table, growth);
+		return pos;
+	}
+	for (j=0; j < nfields; j++)
+	{
+		SQLattribute   *attr = &table->attrs[j];
+		const char	   *addr;
+
+		if (pos + sizeof(int32) > tail)
+			Elog("binary COPY stream corruption");
+		sz = (int32)ntohl(*((const uint32 *)pos));
+		pos += sizeof(int32);
+		if (sz < 0)
+		{
+			addr = NULL;
+			sz = 0;
+		}
+		else
+		{
+			if (pos + sz > tail)
+				Elog("binary COPY stream corruption");
+			addr = pos;
+			pos += sz;
+		}
+		assert(attr->nitems == table->nitems);
+		if (sampled)
+			tv = perf_clock_ns(CLOCK_MONOTONIC);
+		attr->put_value(attr, addr, sz);
+		if (attr->stat_update)
+			attr->stat_update(attr, addr, sz);
+		if (shows_stats)
+		{
+			if (sampled)
+			{
+				attr->perf_decode_ns += perf_clock_ns(CLOCK_MONOTONIC) - tv;
+				attr->perf_nsamples++;
+			}
+			if (!addr)
+				attr->perf_nnulls++;
+			attr->perf_nbytes += sz;
+		}
+		growth += attr->usage_fixed + attr->usage_ratio * sz;
+	}
+	table->nitems++;
+	perf_counter_add(nrows, 1);
+	__pgsql_check_usage(table, growth);
+	return pos;
+}
+
+void
+pgsql_append_copy_results(SQLtable *table, PGconn *conn)
+{
+	static const char signature[11] = "PGCOPY\n\377\r\n\0";
+	PGresult   *res;
+	char	   *buffer;
+	int			nbytes;
+	bool		has_header = false;
+	bool		end_of_stream = false;
+	SQLperfTimer timer;
+
+	perf_timer_begin(&timer);
+	while ((nbytes = PQgetCopyData(conn, &buffer, 0)) > 0)
+	{
+		const char *pos = buffer;
+		const char *tail = buffer + nbytes;
+
+		perf_update_fetch_max(perf_timer_end(&timer, PERF_PHASE__FETCH,
+											 nbytes));
+		perf_timer_begin(&timer);
+
+		if (!has_header)
+		{
+			int32		extra_sz;
+
+			/* signature + flags + length of the header extension */
+			if (nbytes < sizeof(signature) + 2 * sizeof(int32) ||
+				memcmp(pos, signature, sizeof(signature)) != 0)
+				Elog("unexpected header of the binary COPY stream");
+			pos += sizeof(signature) + sizeof(int32);
+			extra_sz = (int32)ntohl(*((const uint32 *)pos));
+			pos += sizeof(int32) + extra_sz;
+			has_header = true;
+		}
+		if (end_of_stream)
+			Elog("binary COPY stream has data after the trailer");
+		while (pos < tail)
+		{
+			pos = pgsql_append_copy_tuple(table, pos, tail);
+			if (!pos)
+			{
+				end_of_stream = true;
+				break;
+			}
+		}
+		PQfreemem(buffer);
+		perf_timer_end(&timer, PERF_PHASE__DECODE, 0);
+		perf_timer_begin(&timer);
+	}
+	perf_timer_end(&timer, PERF_PHASE__FETCH, 0);
+	if (nbytes == -2)
+		Elog("failed on PQgetCopyData: %s", PQerrorMessage(conn));
+	/* check the status of COPY command */
+	while ((res = PQgetResult(conn)) != NULL)
+	{
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			Elog("SQL execution failed: %s", PQresultErrorMessage(res));
+		PQclear(res);
+	}
+	if (!end_of_stream)
+		Elog("binary COPY stream is terminated without trailer");
+}
+
+/* ----------------------------------------------------------------
+ *
+ * Column-parallel decoder
+ *
+ * Because every SQLattribute owns its individual buffers, columns of
+ * the fetched PGresult can be decoded independently. The decoder threads
+ * (and the caller itself) pick up the columns one by one, then decode
+ * the rows in the current chunk. The chunk is sized not to cross the
+ * threshold of the record batch; see __pgsql_append_results_columns().
+ *
+ * ----------------------------------------------------------------
+ */
+struct SQLdecoder
+{
+	int				nthreads;	/* including the caller thread */
+	pthread_t	   *threads;
+	pthread_barrier_t barrier_begin;
+	pthread_barrier_t barrier_end;
+	bool			shutdown;
+	/* current task */
+	SQLtable	   *table;
+	PGresult	   *res;
+	int				row_begin;
+	int				row_end;
+	int				next_column;	/* atomic */
+};
+
+static void
+__pgsql_decode_columns(SQLdecoder *decoder)
+{
+	SQLtable   *table = decoder->table;
+	PGresult   *res = decoder->res;
+	int			i, j;
+
+	while ((j = __atomic_fetch_add(&decoder->next_column, 1,
+								   __ATOMIC_SEQ_CST)) < table->nfields)
+	{
+		SQLattribute *attr = &table->attrs[j];
+		uint64		tv = 0;
+
+		/* data must be binary format */
+		assert(PQfformat(res, j) == 1);
+		assert(attr->nitems == table->nitems);
+		if (shows_stats)
+			tv = perf_clock_ns(CLOCK_MONOTONIC);
+		if (attr->put_values)
+		{
+			attr->put_values(attr, res, j,
+							 decoder->row_begin,
+							 decoder->row_end);
+			if (shows_stats)
+			{
+				/* deliberately out of the measured time */
+				tv = perf_clock_ns(CLOCK_MONOTONIC) - tv;
+				for (i=decoder->row_begin; i < decoder->row_end; i++)
+				{
+					if (PQgetisnull(res, i, j))
+						attr->perf_nnulls++;
+					else
+						attr->perf_nbytes += PQgetlength(res, i, j);
+				}
+				attr->perf_decode_ns += tv;
+				attr->perf_nsamples += decoder->row_end - decoder->row_begin;
+			}
+		}
+		else
+		{
+			for (i=decoder->row_begin; i < decoder->row_end; i++)
+			{
+				const char *addr;
+				size_t		sz;
+
+				if (PQgetisnull(res, i, j))
+				{
+					addr = NULL;
+					sz = 0;
+				}
+				else
+				{
+					addr = PQgetvalue(res, i, j);
+					sz = PQgetlength(res, i, j);
+				}
+				attr->put_value(attr, addr, sz);
+				if (attr->stat_update)
+					attr->stat_update(attr, addr, sz);
+				if (shows_stats)
+				{
+					if (!addr)
+						attr->perf_nnulls++;
+					attr->perf_nbytes += sz;
+				}
+			}
+			if (shows_stats)
+			{
+				attr->perf_decode_ns += perf_clock_ns(CLOCK_MONOTONIC) - tv;
+				attr->perf_nsamples += decoder->row_end - decoder->row_begin;
+			}
+		}
+	}
+}
+
+static void *
+pgsql_decoder_main(void *__decoder)
+{
+	SQLdecoder *decoder = __decoder;
+
+	for (;;)
+	{
+		pthread_barrier_wait(&decoder->barrier_begin);
+		if (decoder->shutdown)
+			break;
+		if (shows_stats)
+		{
+			/* wall time is accounted by the caller thread */
+			uint64	cpu_ns = perf_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+
+			__pgsql_decode_columns(decoder);
+			cpu_ns = perf_clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_ns;
+			perf_counter_add(cpu_ns[PERF_PHASE__DECODE], cpu_ns);
+		}
+		else
+			__pgsql_decode_columns(decoder);
+		pthread_barrier_wait(&decoder->barrier_end);
+	}
+	return NULL;
+}
+
+/*
+ * __pgsql_row_growth - upper bound of the buffer growth by the row
+ */
+static inline size_t
+__pgsql_row_growth(SQLtable *table, PGresult *res, int row)
+{
+	size_t		growth = 0;
+	int			j;
+
+	for (j=0; j < table->nfields; j++)
+	{
+		SQLattribute *attr = &table->attrs[j];
+
+		growth += attr->usage_fixed;
+		if (attr->usage_ratio > 0)
+			growth += attr->usage_ratio * PQgetlength(res, row, j);
+	}
+	return growth;
+}
+
+/*
+ * __pgsql_decode_chunk - decodes the rows column by column; by the decoder
+ * threads if any, or by the caller alone.
+ */
+static void
+__pgsql_decode_chunk(SQLtable *table, PGresult *res,
+					 int row_begin, int row_end)
+{
+	SQLdecoder	__decoder;
+	SQLdecoder *decoder = table->decoder;
+
+	if (!decoder || row_end - row_begin == 1)
+	{
+		memset(&__decoder, 0, sizeof(SQLdecoder));
+		__decoder.nthreads = 1;
+		decoder = &__decoder;
+	}
+	decoder->table = table;
+	decoder->res = res;
+	decoder->row_begin = row_begin;
+	decoder->row_end = row_end;
+	decoder->next_column = 0;
+	if (decoder->nthreads > 1)
+	{
+		pthread_barrier_wait(&decoder->barrier_begin);
+		__pgsql_decode_columns(decoder);
+		pthread_barrier_wait(&decoder->barrier_end);
+	}
+	else
+		__pgsql_decode_columns(decoder);
+	table->nitems += row_end - row_begin;
+}
+
+/*
+ * __pgsql_append_results_columns - appends the rows in chunks. A chunk is
+ * the run of rows whose upper bound of the usage stays under the threshold,
+ * so no usage check is needed inside. The next row may cross it, thus it
+ * is decoded alone and checked like the row-by-row paths; so the record
+ * batches end on the same rows.
+ */
+static void
+__pgsql_append_results_columns(SQLtable *table, PGresult *res,
+							   int row_begin, int row_end)
+{
+	int			i = row_begin;
+
+	while (i < row_end)
+	{
+		size_t		bound = table->usage_bound;
+		size_t		growth = 0;
+		int			k;
+
+		for (k=i; k < row_end; k++)
+		{
+			growth = __pgsql_row_growth(table, res, k);
+			if (bound + growth > table->segment_sz)
+				break;
+			bound += growth;
+		}
+		if (k > i)
+		{
+			__pgsql_decode_chunk(table, res, i, k);
+			table->usage_bound = bound;
+			i = k;
+		}
+		if (i < row_end)
+		{
+			__pgsql_decode_chunk(table, res, i, i+1);
+			__pgsql_check_usage(table, growth);
+			i++;
+		}
+	}
+}
+
+/*
+ * pgsql_setup_decoder - launch (nthreads - 1) decoder threads for the table
+ */
+void
+pgsql_setup_decoder(SQLtable *table, int nthreads)
+{
+	SQLdecoder *decoder;
+	int			i;
+
+	assert(nthreads > 1 && !table->decoder);
+	decoder = palloc0(sizeof(SQLdecoder));
+	decoder->nthreads = nthreads;
+	decoder->threads = palloc0(sizeof(pthread_t) * nthreads);
+	if ((errno = pthread_barrier_init(&decoder->barrier_begin,
+									  NULL, nthreads)) != 0 ||
+		(errno = pthread_barrier_init(&decoder->barrier_end,
+									  NULL, nthreads)) != 0)
+		Elog("failed on pthread_barrier_init: %m");
+	for (i=1; i < nthreads; i++)
+	{
+		if ((errno = pthread_create(&decoder->threads[i], NULL,
+									pgsql_decoder_main, decoder)) != 0)
+			Elog("failed on pthread_create: %m");
+	}
+	table->decoder = decoder;
+}
+
+/*
+ * pgsql_shutdown_decoder - terminates the decoder threads
+ */
+void
+pgsql_shutdown_decoder(SQLtable *table)
+{
+	SQLdecoder *decoder = table->decoder;
+	int			i;
+
+	if (!decoder)
+		return;
+	decoder->shutdown = true;
+	pthread_barrier_wait(&decoder->barrier_begin);
+	for (i=1; i < decoder->nthreads; i++)
+	{
+		if ((errno = pthread_join(decoder->threads[i], NULL)) != 0)
+			Elog("failed on pthread_join: %m");
+	}
+	pthread_barrier_destroy(&decoder->barrier_begin);
+	pthread_barrier_destroy(&decoder->barrier_end);
+	table->decoder = NULL;
+}
+
 /*
  * pgsql_dump_attribute
  */